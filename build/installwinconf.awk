@@ -151,6 +151,8 @@ BEGIN {
           print "#LoadModule info_module modules/mod_info.so" > dstfl;
           print "LoadModule isapi_module modules/mod_isapi.so" > dstfl;
           print "#LoadModule lbmethod_bybusyness_module modules/mod_lbmethod_bybusyness.so" > dstfl;
+          print "#LoadModule lbmethod_byhash_module modules/mod_lbmethod_byhash.so" > dstfl;
+          print "#LoadModule lbmethod_bylatency_module modules/mod_lbmethod_bylatency.so" > dstfl;
           print "#LoadModule lbmethod_byrequests_module modules/mod_lbmethod_byrequests.so" > dstfl;
           print "#LoadModule lbmethod_bytraffic_module modules/mod_lbmethod_bytraffic.so" > dstfl;
           print "#LoadModule lbmethod_heartbeat_module modules/mod_lbmethod_heartbeat.so" > dstfl;
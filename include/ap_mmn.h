@@ -717,6 +717,26 @@
  * 20211221.12 (2.5.1-dev) Add cmd_parms->regex
  * 20211221.13 (2.5.1-dev) Add hook token_checker to check for authorization other
  *                         than username / password. Add autht_provider structure.
+ * 20211221.14 (2.5.1-dev) Add stale_while_revalidate and stale_if_error to
+ *                         cache_control_t
+ * 20211221.15 (2.5.1-dev) Add the ap_proxy_*_busy_count(), ap_proxy_*_lbstatus() and
+ *                         other atomic accessors of proxy_worker_shared to mod_proxy.h
+ * 20211221.16 (2.5.1-dev) Add latency and latency_updated to proxy_worker_shared,
+ *                         ap_proxy_get_latency() and ap_proxy_add_latency()
+ * 20211221.17 (2.5.1-dev) Add warm, maxage, maxidle, pool_hits and
+ *                         pool_misses to proxy_worker_shared, established
+ *                         and released to proxy_conn_rec, and
+ *                         ap_proxy_warm_worker().
+ * 20211221.18 (2.5.1-dev) Add connect_delay and family to proxy_worker_shared
+ * 20211221.19 (2.5.1-dev) Add address to proxy_conn_pool and proxy_conn_rec,
+ *                         address_ttl to proxy_worker_shared, and
+ *                         ap_proxy_refresh_worker_address()
+ * 20211221.20 (2.5.1-dev) Add aliases_index to proxy_server_conf
+ * 20211221.21 (2.5.1-dev) Add sendchunked, sendchunked_probed, spooled_reqs
+ *                         and spooled to proxy_worker_shared, and
+ *                         ap_proxy_get_spooled()/ap_proxy_add_spooled()
+ * 20211221.22 (2.5.1-dev) Add ap_proxy_get_worker_address()
+ * 20211221.23 (2.5.1-dev) Add sendchunked_retry to proxy_worker_shared
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -724,7 +744,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20211221
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 13             /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 23             /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
@@ -479,6 +479,9 @@ AP_DECLARE_HOOK(int, input_pending, (conn_rec *c))
  * handle all processing of a particular connection on the same thread.
  * @note This hook will be called on the thread that was previously
  * processing the connection.
+ * @note The connection is already suspended when this hook is called, so
+ * it can be resumed (ap_mpm_resume_suspended()) from a callback registered
+ * here, on another thread possibly.
  * @note This hook is not called at the end of connection processing.  This
  * hook only notifies a module when processing of an active connection is
  * suspended.
@@ -46,10 +46,14 @@ typedef struct cache_control {
     unsigned int proxy_revalidate:1;
     unsigned int s_maxage:1;
     unsigned int invalidated:1; /* has this entity been invalidated? */
+    unsigned int stale_while_revalidate:1;
+    unsigned int stale_if_error:1;
     apr_int64_t max_age_value; /* if positive, then set */
     apr_int64_t max_stale_value; /* if positive, then set */
     apr_int64_t min_fresh_value; /* if positive, then set */
     apr_int64_t s_maxage_value; /* if positive, then set */
+    apr_int64_t stale_while_revalidate_value; /* if positive, then set */
+    apr_int64_t stale_if_error_value; /* if positive, then set */
 } cache_control_t;
 
 #endif /* CACHE_COMMON_H */
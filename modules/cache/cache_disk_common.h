@@ -27,12 +27,52 @@
 #define CACHE_DIST_COMMON_H
 
 #define VARY_FORMAT_VERSION 5
-#define DISK_FORMAT_VERSION 6
+#define DISK_FORMAT_VERSION 8
+
+/* The formats which kept the body in a separate CACHE_DATA_SUFFIX file.
+ * Their on-disk header is the leading DISK_INFO_SPLIT_LEN (resp.
+ * DISK_INFO_SPLIT_NOSTALE_LEN) bytes of disk_cache_info_t, which
+ * htcacheclean relies on for migration.
+ */
+#define DISK_FORMAT_VERSION_SPLIT 7
+#define DISK_INFO_SPLIT_LEN APR_OFFSETOF(disk_cache_info_t, hdrs_len)
+
+/* The split format from before the stale-while-revalidate and
+ * stale-if-error values were added to the end of cache_control_t.
+ */
+#define DISK_FORMAT_VERSION_SPLIT_NOSTALE 6
+#define DISK_INFO_SPLIT_NOSTALE_LEN (APR_OFFSETOF(disk_cache_info_t, control) \
+        + APR_OFFSETOF(cache_control_t, stale_while_revalidate_value))
 
 #define CACHE_HEADER_SUFFIX ".header"
 #define CACHE_DATA_SUFFIX   ".data"
 #define CACHE_VDIR_SUFFIX   ".vary"
 
+/* The body starts on a page boundary within the entity file, so that it
+ * can be mapped or sent straight from there.
+ */
+#define CACHE_DISK_BODY_ALIGN 4096
+
+/* The journal of stored, served and removed entities which mod_cache_disk
+ * appends to when CacheJournal is enabled, and the index htcacheclean
+ * builds from it. Both live in the cache root. A journal record is a line
+ * "<op> <time> <size> <entity>", where the entity is the path of its file
+ * relative to the cache root without CACHE_HEADER_SUFFIX.
+ */
+#define CACHE_JOURNAL_FILE   "cache.journal"
+#define CACHE_INDEX_FILE     "cache.index"
+#define CACHE_JOURNAL_STORE  '+'
+#define CACHE_JOURNAL_ACCESS '*'
+#define CACHE_JOURNAL_REMOVE '-'
+
+/* htcacheclean creates the journal, to be appended to by httpd running
+ * as another user, possibly. Each child of httpd looks for a journal
+ * replaced by htcacheclean no more than once every CACHE_JOURNAL_RECHECK.
+ */
+#define CACHE_JOURNAL_PERMS (APR_FPROT_UREAD | APR_FPROT_UWRITE \
+                             | APR_FPROT_GREAD | APR_FPROT_GWRITE)
+#define CACHE_JOURNAL_RECHECK apr_time_from_sec(1)
+
 #define AP_TEMPFILE_PREFIX "/"
 #define AP_TEMPFILE_BASE   "aptmp"
 #define AP_TEMPFILE_SUFFIX "XXXXXX"
@@ -54,7 +94,9 @@ typedef struct {
     apr_time_t expire;
     apr_time_t request_time;
     apr_time_t response_time;
-    /* The ident of the body file, so we can test the body matches the header */
+    /* The ident of the body file, so we can test the body matches the header
+     * (DISK_FORMAT_VERSION_SPLIT only, unused since the body moved in).
+     */
     apr_ino_t inode;
     apr_dev_t device;
     /* Does this cached request have a body? */
@@ -62,6 +104,13 @@ typedef struct {
     unsigned int header_only:1;
     /* The parsed cache control header */
     cache_control_t control;
+    /* The size of the header block that follows: the entity name, then
+     * the response and request headers, each terminated by an empty line.
+     */
+    apr_size_t hdrs_len;
+    /* Where the body starts within the file, and how long it is. */
+    apr_off_t body_offset;
+    apr_off_t body_len;
 } disk_cache_info_t;
 
 #endif /* CACHE_DIST_COMMON_H */
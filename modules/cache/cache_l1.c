@@ -0,0 +1,673 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mod_cache.h"
+
+#include "cache_l1.h"
+#include "cache_util.h"
+
+#include "apr_atomic.h"
+#include "apr_hash.h"
+#include "apr_strings.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
+
+APLOG_USE_MODULE(cache);
+
+/*
+ * The memory tier: recently served small entities of this child, kept
+ * in memory in a form that needs no parsing to be served again.
+ *
+ * Each entity lives in a single allocation: the entry below, followed by
+ * the name/value pairs of the response and request headers, the strings
+ * they point to, the key and the body. The entry is reference counted,
+ * the index holds one reference, every request that opened it holds one
+ * until its pool goes away, and every bucket of the body holds one, so
+ * that an entity can be dropped from the index while still being sent.
+ *
+ * The tier sits in front of the configured providers, and only ever
+ * serves fresh entities. Stale entities are dropped and left to the
+ * providers to revalidate. Storing, removing or invalidating an entity
+ * drops it from the tier of this child.
+ *
+ * Like the providers, the tier keeps the variants of an entity with a
+ * Vary header apart: the Vary header is recorded under the key of the
+ * URL, and each variant is held under a key made of the key of the URL
+ * and the request headers it varies on. The record lives for as long as
+ * any of its variants.
+ */
+
+typedef struct {
+    const char *key;             /* the key of the URL */
+    const char *vary;            /* the Vary header of the variants */
+    apr_uint32_t variants;       /* entries held, with the lock held */
+} cache_l1_vary_t;
+
+typedef struct cache_l1_entry cache_l1_entry_t;
+struct cache_l1_entry {
+    cache_l1_entry_t *prev;      /* more recently used */
+    cache_l1_entry_t *next;      /* less recently used */
+    const char *key;
+    cache_info info;
+    const char **resp_hdrs;      /* name/value pairs */
+    int nresp;
+    const char **req_hdrs;       /* name/value pairs */
+    int nreq;
+    const char *body;
+    apr_size_t body_len;
+    apr_size_t size;             /* bytes charged to the budget */
+    apr_uint32_t refs;
+    cache_l1_vary_t *vary;       /* for a variant, its Vary record */
+};
+
+typedef struct {
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;   /* guards everything but the hits */
+#endif
+    apr_hash_t *index;
+    apr_hash_t *vary;            /* Vary records by key of the URL */
+    cache_l1_entry_t *head;      /* most recently used */
+    cache_l1_entry_t *tail;      /* least recently used */
+    apr_size_t max_entity;
+    cache_l1_stats_t stats;
+} cache_l1_t;
+
+static cache_l1_t *l1;
+
+static void l1_lock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(l1->mutex);
+#endif
+}
+
+static void l1_unlock(void)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(l1->mutex);
+#endif
+}
+
+static void l1_release(cache_l1_entry_t *e)
+{
+    if (!apr_atomic_dec32(&e->refs)) {
+        free(e);
+    }
+}
+
+static apr_status_t l1_entry_cleanup(void *data)
+{
+    l1_release((cache_l1_entry_t *)data);
+    return APR_SUCCESS;
+}
+
+/* Take the entry out of the LRU list, with the lock held */
+static void l1_detach(cache_l1_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    }
+    else {
+        l1->head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    else {
+        l1->tail = e->prev;
+    }
+}
+
+/* Put the entry first in the LRU list, with the lock held */
+static void l1_attach(cache_l1_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = l1->head;
+    if (l1->head) {
+        l1->head->prev = e;
+    }
+    else {
+        l1->tail = e;
+    }
+    l1->head = e;
+}
+
+/* Drop the entry from the tier, with the lock held */
+static void l1_unlink(cache_l1_entry_t *e)
+{
+    l1_detach(e);
+    apr_hash_set(l1->index, e->key, APR_HASH_KEY_STRING, NULL);
+    l1->stats.used -= e->size;
+    l1->stats.entries--;
+    if (e->vary && !--e->vary->variants) {
+        /* unless replaced by a record for another Vary header */
+        if (apr_hash_get(l1->vary, e->vary->key,
+                         APR_HASH_KEY_STRING) == e->vary) {
+            apr_hash_set(l1->vary, e->vary->key, APR_HASH_KEY_STRING, NULL);
+        }
+        free(e->vary);
+    }
+    e->vary = NULL;
+    l1_release(e);
+}
+
+/* The key of the variant of the URL which the given request headers
+ * select, as regen_key() of mod_cache_disk does.
+ */
+static const char *l1_variant_key(apr_pool_t *p, const char *key,
+        const char *vary, apr_table_t *headers)
+{
+    apr_array_header_t *iovs = apr_array_make(p, 8, sizeof(struct iovec));
+    struct iovec *iov;
+    char *token = NULL, *last = NULL;
+    apr_status_t rv;
+
+    iov = apr_array_push(iovs);
+    iov->iov_base = (void *)key;
+    iov->iov_len = strlen(key);
+
+    for (rv = cache_strqtok(apr_pstrdup(p, vary), &token, NULL, &last);
+         rv == APR_SUCCESS;
+         rv = cache_strqtok(NULL, &token, NULL, &last)) {
+        const char *value = cache_table_getm(p, headers, token);
+        char *field = apr_pstrcat(p, "\n", token, ": ",
+                                  value ? value : "", NULL);
+
+        iov = apr_array_push(iovs);
+        iov->iov_base = field;
+        iov->iov_len = strlen(field);
+    }
+
+    return apr_pstrcatv(p, (const struct iovec *)iovs->elts, iovs->nelts,
+                        NULL);
+}
+
+/* The key the request finds its entity under, NULL if not held */
+static const char *l1_request_key(request_rec *r, const char *key)
+{
+    cache_l1_vary_t *v;
+    const char *vary = NULL;
+
+    l1_lock();
+    if (!apr_hash_get(l1->index, key, APR_HASH_KEY_STRING)) {
+        v = apr_hash_get(l1->vary, key, APR_HASH_KEY_STRING);
+        if (v) {
+            vary = apr_pstrdup(r->pool, v->vary);
+        }
+        else {
+            key = NULL;
+        }
+    }
+    l1_unlock();
+
+    return vary ? l1_variant_key(r->pool, key, vary, r->headers_in) : key;
+}
+
+static void l1_remove(const char *key)
+{
+    cache_l1_entry_t *e;
+
+    if (!l1 || !key) {
+        return;
+    }
+
+    l1_lock();
+    e = apr_hash_get(l1->index, key, APR_HASH_KEY_STRING);
+    if (e) {
+        l1_unlink(e);
+    }
+    l1_unlock();
+}
+
+/*
+ * The body is served straight from the entry, with a reference held for
+ * as long as any bucket of it is around.
+ */
+typedef struct {
+    apr_bucket_refcount refcount;
+    cache_l1_entry_t *entry;
+} cache_l1_bucket_t;
+
+static void l1_bucket_destroy(void *data)
+{
+    cache_l1_bucket_t *d = data;
+
+    if (apr_bucket_shared_destroy(d)) {
+        l1_release(d->entry);
+        apr_bucket_free(d);
+    }
+}
+
+static apr_status_t l1_bucket_read(apr_bucket *b, const char **str,
+        apr_size_t *len, apr_read_type_e block)
+{
+    cache_l1_bucket_t *d = b->data;
+
+    *str = d->entry->body + b->start;
+    *len = b->length;
+    return APR_SUCCESS;
+}
+
+static const apr_bucket_type_t l1_bucket_type = {
+    "CACHE_L1", 5, APR_BUCKET_DATA,
+    l1_bucket_destroy,
+    l1_bucket_read,
+    apr_bucket_setaside_noop,
+    apr_bucket_shared_split,
+    apr_bucket_shared_copy
+};
+
+static apr_bucket *l1_bucket_create(cache_l1_entry_t *e,
+        apr_bucket_alloc_t *list)
+{
+    apr_bucket *b = apr_bucket_alloc(sizeof(*b), list);
+    cache_l1_bucket_t *d = apr_bucket_alloc(sizeof(*d), list);
+
+    APR_BUCKET_INIT(b);
+    b->free = apr_bucket_free;
+    b->list = list;
+
+    apr_atomic_inc32(&e->refs);
+    d->entry = e;
+
+    b = apr_bucket_shared_make(b, d, 0, e->body_len);
+    b->type = &l1_bucket_type;
+    return b;
+}
+
+static apr_table_t *l1_table(apr_pool_t *p, const char **hdrs, int n)
+{
+    apr_table_t *t = apr_table_make(p, n);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        apr_table_addn(t, hdrs[2 * i], hdrs[2 * i + 1]);
+    }
+    return t;
+}
+
+static apr_size_t l1_table_size(const apr_table_t *t, int *n)
+{
+    const apr_array_header_t *arr;
+    const apr_table_entry_t *elts;
+    apr_size_t size = 0;
+    int i;
+
+    *n = 0;
+    if (!t) {
+        return 0;
+    }
+
+    arr = apr_table_elts(t);
+    elts = (const apr_table_entry_t *) arr->elts;
+    for (i = 0; i < arr->nelts; i++) {
+        if (elts[i].key && elts[i].val) {
+            size += 2 * sizeof(char *)
+                    + strlen(elts[i].key) + strlen(elts[i].val) + 2;
+            (*n)++;
+        }
+    }
+    return size;
+}
+
+static char *l1_table_copy(const apr_table_t *t, const char **hdrs,
+        char *buf)
+{
+    const apr_array_header_t *arr;
+    const apr_table_entry_t *elts;
+    apr_size_t len;
+    int i;
+
+    if (!t) {
+        return buf;
+    }
+
+    arr = apr_table_elts(t);
+    elts = (const apr_table_entry_t *) arr->elts;
+    for (i = 0; i < arr->nelts; i++) {
+        if (elts[i].key && elts[i].val) {
+            len = strlen(elts[i].key) + 1;
+            memcpy(buf, elts[i].key, len);
+            *hdrs++ = buf;
+            buf += len;
+            len = strlen(elts[i].val) + 1;
+            memcpy(buf, elts[i].val, len);
+            *hdrs++ = buf;
+            buf += len;
+        }
+    }
+    return buf;
+}
+
+/*
+ * Provider callbacks. The tier is filled by cache_l1_fill() as entities
+ * are served, never through the store functions.
+ */
+static int l1_remove_entity(cache_handle_t *h)
+{
+    l1_remove(h->cache_obj->key);
+    return OK;
+}
+
+static apr_status_t l1_store_headers(cache_handle_t *h, request_rec *r,
+        cache_info *info)
+{
+    return APR_ENOTIMPL;
+}
+
+static apr_status_t l1_store_body(cache_handle_t *h, request_rec *r,
+        apr_bucket_brigade *in, apr_bucket_brigade *out)
+{
+    return APR_ENOTIMPL;
+}
+
+static apr_status_t l1_recall_headers(cache_handle_t *h, request_rec *r)
+{
+    cache_l1_entry_t *e = h->cache_obj->vobj;
+
+    h->resp_hdrs = l1_table(r->pool, e->resp_hdrs, e->nresp);
+    h->req_hdrs = l1_table(r->pool, e->req_hdrs, e->nreq);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t l1_recall_body(cache_handle_t *h, apr_pool_t *p,
+        apr_bucket_brigade *bb)
+{
+    cache_l1_entry_t *e = h->cache_obj->vobj;
+
+    if (e->body_len) {
+        APR_BRIGADE_INSERT_TAIL(bb, l1_bucket_create(e, bb->bucket_alloc));
+    }
+    apr_atomic_inc32(&l1->stats.hits);
+
+    return APR_SUCCESS;
+}
+
+static int l1_create_entity(cache_handle_t *h, request_rec *r,
+        const char *key, apr_off_t len, apr_bucket_brigade *bb)
+{
+    /* a new entity is on its way, the one we hold is outdated */
+    if (l1) {
+        l1_remove(l1_request_key(r, key));
+    }
+    return DECLINED;
+}
+
+static int l1_open_entity(cache_handle_t *h, request_rec *r, const char *key)
+{
+    cache_l1_entry_t *e;
+    cache_object_t *obj;
+
+    h->cache_obj = NULL;
+
+    key = l1_request_key(r, key);
+    if (!key) {
+        return DECLINED;
+    }
+
+    l1_lock();
+    e = apr_hash_get(l1->index, key, APR_HASH_KEY_STRING);
+    if (e) {
+        if (e != l1->head) {
+            l1_detach(e);
+            l1_attach(e);
+        }
+        apr_atomic_inc32(&e->refs);
+    }
+    l1_unlock();
+
+    if (!e) {
+        return DECLINED;
+    }
+
+    apr_pool_cleanup_register(r->pool, e, l1_entry_cleanup,
+            apr_pool_cleanup_null);
+
+    obj = apr_pcalloc(r->pool, sizeof(cache_object_t));
+    obj->key = e->key;
+    memcpy(&obj->info, &e->info, sizeof(cache_info));
+    obj->vobj = e;
+
+    h->cache_obj = obj;
+    h->req_hdrs = NULL;
+    h->resp_hdrs = NULL;
+
+    return OK;
+}
+
+static int l1_remove_url(cache_handle_t *h, request_rec *r)
+{
+    if (h->cache_obj) {
+        l1_remove(h->cache_obj->key);
+    }
+    return OK;
+}
+
+static apr_status_t l1_commit_entity(cache_handle_t *h, request_rec *r)
+{
+    return APR_ENOTIMPL;
+}
+
+static apr_status_t l1_invalidate_entity(cache_handle_t *h, request_rec *r)
+{
+    l1_remove(h->cache_obj->key);
+    return APR_SUCCESS;
+}
+
+const cache_provider cache_l1_provider =
+{
+    &l1_remove_entity,
+    &l1_store_headers,
+    &l1_store_body,
+    &l1_recall_headers,
+    &l1_recall_body,
+    &l1_create_entity,
+    &l1_open_entity,
+    &l1_remove_url,
+    &l1_commit_entity,
+    &l1_invalidate_entity
+};
+
+void cache_l1_child_init(apr_pool_t *p, server_rec *s, apr_size_t size,
+        apr_size_t max_entity)
+{
+    cache_l1_t *tier;
+
+    if (!size) {
+        return;
+    }
+
+    tier = apr_pcalloc(p, sizeof(cache_l1_t));
+#if APR_HAS_THREADS
+    {
+        apr_status_t rv = apr_thread_mutex_create(&tier->mutex,
+                APR_THREAD_MUTEX_DEFAULT, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10463)
+                    "cache: could not create the memory tier lock, "
+                    "the memory tier is disabled");
+            return;
+        }
+    }
+#endif
+    tier->index = apr_hash_make(p);
+    tier->vary = apr_hash_make(p);
+    tier->max_entity = max_entity;
+    tier->stats.size = size;
+
+    l1 = tier;
+}
+
+cache_provider_list *cache_l1_providers(request_rec *r,
+        cache_provider_list *providers)
+{
+    cache_provider_list *newp;
+
+    if (!l1 || !providers) {
+        return providers;
+    }
+
+    newp = apr_pcalloc(r->pool, sizeof(cache_provider_list));
+    newp->provider_name = "memory";
+    newp->provider = &cache_l1_provider;
+    newp->next = providers;
+
+    return newp;
+}
+
+void cache_l1_note(cache_request_rec *cache, const cache_provider *provider,
+        cache_handle_t *h, request_rec *r)
+{
+    if (!l1 || provider == &cache_l1_provider || !h->resp_hdrs) {
+        cache->l1_resp_hdrs = NULL;
+        return;
+    }
+
+    /* cache_check_freshness() adds Age and Warning to the original */
+    cache->l1_resp_hdrs = apr_table_copy(r->pool, h->resp_hdrs);
+}
+
+void cache_l1_fill(cache_request_rec *cache, request_rec *r,
+        apr_bucket_brigade *bb)
+{
+    cache_handle_t *h = cache->handle;
+    cache_l1_entry_t *e, *old;
+    cache_l1_vary_t *v = NULL;
+    apr_size_t size, klen, blen;
+    apr_off_t len;
+    const char **pairs;
+    const char *key, *vary;
+    char *buf;
+    int nresp, nreq;
+
+    if (!l1 || !cache->l1_resp_hdrs || !h || !h->cache_obj || !cache->key) {
+        return;
+    }
+
+    /* The tier has no notion of header only entities, those stored on
+     * a HEAD are only ever served to HEADs by the providers. Nothing of
+     * a HEAD goes in, a GET must never get its empty body.
+     */
+    if (r->header_only) {
+        return;
+    }
+
+    /* only bodies of known and small enough size */
+    if (apr_brigade_length(bb, 0, &len) != APR_SUCCESS || len < 0
+            || len > (apr_off_t)l1->max_entity) {
+        return;
+    }
+
+    /* the key of the URL, or one of our own for a variant */
+    key = cache->key;
+    vary = cache_table_getm(r->pool, cache->l1_resp_hdrs, "Vary");
+    if (vary) {
+        key = l1_variant_key(r->pool, key, vary, h->req_hdrs);
+    }
+
+    klen = strlen(key) + 1;
+    size = sizeof(cache_l1_entry_t) + klen + (apr_size_t)len;
+    size += l1_table_size(cache->l1_resp_hdrs, &nresp);
+    size += l1_table_size(h->req_hdrs, &nreq);
+    if (size > l1->stats.size) {
+        return;
+    }
+
+    e = ap_malloc(size);
+    memset(e, 0, sizeof(cache_l1_entry_t));
+
+    pairs = (const char **)(e + 1);
+    e->resp_hdrs = pairs;
+    e->nresp = nresp;
+    e->req_hdrs = pairs + 2 * nresp;
+    e->nreq = nreq;
+    buf = (char *)(e->req_hdrs + 2 * nreq);
+    buf = l1_table_copy(cache->l1_resp_hdrs, e->resp_hdrs, buf);
+    buf = l1_table_copy(h->req_hdrs, e->req_hdrs, buf);
+
+    memcpy(buf, key, klen);
+    e->key = buf;
+    buf += klen;
+
+    /* reads the body into memory, the brigade keeps it for sending */
+    blen = (apr_size_t)len;
+    if (blen && (apr_brigade_flatten(bb, buf, &blen) != APR_SUCCESS
+            || blen != (apr_size_t)len)) {
+        free(e);
+        return;
+    }
+    e->body = buf;
+    e->body_len = blen;
+
+    memcpy(&e->info, &h->cache_obj->info, sizeof(cache_info));
+    e->size = size;
+    e->refs = 1;
+
+    l1_lock();
+    old = apr_hash_get(l1->index, e->key, APR_HASH_KEY_STRING);
+    if (old) {
+        l1_unlink(old);
+    }
+    while (l1->tail && l1->stats.used + size > l1->stats.size) {
+        l1_unlink(l1->tail);
+        l1->stats.evictions++;
+    }
+    if (vary) {
+        /* the URL had no Vary header before */
+        old = apr_hash_get(l1->index, cache->key, APR_HASH_KEY_STRING);
+        if (old) {
+            l1_unlink(old);
+        }
+        v = apr_hash_get(l1->vary, cache->key, APR_HASH_KEY_STRING);
+        if (!v || strcmp(v->vary, vary)) {
+            apr_size_t kl = strlen(cache->key) + 1, vl = strlen(vary) + 1;
+
+            v = ap_malloc(sizeof(cache_l1_vary_t) + kl + vl);
+            v->key = memcpy((char *)(v + 1), cache->key, kl);
+            v->vary = memcpy((char *)(v + 1) + kl, vary, vl);
+            v->variants = 0;
+            apr_hash_set(l1->vary, v->key, APR_HASH_KEY_STRING, v);
+        }
+        v->variants++;
+        e->vary = v;
+    }
+    l1_attach(e);
+    apr_hash_set(l1->index, e->key, APR_HASH_KEY_STRING, e);
+    l1->stats.used += size;
+    l1->stats.entries++;
+    l1->stats.fills++;
+    l1_unlock();
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+            "cache: %s taken into the memory tier (%" APR_SIZE_T_FMT
+            " bytes)", e->key, size);
+}
+
+int cache_l1_stats(cache_l1_stats_t *stats)
+{
+    if (!l1) {
+        return 0;
+    }
+
+    l1_lock();
+    memcpy(stats, &l1->stats, sizeof(cache_l1_stats_t));
+    l1_unlock();
+    stats->hits = apr_atomic_read32(&l1->stats.hits);
+
+    return 1;
+}
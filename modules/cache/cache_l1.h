@@ -0,0 +1,93 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file cache_l1.h
+ * @brief Cache Memory Tier
+ *
+ * @defgroup Cache_l1  Cache Memory Tier
+ * @ingroup  MOD_CACHE
+ * @{
+ */
+
+#ifndef CACHE_L1_H
+#define CACHE_L1_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mod_cache.h"
+#include "cache_util.h"
+
+/**
+ * The memory tier poses as the first provider of every URL space that
+ * has caching enabled, see CacheMemorySize.
+ */
+extern const cache_provider cache_l1_provider;
+
+/* per child counters of the memory tier */
+typedef struct {
+    apr_uint32_t entries;       /* entities held */
+    apr_size_t used;            /* bytes held */
+    apr_size_t size;            /* bytes allowed */
+    apr_uint32_t hits;          /* entities served */
+    apr_uint32_t fills;         /* entities taken in */
+    apr_uint32_t evictions;     /* entities dropped for room */
+} cache_l1_stats_t;
+
+/**
+ * Set up the memory tier of this child.
+ * @param p the child pool
+ * @param s the main server
+ * @param size the byte budget, zero disables the tier
+ * @param max_entity the largest body to be held
+ */
+void cache_l1_child_init(apr_pool_t *p, server_rec *s, apr_size_t size,
+        apr_size_t max_entity);
+
+/**
+ * Put the memory tier in front of the given providers, if enabled.
+ */
+cache_provider_list *cache_l1_providers(request_rec *r,
+        cache_provider_list *providers);
+
+/**
+ * Keep the headers recalled by a provider aside, before cache_select()
+ * adds to them, should the entity be taken into the memory tier.
+ */
+void cache_l1_note(cache_request_rec *cache, const cache_provider *provider,
+        cache_handle_t *h, request_rec *r);
+
+/**
+ * Take the entity served from a provider into the memory tier, if small
+ * enough. The brigade holds the body as recalled by the provider.
+ */
+void cache_l1_fill(cache_request_rec *cache, request_rec *r,
+        apr_bucket_brigade *bb);
+
+/**
+ * Read the counters of the memory tier.
+ * @return 0 if the tier is disabled
+ */
+int cache_l1_stats(cache_l1_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !CACHE_L1_H */
+/** @} */
@@ -31,7 +31,7 @@
 #include "cache_common.h"
 
 #define CACHE_SOCACHE_VARY_FORMAT_VERSION 1
-#define CACHE_SOCACHE_DISK_FORMAT_VERSION 2
+#define CACHE_SOCACHE_DISK_FORMAT_VERSION 3
 
 typedef struct {
     /* Indicates the format of the header struct stored on-disk. */
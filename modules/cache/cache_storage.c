@@ -16,6 +16,7 @@
 
 #include "mod_cache.h"
 
+#include "cache_l1.h"
 #include "cache_storage.h"
 #include "cache_util.h"
 
@@ -256,6 +257,7 @@ int cache_select(cache_request_rec *cache, request_rec *r)
                 list = list->next;
                 continue;
             }
+            cache_l1_note(cache, list->provider, h, r);
 
             /*
              * Check Content-Negotiation - Vary
@@ -337,6 +339,17 @@ int cache_select(cache_request_rec *cache, request_rec *r)
             if (mismatch || !cache_check_freshness(h, cache, r)) {
                 const char *etag, *lastmod;
 
+                /* The memory tier only serves fresh entities, the
+                 * providers behind it take care of the rest.
+                 */
+                if (list->provider == &cache_l1_provider) {
+                    if (!mismatch) {
+                        list->provider->remove_entity(h);
+                    }
+                    list = list->next;
+                    continue;
+                }
+
                 /* Cache-Control: only-if-cached and revalidation required, try
                  * the next provider
                  */
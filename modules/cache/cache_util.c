@@ -17,6 +17,7 @@
 #include "mod_cache.h"
 
 #include "cache_util.h"
+#include "cache_l1.h"
 #include <ap_provider.h>
 
 #include "test_char.h"
@@ -226,7 +227,7 @@ cache_provider_list *cache_get_providers(request_rec *r,
         }
     }
 
-    return providers;
+    return cache_l1_providers(r, providers);
 }
 
 
@@ -532,6 +533,82 @@ int ap_cache_check_no_store(cache_request_rec *cache, request_rec *r)
     return 1;
 }
 
+/*
+ * Return the freshness lifetime of the cached entity in seconds, as
+ * determined by the origin server, or -1 if there is none.
+ */
+static apr_int64_t cache_freshness_lifetime(cache_info *info)
+{
+    if (info->control.s_maxage_value != -1) {
+        return info->control.s_maxage_value;
+    }
+    if (info->control.max_age_value != -1) {
+        return info->control.max_age_value;
+    }
+    if (info->expire != APR_DATE_BAD) {
+        return apr_time_sec(info->expire - info->date);
+    }
+    return -1;
+}
+
+/*
+ * Return the current age of the cached entity in seconds.
+ */
+static apr_int64_t cache_entity_age(cache_handle_t *h, request_rec *r)
+{
+    const char *agestr;
+    apr_time_t age_c = 0;
+
+    if ((agestr = apr_table_get(h->resp_hdrs, "Age"))) {
+        char *endp;
+        apr_off_t offt;
+        if (!apr_strtoff(&offt, agestr, &endp, 10)
+                && endp > agestr && !*endp) {
+            age_c = offt;
+        }
+    }
+
+    return ap_cache_current_age(&h->cache_obj->info, age_c, r->request_time);
+}
+
+int cache_check_stale_on_error(cache_handle_t *h, cache_request_rec *cache,
+        request_rec *r)
+{
+    cache_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
+                                                 &cache_module);
+    cache_control_t *control = &h->cache_obj->info.control;
+    apr_int64_t lifetime, limit = -1;
+
+    if (!dconf->stale_on_error || control->must_revalidate
+            || control->proxy_revalidate) {
+        return 0;
+    }
+
+    /*
+     * RFC5861 section 4: stale-if-error bounds the staleness of a response
+     * served in place of an error. It may appear in both the request and
+     * the cached response, the smaller of the two takes priority.
+     */
+    if (control->stale_if_error) {
+        limit = control->stale_if_error_value;
+    }
+    if (cache->control_in.stale_if_error
+            && (limit == -1 || cache->control_in.stale_if_error_value < limit)) {
+        limit = cache->control_in.stale_if_error_value;
+    }
+    if (limit != -1) {
+        lifetime = cache_freshness_lifetime(&h->cache_obj->info);
+        if (lifetime == -1 || cache_entity_age(h, r) > lifetime + limit) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10450)
+                    "Cached response for %s is stale beyond stale-if-error, "
+                    "passing on the error", r->unparsed_uri);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         request_rec *r)
 {
@@ -740,6 +817,58 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         return 1;    /* Cache object is fresh (enough) */
     }
 
+    /* A background refresh always revalidates, see below. */
+    if (apr_table_get(r->notes, CACHE_REFRESH_KEY)) {
+        return 0;
+    }
+
+    /*
+     * We are stale, but the origin may allow us to serve the stale response
+     * while we revalidate it in the background (RFC5861 section 3). In this
+     * case the client gets the stale response straight away, with a warning,
+     * and the revalidation is handed over to a background refresh.
+     *
+     * Clients asking for a response of a given freshness, and entities that
+     * shared caches must revalidate, keep taking the synchronous path.
+     */
+    if (h->cache_obj->info.control.stale_while_revalidate
+            && maxage_req == -1 && !minfresh
+            && !h->cache_obj->info.control.must_revalidate
+            && !h->cache_obj->info.control.proxy_revalidate
+            && smaxage == -1) {
+        cache_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
+                                                     &cache_module);
+        apr_int64_t lifetime = cache_freshness_lifetime(info);
+
+        if (dconf->stale_while_revalidate && lifetime != -1
+                && age < lifetime + h->cache_obj->info.control
+                                     .stale_while_revalidate_value) {
+            status = cache_refresh_schedule(h, cache, r);
+            if (status == APR_SUCCESS || APR_STATUS_IS_EEXIST(status)) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, r, APLOGNO(10451)
+                        "Serving stale cached URL while revalidating in "
+                        "the background: %s", r->unparsed_uri);
+
+                apr_table_set(h->resp_hdrs, "Age",
+                              apr_psprintf(r->pool, "%lu", (unsigned long)age));
+
+                /* make sure we don't stomp on a previous warning */
+                warn_head = apr_table_get(h->resp_hdrs, "Warning");
+                if ((warn_head == NULL) ||
+                        (ap_strstr_c(warn_head, "110") == NULL)) {
+                    apr_table_mergen(h->resp_hdrs, "Warning",
+                                     "110 Response is stale");
+                }
+
+                apr_atomic_inc32(&cache_stale_stats.stale_while_revalidate);
+                return 1;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, r, APLOGNO(10452)
+                    "Could not schedule a background refresh, "
+                    "revalidating entry: %s", r->unparsed_uri);
+        }
+    }
+
     /*
      * At this point we are stale, but: if we are under load, we may let
      * a significant number of stale requests through before the first
@@ -1043,6 +1172,8 @@ int ap_cache_control(request_rec *r, cache_control_t *cc,
     cc->max_stale_value = -1;
     cc->min_fresh_value = -1;
     cc->s_maxage_value = -1;
+    cc->stale_while_revalidate_value = -1;
+    cc->stale_if_error_value = -1;
 
     if (pragma_header) {
         char *header = apr_pstrdup(r->pool, pragma_header), *token;
@@ -1149,6 +1280,21 @@ int ap_cache_control(request_rec *r, cache_control_t *cc,
                         cc->s_maxage_value = offt;
                     }
                 }
+                else if (arg && !ap_cstr_casecmp(token,
+                                                 "stale-while-revalidate")) {
+                    if (!apr_strtoff(&offt, arg, &endp, 10)
+                            && endp > arg && !*endp) {
+                        cc->stale_while_revalidate = 1;
+                        cc->stale_while_revalidate_value = offt;
+                    }
+                }
+                else if (arg && !ap_cstr_casecmp(token, "stale-if-error")) {
+                    if (!apr_strtoff(&offt, arg, &endp, 10)
+                            && endp > arg && !*endp) {
+                        cc->stale_if_error = 1;
+                        cc->stale_if_error_value = offt;
+                    }
+                }
                 break;
             }
         }
@@ -95,10 +95,15 @@ extern "C" {
 #define DEFAULT_X_CACHE         0
 #define DEFAULT_X_CACHE_DETAIL  0
 #define DEFAULT_CACHE_STALE_ON_ERROR 1
+#define DEFAULT_CACHE_STALE_WHILE_REVALIDATE 0
+#define DEFAULT_CACHE_REFRESH_MAX 16
+#define DEFAULT_CACHE_MEMORY_SIZE 0
+#define DEFAULT_CACHE_MEMORY_MAX_ENTITY 65536
 #define DEFAULT_CACHE_LOCKPATH "mod_cache-lock"
 #define CACHE_LOCKNAME_KEY "mod_cache-lockname"
 #define CACHE_LOCKFILE_KEY "mod_cache-lockfile"
 #define CACHE_CTX_KEY "mod_cache-ctx"
+#define CACHE_REFRESH_KEY "mod_cache-refresh-key"
 
 /**
  * cache_util.c
@@ -126,6 +131,12 @@ typedef struct {
     const char *lockpath;
     apr_time_t lockmaxage;
     apr_uri_t *base_uri;
+    /** maximum number of concurrent background refreshes per child */
+    int refresh_max;
+    /** size of the memory tier per child, zero for none */
+    apr_size_t memory_size;
+    /** largest body held in the memory tier */
+    apr_size_t memory_max_entity;
     /** ignore client's requests for uncached responses */
     unsigned int ignorecachecontrol:1;
     /** ignore query-string when caching */
@@ -153,6 +164,9 @@ typedef struct {
     unsigned int lockmaxage_set:1;
     unsigned int x_cache_set:1;
     unsigned int x_cache_detail_set:1;
+    unsigned int refresh_max_set:1;
+    unsigned int memory_size_set:1;
+    unsigned int memory_max_entity_set:1;
 } cache_server_conf;
 
 typedef struct {
@@ -173,6 +187,8 @@ typedef struct {
     unsigned int x_cache_detail:1;
     /* serve stale on error */
     unsigned int stale_on_error:1;
+    /* serve stale while revalidating in the background */
+    unsigned int stale_while_revalidate:1;
     /** ignore the last-modified header when deciding to cache this request */
     unsigned int no_last_mod_ignore:1;
     /** ignore expiration date from server */
@@ -188,6 +204,7 @@ typedef struct {
     unsigned int x_cache_set:1;
     unsigned int x_cache_detail_set:1;
     unsigned int stale_on_error_set:1;
+    unsigned int stale_while_revalidate_set:1;
     unsigned int no_last_mod_ignore_set:1;
     unsigned int store_expired_set:1;
     unsigned int store_private_set:1;
@@ -229,8 +246,21 @@ typedef struct {
     apr_off_t size;                     /* the content length from the headers, or -1 */
     apr_bucket_brigade *out;            /* brigade to reuse for upstream responses */
     cache_control_t control_in;         /* cache control incoming */
+    apr_table_t *l1_resp_hdrs;          /* recalled headers, for the memory tier */
 } cache_request_rec;
 
+/* per child counters of stale content served, and of background refreshes */
+typedef struct {
+    apr_uint32_t stale_while_revalidate;    /* served stale, refresh pending */
+    apr_uint32_t stale_if_error;            /* served stale on backend error */
+    apr_uint32_t refresh_started;           /* background refreshes started */
+    apr_uint32_t refresh_failed;            /* background refreshes failed */
+    apr_uint32_t refresh_rejected;          /* refreshes over the limit */
+    apr_uint32_t refresh_active;            /* refreshes queued or running */
+} cache_stale_stats_t;
+
+extern cache_stale_stats_t cache_stale_stats;
+
 /**
  * Check the whether the request allows a cached object to be served as per RFC2616
  * section 14.9.4 (Cache Revalidation and Reload Controls)
@@ -259,6 +289,30 @@ int ap_cache_check_no_store(cache_request_rec *cache, request_rec *r);
 int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         request_rec *r);
 
+/**
+ * Check whether a stale cache object may be served in place of a 5xx error,
+ * as per RFC2616 section 13.8 and RFC5861 section 4 (stale-if-error).
+ * @param h the stale cache_handle_t
+ * @param cache cache_request_rec
+ * @param r request_rec
+ * @return 0 ==> the error must be passed on, 1 ==> stale object may be served
+ */
+int cache_check_stale_on_error(cache_handle_t *h, cache_request_rec *cache,
+        request_rec *r);
+
+/**
+ * Schedule an asynchronous revalidation of the stale cache object, so that
+ * the stale object can be served to the client straight away as per
+ * RFC5861 section 3 (stale-while-revalidate).
+ *
+ * Returns APR_SUCCESS if a refresh was scheduled, APR_EEXIST if a refresh
+ * of the same entity is already in flight within this child, APR_EBUSY if
+ * the CacheStaleRefreshMax limit was reached, or APR_ENOTIMPL if refreshes
+ * cannot be run in the background on this platform.
+ */
+apr_status_t cache_refresh_schedule(cache_handle_t *h,
+        cache_request_rec *cache, request_rec *r);
+
 /**
  * Try obtain a cache wide lock on the given cache key.
  *
@@ -9,6 +9,7 @@ APACHE_MODULE(file_cache, File cache, , , most)
 dnl #  list of object files for mod_cache
 cache_objs="dnl
 mod_cache.lo dnl
+cache_l1.lo dnl
 cache_storage.lo dnl
 cache_util.lo dnl
 "
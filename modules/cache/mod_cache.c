@@ -16,12 +16,23 @@
 
 #include "mod_cache.h"
 
+#include "cache_l1.h"
 #include "cache_storage.h"
 #include "cache_util.h"
 
+#include "mod_status.h"
+
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_pool.h"
+#include "apr_thread_mutex.h"
+#endif
+
 module AP_MODULE_DECLARE_DATA cache_module;
 APR_OPTIONAL_FN_TYPE(ap_cache_generate_key) *cache_generate_key;
 
+cache_stale_stats_t cache_stale_stats;
+
 /* -------------------------------------------------------------- */
 
 
@@ -35,6 +46,15 @@ static ap_filter_rec_t *cache_out_filter_handle;
 static ap_filter_rec_t *cache_out_subreq_filter_handle;
 static ap_filter_rec_t *cache_remove_url_filter_handle;
 static ap_filter_rec_t *cache_invalidate_filter_handle;
+static ap_filter_rec_t *cache_refresh_in_filter_handle;
+static ap_filter_rec_t *cache_refresh_out_filter_handle;
+
+#if APR_HAS_THREADS
+/* Background refreshes of this child, and the keys they are refreshing */
+static apr_thread_pool_t *cache_refresh_tp;
+static apr_thread_mutex_t *cache_refresh_mutex;
+static apr_hash_t *cache_refresh_keys;
+#endif
 
 /**
  * Entity headers' names
@@ -234,6 +254,12 @@ static int cache_quick_handler(request_rec *r, int lookup)
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv,
                             r, APLOGNO(00752) "Cache locked for url, not caching "
                             "response: %s", r->uri);
+
+                    /* someone else is already refreshing this entity */
+                    if (apr_table_get(r->notes, CACHE_REFRESH_KEY)) {
+                        return DONE;
+                    }
+
                     /* cache_select() may have added conditional headers */
                     if (cache->stale_headers) {
                         r->headers_in = cache->stale_headers;
@@ -258,9 +284,15 @@ static int cache_quick_handler(request_rec *r, int lookup)
         return DECLINED;
     }
 
+    /* a background refresh found the entity fresh already, we are done */
+    if (apr_table_get(r->notes, CACHE_REFRESH_KEY)) {
+        return DONE;
+    }
+
     /* we've got a cache hit! tell everyone who cares */
     cache_run_cache_status(cache->handle, r, r->headers_out, AP_CACHE_HIT,
-            "cache hit");
+            cache->provider == &cache_l1_provider ? "cache hit from memory"
+                    : "cache hit");
 
     /* if we are a lookup, we are exiting soon one way or another; Restore
      * the headers. */
@@ -556,6 +588,11 @@ static int cache_handler(request_rec *r)
                 ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv,
                         r, APLOGNO(00760) "Cache locked for url, not caching "
                         "response: %s", r->uri);
+
+                /* someone else is already refreshing this entity */
+                if (apr_table_get(r->notes, CACHE_REFRESH_KEY)) {
+                    return DONE;
+                }
             }
         }
         else {
@@ -565,9 +602,15 @@ static int cache_handler(request_rec *r)
         return DECLINED;
     }
 
+    /* a background refresh found the entity fresh already, we are done */
+    if (apr_table_get(r->notes, CACHE_REFRESH_KEY)) {
+        return DONE;
+    }
+
     /* we've got a cache hit! tell everyone who cares */
     cache_run_cache_status(cache->handle, r, r->headers_out, AP_CACHE_HIT,
-            "cache hit");
+            cache->provider == &cache_l1_provider ? "cache hit from memory"
+                    : "cache hit");
 
     rv = ap_meets_conditions(r);
     if (rv != OK) {
@@ -674,6 +717,7 @@ static apr_status_t cache_out_filter(ap_filter_t *f, apr_bucket_brigade *in)
 
             /* recall_headers() was called in cache_select() */
             cache->provider->recall_body(cache->handle, r->pool, bb);
+            cache_l1_fill(cache, r, bb);
             APR_BRIGADE_PREPEND(in, bb);
 
             /* This filter is done once it has served up its content */
@@ -887,8 +931,7 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
         ap_remove_output_filter(cache->remove_url_filter);
 
         if (cache->stale_handle
-                && !cache->stale_handle->cache_obj->info.control.must_revalidate
-                && !cache->stale_handle->cache_obj->info.control.proxy_revalidate) {
+                && cache_check_stale_on_error(cache->stale_handle, cache, r)) {
             const char *warn_head;
 
             /* morph the current save filter into the out filter, and serve from
@@ -919,6 +962,7 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
                     apr_psprintf(r->pool,
                             "cache hit: %d status; stale content returned",
                             r->status));
+            apr_atomic_inc32(&cache_stale_stats.stale_if_error);
 
             /* give someone else the chance to cache the file */
             cache_remove_lock(conf, cache, f->r, NULL);
@@ -1872,9 +1916,8 @@ static void cache_insert_error_filter(request_rec *r)
         ap_remove_output_filter(cache->remove_url_filter);
 
         if (cache->stale_handle && cache->save_filter
-                && !cache->stale_handle->cache_obj->info.control.must_revalidate
-                && !cache->stale_handle->cache_obj->info.control.proxy_revalidate
-                && !cache->stale_handle->cache_obj->info.control.s_maxage) {
+                && !cache->stale_handle->cache_obj->info.control.s_maxage
+                && cache_check_stale_on_error(cache->stale_handle, cache, r)) {
             const char *warn_head;
             cache_server_conf
                     *conf =
@@ -1913,6 +1956,7 @@ static void cache_insert_error_filter(request_rec *r)
                             r->pool,
                             "cache hit: %d status; stale content returned",
                             r->status));
+            apr_atomic_inc32(&cache_stale_stats.stale_if_error);
 
             /* give someone else the chance to cache the file */
             cache_remove_lock(conf, cache, r, NULL);
@@ -1923,6 +1967,354 @@ static void cache_insert_error_filter(request_rec *r)
     return;
 }
 
+/* -------------------------------------------------------------- */
+/* Background refresh (RFC5861 stale-while-revalidate)
+ *
+ * When a stale entity may be served while it is revalidated, the client
+ * gets the stale entity straight away, and a copy of its request is run
+ * through the server again on a thread of our own. The copy is marked by
+ * the key of the entity in its notes, so that cache_check_freshness()
+ * never serves it stale content: the copy goes to the origin server with
+ * the conditionals of the stale entity, and the response is thrown away
+ * by the CACHE_REFRESH_OUT filter once it has been stored. Should another
+ * request have refreshed the entity already, or hold the lock on it, the
+ * copy ends right there.
+ */
+
+typedef struct cache_refresh_t {
+    apr_pool_t *pool;
+    conn_rec *c;                /* detached copy of the client connection */
+    server_rec *s;
+    const char *key;
+    const char *hostname;
+    const char *unparsed_uri;
+    const char *protocol;
+    int proto_num;
+    apr_table_t *headers_in;
+} cache_refresh_t;
+
+static apr_status_t cache_refresh_out_filter(ap_filter_t *f,
+        apr_bucket_brigade *bb)
+{
+    /* the refreshed entity has been stored by now, nobody is listening */
+    apr_brigade_cleanup(bb);
+    return APR_SUCCESS;
+}
+
+static apr_status_t cache_refresh_in_filter(ap_filter_t *f,
+        apr_bucket_brigade *bb, ap_input_mode_t mode, apr_read_type_e block,
+        apr_off_t readbytes)
+{
+    /* a refresh is a GET, there is no request body to read */
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+    return APR_SUCCESS;
+}
+
+#if APR_HAS_THREADS
+
+static void * APR_THREAD_FUNC cache_refresh_run(apr_thread_t *thd, void *data)
+{
+    cache_refresh_t *job = data;
+    apr_bucket_alloc_t *ba;
+    conn_rec *c;
+    request_rec *r;
+    int access_status = HTTP_INTERNAL_SERVER_ERROR;
+
+    ba = apr_bucket_alloc_create(job->pool);
+    c = ap_create_secondary_connection(job->pool, job->c, ba);
+    if (c) {
+        c->current_thread = thd;
+        c->keepalive = AP_CONN_CLOSE;
+        ap_add_input_filter_handle(cache_refresh_in_filter_handle, NULL, NULL,
+                c);
+        ap_add_output_filter_handle(cache_refresh_out_filter_handle, NULL,
+                NULL, c);
+
+        r = ap_create_request(c);
+        r->request_time = apr_time_now();
+        r->method = "GET";
+        r->method_number = M_GET;
+        r->protocol = job->protocol;
+        r->proto_num = job->proto_num;
+        r->hostname = job->hostname;
+        r->the_request = apr_pstrcat(r->pool, "GET ", job->unparsed_uri, " ",
+                job->protocol, NULL);
+        r->headers_in = apr_table_copy(r->pool, job->headers_in);
+        ap_parse_uri(r, job->unparsed_uri);
+        apr_table_setn(r->notes, CACHE_REFRESH_KEY, job->key);
+
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10453)
+                "cache: background refresh of %s", job->key);
+
+        /* as for a request read from the client, see ap_read_request() */
+        access_status = ap_post_read_request(r);
+        if (access_status == OK) {
+            access_status = ap_run_quick_handler(r, 0);
+            if (access_status == DECLINED) {
+                access_status = ap_process_request_internal(r);
+                if (access_status == OK) {
+                    access_status = ap_invoke_handler(r);
+                }
+            }
+        }
+        ap_die(access_status, r);
+
+        if ((access_status != OK && access_status != DONE)
+                || r->status >= HTTP_INTERNAL_SERVER_ERROR) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(10454)
+                    "cache: background refresh of %s failed with status %d",
+                    job->key, r->status);
+            apr_atomic_inc32(&cache_stale_stats.refresh_failed);
+        }
+    }
+    else {
+        apr_atomic_inc32(&cache_stale_stats.refresh_failed);
+    }
+
+    apr_thread_mutex_lock(cache_refresh_mutex);
+    apr_hash_set(cache_refresh_keys, job->key, APR_HASH_KEY_STRING, NULL);
+    apr_atomic_dec32(&cache_stale_stats.refresh_active);
+    apr_thread_mutex_unlock(cache_refresh_mutex);
+
+    apr_pool_destroy(job->pool);
+    return NULL;
+}
+
+static int cache_refresh_copy_header(void *rec, const char *key,
+        const char *value)
+{
+    apr_table_add((apr_table_t *)rec, key, value);
+    return 1;
+}
+
+/*
+ * Take a copy of the connection that outlives the client connection, the
+ * refresh may well finish after the client has gone away.
+ */
+static conn_rec *cache_refresh_conn(apr_pool_t *p, request_rec *r)
+{
+    conn_rec *c = apr_pmemdup(p, r->connection, sizeof(conn_rec));
+
+    c->pool = p;
+    c->base_server = r->server;
+    c->vhost_lookup_data = NULL;
+    apr_sockaddr_info_copy(&c->local_addr, r->connection->local_addr, p);
+    apr_sockaddr_info_copy(&c->client_addr, r->connection->client_addr, p);
+    c->client_ip = apr_pstrdup(p, r->connection->client_ip);
+    c->remote_host = apr_pstrdup(p, r->connection->remote_host);
+    c->remote_logname = apr_pstrdup(p, r->connection->remote_logname);
+    c->local_ip = apr_pstrdup(p, r->connection->local_ip);
+    c->local_host = apr_pstrdup(p, r->connection->local_host);
+    c->conn_config = ap_create_conn_config(p);
+    c->notes = apr_table_make(p, 5);
+    c->input_filters = NULL;
+    c->output_filters = NULL;
+    c->sbh = NULL;
+    c->bucket_alloc = NULL;
+    c->cs = NULL;
+    c->log = NULL;
+    c->log_id = NULL;
+    c->current_thread = NULL;
+    c->slaves = NULL;
+    c->master = NULL;
+    c->ctx = NULL;
+    c->suspended_baton = NULL;
+    c->requests = NULL;
+    c->filter_conn_ctx = NULL;
+
+    return c;
+}
+
+#endif /* APR_HAS_THREADS */
+
+apr_status_t cache_refresh_schedule(cache_handle_t *h,
+        cache_request_rec *cache, request_rec *r)
+{
+#if APR_HAS_THREADS
+    cache_server_conf *conf;
+    cache_refresh_t *job;
+    apr_allocator_t *allocator;
+    apr_pool_t *p;
+    apr_status_t rv;
+
+    if (!cache_refresh_tp || r->main || !h->cache_obj->key) {
+        return APR_ENOTIMPL;
+    }
+
+    conf = ap_get_module_config(r->server->module_config, &cache_module);
+
+    apr_thread_mutex_lock(cache_refresh_mutex);
+    if (apr_hash_get(cache_refresh_keys, h->cache_obj->key,
+            APR_HASH_KEY_STRING)) {
+        apr_thread_mutex_unlock(cache_refresh_mutex);
+        return APR_EEXIST;
+    }
+    if (apr_atomic_read32(&cache_stale_stats.refresh_active)
+            >= (apr_uint32_t)conf->refresh_max) {
+        apr_thread_mutex_unlock(cache_refresh_mutex);
+        apr_atomic_inc32(&cache_stale_stats.refresh_rejected);
+        return APR_EBUSY;
+    }
+
+    /* the refresh must not depend on the lifetime of the client's pools */
+    rv = apr_allocator_create(&allocator);
+    if (rv == APR_SUCCESS) {
+        rv = apr_pool_create_ex(&p, NULL, NULL, allocator);
+        if (rv != APR_SUCCESS) {
+            apr_allocator_destroy(allocator);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        apr_thread_mutex_unlock(cache_refresh_mutex);
+        return rv;
+    }
+    apr_allocator_owner_set(allocator, p);
+    apr_pool_tag(p, "cache_refresh");
+
+    job = apr_pcalloc(p, sizeof(cache_refresh_t));
+    job->pool = p;
+    job->s = r->server;
+    job->c = cache_refresh_conn(p, r);
+    job->key = apr_pstrdup(p, h->cache_obj->key);
+    job->hostname = apr_pstrdup(p, r->hostname);
+    job->unparsed_uri = apr_pstrdup(p, r->unparsed_uri);
+    job->protocol = apr_pstrdup(p, r->protocol);
+    job->proto_num = r->proto_num;
+
+    /* the refresh brings its own conditionals, see cache_select() */
+    job->headers_in = apr_table_make(p, apr_table_elts(r->headers_in)->nelts);
+    apr_table_do(cache_refresh_copy_header, job->headers_in, r->headers_in,
+            NULL);
+    apr_table_unset(job->headers_in, "If-Match");
+    apr_table_unset(job->headers_in, "If-Modified-Since");
+    apr_table_unset(job->headers_in, "If-None-Match");
+    apr_table_unset(job->headers_in, "If-Range");
+    apr_table_unset(job->headers_in, "If-Unmodified-Since");
+    apr_table_unset(job->headers_in, "Range");
+    apr_table_unset(job->headers_in, "Cache-Control");
+    apr_table_unset(job->headers_in, "Pragma");
+    apr_table_unset(job->headers_in, "Expect");
+    apr_table_unset(job->headers_in, "Content-Length");
+    apr_table_unset(job->headers_in, "Transfer-Encoding");
+
+    rv = apr_thread_pool_push(cache_refresh_tp, cache_refresh_run, job,
+            APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
+    if (rv != APR_SUCCESS) {
+        apr_thread_mutex_unlock(cache_refresh_mutex);
+        apr_pool_destroy(p);
+        return rv;
+    }
+    apr_hash_set(cache_refresh_keys, job->key, APR_HASH_KEY_STRING, job);
+    apr_atomic_inc32(&cache_stale_stats.refresh_active);
+    apr_atomic_inc32(&cache_stale_stats.refresh_started);
+    apr_thread_mutex_unlock(cache_refresh_mutex);
+
+    return APR_SUCCESS;
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
+static void cache_child_init(apr_pool_t *p, server_rec *s)
+{
+    cache_server_conf *conf = ap_get_module_config(s->module_config,
+                                                   &cache_module);
+#if APR_HAS_THREADS
+    apr_status_t rv;
+#endif
+
+    cache_l1_child_init(p, s, conf->memory_size, conf->memory_max_entity);
+
+#if APR_HAS_THREADS
+    if (conf->refresh_max <= 0) {
+        return;
+    }
+
+    rv = apr_thread_mutex_create(&cache_refresh_mutex,
+            APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_pool_create(&cache_refresh_tp, 0, conf->refresh_max,
+                p);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10455)
+                "cache: could not create the background refresh thread "
+                "pool, stale entities will be revalidated synchronously");
+        cache_refresh_tp = NULL;
+        return;
+    }
+    cache_refresh_keys = apr_hash_make(p);
+#endif
+}
+
+static int cache_status_hook(request_rec *r, int flags)
+{
+    apr_uint32_t swr = apr_atomic_read32(&cache_stale_stats.stale_while_revalidate);
+    apr_uint32_t sie = apr_atomic_read32(&cache_stale_stats.stale_if_error);
+    apr_uint32_t started = apr_atomic_read32(&cache_stale_stats.refresh_started);
+    apr_uint32_t failed = apr_atomic_read32(&cache_stale_stats.refresh_failed);
+    apr_uint32_t rejected = apr_atomic_read32(&cache_stale_stats.refresh_rejected);
+    apr_uint32_t active = apr_atomic_read32(&cache_stale_stats.refresh_active);
+    cache_l1_stats_t l1;
+    int has_l1 = cache_l1_stats(&l1);
+
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "CacheStaleWhileRevalidate: %u\n"
+                      "CacheStaleIfError: %u\n"
+                      "CacheRefreshStarted: %u\n"
+                      "CacheRefreshFailed: %u\n"
+                      "CacheRefreshRejected: %u\n"
+                      "CacheRefreshActive: %u\n",
+                   swr, sie, started, failed, rejected, active);
+        if (has_l1) {
+            ap_rprintf(r, "CacheMemoryEntries: %u\n"
+                          "CacheMemoryBytes: %" APR_SIZE_T_FMT "\n"
+                          "CacheMemoryHits: %u\n"
+                          "CacheMemoryFills: %u\n"
+                          "CacheMemoryEvictions: %u\n",
+                       l1.entries, l1.used, l1.hits, l1.fills, l1.evictions);
+        }
+    }
+    else {
+        ap_rputs("<hr>\n<h2>mod_cache status for this child</h2>\n"
+                 "<table border=\"0\">\n", r);
+        ap_rprintf(r, "<tr><td>Served stale while revalidating:</td>"
+                      "<td>%u</td></tr>\n", swr);
+        ap_rprintf(r, "<tr><td>Served stale on error:</td>"
+                      "<td>%u</td></tr>\n", sie);
+        ap_rprintf(r, "<tr><td>Background refreshes started:</td>"
+                      "<td>%u</td></tr>\n", started);
+        ap_rprintf(r, "<tr><td>Background refreshes failed:</td>"
+                      "<td>%u</td></tr>\n", failed);
+        ap_rprintf(r, "<tr><td>Background refreshes over the limit:</td>"
+                      "<td>%u</td></tr>\n", rejected);
+        ap_rprintf(r, "<tr><td>Background refreshes in progress:</td>"
+                      "<td>%u</td></tr>\n", active);
+        if (has_l1) {
+            ap_rprintf(r, "<tr><td>Memory tier entities:</td>"
+                          "<td>%u</td></tr>\n", l1.entries);
+            ap_rprintf(r, "<tr><td>Memory tier bytes used:</td>"
+                          "<td>%" APR_SIZE_T_FMT " of %" APR_SIZE_T_FMT
+                          "</td></tr>\n", l1.used, l1.size);
+            ap_rprintf(r, "<tr><td>Memory tier hits:</td>"
+                          "<td>%u</td></tr>\n", l1.hits);
+            ap_rprintf(r, "<tr><td>Memory tier fills:</td>"
+                          "<td>%u</td></tr>\n", l1.fills);
+            ap_rprintf(r, "<tr><td>Memory tier evictions:</td>"
+                          "<td>%u</td></tr>\n", l1.evictions);
+        }
+        ap_rputs("</table>\n", r);
+    }
+
+    return OK;
+}
+
+static void cache_status_register(apr_pool_t *p)
+{
+    APR_OPTIONAL_HOOK(ap, status_hook, cache_status_hook, NULL, NULL,
+                      APR_HOOK_MIDDLE);
+}
+
 /* -------------------------------------------------------------- */
 /* Setup configurable data */
 
@@ -1948,6 +2340,7 @@ static void *create_dir_config(apr_pool_t *p, char *dummy)
     dconf->x_cache_detail = DEFAULT_X_CACHE_DETAIL;
 
     dconf->stale_on_error = DEFAULT_CACHE_STALE_ON_ERROR;
+    dconf->stale_while_revalidate = DEFAULT_CACHE_STALE_WHILE_REVALIDATE;
 
     /* array of providers for this URL space */
     dconf->cacheenable = apr_array_make(p, 10, sizeof(struct cache_enable));
@@ -1996,6 +2389,11 @@ static void *merge_dir_config(apr_pool_t *p, void *basev, void *addv) {
     new->stale_on_error_set = add->stale_on_error_set
             || base->stale_on_error_set;
 
+    new->stale_while_revalidate = (add->stale_while_revalidate_set == 0)
+            ? base->stale_while_revalidate : add->stale_while_revalidate;
+    new->stale_while_revalidate_set = add->stale_while_revalidate_set
+            || base->stale_while_revalidate_set;
+
     new->cacheenable = add->enable_set ? apr_array_append(p, base->cacheenable,
             add->cacheenable) : base->cacheenable;
     new->enable_set = add->enable_set || base->enable_set;
@@ -2033,6 +2431,9 @@ static void * create_cache_config(apr_pool_t *p, server_rec *s)
     ps->lockmaxage = apr_time_from_sec(DEFAULT_CACHE_MAXAGE);
     ps->x_cache = DEFAULT_X_CACHE;
     ps->x_cache_detail = DEFAULT_X_CACHE_DETAIL;
+    ps->refresh_max = DEFAULT_CACHE_REFRESH_MAX;
+    ps->memory_size = DEFAULT_CACHE_MEMORY_SIZE;
+    ps->memory_max_entity = DEFAULT_CACHE_MEMORY_MAX_ENTITY;
     return ps;
 }
 
@@ -2095,6 +2496,18 @@ static void * merge_cache_config(apr_pool_t *p, void *basev, void *overridesv)
         (overrides->base_uri_set == 0)
         ? base->base_uri
         : overrides->base_uri;
+    ps->refresh_max =
+        (overrides->refresh_max_set == 0)
+        ? base->refresh_max
+        : overrides->refresh_max;
+    ps->memory_size =
+        (overrides->memory_size_set == 0)
+        ? base->memory_size
+        : overrides->memory_size;
+    ps->memory_max_entity =
+        (overrides->memory_max_entity_set == 0)
+        ? base->memory_max_entity
+        : overrides->memory_max_entity;
     return ps;
 }
 
@@ -2508,6 +2921,85 @@ static const char *set_cache_stale_on_error(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *set_cache_stale_while_revalidate(cmd_parms *parms,
+        void *dummy, int flag)
+{
+    cache_dir_conf *dconf = (cache_dir_conf *)dummy;
+
+    dconf->stale_while_revalidate = flag;
+    dconf->stale_while_revalidate_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_refresh_max(cmd_parms *parms, void *dummy,
+        const char *arg)
+{
+    cache_server_conf *conf;
+    const char *err;
+    int max;
+
+    if ((err = ap_check_cmd_context(parms, GLOBAL_ONLY)) != NULL) {
+        return err;
+    }
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    max = atoi(arg);
+    if (max < 0) {
+        return "CacheStaleRefreshMax value must be a positive integer or zero";
+    }
+    conf->refresh_max = max;
+    conf->refresh_max_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_memory_size(cmd_parms *parms, void *dummy,
+        const char *arg)
+{
+    cache_server_conf *conf;
+    const char *err;
+    apr_off_t size;
+
+    if ((err = ap_check_cmd_context(parms, GLOBAL_ONLY)) != NULL) {
+        return err;
+    }
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS || size < 0) {
+        return "CacheMemorySize argument must be a non-negative integer "
+               "representing the size of the memory tier in bytes";
+    }
+    conf->memory_size = (apr_size_t)size;
+    conf->memory_size_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_memory_max_entity(cmd_parms *parms, void *dummy,
+        const char *arg)
+{
+    cache_server_conf *conf;
+    const char *err;
+    apr_off_t size;
+
+    if ((err = ap_check_cmd_context(parms, GLOBAL_ONLY)) != NULL) {
+        return err;
+    }
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS || size < 0) {
+        return "CacheMemoryMaxEntitySize argument must be a non-negative "
+               "integer representing the largest body held in memory in bytes";
+    }
+    conf->memory_max_entity = (apr_size_t)size;
+    conf->memory_max_entity_set = 1;
+    return NULL;
+}
+
 static int cache_post_config(apr_pool_t *p, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *s)
 {
@@ -2595,6 +3087,25 @@ static const command_rec cache_cmds[] =
     AP_INIT_FLAG("CacheStaleOnError", set_cache_stale_on_error,
                  NULL, RSRC_CONF|ACCESS_CONF,
                  "Serve stale content on 5xx errors if present. Defaults to on."),
+    AP_INIT_FLAG("CacheStaleWhileRevalidate", set_cache_stale_while_revalidate,
+                 NULL, RSRC_CONF|ACCESS_CONF,
+                 "Serve stale content while revalidating it in the background "
+                 "when allowed by Cache-Control: stale-while-revalidate. "
+                 "Defaults to off."),
+    AP_INIT_TAKE1("CacheStaleRefreshMax", set_cache_refresh_max, NULL,
+                  RSRC_CONF,
+                  "Maximum number of concurrent background refreshes per "
+                  "child process. Defaults to "
+                  APR_STRINGIFY(DEFAULT_CACHE_REFRESH_MAX) "."),
+    AP_INIT_TAKE1("CacheMemorySize", set_cache_memory_size, NULL, RSRC_CONF,
+                  "The size in bytes of the in memory tier of each child "
+                  "process, in front of the cache providers. Defaults to 0, "
+                  "no memory tier."),
+    AP_INIT_TAKE1("CacheMemoryMaxEntitySize", set_cache_memory_max_entity,
+                  NULL, RSRC_CONF,
+                  "The largest body in bytes held in the memory tier. "
+                  "Defaults to "
+                  APR_STRINGIFY(DEFAULT_CACHE_MEMORY_MAX_ENTITY) "."),
     {NULL}
 };
 
@@ -2688,7 +3199,19 @@ static void register_hooks(apr_pool_t *p)
                                   cache_invalidate_filter,
                                   NULL,
                                   AP_FTYPE_PROTOCOL);
+    cache_refresh_in_filter_handle =
+        ap_register_input_filter("CACHE_REFRESH_IN",
+                                 cache_refresh_in_filter,
+                                 NULL,
+                                 AP_FTYPE_NETWORK);
+    cache_refresh_out_filter_handle =
+        ap_register_output_filter("CACHE_REFRESH_OUT",
+                                  cache_refresh_out_filter,
+                                  NULL,
+                                  AP_FTYPE_NETWORK);
     ap_hook_post_config(cache_post_config, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_hook_child_init(cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+    cache_status_register(p);
 }
 
 AP_DECLARE_MODULE(cache) =
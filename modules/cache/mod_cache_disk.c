@@ -17,6 +17,7 @@
 #include "apr_lib.h"
 #include "apr_file_io.h"
 #include "apr_strings.h"
+#include "apr_hash.h"
 #include "mod_cache.h"
 #include "mod_cache_disk.h"
 #include "http_config.h"
@@ -27,19 +28,24 @@
 #include "util_script.h"
 #include "util_charset.h"
 
+#if APR_HAS_THREADS
+#include "apr_thread_pool.h"
+#include "apr_thread_mutex.h"
+#endif
+
 /*
  * mod_cache_disk: Disk Based HTTP 1.1 Cache.
  *
- * Flow to Find the .data file:
+ * Flow to Find the entity:
  *   Incoming client requests URI /foo/bar/baz
  *   Generate <hash> off of /foo/bar/baz
  *   Open <hash>.header
- *   Read in <hash>.header file (may contain Format #1 or Format #2)
+ *   Read the head of <hash>.header in one go (may contain Format #1 or Format #2)
  *   If format #1 (Contains a list of Vary Headers):
  *      Use each header name (from .header) with our request values (headers_in) to
  *      regenerate <hash> using HeaderName+HeaderValue+.../foo/bar/baz
- *      re-read in <hash>.header (must be format #2)
- *   read in <hash>.data
+ *      re-read the head of <hash>.header (must be format #2)
+ *   serve the body from the same <hash>.header file
  *
  * Format #1:
  *   apr_uint32_t format;
@@ -53,10 +59,35 @@
  *   CRLF
  *   r->headers_in (delimited by CRLF)
  *   CRLF
+ *   padding up to disk_cache_info_t->body_offset
+ *   body [length is in disk_cache_info_t->body_len]
+ *
+ * The entity name and the two header tables make up the header block,
+ * whose length is in disk_cache_info_t->hdrs_len.
  */
 
 module AP_MODULE_DECLARE_DATA cache_disk_module;
 
+#if APR_HAS_THREADS
+/* Background writers of this child, see CacheWriteBehind */
+static apr_thread_pool_t *writer_tp;
+#endif
+
+/* The journals this child appends to, by cache root, see CacheJournal */
+typedef struct {
+    const char *path;
+    apr_file_t *fd;
+    apr_ino_t inode;
+    apr_dev_t device;
+    apr_time_t checked;          /* when the path was last looked at */
+} disk_cache_journal_t;
+
+static apr_pool_t *journal_pool;
+static apr_hash_t *journals;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *journal_mutex;
+#endif
+
 /* Forward declarations */
 static int remove_entity(cache_handle_t *h);
 static apr_status_t store_headers(cache_handle_t *h, request_rec *r, cache_info *i);
@@ -65,7 +96,7 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r, apr_bucket_bri
 static apr_status_t recall_headers(cache_handle_t *h, request_rec *r);
 static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_brigade *bb);
 static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
-                               apr_file_t *file);
+                               char **buf, char *end);
 
 /*
  * Local static functions
@@ -89,24 +120,6 @@ static char *header_file(apr_pool_t *p, disk_cache_conf *conf,
      }
 }
 
-static char *data_file(apr_pool_t *p, disk_cache_conf *conf,
-                       disk_cache_object_t *dobj, const char *name)
-{
-    if (!dobj->hashfile) {
-        dobj->hashfile = ap_cache_generate_name(p, conf->dirlevels,
-                                                conf->dirlength, name);
-    }
-
-    if (dobj->prefix) {
-        return apr_pstrcat(p, dobj->prefix, CACHE_VDIR_SUFFIX "/",
-                           dobj->hashfile, CACHE_DATA_SUFFIX, NULL);
-     }
-     else {
-        return apr_pstrcat(p, conf->cache_root, "/", dobj->hashfile,
-                           CACHE_DATA_SUFFIX, NULL);
-     }
-}
-
 static apr_status_t mkdir_structure(disk_cache_conf *conf, const char *file, apr_pool_t *pool)
 {
     apr_status_t rv;
@@ -185,6 +198,121 @@ static apr_status_t file_cache_el_final(disk_cache_conf *conf, disk_cache_file_t
     return rv;
 }
 
+/* The journal handle of the cache root, opened anew once htcacheclean
+ * replaced the journal, with the lock held. The path is looked at no
+ * more than once every CACHE_JOURNAL_RECHECK, htcacheclean waits as long
+ * before it reads what it took over.
+ */
+static apr_file_t *journal_open(disk_cache_conf *conf, server_rec *s)
+{
+    disk_cache_journal_t *j;
+    apr_finfo_t finfo;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv;
+
+    j = apr_hash_get(journals, conf->cache_root, APR_HASH_KEY_STRING);
+    if (!j) {
+        j = apr_pcalloc(journal_pool, sizeof(*j));
+        j->path = apr_pstrcat(journal_pool, conf->cache_root, "/",
+                              CACHE_JOURNAL_FILE, NULL);
+        apr_hash_set(journals, apr_pstrdup(journal_pool, conf->cache_root),
+                     APR_HASH_KEY_STRING, j);
+    }
+    else if (now - j->checked < CACHE_JOURNAL_RECHECK) {
+        return j->fd;
+    }
+    j->checked = now;
+
+    if (j->fd) {
+        rv = apr_stat(&finfo, j->path, APR_FINFO_IDENT, journal_pool);
+        if (rv == APR_SUCCESS && finfo.inode == j->inode
+                && finfo.device == j->device) {
+            return j->fd;
+        }
+        apr_file_close(j->fd);
+        j->fd = NULL;
+    }
+
+    /* the journal only exists while htcacheclean keeps an index of the
+     * cache, so it is never created here
+     */
+    rv = apr_file_open(&j->fd, j->path,
+                       APR_FOPEN_WRITE | APR_FOPEN_APPEND | APR_FOPEN_BINARY,
+                       CACHE_JOURNAL_PERMS, journal_pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_info_get(&finfo, APR_FINFO_IDENT, j->fd);
+        if (rv == APR_SUCCESS) {
+            j->inode = finfo.inode;
+            j->device = finfo.device;
+        }
+        else {
+            apr_file_close(j->fd);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        j->fd = NULL;
+        if (!APR_STATUS_IS_ENOENT(rv)) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10532)
+                    "could not open the cache journal %s", j->path);
+        }
+    }
+
+    return j->fd;
+}
+
+/* Let htcacheclean know about an entity file that was stored, served or
+ * removed. Each child keeps the journal open, and appends each record in
+ * a single write.
+ */
+static void journal_record(disk_cache_conf *conf, server_rec *s, char op,
+                           const char *file, apr_pool_t *pool)
+{
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_off_t size = 0;
+    apr_size_t len, slen = sizeof(CACHE_HEADER_SUFFIX) - 1;
+    const char *name;
+    char *line;
+    apr_status_t rv = APR_SUCCESS;
+
+    if (!conf->journal || !journals) {
+        return;
+    }
+
+    if (op == CACHE_JOURNAL_STORE
+            && apr_stat(&finfo, file, APR_FINFO_SIZE, pool) == APR_SUCCESS) {
+        size = finfo.size;
+    }
+
+    name = file + conf->cache_root_len;
+    while (*name == '/') {
+        name++;
+    }
+    len = strlen(name);
+    if (len > slen && !strcmp(name + len - slen, CACHE_HEADER_SUFFIX)) {
+        len -= slen;
+    }
+
+    line = apr_psprintf(pool, "%c %" APR_TIME_T_FMT " %" APR_OFF_T_FMT
+                        " %.*s\n", op, apr_time_now(), size, (int)len, name);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(journal_mutex);
+#endif
+    fd = journal_open(conf, s);
+    if (fd) {
+        rv = apr_file_write_full(fd, line, strlen(line), NULL);
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(journal_mutex);
+#endif
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10464)
+                "could not append to the cache journal in %s",
+                conf->cache_root);
+    }
+}
+
 static apr_status_t file_cache_temp_cleanup(void *dummy)
 {
     disk_cache_file_t *file = (disk_cache_file_t *)dummy;
@@ -211,23 +339,383 @@ static apr_status_t file_cache_create(disk_cache_conf *conf, disk_cache_file_t *
     return APR_SUCCESS;
 }
 
-/* These two functions get and put state information into the data
+#if APR_HAS_THREADS
+/*
+ * Write behind: store_body() hands copies of the body over to a writer
+ * running on a thread of its own, so that the response goes on to the
+ * client without waiting for the disk. The writer owns its pool, and
+ * everything it needs once the request is gone travels in the commit.
+ */
+typedef struct disk_cache_chunk {
+    struct disk_cache_chunk *next;
+    apr_size_t len;              /* data follows the struct */
+} disk_cache_chunk_t;
+
+typedef struct {
+    char *head;                  /* info struct and header block */
+    apr_size_t head_len;
+    char *file;                  /* final name of the entity file */
+    char *vary;                  /* contents of the vary file, if any */
+    apr_size_t vary_len;
+    char *vary_file;
+} disk_cache_commit_t;
+
+struct disk_cache_writer {
+    apr_pool_t *pool;
+    server_rec *s;
+    disk_cache_conf *conf;
+    apr_thread_mutex_t *mutex;   /* guards the fields below down to status */
+    disk_cache_chunk_t *first;
+    disk_cache_chunk_t *last;
+    disk_cache_commit_t *commit;
+    apr_status_t status;         /* first write error, stops the queueing */
+    unsigned int scheduled:1;    /* a task is queued or running */
+    unsigned int aborted:1;
+    char *tempfile;
+    apr_file_t *tempfd;
+    apr_off_t body_offset;
+};
+
+static apr_status_t writer_temp_cleanup(void *data)
+{
+    disk_cache_writer_t *w = (disk_cache_writer_t *)data;
+
+    /* clean up the temporary file, unless it made it into the cache */
+    if (w->tempfd) {
+        apr_file_remove(w->tempfile, w->pool);
+        w->tempfd = NULL;
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t writer_write(disk_cache_writer_t *w,
+                                 disk_cache_chunk_t *chunk)
+{
+    apr_status_t rv;
+
+    if (!w->tempfd) {
+        apr_off_t offset = w->body_offset;
+
+        rv = apr_file_mktemp(&w->tempfd, w->tempfile,
+                APR_CREATE | APR_WRITE | APR_BINARY | APR_BUFFERED
+                        | APR_EXCL, w->pool);
+        if (rv == APR_SUCCESS) {
+            /* leave room for the info struct and the header block */
+            rv = apr_file_seek(w->tempfd, APR_SET, &offset);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, w->s, APLOGNO(10457)
+                    "could not create entity file %s", w->tempfile);
+            return rv;
+        }
+    }
+
+    rv = apr_file_write_full(w->tempfd, chunk + 1, chunk->len, NULL);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, w->s, APLOGNO(10458)
+                "could not write to entity file %s", w->tempfile);
+    }
+
+    return rv;
+}
+
+static void writer_store(disk_cache_writer_t *w, disk_cache_commit_t *commit)
+{
+    apr_file_t *fd;
+    char *tempfile;
+    apr_off_t offset = 0;
+    apr_status_t rv;
+
+    /* The info struct and the header block go in front of the body */
+    rv = apr_file_seek(w->tempfd, APR_SET, &offset);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(w->tempfd, commit->head, commit->head_len,
+                                 NULL);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_close(w->tempfd); /* flush and close */
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, w->s, APLOGNO(10459)
+                "could not write info to entity file %s", w->tempfile);
+        return;
+    }
+
+    rv = safe_file_rename(w->conf, w->tempfile, commit->file, w->pool);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, w->s, APLOGNO(10460)
+                "rename tempfile to file failed: %s -> %s",
+                w->tempfile, commit->file);
+        return;
+    }
+    w->tempfd = NULL;
+
+    journal_record(w->conf, w->s, CACHE_JOURNAL_STORE, commit->file, w->pool);
+
+    if (!commit->vary) {
+        return;
+    }
+
+    tempfile = apr_pstrcat(w->pool, w->conf->cache_root, AP_TEMPFILE, NULL);
+    rv = apr_file_mktemp(&fd, tempfile,
+                         APR_CREATE | APR_WRITE | APR_BINARY | APR_EXCL,
+                         w->pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(fd, commit->vary, commit->vary_len, NULL);
+        apr_file_close(fd);
+        if (rv == APR_SUCCESS) {
+            rv = safe_file_rename(w->conf, tempfile, commit->vary_file,
+                                  w->pool);
+        }
+        if (rv != APR_SUCCESS) {
+            apr_file_remove(tempfile, w->pool);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, w->s, APLOGNO(10461)
+                "could not store vary file %s", commit->vary_file);
+    }
+}
+
+static void * APR_THREAD_FUNC writer_run(apr_thread_t *thd, void *data)
+{
+    disk_cache_writer_t *w = (disk_cache_writer_t *)data;
+    disk_cache_chunk_t *chunk, *next;
+    disk_cache_commit_t *commit;
+    apr_status_t rv = APR_SUCCESS;
+    int aborted;
+
+    for (;;) {
+        apr_thread_mutex_lock(w->mutex);
+        chunk = w->first;
+        w->first = w->last = NULL;
+        commit = w->commit;
+        aborted = w->aborted;
+        rv = w->status;
+        if (!chunk && !commit && !aborted) {
+            /* wait for more, store_body() schedules us again */
+            w->scheduled = 0;
+            apr_thread_mutex_unlock(w->mutex);
+            return NULL;
+        }
+        apr_thread_mutex_unlock(w->mutex);
+
+        if (!chunk) {
+            break;
+        }
+
+        for (; chunk; chunk = next) {
+            next = chunk->next;
+            if (rv == APR_SUCCESS && !aborted) {
+                rv = writer_write(w, chunk);
+            }
+            free(chunk);
+        }
+
+        if (rv != APR_SUCCESS) {
+            apr_thread_mutex_lock(w->mutex);
+            w->status = rv;
+            apr_thread_mutex_unlock(w->mutex);
+        }
+    }
+
+    /* The request is done with us one way or the other */
+    if (commit) {
+        if (rv == APR_SUCCESS && w->tempfd) {
+            writer_store(w, commit);
+        }
+        free(commit);
+    }
+
+    apr_pool_destroy(w->pool);
+
+    return NULL;
+}
+
+/* Hand the writer its final instructions, after which it belongs to the
+ * thread pool. A NULL commit abandons the entity.
+ */
+static void writer_finish(disk_cache_writer_t *w, disk_cache_commit_t *commit)
+{
+    apr_thread_mutex_lock(w->mutex);
+    if (commit) {
+        w->commit = commit;
+    }
+    else {
+        w->aborted = 1;
+    }
+    if (!w->scheduled) {
+        if (apr_thread_pool_push(writer_tp, writer_run, w,
+                APR_THREAD_TASK_PRIORITY_NORMAL, NULL) != APR_SUCCESS) {
+            /* nobody else will, finish the job ourselves */
+            apr_thread_mutex_unlock(w->mutex);
+            writer_run(NULL, w);
+            return;
+        }
+        w->scheduled = 1;
+    }
+    apr_thread_mutex_unlock(w->mutex);
+}
+
+static apr_status_t writer_cleanup(void *data)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t *)data;
+
+    /* the request went away before the commit */
+    if (dobj->writer) {
+        writer_finish(dobj->writer, NULL);
+        dobj->writer = NULL;
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t writer_create(disk_cache_object_t *dobj, request_rec *r)
+{
+    disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                 &cache_disk_module);
+    disk_cache_writer_t *w;
+    apr_allocator_t *allocator;
+    apr_pool_t *p;
+    apr_status_t rv;
+
+    /* the writer must not depend on the lifetime of the request */
+    rv = apr_allocator_create(&allocator);
+    if (rv == APR_SUCCESS) {
+        rv = apr_pool_create_ex(&p, NULL, NULL, allocator);
+        if (rv != APR_SUCCESS) {
+            apr_allocator_destroy(allocator);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    apr_allocator_owner_set(allocator, p);
+    apr_pool_tag(p, "mod_cache_disk (writer)");
+
+    w = apr_pcalloc(p, sizeof(disk_cache_writer_t));
+    w->pool = p;
+    w->s = r->server;
+    w->conf = conf;
+    w->tempfile = apr_pstrcat(p, conf->cache_root, AP_TEMPFILE, NULL);
+    w->body_offset = dobj->disk_info.body_offset;
+
+    rv = apr_thread_mutex_create(&w->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(p);
+        return rv;
+    }
+    apr_pool_cleanup_register(p, w, writer_temp_cleanup,
+                              apr_pool_cleanup_null);
+
+    dobj->writer = w;
+    apr_pool_cleanup_register(dobj->hdrs.pool, dobj, writer_cleanup,
+                              apr_pool_cleanup_null);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t writer_queue(disk_cache_writer_t *w, const char *str,
+                                 apr_size_t length)
+{
+    disk_cache_chunk_t *chunk;
+    apr_status_t rv;
+
+    chunk = ap_malloc(sizeof(disk_cache_chunk_t) + length);
+    chunk->next = NULL;
+    chunk->len = length;
+    memcpy(chunk + 1, str, length);
+
+    apr_thread_mutex_lock(w->mutex);
+    rv = w->status;
+    if (rv == APR_SUCCESS) {
+        if (w->last) {
+            w->last->next = chunk;
+        }
+        else {
+            w->first = chunk;
+        }
+        w->last = chunk;
+        chunk = NULL;
+        if (!w->scheduled) {
+            rv = apr_thread_pool_push(writer_tp, writer_run, w,
+                    APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
+            w->scheduled = (rv == APR_SUCCESS);
+        }
+    }
+    apr_thread_mutex_unlock(w->mutex);
+
+    if (chunk) {
+        free(chunk);
+    }
+
+    return rv;
+}
+#endif /* APR_HAS_THREADS */
+
+/* Read the head of a cache file with a single read. For most entities
+ * this covers both the info struct and the whole header block.
+ */
+static apr_status_t read_head(disk_cache_object_t *dobj, request_rec *r,
+                              apr_uint32_t *format)
+{
+    apr_status_t rv;
+    apr_size_t len = CACHE_DISK_HEAD_SIZE;
+
+    if (!dobj->head) {
+        dobj->head = apr_palloc(r->pool, len);
+    }
+
+    rv = apr_file_read(dobj->hdrs.fd, dobj->head, &len);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    if (len < sizeof(*format)) {
+        return APR_EOF;
+    }
+    dobj->head_len = len;
+
+    memcpy(format, dobj->head, sizeof(*format));
+
+    return APR_SUCCESS;
+}
+
+/* These two functions get and put state information into the entity
  * file for an ap_cache_el, this state information will be read
  * and written transparent to clients of this module
  */
-static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
+static int file_cache_recall_mydata(cache_info *info,
                                     disk_cache_object_t *dobj, request_rec *r)
 {
     apr_status_t rv;
-    char *urlbuff;
     apr_size_t len;
 
-    /* read the data from the cache file */
-    len = sizeof(disk_cache_info_t);
-    rv = apr_file_read_full(fd, &dobj->disk_info, len, &len);
-    if (rv != APR_SUCCESS) {
-        return rv;
+    if (dobj->head_len < sizeof(disk_cache_info_t)) {
+        return APR_EOF;
     }
+    memcpy(&dobj->disk_info, dobj->head, sizeof(disk_cache_info_t));
+
+    len = sizeof(disk_cache_info_t) + dobj->disk_info.hdrs_len;
+    if (dobj->disk_info.name_len > dobj->disk_info.hdrs_len
+            || (apr_off_t)len > dobj->disk_info.body_offset) {
+        return APR_EGENERAL;
+    }
+
+    /* Fetch what the first read left of a large header block */
+    if (len > dobj->head_len) {
+        char *head = apr_palloc(r->pool, len);
+        apr_size_t more = len - dobj->head_len;
+
+        memcpy(head, dobj->head, dobj->head_len);
+        rv = apr_file_read_full(dobj->hdrs.fd, head + dobj->head_len,
+                                more, &more);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        dobj->head = head;
+    }
+    dobj->head_len = len;
 
     /* Store it away so we can get it later. */
     info->status = dobj->disk_info.status;
@@ -238,22 +726,16 @@ static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
 
     memcpy(&info->control, &dobj->disk_info.control, sizeof(cache_control_t));
 
-    /* Note that we could optimize this by conditionally doing the palloc
-     * depending upon the size. */
-    urlbuff = apr_palloc(r->pool, dobj->disk_info.name_len + 1);
-    len = dobj->disk_info.name_len;
-    rv = apr_file_read_full(fd, urlbuff, len, &len);
-    if (rv != APR_SUCCESS) {
-        return rv;
-    }
-    urlbuff[dobj->disk_info.name_len] = '\0';
-
     /* check that we have the same URL */
-    /* Would strncmp be correct? */
-    if (strcmp(urlbuff, dobj->name) != 0) {
+    if (dobj->disk_info.name_len != strlen(dobj->name)
+            || memcmp(dobj->head + sizeof(disk_cache_info_t), dobj->name,
+                      dobj->disk_info.name_len)) {
         return APR_EGENERAL;
     }
 
+    dobj->body_offset = dobj->disk_info.body_offset;
+    dobj->file_size = dobj->disk_info.body_len;
+
     return APR_SUCCESS;
 }
 
@@ -390,9 +872,7 @@ static int create_entity(cache_handle_t *h, request_rec *r, const char *key, apr
 
     file_cache_create(conf, &dobj->hdrs, pool);
     file_cache_create(conf, &dobj->vary, pool);
-    file_cache_create(conf, &dobj->data, pool);
 
-    dobj->data.file = data_file(r->pool, conf, dobj, key);
     dobj->hdrs.file = header_file(r->pool, conf, dobj, key);
     dobj->vary.file = header_file(r->pool, conf, dobj, key);
 
@@ -404,7 +884,6 @@ static int create_entity(cache_handle_t *h, request_rec *r, const char *key, apr
 static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
 {
     apr_uint32_t format;
-    apr_size_t len;
     const char *nkey;
     apr_status_t rc;
     static int error_logged = 0;
@@ -413,7 +892,6 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
 #ifdef APR_SENDFILE_ENABLED
     core_dir_config *coreconf = ap_get_core_module_config(r->per_dir_config);
 #endif
-    apr_finfo_t finfo;
     cache_object_t *obj;
     cache_info *info;
     disk_cache_object_t *dobj;
@@ -445,34 +923,50 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     dobj->root = apr_pstrmemdup(r->pool, conf->cache_root, conf->cache_root_len);
     dobj->root_len = conf->cache_root_len;
 
+    /* The body is served from the same file, so open it the way the
+     * data file used to be opened.
+     */
+    flags = APR_READ | APR_BINARY;
+#ifdef APR_SENDFILE_ENABLED
+    /* When we are in the quick handler we don't have the per-directory
+     * configuration, so this check only takes the global setting of
+     * the EnableSendFile directive into account.
+     */
+    flags |= AP_SENDFILE_ENABLED(coreconf->enable_sendfile);
+#endif
+
     dobj->vary.file = header_file(r->pool, conf, dobj, key);
-    flags = APR_READ|APR_BINARY|APR_BUFFERED;
-    rc = apr_file_open(&dobj->vary.fd, dobj->vary.file, flags, 0, r->pool);
+    dobj->hdrs.file = dobj->vary.file;
+    rc = apr_file_open(&dobj->hdrs.fd, dobj->hdrs.file, flags, 0, r->pool);
     if (rc != APR_SUCCESS) {
         return DECLINED;
     }
 
     /* read the format from the cache file */
-    len = sizeof(format);
-    apr_file_read_full(dobj->vary.fd, &format, len, &len);
+    rc = read_head(dobj, r, &format);
+    if (rc != APR_SUCCESS) {
+        apr_file_close(dobj->hdrs.fd);
+        return DECLINED;
+    }
 
     if (format == VARY_FORMAT_VERSION) {
         apr_array_header_t* varray;
-        apr_time_t expire;
+        char *buf = dobj->head + sizeof(format) + sizeof(apr_time_t);
 
-        len = sizeof(expire);
-        apr_file_read_full(dobj->vary.fd, &expire, len, &len);
+        apr_file_close(dobj->hdrs.fd);
+        dobj->hdrs.fd = NULL;
 
         varray = apr_array_make(r->pool, 5, sizeof(char*));
-        rc = read_array(r, varray, dobj->vary.fd);
+        rc = APR_EOF;
+        if (buf <= dobj->head + dobj->head_len) {
+            rc = read_array(r, varray, &buf, dobj->head + dobj->head_len);
+        }
         if (rc != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(00704)
                     "Cannot parse vary header file: %s",
                     dobj->vary.file);
-            apr_file_close(dobj->vary.fd);
             return DECLINED;
         }
-        apr_file_close(dobj->vary.fd);
 
         nkey = regen_key(r->pool, r->headers_in, varray, key);
 
@@ -480,33 +974,28 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         dobj->prefix = dobj->vary.file;
         dobj->hdrs.file = header_file(r->pool, conf, dobj, nkey);
 
-        flags = APR_READ|APR_BINARY|APR_BUFFERED;
         rc = apr_file_open(&dobj->hdrs.fd, dobj->hdrs.file, flags, 0, r->pool);
         if (rc != APR_SUCCESS) {
             return DECLINED;
         }
+
+        rc = read_head(dobj, r, &format);
+        if (rc != APR_SUCCESS) {
+            apr_file_close(dobj->hdrs.fd);
+            return DECLINED;
+        }
     }
-    else if (format != DISK_FORMAT_VERSION) {
+    else {
+        nkey = key;
+    }
+
+    if (format != DISK_FORMAT_VERSION) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00705)
                 "File '%s' has a version mismatch. File had version: %d.",
-                dobj->vary.file, format);
-        apr_file_close(dobj->vary.fd);
+                dobj->hdrs.file, format);
+        apr_file_close(dobj->hdrs.fd);
         return DECLINED;
     }
-    else {
-        apr_off_t offset = 0;
-
-        /* oops, not vary as it turns out */
-        dobj->hdrs.fd = dobj->vary.fd;
-        dobj->vary.fd = NULL;
-        dobj->hdrs.file = dobj->vary.file;
-
-        /* This wasn't a Vary Format file, so we must seek to the
-         * start of the file again, so that later reads work.
-         */
-        apr_file_seek(dobj->hdrs.fd, APR_SET, &offset);
-        nkey = key;
-    }
 
     obj->key = nkey;
     dobj->key = nkey;
@@ -517,12 +1006,9 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
 
     file_cache_create(conf, &dobj->hdrs, pool);
     file_cache_create(conf, &dobj->vary, pool);
-    file_cache_create(conf, &dobj->data, pool);
-
-    dobj->data.file = data_file(r->pool, conf, dobj, nkey);
 
     /* Read the bytes to setup the cache_info fields */
-    rc = file_cache_recall_mydata(dobj->hdrs.fd, info, dobj, r);
+    rc = file_cache_recall_mydata(info, dobj, r);
     if (rc != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(00706)
                 "Cannot read header file %s", dobj->hdrs.file);
@@ -540,62 +1026,18 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         return DECLINED;
     }
 
-    /* Open the data file */
-    if (dobj->disk_info.has_body) {
-        flags = APR_READ | APR_BINARY;
-#ifdef APR_SENDFILE_ENABLED
-        /* When we are in the quick handler we don't have the per-directory
-         * configuration, so this check only takes the global setting of
-         * the EnableSendFile directive into account.
-         */
-        flags |= AP_SENDFILE_ENABLED(coreconf->enable_sendfile);
-#endif
-        rc = apr_file_open(&dobj->data.fd, dobj->data.file, flags, 0, r->pool);
-        if (rc != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(00708)
-                    "Cannot open data file %s", dobj->data.file);
-            apr_file_close(dobj->hdrs.fd);
-            return DECLINED;
-        }
-
-        rc = apr_file_info_get(&finfo, APR_FINFO_SIZE | APR_FINFO_IDENT,
-                dobj->data.fd);
-        if (rc == APR_SUCCESS) {
-            dobj->file_size = finfo.size;
-        }
-
-        /* Atomic check - does the body file belong to the header file? */
-        if (dobj->disk_info.inode == finfo.inode &&
-                dobj->disk_info.device == finfo.device) {
-
-            /* Initialize the cache_handle callback functions */
-            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00709)
-                    "Recalled cached URL info header %s", dobj->name);
-
-            /* make the configuration stick */
-            h->cache_obj = obj;
-            obj->vobj = dobj;
-
-            return OK;
-        }
-
-    }
-    else {
-
-        /* make the configuration stick */
-        h->cache_obj = obj;
-        obj->vobj = dobj;
+    /* Initialize the cache_handle callback functions */
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00709)
+            "Recalled cached URL info header %s", dobj->name);
 
-        return OK;
-    }
+    /* make the configuration stick */
+    h->cache_obj = obj;
+    obj->vobj = dobj;
 
-    /* Oh dear, no luck matching header to the body */
-    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00710)
-            "Cached URL info header '%s' didn't match body, ignoring this entry",
-            dobj->name);
+    journal_record(conf, r->server, CACHE_JOURNAL_ACCESS, dobj->hdrs.file,
+                   r->pool);
 
-    apr_file_close(dobj->hdrs.fd);
-    return DECLINED;
+    return OK;
 }
 
 static void close_disk_cache_fd(disk_cache_file_t *file)
@@ -616,7 +1058,6 @@ static int remove_entity(cache_handle_t *h)
 
     close_disk_cache_fd(&(dobj->hdrs));
     close_disk_cache_fd(&(dobj->vary));
-    close_disk_cache_fd(&(dobj->data));
 
     /* Null out the cache object pointer so next time we start from scratch  */
     h->cache_obj = NULL;
@@ -625,6 +1066,8 @@ static int remove_entity(cache_handle_t *h)
 
 static int remove_url(cache_handle_t *h, request_rec *r)
 {
+    disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                 &cache_disk_module);
     apr_status_t rc;
     disk_cache_object_t *dobj;
 
@@ -649,30 +1092,16 @@ static int remove_url(cache_handle_t *h, request_rec *r)
                     dobj->hdrs.file);
             return DECLINED;
         }
-    }
-
-    /* Delete data file */
-    if (dobj->data.file) {
-        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00713)
-                "Deleting %s from cache.", dobj->data.file);
 
-        rc = apr_file_remove(dobj->data.file, r->pool);
-        if ((rc != APR_SUCCESS) && !APR_STATUS_IS_ENOENT(rc)) {
-            /* Will only result in an output if httpd is started with -e debug.
-             * For reason see log_error_core for the case s == NULL.
-             */
-            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rc, r, APLOGNO(00714)
-                    "Failed to delete data file %s from cache.",
-                    dobj->data.file);
-            return DECLINED;
-        }
+        journal_record(conf, r->server, CACHE_JOURNAL_REMOVE,
+                       dobj->hdrs.file, r->pool);
     }
 
     /* now delete directories as far as possible up to our cache root */
     if (dobj->root) {
         const char *str_to_copy;
 
-        str_to_copy = dobj->hdrs.file ? dobj->hdrs.file : dobj->data.file;
+        str_to_copy = dobj->hdrs.file;
         if (str_to_copy) {
             char *dir, *slash, *q;
 
@@ -687,7 +1116,7 @@ static int remove_url(cache_handle_t *h, request_rec *r)
              * in the way as far as possible
              *
              * Note: due to the way we constructed the file names in
-             * header_file and data_file, we are guaranteed that the
+             * header_file, we are guaranteed that the
              * cache_root is suffixed by at least one '/' which will be
              * turned into a terminating null by this loop.  Therefore,
              * we won't either delete or go above our cache root.
@@ -706,32 +1135,39 @@ static int remove_url(cache_handle_t *h, request_rec *r)
         }
     }
 
-    return OK;
+    return OK;
+}
+
+/* Cut the next (CR)LF terminated line out of a header block. */
+static char *read_line(char **buf, char *end)
+{
+    char *w = *buf, *eol;
+
+    eol = memchr(w, '\n', end - w);
+    if (!eol) {
+        return NULL;
+    }
+    *buf = eol + 1;
+
+    if (eol > w && eol[-1] == CR) {
+        --eol;
+    }
+    *eol = '\0';
+
+    return w;
 }
 
 static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
-                               apr_file_t *file)
+                               char **buf, char *end)
 {
-    char w[MAX_STRING_LEN];
-    apr_size_t p;
-    apr_status_t rv;
+    char *w;
 
     while (1) {
-        rv = apr_file_gets(w, MAX_STRING_LEN - 1, file);
-        if (rv != APR_SUCCESS) {
+        w = read_line(buf, end);
+        if (!w) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00716)
                           "Premature end of vary array.");
-            return rv;
-        }
-
-        p = strlen(w);
-        if (p > 0 && w[p - 1] == '\n') {
-            if (p > 1 && w[p - 2] == CR) {
-                w[p - 2] = '\0';
-            }
-            else {
-                w[p - 1] = '\0';
-            }
+            return APR_EOF;
         }
 
         /* If we've finished reading the array, break out of the loop. */
@@ -739,7 +1175,7 @@ static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
             break;
         }
 
-        *((const char **) apr_array_push(arr)) = apr_pstrdup(r->pool, w);
+        *((const char **) apr_array_push(arr)) = w;
     }
 
     return APR_SUCCESS;
@@ -773,38 +1209,19 @@ static apr_status_t store_array(apr_file_t *fd, apr_array_header_t* arr)
     return apr_file_writev_full(fd, (const struct iovec *) &iov, 1, &amt);
 }
 
-static apr_status_t read_table(cache_handle_t *handle, request_rec *r,
-                               apr_table_t *table, apr_file_t *file)
+static apr_status_t read_table(request_rec *r, apr_table_t *table,
+                               char **buf, char *end)
 {
-    char w[MAX_STRING_LEN];
+    char *w;
     char *l;
-    apr_size_t p;
-    apr_status_t rv;
 
     while (1) {
 
-        /* ### What about APR_EOF? */
-        rv = apr_file_gets(w, MAX_STRING_LEN - 1, file);
-        if (rv != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(00717)
+        w = read_line(buf, end);
+        if (!w) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00717)
                           "Premature end of cache headers.");
-            return rv;
-        }
-
-        /* Delete terminal (CR?)LF */
-
-        p = strlen(w);
-        /* Indeed, the host's '\n':
-           '\012' for UNIX; '\015' for MacOS; '\025' for OS/390
-           -- whatever the script generates.
-        */
-        if (p > 0 && w[p - 1] == '\n') {
-            if (p > 1 && w[p - 2] == CR) {
-                w[p - 2] = '\0';
-            }
-            else {
-                w[p - 1] = '\0';
-            }
+            return APR_EOF;
         }
 
         /* If we've finished reading the headers, break out of the loop. */
@@ -812,33 +1229,6 @@ static apr_status_t read_table(cache_handle_t *handle, request_rec *r,
             break;
         }
 
-#if APR_CHARSET_EBCDIC
-        /* Chances are that we received an ASCII header text instead of
-         * the expected EBCDIC header lines. Try to auto-detect:
-         */
-        if (!(l = strchr(w, ':'))) {
-            int maybeASCII = 0, maybeEBCDIC = 0;
-            unsigned char *cp, native;
-            apr_size_t inbytes_left, outbytes_left;
-
-            for (cp = w; *cp != '\0'; ++cp) {
-                native = apr_xlate_conv_byte(ap_hdrs_from_ascii, *cp);
-                if (apr_isprint(*cp) && !apr_isprint(native))
-                    ++maybeEBCDIC;
-                if (!apr_isprint(*cp) && apr_isprint(native))
-                    ++maybeASCII;
-            }
-            if (maybeASCII > maybeEBCDIC) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00718)
-                        "CGI Interface Error: Script headers apparently ASCII: (CGI = %s)",
-                        r->filename);
-                inbytes_left = outbytes_left = cp - w;
-                apr_xlate_conv_buffer(ap_hdrs_from_ascii,
-                                      w, &inbytes_left, w, &outbytes_left);
-            }
-        }
-#endif /*APR_CHARSET_EBCDIC*/
-
         /* if we see a bogus header don't ignore it. Shout and scream */
         if (!(l = strchr(w, ':'))) {
             return APR_EGENERAL;
@@ -849,7 +1239,8 @@ static apr_status_t read_table(cache_handle_t *handle, request_rec *r,
             ++l;
         }
 
-        apr_table_add(table, w, l);
+        /* The header block lives in the request pool, no need to copy */
+        apr_table_addn(table, w, l);
     }
 
     return APR_SUCCESS;
@@ -866,33 +1257,36 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
 {
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
     apr_status_t rv;
+    char *buf, *end;
 
     /* This case should not happen... */
-    if (!dobj->hdrs.fd) {
+    if (!dobj->head) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00719)
-                "recalling headers; but no header fd for %s", dobj->name);
+                "recalling headers; but no header block for %s", dobj->name);
         return APR_NOTFOUND;
     }
 
     h->req_hdrs = apr_table_make(r->pool, 20);
     h->resp_hdrs = apr_table_make(r->pool, 20);
 
+    /* open_entity already read the header block, skip past the name */
+    buf = dobj->head + sizeof(disk_cache_info_t) + dobj->disk_info.name_len;
+    end = dobj->head + dobj->head_len;
+
     /* Call routine to read the header lines/status line */
-    rv = read_table(h, r, h->resp_hdrs, dobj->hdrs.fd);
+    rv = read_table(r, h->resp_hdrs, &buf, end);
     if (rv != APR_SUCCESS) { 
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02987) 
                       "Error reading response headers from %s for %s",
                       dobj->hdrs.file, dobj->name);
     }
-    rv = read_table(h, r, h->req_hdrs, dobj->hdrs.fd);
+    rv = read_table(r, h->req_hdrs, &buf, end);
     if (rv != APR_SUCCESS) { 
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02988) 
                       "Error reading request headers from %s for %s",
                       dobj->hdrs.file, dobj->name);
     }
 
-    apr_file_close(dobj->hdrs.fd);
-
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00720)
             "Recalled headers for URL %s", dobj->name);
     return APR_SUCCESS;
@@ -902,44 +1296,139 @@ static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_bri
 {
     disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
 
-    if (dobj->data.fd) {
-        apr_brigade_insert_file(bb, dobj->data.fd, 0, dobj->file_size, p);
+    if (dobj->hdrs.fd && dobj->file_size) {
+        apr_brigade_insert_file(bb, dobj->hdrs.fd, dobj->body_offset,
+                                dobj->file_size, p);
     }
 
     return APR_SUCCESS;
 }
 
-static apr_status_t store_table(apr_file_t *fd, apr_table_t *table)
+static void push_iov(apr_array_header_t *iovs, const void *base,
+                     apr_size_t len)
+{
+    struct iovec *iov = apr_array_push(iovs);
+
+    iov->iov_base = (void *)base;
+    iov->iov_len = len;
+}
+
+static void store_table(apr_array_header_t *iovs, apr_table_t *table)
 {
     int i;
-    apr_status_t rv;
-    struct iovec iov[4];
-    apr_size_t amt;
     apr_table_entry_t *elts;
 
-    elts = (apr_table_entry_t *) apr_table_elts(table)->elts;
-    for (i = 0; i < apr_table_elts(table)->nelts; ++i) {
-        if (elts[i].key != NULL) {
-            iov[0].iov_base = elts[i].key;
-            iov[0].iov_len = strlen(elts[i].key);
-            iov[1].iov_base = ": ";
-            iov[1].iov_len = sizeof(": ") - 1;
-            iov[2].iov_base = elts[i].val;
-            iov[2].iov_len = strlen(elts[i].val);
-            iov[3].iov_base = CRLF;
-            iov[3].iov_len = sizeof(CRLF) - 1;
-
-            rv = apr_file_writev_full(fd, (const struct iovec *) &iov, 4, &amt);
-            if (rv != APR_SUCCESS) {
-                return rv;
+    if (table) {
+        elts = (apr_table_entry_t *) apr_table_elts(table)->elts;
+        for (i = 0; i < apr_table_elts(table)->nelts; ++i) {
+            if (elts[i].key != NULL) {
+                push_iov(iovs, elts[i].key, strlen(elts[i].key));
+                push_iov(iovs, ": ", sizeof(": ") - 1);
+                push_iov(iovs, elts[i].val, strlen(elts[i].val));
+                push_iov(iovs, CRLF, sizeof(CRLF) - 1);
             }
         }
     }
-    iov[0].iov_base = CRLF;
-    iov[0].iov_len = sizeof(CRLF) - 1;
-    rv = apr_file_writev_full(fd, (const struct iovec *) &iov, 1, &amt);
-    return rv;
+    push_iov(iovs, CRLF, sizeof(CRLF) - 1);
+}
+
+/* Lay out the header block up front, so that store_body knows where the
+ * body goes before the info struct gets written in front of it.
+ */
+static void build_block(disk_cache_object_t *dobj, apr_pool_t *p)
+{
+    apr_array_header_t *iovs = apr_array_make(p, 64, sizeof(struct iovec));
+
+    push_iov(iovs, dobj->name, strlen(dobj->name));
+
+    store_table(iovs, dobj->headers_out);
+
+    /* Parse the vary header and dump those fields from the headers_in. */
+    /* FIXME: Make call to the same thing cache_select calls to crack Vary. */
+    store_table(iovs, dobj->headers_in);
+
+    dobj->block = apr_pstrcatv(p, (const struct iovec *) iovs->elts,
+                               iovs->nelts, &dobj->block_len);
+
+    dobj->disk_info.hdrs_len = dobj->block_len;
+    dobj->disk_info.body_offset = APR_ALIGN(sizeof(disk_cache_info_t)
+                                            + dobj->block_len,
+                                            CACHE_DISK_BODY_ALIGN);
+}
+
+#if APR_HAS_THREADS
+/* The vary file as write_vary() would have written it */
+static char *build_vary(apr_pool_t *p, apr_time_t expire,
+                        apr_array_header_t *varray, apr_size_t *len)
+{
+    apr_array_header_t *iovs;
+    apr_uint32_t format = VARY_FORMAT_VERSION;
+    const char **elts = (const char **) varray->elts;
+    int i;
+
+    iovs = apr_array_make(p, varray->nelts * 2 + 3, sizeof(struct iovec));
+
+    push_iov(iovs, &format, sizeof(format));
+    push_iov(iovs, &expire, sizeof(expire));
+    for (i = 0; i < varray->nelts; i++) {
+        push_iov(iovs, elts[i], strlen(elts[i]));
+        push_iov(iovs, CRLF, sizeof(CRLF) - 1);
+    }
+    push_iov(iovs, CRLF, sizeof(CRLF) - 1);
+
+    return apr_pstrcatv(p, (const struct iovec *) iovs->elts, iovs->nelts,
+                        len);
+}
+
+/* Pack up what the writer needs to finish the entity in a single
+ * allocation, which the writer frees when done.
+ */
+static apr_status_t writer_commit(disk_cache_object_t *dobj,
+                                  disk_cache_info_t *disk_info,
+                                  const char *vary, apr_size_t vary_len)
+{
+    disk_cache_writer_t *w = dobj->writer;
+    disk_cache_commit_t *commit;
+    apr_size_t file_len = strlen(dobj->hdrs.file) + 1;
+    apr_size_t vary_file_len = vary ? strlen(dobj->vary.file) + 1 : 0;
+    char *buf;
+
+    commit = ap_malloc(sizeof(disk_cache_commit_t) + sizeof(disk_cache_info_t)
+                       + dobj->block_len + file_len + vary_len
+                       + vary_file_len);
+    buf = (char *)(commit + 1);
+
+    commit->head = buf;
+    commit->head_len = sizeof(disk_cache_info_t) + dobj->block_len;
+    memcpy(buf, disk_info, sizeof(disk_cache_info_t));
+    memcpy(buf + sizeof(disk_cache_info_t), dobj->block, dobj->block_len);
+    buf += commit->head_len;
+
+    commit->file = buf;
+    memcpy(buf, dobj->hdrs.file, file_len);
+    buf += file_len;
+
+    if (vary) {
+        commit->vary = buf;
+        commit->vary_len = vary_len;
+        memcpy(buf, vary, vary_len);
+        buf += vary_len;
+        commit->vary_file = buf;
+        memcpy(buf, dobj->vary.file, vary_file_len);
+    }
+    else {
+        commit->vary = NULL;
+        commit->vary_len = 0;
+        commit->vary_file = NULL;
+    }
+
+    /* from here on the writer is on its own */
+    dobj->writer = NULL;
+    writer_finish(w, commit);
+
+    return APR_SUCCESS;
 }
+#endif
 
 static apr_status_t store_headers(cache_handle_t *h, request_rec *r, cache_info *info)
 {
@@ -959,6 +1448,116 @@ static apr_status_t store_headers(cache_handle_t *h, request_rec *r, cache_info
         dobj->disk_info.header_only = 1;
     }
 
+    build_block(dobj, r->pool);
+
+    return APR_SUCCESS;
+}
+
+/* Copy the body of the entity we opened over to the new entity file,
+ * for when only the headers have changed.
+ */
+static apr_status_t copy_body(disk_cache_object_t *dobj, request_rec *r)
+{
+    apr_bucket_brigade *bb;
+    apr_bucket *e;
+    apr_off_t offset = dobj->disk_info.body_offset;
+    apr_status_t rv;
+
+    if (!dobj->hdrs.fd) {
+        return APR_EGENERAL;
+    }
+
+    rv = apr_file_seek(dobj->hdrs.tempfd, APR_SET, &offset);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    apr_brigade_insert_file(bb, dobj->hdrs.fd, dobj->body_offset,
+                            dobj->file_size, r->pool);
+
+    for (e = APR_BRIGADE_FIRST(bb);
+         rv == APR_SUCCESS && e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e)) {
+        const char *str;
+        apr_size_t length;
+
+        rv = apr_bucket_read(e, &str, &length, APR_BLOCK_READ);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_write_full(dobj->hdrs.tempfd, str, length, NULL);
+        }
+    }
+
+    apr_brigade_destroy(bb);
+
+    return rv;
+}
+
+static apr_status_t write_vary(cache_handle_t *h, request_rec *r,
+                               apr_array_header_t *varray)
+{
+    disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                 &cache_disk_module);
+    disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
+    apr_uint32_t format = VARY_FORMAT_VERSION;
+    apr_size_t amt;
+    apr_status_t rv;
+
+    rv = mkdir_structure(conf, dobj->hdrs.file, r->pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_mktemp(&dobj->vary.tempfd, dobj->vary.tempfile,
+                             APR_CREATE | APR_WRITE | APR_BINARY | APR_EXCL,
+                             dobj->vary.pool);
+    }
+
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00721)
+                "could not create vary file %s",
+                dobj->vary.tempfile);
+        return rv;
+    }
+
+    amt = sizeof(format);
+    rv = apr_file_write_full(dobj->vary.tempfd, &format, amt, NULL);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00722)
+                "could not write to vary file %s",
+                dobj->vary.tempfile);
+        apr_file_close(dobj->vary.tempfd);
+        apr_pool_destroy(dobj->vary.pool);
+        return rv;
+    }
+
+    amt = sizeof(h->cache_obj->info.expire);
+    rv = apr_file_write_full(dobj->vary.tempfd,
+                             &h->cache_obj->info.expire, amt, NULL);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00723)
+                "could not write to vary file %s",
+                dobj->vary.tempfile);
+        apr_file_close(dobj->vary.tempfd);
+        apr_pool_destroy(dobj->vary.pool);
+        return rv;
+    }
+
+    rv = store_array(dobj->vary.tempfd, varray);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(10413)
+                "could not write to vary file %s",
+                dobj->vary.tempfile);
+        apr_pool_destroy(dobj->vary.pool);
+        return rv;
+    }
+
+    rv = apr_file_close(dobj->vary.tempfd);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00724)
+                "could not close vary file %s",
+                dobj->vary.tempfile);
+        apr_pool_destroy(dobj->vary.pool);
+        return rv;
+    }
+
     return APR_SUCCESS;
 }
 
@@ -968,10 +1567,15 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
                                                  &cache_disk_module);
     apr_status_t rv;
     apr_size_t amt;
+    apr_off_t offset;
     disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
 
     disk_cache_info_t disk_info;
     struct iovec iov[2];
+#if APR_HAS_THREADS
+    char *vary = NULL;
+    apr_size_t vary_len = 0;
+#endif
 
     memset(&disk_info, 0, sizeof(disk_cache_info_t));
 
@@ -982,7 +1586,6 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
 
         if (tmp) {
             apr_array_header_t* varray;
-            apr_uint32_t format = VARY_FORMAT_VERSION;
 
             /* If we were initially opened as a vary format, rollback
              * that internal state for the moment so we can recreate the
@@ -993,82 +1596,34 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
                 dobj->prefix = NULL;
             }
 
-            rv = mkdir_structure(conf, dobj->hdrs.file, r->pool);
-            if (rv == APR_SUCCESS) {
-                rv = apr_file_mktemp(&dobj->vary.tempfd, dobj->vary.tempfile,
-                                     APR_CREATE | APR_WRITE | APR_BINARY | APR_EXCL,
-                                     dobj->vary.pool);
-            }
-
-            if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00721)
-                        "could not create vary file %s",
-                        dobj->vary.tempfile);
-                return rv;
-            }
-
-            amt = sizeof(format);
-            rv = apr_file_write_full(dobj->vary.tempfd, &format, amt, NULL);
-            if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00722)
-                        "could not write to vary file %s",
-                        dobj->vary.tempfile);
-                apr_file_close(dobj->vary.tempfd);
-                apr_pool_destroy(dobj->vary.pool);
-                return rv;
-            }
-
-            amt = sizeof(h->cache_obj->info.expire);
-            rv = apr_file_write_full(dobj->vary.tempfd,
-                                     &h->cache_obj->info.expire, amt, NULL);
-            if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00723)
-                        "could not write to vary file %s",
-                        dobj->vary.tempfile);
-                apr_file_close(dobj->vary.tempfd);
-                apr_pool_destroy(dobj->vary.pool);
-                return rv;
-            }
-
             varray = apr_array_make(r->pool, 6, sizeof(char*));
             tokens_to_array(r->pool, tmp, varray);
 
-            rv = store_array(dobj->vary.tempfd, varray);
-            if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(10413)
-                        "could not write to vary file %s",
-                        dobj->vary.tempfile);
-                apr_pool_destroy(dobj->vary.pool);
-                return rv;
+#if APR_HAS_THREADS
+            if (dobj->writer) {
+                vary = build_vary(r->pool, h->cache_obj->info.expire, varray,
+                                  &vary_len);
             }
-
-            rv = apr_file_close(dobj->vary.tempfd);
-            if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00724)
-                        "could not close vary file %s",
-                        dobj->vary.tempfile);
-                apr_pool_destroy(dobj->vary.pool);
-                return rv;
+            else
+#endif
+            {
+                rv = write_vary(h, r, varray);
+                if (rv != APR_SUCCESS) {
+                    return rv;
+                }
             }
 
             tmp = regen_key(r->pool, dobj->headers_in, varray, dobj->name);
             dobj->prefix = dobj->hdrs.file;
             dobj->hashfile = NULL;
-            dobj->data.file = data_file(r->pool, conf, dobj, tmp);
             dobj->hdrs.file = header_file(r->pool, conf, dobj, tmp);
         }
     }
 
 
-    rv = apr_file_mktemp(&dobj->hdrs.tempfd, dobj->hdrs.tempfile,
-                         APR_CREATE | APR_WRITE | APR_BINARY |
-                         APR_BUFFERED | APR_EXCL, dobj->hdrs.pool);
-
-    if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00725)
-                "could not create header file %s",
-                dobj->hdrs.tempfile);
-        return rv;
+    if (!dobj->block) {
+        /* invalidate_entity() gets here without store_headers() */
+        build_block(dobj, r->pool);
     }
 
     disk_info.format = DISK_FORMAT_VERSION;
@@ -1078,57 +1633,75 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
     disk_info.request_time = h->cache_obj->info.request_time;
     disk_info.response_time = h->cache_obj->info.response_time;
     disk_info.status = h->cache_obj->info.status;
-    disk_info.inode = dobj->disk_info.inode;
-    disk_info.device = dobj->disk_info.device;
     disk_info.has_body = dobj->disk_info.has_body;
     disk_info.header_only = dobj->disk_info.header_only;
 
     disk_info.name_len = strlen(dobj->name);
+    disk_info.hdrs_len = dobj->block_len;
+    disk_info.body_offset = dobj->disk_info.body_offset;
+    disk_info.body_len = dobj->disk_info.has_body ? dobj->disk_info.body_len : 0;
 
     memcpy(&disk_info.control, &h->cache_obj->info.control, sizeof(cache_control_t));
 
-    iov[0].iov_base = (void*)&disk_info;
-    iov[0].iov_len = sizeof(disk_cache_info_t);
-    iov[1].iov_base = (void*)dobj->name;
-    iov[1].iov_len = disk_info.name_len;
-
-    rv = apr_file_writev_full(dobj->hdrs.tempfd, (const struct iovec *) &iov,
-                              2, &amt);
-    if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00726)
-                "could not write info to header file %s",
-                dobj->hdrs.tempfile);
-        apr_file_close(dobj->hdrs.tempfd);
-        apr_pool_destroy(dobj->hdrs.pool);
-        return rv;
+#if APR_HAS_THREADS
+    /* The writer has the body, let it finish the job */
+    if (dobj->writer) {
+        return writer_commit(dobj, &disk_info, vary, vary_len);
     }
+#endif
+
+    /* Unless store_body() already started the file, we're either caching
+     * a response without a body, or updating the headers of the entity we
+     * opened. The entity is written anew along with its body then, and
+     * renamed over the old one on commit: readers in other children must
+     * never see a partly written head.
+     */
+    if (!dobj->hdrs.tempfd) {
+        rv = apr_file_mktemp(&dobj->hdrs.tempfd, dobj->hdrs.tempfile,
+                             APR_CREATE | APR_WRITE | APR_BINARY |
+                             APR_BUFFERED | APR_EXCL, dobj->hdrs.pool);
 
-    if (dobj->headers_out) {
-        rv = store_table(dobj->hdrs.tempfd, dobj->headers_out);
         if (rv != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00727)
-                    "could not write out-headers to header file %s",
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00725)
+                    "could not create header file %s",
                     dobj->hdrs.tempfile);
-            apr_file_close(dobj->hdrs.tempfd);
-            apr_pool_destroy(dobj->hdrs.pool);
             return rv;
         }
-    }
 
-    /* Parse the vary header and dump those fields from the headers_in. */
-    /* FIXME: Make call to the same thing cache_select calls to crack Vary. */
-    if (dobj->headers_in) {
-        rv = store_table(dobj->hdrs.tempfd, dobj->headers_in);
-        if (rv != APR_SUCCESS) {
-            ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00728)
-                    "could not write in-headers to header file %s",
-                    dobj->hdrs.tempfile);
-            apr_file_close(dobj->hdrs.tempfd);
-            apr_pool_destroy(dobj->hdrs.pool);
-            return rv;
+        if (dobj->disk_info.has_body) {
+            rv = copy_body(dobj, r);
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(10456)
+                        "could not copy body to header file %s",
+                        dobj->hdrs.tempfile);
+                apr_file_close(dobj->hdrs.tempfd);
+                apr_pool_destroy(dobj->hdrs.pool);
+                return rv;
+            }
         }
     }
 
+    /* The info struct and the header block go in front of the body */
+    offset = 0;
+    rv = apr_file_seek(dobj->hdrs.tempfd, APR_SET, &offset);
+    if (rv == APR_SUCCESS) {
+        iov[0].iov_base = (void*)&disk_info;
+        iov[0].iov_len = sizeof(disk_cache_info_t);
+        iov[1].iov_base = (void*)dobj->block;
+        iov[1].iov_len = dobj->block_len;
+
+        rv = apr_file_writev_full(dobj->hdrs.tempfd,
+                                  (const struct iovec *) &iov, 2, &amt);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00726)
+                "could not write info to header file %s",
+                dobj->hdrs.tempfile);
+        apr_file_close(dobj->hdrs.tempfd);
+        apr_pool_destroy(dobj->hdrs.pool);
+        return rv;
+    }
+
     rv = apr_file_close(dobj->hdrs.tempfd); /* flush and close */
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00729)
@@ -1168,7 +1741,7 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
         e = APR_BRIGADE_FIRST(in);
 
         /* are we done completely? if so, pass any trailing buckets right through */
-        if (dobj->done || !dobj->data.pool) {
+        if (dobj->done || !dobj->hdrs.pool) {
             APR_BUCKET_REMOVE(e);
             APR_BRIGADE_INSERT_TAIL(out, e);
             continue;
@@ -1206,7 +1779,7 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
                     "Error when reading bucket for URL %s",
                     h->cache_obj->key);
             /* Remove the intermediate cache file and return non-APR_SUCCESS */
-            apr_pool_destroy(dobj->data.pool);
+            apr_pool_destroy(dobj->hdrs.pool);
             return rv;
         }
 
@@ -1217,51 +1790,71 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
 
         if (!dobj->disk_info.header_only) {
 
-            /* Attempt to create the data file at the last possible moment, if
-             * the body is empty, we don't write a file at all, and save an inode.
+#if APR_HAS_THREADS
+            /* Leave the entity file to a background writer if so configured,
+             * falling back to writing it ourselves.
+             */
+            if (!dobj->disk_info.has_body && dconf->write_behind && writer_tp
+                    && writer_create(dobj, r) == APR_SUCCESS) {
+                dobj->disk_info.body_len = 0;
+                dobj->disk_info.has_body = 1;
+            }
+#endif
+
+            /* Attempt to create the entity file at the last possible moment,
+             * if the body is empty, commit_entity() writes the headers alone.
              */
-            if (!dobj->data.tempfd) {
-                apr_finfo_t finfo;
-                rv = apr_file_mktemp(&dobj->data.tempfd, dobj->data.tempfile,
+            if (!dobj->hdrs.tempfd && !dobj->writer) {
+                apr_off_t offset = dobj->disk_info.body_offset;
+
+                rv = apr_file_mktemp(&dobj->hdrs.tempfd, dobj->hdrs.tempfile,
                         APR_CREATE | APR_WRITE | APR_BINARY | APR_BUFFERED
-                                | APR_EXCL, dobj->data.pool);
-                if (rv != APR_SUCCESS) {
-                    apr_pool_destroy(dobj->data.pool);
-                    return rv;
+                                | APR_EXCL, dobj->hdrs.pool);
+                if (rv == APR_SUCCESS) {
+                    /* leave room for the info struct and the header block */
+                    rv = apr_file_seek(dobj->hdrs.tempfd, APR_SET, &offset);
                 }
-                dobj->file_size = 0;
-                rv = apr_file_info_get(&finfo, APR_FINFO_IDENT,
-                        dobj->data.tempfd);
                 if (rv != APR_SUCCESS) {
-                    apr_pool_destroy(dobj->data.pool);
+                    apr_pool_destroy(dobj->hdrs.pool);
                     return rv;
                 }
-                dobj->disk_info.device = finfo.device;
-                dobj->disk_info.inode = finfo.inode;
+                dobj->disk_info.body_len = 0;
                 dobj->disk_info.has_body = 1;
             }
 
             /* write to the cache, leave if we fail */
-            rv = apr_file_write_full(dobj->data.tempfd, str, length, &written);
+#if APR_HAS_THREADS
+            if (dobj->writer) {
+                rv = writer_queue(dobj->writer, str, length);
+                written = length;
+            }
+            else
+#endif
+            rv = apr_file_write_full(dobj->hdrs.tempfd, str, length, &written);
             if (rv != APR_SUCCESS) {
                 ap_log_rerror(
                         APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00731) "Error when writing cache file for URL %s", h->cache_obj->key);
                 /* Remove the intermediate cache file and return non-APR_SUCCESS */
-                apr_pool_destroy(dobj->data.pool);
+                apr_pool_destroy(dobj->hdrs.pool);
                 return rv;
             }
-            dobj->file_size += written;
-            if (dobj->file_size > dconf->maxfs) {
+            dobj->disk_info.body_len += written;
+            if (dobj->disk_info.body_len > dconf->maxfs) {
                 ap_log_rerror(
                         APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00732) "URL %s failed the size check "
-                        "(%" APR_OFF_T_FMT ">%" APR_OFF_T_FMT ")", h->cache_obj->key, dobj->file_size, dconf->maxfs);
+                        "(%" APR_OFF_T_FMT ">%" APR_OFF_T_FMT ")", h->cache_obj->key, dobj->disk_info.body_len, dconf->maxfs);
                 /* Remove the intermediate cache file and return non-APR_SUCCESS */
-                apr_pool_destroy(dobj->data.pool);
+                apr_pool_destroy(dobj->hdrs.pool);
                 return APR_EGENERAL;
             }
 
         }
 
+        /* the writer does the waiting, nothing holds the client up */
+        if (dobj->writer) {
+            continue;
+        }
+
         /* have we reached the limit of how much we're prepared to write in one
          * go? If so, leave, we'll get called again. This prevents us from trying
          * to swallow too much data at once, or taking so long to write the data
@@ -1287,11 +1880,11 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
             const char *cl_header;
             apr_off_t cl;
 
-            if (dobj->data.tempfd) {
-                rv = apr_file_close(dobj->data.tempfd);
+            if (dobj->hdrs.tempfd) {
+                rv = apr_file_flush(dobj->hdrs.tempfd);
                 if (rv != APR_SUCCESS) {
                     /* Buffered write failed, abandon attempt to write */
-                    apr_pool_destroy(dobj->data.pool);
+                    apr_pool_destroy(dobj->hdrs.pool);
                     return rv;
                 }
             }
@@ -1301,26 +1894,26 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
                         APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(00733) "Discarding body for URL %s "
                         "because connection has been aborted.", h->cache_obj->key);
                 /* Remove the intermediate cache file and return non-APR_SUCCESS */
-                apr_pool_destroy(dobj->data.pool);
+                apr_pool_destroy(dobj->hdrs.pool);
                 return APR_EGENERAL;
             }
 
-            if (dobj->file_size < dconf->minfs) {
+            if (dobj->disk_info.body_len < dconf->minfs) {
                 ap_log_rerror(
                         APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00734) "URL %s failed the size check "
-                        "(%" APR_OFF_T_FMT "<%" APR_OFF_T_FMT ")", h->cache_obj->key, dobj->file_size, dconf->minfs);
+                        "(%" APR_OFF_T_FMT "<%" APR_OFF_T_FMT ")", h->cache_obj->key, dobj->disk_info.body_len, dconf->minfs);
                 /* Remove the intermediate cache file and return non-APR_SUCCESS */
-                apr_pool_destroy(dobj->data.pool);
+                apr_pool_destroy(dobj->hdrs.pool);
                 return APR_EGENERAL;
             }
 
             cl_header = apr_table_get(r->headers_out, "Content-Length");
             if (cl_header && (!ap_parse_strict_length(&cl, cl_header)
-                              || cl != dobj->file_size)) {
+                              || cl != dobj->disk_info.body_len)) {
                 ap_log_rerror(
                         APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00735) "URL %s didn't receive complete response, not caching", h->cache_obj->key);
                 /* Remove the intermediate cache file and return non-APR_SUCCESS */
-                apr_pool_destroy(dobj->data.pool);
+                apr_pool_destroy(dobj->hdrs.pool);
                 return APR_EGENERAL;
             }
         }
@@ -1341,21 +1934,19 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
     /* write the headers to disk at the last possible moment */
     rv = write_headers(h, r);
 
-    /* move header and data tempfiles to the final destination */
-    if (APR_SUCCESS == rv) {
+    /* move entity and vary tempfiles to the final destination, unless
+     * the writer in the background got the entity
+     */
+    if (APR_SUCCESS == rv && dobj->hdrs.tempfd) {
         rv = file_cache_el_final(conf, &dobj->hdrs, r);
+        if (APR_SUCCESS == rv) {
+            journal_record(conf, r->server, CACHE_JOURNAL_STORE,
+                           dobj->hdrs.file, r->pool);
+        }
     }
     if (APR_SUCCESS == rv) {
         rv = file_cache_el_final(conf, &dobj->vary, r);
     }
-    if (APR_SUCCESS == rv) {
-        if (!dobj->disk_info.header_only) {
-            rv = file_cache_el_final(conf, &dobj->data, r);
-        }
-        else if (dobj->data.file) {
-            rv = apr_file_remove(dobj->data.file, dobj->data.pool);
-        }
-    }
 
     /* remove the cached items completely on any failure */
     if (APR_SUCCESS != rv) {
@@ -1370,7 +1961,9 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
                 dobj->name);
     }
 
-    apr_pool_destroy(dobj->data.pool);
+    if (dobj->hdrs.pool) {
+        apr_pool_destroy(dobj->hdrs.pool);
+    }
 
     return APR_SUCCESS;
 }
@@ -1416,6 +2009,8 @@ static void *merge_dir_config(apr_pool_t *p, void *basev, void *addv)
     new->readsize_set = add->readsize_set || base->readsize_set;
     new->readtime = (add->readtime_set == 0) ? base->readtime : add->readtime;
     new->readtime_set = add->readtime_set || base->readtime_set;
+    new->write_behind = (add->write_behind_set == 0) ? base->write_behind : add->write_behind;
+    new->write_behind_set = add->write_behind_set || base->write_behind_set;
 
     return new;
 }
@@ -1427,6 +2022,7 @@ static void *create_config(apr_pool_t *p, server_rec *s)
     /* XXX: Set default values */
     conf->dirlevels = DEFAULT_DIRLEVELS;
     conf->dirlength = DEFAULT_DIRLENGTH;
+    conf->write_behind_threads = DEFAULT_WRITE_BEHIND_THREADS;
 
     conf->cache_root = NULL;
     conf->cache_root_len = 0;
@@ -1541,6 +2137,46 @@ static const char
     return NULL;
 }
 
+static const char
+*set_cache_write_behind(cmd_parms *parms, void *in_struct_ptr, int flag)
+{
+    disk_cache_dir_conf *dconf = (disk_cache_dir_conf *)in_struct_ptr;
+
+    dconf->write_behind = flag;
+    dconf->write_behind_set = 1;
+    return NULL;
+}
+
+static const char
+*set_cache_write_behind_threads(cmd_parms *parms, void *in_struct_ptr,
+                                const char *arg)
+{
+    disk_cache_conf *conf = ap_get_module_config(parms->server->module_config,
+                                                 &cache_disk_module);
+    const char *err;
+    int val;
+
+    if ((err = ap_check_cmd_context(parms, GLOBAL_ONLY)) != NULL) {
+        return err;
+    }
+
+    val = atoi(arg);
+    if (val < 0)
+        return "CacheWriteBehindThreads value must be a positive integer or zero";
+    conf->write_behind_threads = val;
+    return NULL;
+}
+
+static const char
+*set_cache_journal(cmd_parms *parms, void *in_struct_ptr, int flag)
+{
+    disk_cache_conf *conf = ap_get_module_config(parms->server->module_config,
+                                                 &cache_disk_module);
+
+    conf->journal = flag;
+    return NULL;
+}
+
 static const command_rec disk_cache_cmds[] =
 {
     AP_INIT_TAKE1("CacheRoot", set_cache_root, NULL, RSRC_CONF,
@@ -1557,6 +2193,12 @@ static const command_rec disk_cache_cmds[] =
                   "The maximum quantity of data to attempt to read and cache in one go"),
     AP_INIT_TAKE1("CacheReadTime", set_cache_readtime, NULL, RSRC_CONF | ACCESS_CONF,
                   "The maximum time taken to attempt to read and cache in go"),
+    AP_INIT_FLAG("CacheWriteBehind", set_cache_write_behind, NULL, RSRC_CONF | ACCESS_CONF,
+                 "Write cached bodies to disk in the background, while they go to the client"),
+    AP_INIT_TAKE1("CacheWriteBehindThreads", set_cache_write_behind_threads, NULL, RSRC_CONF,
+                  "The maximum number of background cache writers per child process"),
+    AP_INIT_FLAG("CacheJournal", set_cache_journal, NULL, RSRC_CONF,
+                 "Record stored, served and removed entities for htcacheclean"),
     {NULL}
 };
 
@@ -1574,11 +2216,57 @@ static const cache_provider cache_disk_provider =
     &invalidate_entity
 };
 
+static void disk_cache_child_init(apr_pool_t *p, server_rec *s)
+{
+    server_rec *sv;
+#if APR_HAS_THREADS
+    disk_cache_conf *conf = ap_get_module_config(s->module_config,
+                                                 &cache_disk_module);
+    apr_status_t rv;
+#endif
+
+    for (sv = s; sv; sv = sv->next) {
+        disk_cache_conf *c = ap_get_module_config(sv->module_config,
+                                                  &cache_disk_module);
+        if (c->journal) {
+#if APR_HAS_THREADS
+            rv = apr_thread_mutex_create(&journal_mutex,
+                                         APR_THREAD_MUTEX_DEFAULT, p);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10533)
+                        "could not create the cache journal lock, "
+                        "nothing is journaled");
+                break;
+            }
+#endif
+            journal_pool = p;
+            journals = apr_hash_make(p);
+            break;
+        }
+    }
+
+#if APR_HAS_THREADS
+    if (conf->write_behind_threads <= 0) {
+        return;
+    }
+
+    rv = apr_thread_pool_create(&writer_tp, 0, conf->write_behind_threads, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10462)
+                "could not create the write behind thread pool, "
+                "cached bodies will be written synchronously");
+        writer_tp = NULL;
+    }
+#endif
+}
+
 static void disk_cache_register_hook(apr_pool_t *p)
 {
     /* cache initializer */
     ap_register_provider(p, CACHE_PROVIDER_GROUP, "disk", "0",
                          &cache_disk_provider);
+
+    ap_hook_child_init(disk_cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(cache_disk) = {
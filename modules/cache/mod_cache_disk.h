@@ -33,6 +33,8 @@ typedef struct {
     apr_file_t *tempfd;
 } disk_cache_file_t;
 
+typedef struct disk_cache_writer disk_cache_writer_t;
+
 /*
  * disk_cache_object_t
  * Pointed to by cache_object_t::vobj
@@ -41,18 +43,23 @@ typedef struct disk_cache_object {
     const char *root;            /* the location of the cache directory */
     apr_size_t root_len;
     const char *prefix;
-    disk_cache_file_t data;      /* data file structure */
-    disk_cache_file_t hdrs;      /* headers file structure */
+    disk_cache_file_t hdrs;      /* entity file structure (headers and body) */
     disk_cache_file_t vary;      /* vary file structure */
     const char *hashfile;        /* Computed hash key for this URI */
     const char *name;            /* Requested URI without vary bits - suitable for mortals. */
     const char *key;             /* On-disk prefix; URI with Vary bits (if present) */
-    apr_off_t file_size;         /*  File size of the cached data file  */
+    char *head;                  /* Header block recalled from the entity file */
+    apr_size_t head_len;
+    char *block;                 /* Header block to be stored */
+    apr_size_t block_len;
+    apr_off_t body_offset;       /* Offset of the body in the opened entity file */
+    apr_off_t file_size;         /* Size of the body in the opened entity file */
     disk_cache_info_t disk_info; /* Header information. */
     apr_table_t *headers_in;     /* Input headers to save */
     apr_table_t *headers_out;    /* Output headers to save */
     apr_off_t offset;            /* Max size to set aside */
     apr_time_t timeout;          /* Max time to set aside */
+    disk_cache_writer_t *writer; /* Background writer of the body, if any */
     unsigned int done:1;         /* Is the attempt to cache complete? */
 } disk_cache_object_t;
 
@@ -68,12 +75,20 @@ typedef struct disk_cache_object {
 #define DEFAULT_MAX_FILE_SIZE 1000000
 #define DEFAULT_READSIZE 0
 #define DEFAULT_READTIME 0
+#define DEFAULT_WRITE_BEHIND_THREADS 4
+
+/* How much of an entity file to read up front. This covers the info
+ * struct and the header block of most entities in a single read.
+ */
+#define CACHE_DISK_HEAD_SIZE 8192
 
 typedef struct {
     const char* cache_root;
     apr_size_t cache_root_len;
     int dirlevels;               /* Number of levels of subdirectories */
     int dirlength;               /* Length of subdirectory names */
+    int write_behind_threads;    /* Max background writers per child */
+    int journal;                 /* Record changes for htcacheclean */
 } disk_cache_conf;
 
 typedef struct {
@@ -81,10 +96,12 @@ typedef struct {
     apr_off_t maxfs;             /* maximum file size for cached files */
     apr_off_t readsize;          /* maximum data to attempt to cache in one go */
     apr_time_t readtime;         /* maximum time taken to cache in one go */
+    int write_behind;            /* write the body in the background */
     unsigned int minfs_set:1;
     unsigned int maxfs_set:1;
     unsigned int readsize_set:1;
     unsigned int readtime_set:1;
+    unsigned int write_behind_set:1;
 } disk_cache_dir_conf;
 
 #endif /*MOD_CACHE_DISK_H*/
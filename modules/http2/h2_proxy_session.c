@@ -47,6 +47,7 @@ typedef struct h2_proxy_stream {
     unsigned int waiting_on_100 : 1;
     unsigned int waiting_on_ping : 1;
     unsigned int headers_ended : 1;
+    unsigned int h2_front : 1; /* if the request came over HTTP/2 */
     uint32_t error_code;
 
     apr_bucket_brigade *input;
@@ -65,6 +66,52 @@ static apr_status_t check_suspended(h2_proxy_session *session);
 static void stream_resume(h2_proxy_stream *stream);
 static apr_status_t submit_trailers(h2_proxy_stream *stream);
 
+/* The allocator of the response buckets, the session's when they are
+ * passed to stream_output (from another thread than the request's). */
+static apr_bucket_alloc_t *stream_bucket_alloc(h2_proxy_stream *stream)
+{
+    return stream->session->stream_output? stream->session->c->bucket_alloc
+                                         : stream->r->connection->bucket_alloc;
+}
+
+static apr_status_t stream_read_input(h2_proxy_stream *stream,
+                                      apr_off_t readbytes)
+{
+    h2_proxy_session *session = stream->session;
+
+    if (session->stream_input) {
+        return session->stream_input(session, stream->r, stream->input,
+                                     readbytes);
+    }
+    return ap_get_brigade(stream->r->input_filters, stream->input,
+                          AP_MODE_READBYTES, APR_NONBLOCK_READ, readbytes);
+}
+
+static apr_status_t stream_pass_output(h2_proxy_stream *stream)
+{
+    h2_proxy_session *session = stream->session;
+    apr_status_t status;
+
+    if (session->stream_output) {
+        status = session->stream_output(session, stream->r, stream->output);
+        apr_brigade_cleanup(stream->output);
+        return status;
+    }
+    return ap_pass_brigade(stream->r->output_filters, stream->output);
+}
+
+static void stream_send_interim(h2_proxy_stream *stream)
+{
+    h2_proxy_session *session = stream->session;
+
+    if (session->stream_output) {
+        session->stream_output(session, stream->r, NULL);
+    }
+    else {
+        ap_send_interim_response(stream->r, 1);
+    }
+}
+
 /*
  * The H2_PING connection sub-state: a state independant of the H2_SESSION state
  * of the connection:
@@ -282,7 +329,7 @@ static int on_frame_recv(nghttp2_session *ngh2, const nghttp2_frame *frame,
             if (r->status >= 100 && r->status < 200) {
                 /* By default, we will forward all interim responses when
                  * we are sitting on a HTTP/2 connection to the client */
-                int forward = session->h2_front;
+                int forward = stream->h2_front;
                 switch(r->status) {
                     case 100:
                         if (stream->waiting_on_100) {
@@ -306,7 +353,7 @@ static int on_frame_recv(nghttp2_session *ngh2, const nghttp2_frame *frame,
                               "status=%d, will forward=%d",
                               session->id, r->status, forward);
                 if (forward) {
-                    ap_send_interim_response(r, 1);
+                    stream_send_interim(stream);
                 }
             }
             stream_resume(stream);
@@ -534,14 +581,14 @@ static int stream_response_data(nghttp2_session *ngh2, uint8_t flags,
     stream->data_received += len;
     
     b = apr_bucket_transient_create((const char*)data, len, 
-                                    stream->r->connection->bucket_alloc);
+                                    stream_bucket_alloc(stream));
     APR_BRIGADE_INSERT_TAIL(stream->output, b);
     /* always flush after a DATA frame, as we have no other indication
      * of buffer use */
-    b = apr_bucket_flush_create(stream->r->connection->bucket_alloc);
+    b = apr_bucket_flush_create(stream_bucket_alloc(stream));
     APR_BRIGADE_INSERT_TAIL(stream->output, b);
     
-    status = ap_pass_brigade(stream->r->output_filters, stream->output);
+    status = stream_pass_output(stream);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, stream->r, APLOGNO(03359)
                   "h2_proxy_session(%s): stream=%d, response DATA %ld, %ld"
                   " total", session->id, stream_id, (long)len,
@@ -628,9 +675,7 @@ static ssize_t stream_request_data(nghttp2_session *ngh2, int32_t stream_id,
         status = APR_EAGAIN;
     }
     else if (APR_BRIGADE_EMPTY(stream->input)) {
-        status = ap_get_brigade(stream->r->input_filters, stream->input,
-                                AP_MODE_READBYTES, APR_NONBLOCK_READ,
-                                H2MAX(APR_BUCKET_BUFF_SIZE, length));
+        status = stream_read_input(stream, H2MAX(APR_BUCKET_BUFF_SIZE, length));
         ap_log_rerror(APLOG_MARK, APLOG_TRACE2, status, stream->r, 
                       "h2_proxy_stream(%s-%d): request body read", 
                       stream->session->id, stream->id);
@@ -829,6 +874,7 @@ static apr_status_t open_stream(h2_proxy_session *session, const char *url,
     stream->r = r;
     stream->standalone = standalone;
     stream->session = session;
+    stream->h2_front = session->h2_front;
     stream->state = H2_STREAM_ST_IDLE;
     
     stream->input = apr_brigade_create(stream->pool, session->c->bucket_alloc);
@@ -925,9 +971,7 @@ static apr_status_t submit_stream(h2_proxy_session *session, h2_proxy_stream *st
        HTTP_IN filter to generate the 100-continue itself. */
     if (stream->waiting_on_100 || stream->waiting_on_ping) {
         /* make a small test if we get an EOF/EOS immediately */
-        status = ap_get_brigade(stream->r->input_filters, stream->input,
-                                AP_MODE_READBYTES, APR_NONBLOCK_READ,
-                                APR_BUCKET_BUFF_SIZE);
+        status = stream_read_input(stream, APR_BUCKET_BUFF_SIZE);
         may_have_request_body = APR_STATUS_IS_EAGAIN(status)
                                 || (status == APR_SUCCESS 
                                     && !APR_BUCKET_IS_EOS(APR_BRIGADE_FIRST(stream->input)));
@@ -1016,12 +1060,47 @@ static apr_status_t feed_brigade(h2_proxy_session *session, apr_bucket_brigade *
     return status;
 }
 
+/* Waits until the backend sends something or the session is woken up
+ * (APR_EAGAIN), for the given timeout or else the socket's one.
+ */
+static apr_status_t session_wait(h2_proxy_session *session, 
+                                 apr_interval_time_t timeout)
+{
+    const apr_pollfd_t *pfds;
+    apr_int32_t n;
+    apr_status_t status;
+    
+    /* What the filters have buffered already is not polled */
+    status = ap_get_brigade(session->c->input_filters, session->input, 
+                            AP_MODE_READBYTES, APR_NONBLOCK_READ, 
+                            64 * 1024);
+    if (!APR_BRIGADE_EMPTY(session->input)
+        || (status != APR_SUCCESS && !APR_STATUS_IS_EAGAIN(status))) {
+        return status;
+    }
+    
+    if (timeout <= 0) {
+        apr_socket_timeout_get(ap_get_conn_socket(session->c), &timeout);
+    }
+    status = apr_pollset_poll(session->pollset, timeout, &n, &pfds);
+    if (APR_STATUS_IS_EINTR(status)) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c, 
+                      "h2_proxy_session(%s): woken up", session->id);
+        return APR_EAGAIN;
+    }
+    return status;
+}
+
 static apr_status_t h2_proxy_session_read(h2_proxy_session *session, int block, 
                                           apr_interval_time_t timeout)
 {
     apr_status_t status = APR_SUCCESS;
     
-    if (APR_BRIGADE_EMPTY(session->input)) {
+    if (block && session->pollset && APR_BRIGADE_EMPTY(session->input)) {
+        status = session_wait(session, timeout);
+    }
+    
+    if (status == APR_SUCCESS && APR_BRIGADE_EMPTY(session->input)) {
         apr_socket_t *socket = NULL;
         apr_time_t save_timeout = -1;
         
@@ -1119,9 +1198,7 @@ static apr_status_t check_suspended(h2_proxy_session *session)
                 status = APR_EAGAIN;
             }
             else {
-                status = ap_get_brigade(stream->r->input_filters, stream->input,
-                                        AP_MODE_READBYTES, APR_NONBLOCK_READ,
-                                        APR_BUCKET_BUFF_SIZE);
+                status = stream_read_input(stream, APR_BUCKET_BUFF_SIZE);
             }
             if (status == APR_SUCCESS && !APR_BRIGADE_EMPTY(stream->input)) {
                 stream_resume(stream);
@@ -1375,23 +1452,23 @@ static void ev_stream_done(h2_proxy_session *session, int stream_id,
                           session->id, stream_id, touched, stream->error_code);
 
             if (status != APR_SUCCESS) {
-                b = ap_bucket_error_create(HTTP_SERVICE_UNAVAILABLE, NULL, stream->r->pool,
-                                           stream->r->connection->bucket_alloc);
+                b = ap_bucket_error_create(HTTP_SERVICE_UNAVAILABLE, NULL, stream->pool,
+                                           stream_bucket_alloc(stream));
                 APR_BRIGADE_INSERT_TAIL(stream->output, b);
-                b = apr_bucket_eos_create(stream->r->connection->bucket_alloc);
+                b = apr_bucket_eos_create(stream_bucket_alloc(stream));
                 APR_BRIGADE_INSERT_TAIL(stream->output, b);
-                ap_pass_brigade(stream->r->output_filters, stream->output);
+                stream_pass_output(stream);
             }
             else if (!stream->data_received) {
                 /* if the response had no body, this is the time to flush
                  * an empty brigade which will also write the response headers */
                 h2_proxy_stream_end_headers_out(stream);
                 stream->data_received = 1;
-                b = apr_bucket_flush_create(stream->r->connection->bucket_alloc);
+                b = apr_bucket_flush_create(stream_bucket_alloc(stream));
                 APR_BRIGADE_INSERT_TAIL(stream->output, b);
-                b = apr_bucket_eos_create(stream->r->connection->bucket_alloc);
+                b = apr_bucket_eos_create(stream_bucket_alloc(stream));
                 APR_BRIGADE_INSERT_TAIL(stream->output, b);
-                ap_pass_brigade(stream->r->output_filters, stream->output);
+                stream_pass_output(stream);
             }
         }
 
@@ -1577,6 +1654,9 @@ run_loop:
                     have_read = 1;
                     dispatch_event(session, H2_PROXYS_EV_DATA_READ, 0, NULL);
                 }
+                else if (APR_STATUS_IS_EAGAIN(status)) {
+                    /* woken up, let the caller submit its streams */
+                }
                 else {
                     dispatch_event(session, H2_PROXYS_EV_CONN_ERROR, status, NULL);
                     return status;
@@ -1665,6 +1745,72 @@ void h2_proxy_session_cancel_all(h2_proxy_session *session)
     }
 }
 
+typedef struct {
+    h2_proxy_session *session;
+    request_rec *r;
+} cancel_req_ctx;
+
+static int cancel_req_iter(void *udata, void *val)
+{
+    cancel_req_ctx *ctx = udata;
+    h2_proxy_stream *stream = val;
+    if (stream->r == ctx->r) {
+        nghttp2_submit_rst_stream(ctx->session->ngh2, NGHTTP2_FLAG_NONE,
+                                  stream->id, NGHTTP2_CANCEL);
+        return 0;
+    }
+    return 1;
+}
+
+void h2_proxy_session_cancel(h2_proxy_session *session, request_rec *r)
+{
+    cancel_req_ctx ctx;
+    ctx.session = session;
+    ctx.r = r;
+    h2_proxy_ihash_iter(session->streams, cancel_req_iter, &ctx);
+}
+
+int h2_proxy_session_accepting(h2_proxy_session *session)
+{
+    return (session->ngh2 && !session->aborted
+            && (session->state == H2_PROXYS_ST_INIT
+                || is_accepting_streams(session)));
+}
+
+apr_status_t h2_proxy_session_make_wakeable(h2_proxy_session *session)
+{
+    apr_pollfd_t pfd;
+    apr_status_t status;
+    
+    if (session->pollset) {
+        return APR_SUCCESS;
+    }
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = session->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.desc.s = ap_get_conn_socket(session->c);
+    pfd.reqevents = APR_POLLIN;
+    if (!pfd.desc.s) {
+        return APR_ENOTIMPL;
+    }
+    status = apr_pollset_create(&session->pollset, 1, session->pool, 
+                                APR_POLLSET_WAKEABLE);
+    if (status == APR_SUCCESS) {
+        status = apr_pollset_add(session->pollset, &pfd);
+    }
+    if (status != APR_SUCCESS) {
+        session->pollset = NULL;
+    }
+    return status;
+}
+
+void h2_proxy_session_wakeup(h2_proxy_session *session)
+{
+    if (session->pollset) {
+        apr_pollset_wakeup(session->pollset);
+    }
+}
+
 static int done_iter(void *udata, void *val)
 {
     cleanup_iter_ctx *ctx = udata;
@@ -69,6 +69,13 @@ typedef enum {
 typedef struct h2_proxy_session h2_proxy_session;
 typedef void h2_proxy_request_done(h2_proxy_session *s, request_rec *r,
                                    apr_status_t status, int touched);
+/* Read the request body of r (non-blocking) into bb, allocated from bb */
+typedef apr_status_t h2_proxy_stream_input(h2_proxy_session *s, request_rec *r,
+                                           apr_bucket_brigade *bb,
+                                           apr_off_t readbytes);
+/* Pass the response buckets bb on for r, or an interim response if NULL */
+typedef apr_status_t h2_proxy_stream_output(h2_proxy_session *s, request_rec *r,
+                                            apr_bucket_brigade *bb);
 
 struct h2_proxy_session {
     const char *id;
@@ -102,6 +109,13 @@ struct h2_proxy_session {
     h2_ping_state_t ping_state;
     apr_time_t ping_timeout;
     apr_time_t save_timeout;
+
+    apr_pollset_t *pollset;  /* blocking reads can be woken up, if set */
+
+    /* if set, the request bodies and responses go through these instead of
+     * the requests' filters, with buckets of the session's allocator */
+    h2_proxy_stream_input *stream_input;
+    h2_proxy_stream_output *stream_output;
 };
 
 h2_proxy_session *h2_proxy_session_setup(const char *id, proxy_conn_rec *p_conn,
@@ -126,6 +140,33 @@ apr_status_t h2_proxy_session_process(h2_proxy_session *s);
 
 void h2_proxy_session_cancel_all(h2_proxy_session *s);
 
+/**
+ * Reset the stream of the request, if it has one in the session.
+ * @param s the session
+ * @param r the request
+ */
+void h2_proxy_session_cancel(h2_proxy_session *s, request_rec *r);
+
+/**
+ * @param s the session
+ * @return != 0 if new streams may be submitted to the session
+ */
+int h2_proxy_session_accepting(h2_proxy_session *s);
+
+/**
+ * Let the blocking reads of h2_proxy_session_process() be interrupted
+ * by h2_proxy_session_wakeup(), from any thread.
+ * @param s the session
+ */
+apr_status_t h2_proxy_session_make_wakeable(h2_proxy_session *s);
+
+/**
+ * Interrupt a blocking read of the session, making
+ * h2_proxy_session_process() return.
+ * @param s the session, made wakeable before
+ */
+void h2_proxy_session_wakeup(h2_proxy_session *s);
+
 void h2_proxy_session_cleanup(h2_proxy_session *s, h2_proxy_request_done *done);
 
 #define H2_PROXY_REQ_URL_NOTE   "h2-proxy-req-url"
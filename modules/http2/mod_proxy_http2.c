@@ -18,7 +18,9 @@
 
 #include <ap_mmn.h>
 #include <httpd.h>
+#include <http_protocol.h>
 #include <mod_proxy.h>
+#include <apr_thread_cond.h>
 #include "mod_http2.h"
 
 
@@ -31,14 +33,17 @@
 #define H2MIN(x,y) ((x) < (y) ? (x) : (y))
 
 static void register_hook(apr_pool_t *p);
+static void *h2_proxy_create_sconf(apr_pool_t *p, server_rec *s);
+static void *h2_proxy_merge_sconf(apr_pool_t *p, void *basev, void *addv);
+static const command_rec h2_proxy_cmds[];
 
 AP_DECLARE_MODULE(proxy_http2) = {
     STANDARD20_MODULE_STUFF,
     NULL,              /* create per-directory config structure */
     NULL,              /* merge per-directory config structures */
-    NULL,              /* create per-server config structure */
-    NULL,              /* merge per-server config structures */
-    NULL,              /* command apr_table_t */
+    h2_proxy_create_sconf, /* create per-server config structure */
+    h2_proxy_merge_sconf,  /* merge per-server config structures */
+    h2_proxy_cmds,     /* command apr_table_t */
     register_hook,     /* register hooks */
 #if defined(AP_MODULE_FLAG_NONE)
     AP_MODULE_FLAG_ALWAYS_MERGE
@@ -48,7 +53,14 @@ AP_DECLARE_MODULE(proxy_http2) = {
 /* Optional functions from mod_http2 */
 static int (*is_h2)(conn_rec *c);
 
-typedef struct h2_proxy_ctx {
+typedef struct {
+    int multiplex;             /* share sessions between requests, -1 unset */
+} h2_proxy_srv_conf;
+
+typedef struct h2_proxy_shared h2_proxy_shared;
+
+typedef struct h2_proxy_ctx h2_proxy_ctx;
+struct h2_proxy_ctx {
     const char *id;
     conn_rec *master;
     conn_rec *owner;
@@ -70,7 +82,20 @@ typedef struct h2_proxy_ctx {
     int r_done;                /* request was processed, not necessarily successfully */
     int r_may_retry;           /* request may be retried */
     h2_proxy_session *session; /* current http2 session against backend */
-} h2_proxy_ctx;
+
+    h2_proxy_shared *shared;   /* the shared session used, if any */
+    h2_proxy_ctx *next;        /* in the requests queued or cancelled */
+    int queued;                /* not submitted yet */
+    int cancelled;             /* aborted, its stream to be reset */
+    int handoff;               /* what the driver waits for, H2_PROXY_HANDOFF_* */
+    apr_bucket_brigade *handoff_bb; /* response buckets of the driver's */
+    apr_off_t handoff_len;     /* request body bytes to read at most */
+    apr_status_t handoff_status;
+    char *in_data;             /* request body read, malloc()ed */
+    apr_size_t in_len;
+    int in_eos;
+    apr_bucket_brigade *bb;    /* of the request's connection */
+};
 
 static int h2_proxy_post_config(apr_pool_t *p, apr_pool_t *plog,
                                 apr_pool_t *ptemp, server_rec *s)
@@ -208,44 +233,113 @@ static int proxy_http2_canon(request_rec *r, char *url)
 
 static apr_status_t add_request(h2_proxy_session *session, request_rec *r)
 {
-    h2_proxy_ctx *ctx = session->user_data;
+    proxy_conn_rec *p_conn = session->p_conn;
     const char *url;
     apr_status_t status;
 
     url = apr_table_get(r->notes, H2_PROXY_REQ_URL_NOTE);
     apr_table_setn(r->notes, "proxy-source-port", apr_psprintf(r->pool, "%hu",
-                   ctx->p_conn->connection->local_addr->port));
+                   p_conn->connection->local_addr->port));
     status = h2_proxy_session_submit(session, url, r, 1);
     if (status != APR_SUCCESS) {
         ap_log_cerror(APLOG_MARK, APLOG_ERR, status, r->connection, APLOGNO(03351)
                       "pass request body failed to %pI (%s) from %s (%s)",
-                      ctx->p_conn->addr, ctx->p_conn->hostname ? 
-                      ctx->p_conn->hostname: "", session->c->client_ip, 
+                      p_conn->addr, p_conn->hostname ? 
+                      p_conn->hostname: "", session->c->client_ip, 
                       session->c->remote_host ? session->c->remote_host: "");
     }
     return status;
 }
 
+static void request_done(h2_proxy_ctx *ctx, request_rec *r,
+                         apr_status_t status, int touched);
+
+static void session_req_done(h2_proxy_session *session, request_rec *r,
+                             apr_status_t status, int touched)
+{
+    /* The session may be shared, the request's own ctx is looked up */
+    request_done(ap_get_module_config(r->connection->conn_config,
+                                      &proxy_http2_module),
+                 r, status, touched);
+}
+
+#if APR_HAS_THREADS
+/*
+ * Shared sessions (ProxyHTTP2Multiplex on).
+ *
+ * The concurrent requests of a child to the same worker are sent as streams
+ * of the same backend sessions, as many per session as the backend allows
+ * (SETTINGS_MAX_CONCURRENT_STREAMS), instead of each request holding a
+ * connection of its own. A connection taken from the worker's pool is held
+ * by a shared session for as long as it has requests, and released to the
+ * pool (with its HTTP/2 session) when the last one leaves.
+ *
+ * An nghttp2 session is not thread safe, so one request at a time drives
+ * a shared session (leader/follower): it submits the requests queued to it
+ * and processes the session until its own request is done, while the
+ * threads of the other requests wait on a condition. Their filters are not
+ * run by the driver though: it hands the response buckets over to the
+ * request's thread, which passes copies to its filters (or reads its body)
+ * while the driver waits. Its blocking reads are woken up whenever a request
+ * is queued or cancelled.
+ */
+#define H2_PROXY_SHARED_MAX_STREAMS 100 /* as nghttp2 assumes before SETTINGS */
+#define H2_PROXY_SHARED_ABORT_CHECK apr_time_from_msec(100)
+
+#define H2_PROXY_HANDOFF_NONE    0
+#define H2_PROXY_HANDOFF_INTERIM 1  /* send the interim response in r */
+#define H2_PROXY_HANDOFF_OUTPUT  2  /* pass handoff_bb on */
+#define H2_PROXY_HANDOFF_INPUT   3  /* read handoff_len of the body */
+
+typedef struct {
+    apr_thread_mutex_t *mutex;  /* protects the shared sessions and ctxs */
+    apr_thread_cond_t *cond;    /* signaled on any change */
+    h2_proxy_shared *sessions;  /* sessions with requests */
+} h2_proxy_worker_ctx;
+
+struct h2_proxy_shared {
+    h2_proxy_shared *next;
+    h2_proxy_worker_ctx *wctx;
+    proxy_conn_rec *p_conn;
+    h2_proxy_session *session;  /* NULL until connected */
+    h2_proxy_ctx *pending;      /* requests to submit */
+    h2_proxy_ctx *cancels;      /* requests whose stream is to be reset */
+    h2_proxy_ctx *leader;       /* the request driving the session */
+    int nreqs;                  /* requests using the session */
+    int max_streams;            /* concurrent streams the backend allows */
+    unsigned int driving : 1;   /* a request connects or processes it */
+    unsigned int closed : 1;    /* takes no new request, failed or GOAWAY */
+};
+
+static apr_pool_t *h2_proxy_pchild;
+static apr_thread_mutex_t *h2_proxy_mutex;
+#endif
+
 static void request_done(h2_proxy_ctx *ctx, request_rec *r,
                          apr_status_t status, int touched)
 {   
-    if (r == ctx->r) {
+    if (ctx && r == ctx->r) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, r->connection, 
                       "h2_proxy_session(%s): request done, touched=%d",
                       ctx->id, touched);
+#if APR_HAS_THREADS
+        /* its thread may be waiting for this */
+        if (ctx->shared) {
+            apr_thread_mutex_lock(ctx->shared->wctx->mutex);
+        }
+#endif
         ctx->r_done = 1;
         if (touched) ctx->r_may_retry = 0;
         ctx->r_status = ((status == APR_SUCCESS)? APR_SUCCESS
                          : HTTP_SERVICE_UNAVAILABLE);
+#if APR_HAS_THREADS
+        if (ctx->shared) {
+            apr_thread_mutex_unlock(ctx->shared->wctx->mutex);
+        }
+#endif
     }
 }    
 
-static void session_req_done(h2_proxy_session *session, request_rec *r,
-                             apr_status_t status, int touched)
-{
-    request_done(session->user_data, r, status, touched);
-}
-
 static apr_status_t ctx_run(h2_proxy_ctx *ctx) {
     apr_status_t status = OK;
     int h2_front;
@@ -263,10 +357,11 @@ static apr_status_t ctx_run(h2_proxy_ctx *ctx) {
                       APLOGNO(03372) "session unavailable");
         return HTTP_SERVICE_UNAVAILABLE;
     }
+    /* a reused session has the flag of its first request */
+    ctx->session->h2_front = h2_front;
     
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(03373)
                   "eng(%s): run session %s", ctx->id, ctx->session->id);
-    ctx->session->user_data = ctx;
     
     ctx->r_done = 0;
     add_request(ctx->session, ctx->r);
@@ -298,11 +393,514 @@ out:
         h2_proxy_session_process(ctx->session);
     }
     
-    ctx->session->user_data = NULL;
     ctx->session = NULL;
     return status;
 }
 
+/* Steps One to Three: get a backend connection for the request, connected
+ * and with its conn_rec. */
+static int ctx_connect(h2_proxy_ctx *ctx, char *url, const char *proxyname,
+                       apr_port_t proxyport)
+{
+    char *locurl = url;
+    apr_uri_t uri;
+    int status;
+
+    /* Get a proxy_conn_rec from the worker, might be a new one, might
+     * be one still open from another request, or it might fail if the
+     * worker is stopped or in error. */
+    if ((status = ap_proxy_acquire_connection(ctx->proxy_func, &ctx->p_conn,
+                                              ctx->worker, ctx->server)) != OK) {
+        return status;
+    }
+
+    ctx->p_conn->is_ssl = ctx->is_ssl;
+
+    /* Step One: Determine the URL to connect to (might be a proxy),
+     * initialize the backend accordingly and determine the server 
+     * port string we can expect in responses. */
+    if ((status = ap_proxy_determine_connection(ctx->pool, ctx->r, ctx->conf,
+                                                ctx->worker, ctx->p_conn, &uri,
+                                                &locurl, proxyname, proxyport,
+                                                ctx->server_portstr,
+                                                sizeof(ctx->server_portstr))) != OK) {
+        return status;
+    }
+    
+    /* Step Two: Make the Connection (or check that an already existing
+     * socket is still usable). On success, we have a socket connected to
+     * backend->hostname. */
+    if (ap_proxy_connect_backend(ctx->proxy_func, ctx->p_conn, ctx->worker, 
+                                 ctx->server)) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(03352)
+                      "H2: failed to make connection to backend: %s",
+                      ctx->p_conn->hostname);
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
+    
+    /* Step Three: Create conn_rec for the socket we have open now. */
+    status = ap_proxy_connection_create_ex(ctx->proxy_func, ctx->p_conn, ctx->r);
+    if (status != OK) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, ctx->owner, APLOGNO(03353)
+                      "setup new connection: is_ssl=%d %s %s %s", 
+                      ctx->p_conn->is_ssl, ctx->p_conn->ssl_hostname, 
+                      locurl, ctx->p_conn->hostname);
+        ctx->r_status = status;
+        return status;
+    }
+    
+    if (!ctx->p_conn->data && ctx->is_ssl) {
+        /* New SSL connection: set a note on the connection about what
+         * protocol we need. */
+        apr_table_setn(ctx->p_conn->connection->notes,
+                       "proxy-request-alpn-protos", "h2");
+    }
+    return OK;
+}
+
+#if APR_HAS_THREADS
+static h2_proxy_worker_ctx *worker_ctx_get(proxy_worker *worker)
+{
+    h2_proxy_worker_ctx *wctx;
+
+    wctx = apr_atomic_casptr((volatile void **)&worker->context, NULL, NULL);
+    if (wctx || !h2_proxy_mutex) {
+        return wctx;
+    }
+
+    apr_thread_mutex_lock(h2_proxy_mutex);
+    wctx = worker->context;
+    if (!wctx) {
+        wctx = apr_pcalloc(h2_proxy_pchild, sizeof(*wctx));
+        if (apr_thread_mutex_create(&wctx->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                    h2_proxy_pchild) != APR_SUCCESS
+                || apr_thread_cond_create(&wctx->cond,
+                                          h2_proxy_pchild) != APR_SUCCESS) {
+            wctx = NULL;
+        }
+        else {
+            apr_atomic_casptr((volatile void **)&worker->context, wctx, NULL);
+        }
+    }
+    apr_thread_mutex_unlock(h2_proxy_mutex);
+
+    return wctx;
+}
+
+/* Called with the mutex held: queues the request to a session with room
+ * for it, or to a new one which *pconnect tells to connect. */
+static h2_proxy_shared *shared_join(h2_proxy_worker_ctx *wctx,
+                                    h2_proxy_ctx *ctx, int *pconnect)
+{
+    h2_proxy_shared *shared, **pnext;
+    h2_proxy_ctx **pctx;
+
+    for (shared = wctx->sessions; shared; shared = shared->next) {
+        if (!shared->closed && shared->nreqs < shared->max_streams) {
+            break;
+        }
+    }
+    *pconnect = (shared == NULL);
+    if (!shared) {
+        shared = ap_calloc(1, sizeof(*shared));
+        shared->wctx = wctx;
+        shared->max_streams = H2_PROXY_SHARED_MAX_STREAMS;
+        shared->driving = 1;
+        for (pnext = &wctx->sessions; *pnext; pnext = &(*pnext)->next)
+            ;
+        *pnext = shared;
+    }
+
+    shared->nreqs++;
+    ctx->shared = shared;
+    ctx->queued = 1;
+    ctx->next = NULL;
+    for (pctx = &shared->pending; *pctx; pctx = &(*pctx)->next)
+        ;
+    *pctx = ctx;
+
+    if (shared->driving && shared->session) {
+        /* don't wait for the backend to submit it */
+        h2_proxy_session_wakeup(shared->session);
+    }
+    return shared;
+}
+
+/* Called with the mutex held: leaves the session, the last request
+ * releasing it (without the mutex). */
+static void shared_leave(h2_proxy_shared *shared, h2_proxy_ctx *ctx)
+{
+    h2_proxy_worker_ctx *wctx = shared->wctx;
+    h2_proxy_shared **pnext;
+    h2_proxy_ctx **pctx;
+    int last;
+
+    if (ctx->queued || ctx->cancelled) {
+        pctx = ctx->queued? &shared->pending : &shared->cancels;
+        for (; *pctx; pctx = &(*pctx)->next) {
+            if (*pctx == ctx) {
+                *pctx = ctx->next;
+                break;
+            }
+        }
+        ctx->queued = 0;
+        ctx->cancelled = 0;
+    }
+    ctx->shared = NULL;
+    ctx->next = NULL;
+
+    last = (--shared->nreqs == 0);
+    if (last) {
+        for (pnext = &wctx->sessions; *pnext; pnext = &(*pnext)->next) {
+            if (*pnext == shared) {
+                *pnext = shared->next;
+                break;
+            }
+        }
+    }
+    apr_thread_mutex_unlock(wctx->mutex);
+
+    if (last) {
+        if (shared->session) {
+            /* the connection's session may be reused unshared */
+            shared->session->stream_input = NULL;
+            shared->session->stream_output = NULL;
+        }
+        if (shared->p_conn) {
+            if (shared->closed) {
+                shared->p_conn->close = 1;
+            }
+#if AP_MODULE_MAGIC_AT_LEAST(20140207, 2)
+            proxy_run_detach_backend(ctx->r, shared->p_conn);
+#endif
+            ap_proxy_release_connection(ctx->proxy_func, shared->p_conn,
+                                        ctx->server);
+        }
+        free(shared);
+    }
+}
+
+/* Called with the mutex held, by the thread of the request: does what the
+ * driver handed over, with the filters and allocator of the request. */
+static void shared_deliver(h2_proxy_ctx *ctx)
+{
+    h2_proxy_worker_ctx *wctx = ctx->shared->wctx;
+    apr_bucket_brigade *bb = ctx->handoff_bb;
+    request_rec *r = ctx->r;
+    conn_rec *c = ctx->owner;
+    apr_status_t status = APR_SUCCESS;
+    apr_bucket *b, *e;
+    const char *data;
+    apr_size_t dlen;
+    apr_off_t len;
+
+    apr_thread_mutex_unlock(wctx->mutex);
+
+    if (!ctx->bb) {
+        ctx->bb = apr_brigade_create(ctx->pool, c->bucket_alloc);
+    }
+    if (c->aborted) {
+        status = APR_ECONNABORTED;
+    }
+    else if (ctx->handoff == H2_PROXY_HANDOFF_INTERIM) {
+        ap_send_interim_response(r, 1);
+    }
+    else if (ctx->handoff == H2_PROXY_HANDOFF_OUTPUT) {
+        /* the driver's buckets are only read, while it waits */
+        for (b = APR_BRIGADE_FIRST(bb);
+             b != APR_BRIGADE_SENTINEL(bb) && status == APR_SUCCESS;
+             b = APR_BUCKET_NEXT(b)) {
+            if (APR_BUCKET_IS_EOS(b)) {
+                e = apr_bucket_eos_create(c->bucket_alloc);
+            }
+            else if (APR_BUCKET_IS_FLUSH(b)) {
+                e = apr_bucket_flush_create(c->bucket_alloc);
+            }
+            else if (AP_BUCKET_IS_ERROR(b)) {
+                e = ap_bucket_error_create(((ap_bucket_error *)b->data)->status,
+                                           NULL, r->pool, c->bucket_alloc);
+            }
+            else if (APR_BUCKET_IS_METADATA(b)) {
+                continue;
+            }
+            else if ((status = apr_bucket_read(b, &data, &dlen,
+                                               APR_BLOCK_READ)) == APR_SUCCESS) {
+                e = apr_bucket_transient_create(data, dlen, c->bucket_alloc);
+            }
+            else {
+                break;
+            }
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+        }
+        if (status == APR_SUCCESS) {
+            status = ap_pass_brigade(r->output_filters, ctx->bb);
+        }
+        apr_brigade_cleanup(ctx->bb);
+    }
+    else if (ctx->handoff == H2_PROXY_HANDOFF_INPUT) {
+        /* copied to the heap, for the driver to make buckets of its own */
+        status = ap_get_brigade(r->input_filters, ctx->bb, AP_MODE_READBYTES,
+                                APR_NONBLOCK_READ, ctx->handoff_len);
+        if (status == APR_SUCCESS) {
+            status = apr_brigade_length(ctx->bb, 1, &len);
+        }
+        if (status == APR_SUCCESS && len > 0) {
+            ctx->in_len = (apr_size_t)len;
+            ctx->in_data = ap_malloc(ctx->in_len);
+            status = apr_brigade_flatten(ctx->bb, ctx->in_data, &ctx->in_len);
+        }
+        if (status == APR_SUCCESS) {
+            for (b = APR_BRIGADE_FIRST(ctx->bb);
+                 b != APR_BRIGADE_SENTINEL(ctx->bb);
+                 b = APR_BUCKET_NEXT(b)) {
+                if (APR_BUCKET_IS_EOS(b)) {
+                    ctx->in_eos = 1;
+                }
+            }
+        }
+        apr_brigade_cleanup(ctx->bb);
+    }
+
+    apr_thread_mutex_lock(wctx->mutex);
+    ctx->handoff = H2_PROXY_HANDOFF_NONE;
+    ctx->handoff_bb = NULL;
+    ctx->handoff_status = status;
+    apr_thread_cond_broadcast(wctx->cond);
+}
+
+/* Called by the driver: hands over to the thread of the request and waits
+ * for it to be done, or does it if the request is the driver's own. */
+static apr_status_t shared_handoff(h2_proxy_ctx *ctx, int handoff,
+                                   apr_bucket_brigade *bb, apr_off_t len)
+{
+    h2_proxy_worker_ctx *wctx = ctx->shared->wctx;
+    apr_status_t status;
+
+    apr_thread_mutex_lock(wctx->mutex);
+    ctx->handoff = handoff;
+    ctx->handoff_bb = bb;
+    ctx->handoff_len = len;
+    if (ctx->shared->leader == ctx) {
+        shared_deliver(ctx);
+    }
+    else {
+        apr_thread_cond_broadcast(wctx->cond);
+        while (ctx->handoff != H2_PROXY_HANDOFF_NONE) {
+            apr_thread_cond_wait(wctx->cond, wctx->mutex);
+        }
+    }
+    status = ctx->handoff_status;
+    apr_thread_mutex_unlock(wctx->mutex);
+
+    return status;
+}
+
+static apr_status_t shared_input(h2_proxy_session *session, request_rec *r,
+                                 apr_bucket_brigade *bb, apr_off_t readbytes)
+{
+    h2_proxy_ctx *ctx = ap_get_module_config(r->connection->conn_config,
+                                             &proxy_http2_module);
+    apr_bucket *b;
+    apr_status_t status;
+
+    if (!ctx || !ctx->shared) {
+        return APR_ECONNABORTED;
+    }
+    status = shared_handoff(ctx, H2_PROXY_HANDOFF_INPUT, NULL, readbytes);
+    if (status == APR_SUCCESS) {
+        if (ctx->in_data) {
+            b = apr_bucket_heap_create(ctx->in_data, ctx->in_len, free,
+                                       bb->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, b);
+            ctx->in_data = NULL;
+        }
+        if (ctx->in_eos) {
+            b = apr_bucket_eos_create(bb->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, b);
+        }
+    }
+    else if (ctx->in_data) {
+        free(ctx->in_data);
+        ctx->in_data = NULL;
+    }
+    ctx->in_len = 0;
+    ctx->in_eos = 0;
+    return status;
+}
+
+static apr_status_t shared_output(h2_proxy_session *session, request_rec *r,
+                                  apr_bucket_brigade *bb)
+{
+    h2_proxy_ctx *ctx = ap_get_module_config(r->connection->conn_config,
+                                             &proxy_http2_module);
+
+    if (!ctx || !ctx->shared) {
+        return APR_ECONNABORTED;
+    }
+    return shared_handoff(ctx, bb? H2_PROXY_HANDOFF_OUTPUT
+                                 : H2_PROXY_HANDOFF_INTERIM, bb, 0);
+}
+
+/* Called with the mutex held: processes the session until the request of
+ * ctx is done, for all its requests. */
+static void shared_drive(h2_proxy_shared *shared, h2_proxy_ctx *ctx)
+{
+    h2_proxy_worker_ctx *wctx = shared->wctx;
+    h2_proxy_session *session = shared->session;
+    h2_proxy_ctx *pending, *next;
+    apr_status_t status = APR_SUCCESS;
+
+    shared->driving = 1;
+    shared->leader = ctx;
+    while (!ctx->r_done) {
+        if (ctx->owner->aborted && !ctx->cancelled) {
+            ctx->cancelled = 1;
+            ctx->next = shared->cancels;
+            shared->cancels = ctx;
+        }
+        for (pending = shared->cancels; pending; pending = next) {
+            /* master connection gone, the other requests go on */
+            next = pending->next;
+            pending->next = NULL;
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, pending->owner, 
+                          APLOGNO(10495) "eng(%s): master connection gone, "
+                          "cancel request on session %s", pending->id,
+                          session->id);
+            h2_proxy_session_cancel(session, pending->r);
+        }
+        shared->cancels = NULL;
+
+        pending = shared->pending;
+        shared->pending = NULL;
+        for (next = pending; next; next = next->next) {
+            next->queued = 0;
+        }
+        apr_thread_mutex_unlock(wctx->mutex);
+
+        for (; pending; pending = next) {
+            next = pending->next;
+            pending->next = NULL;
+            session->h2_front = is_h2? is_h2(pending->owner) : 0;
+            if (add_request(session, pending->r) != APR_SUCCESS) {
+                request_done(pending, pending->r, APR_EGENERAL, 0);
+            }
+        }
+
+        status = h2_proxy_session_process(session);
+        if (status != APR_SUCCESS) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, ctx->owner, 
+                          APLOGNO(10496) "eng(%s): end of shared session %s", 
+                          ctx->id, session->id);
+            h2_proxy_session_cleanup(session, session_req_done);
+            if (!ctx->r_done) {
+                request_done(ctx, ctx->r, status, 0);
+            }
+        }
+
+        apr_thread_mutex_lock(wctx->mutex);
+        if (session->remote_max_concurrent > 0) {
+            shared->max_streams = H2MIN((int)session->remote_max_concurrent,
+                                        H2_PROXY_SHARED_MAX_STREAMS);
+        }
+        if (status != APR_SUCCESS || !h2_proxy_session_accepting(session)) {
+            shared->closed = 1;
+        }
+        apr_thread_cond_broadcast(wctx->cond);
+        if (status != APR_SUCCESS) {
+            break;
+        }
+    }
+    shared->leader = NULL;
+    shared->driving = 0;
+    apr_thread_cond_broadcast(wctx->cond);
+}
+
+/* Step Four for a shared session: join one, connecting it if new, and
+ * wait for the request to be done, driving the session when nobody does.
+ */
+static apr_status_t ctx_run_shared(h2_proxy_ctx *ctx, h2_proxy_worker_ctx *wctx,
+                                   char *url, const char *proxyname,
+                                   apr_port_t proxyport)
+{
+    h2_proxy_shared *shared;
+    h2_proxy_session *session = NULL;
+    int status = OK, connect;
+
+    ctx->r_done = 0;
+    apr_thread_mutex_lock(wctx->mutex);
+    shared = shared_join(wctx, ctx, &connect);
+    apr_thread_mutex_unlock(wctx->mutex);
+
+    if (connect) {
+        status = ctx_connect(ctx, url, proxyname, proxyport);
+        if (status == OK) {
+            session = h2_proxy_session_setup(ctx->id, ctx->p_conn, ctx->conf,
+                                             0, 30, 
+                                             h2_proxy_log2((int)ctx->req_buffer_size), 
+                                             session_req_done);
+            if (!session || h2_proxy_session_make_wakeable(session) != APR_SUCCESS) {
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, 
+                              APLOGNO(10497) "shared session unavailable");
+                status = HTTP_SERVICE_UNAVAILABLE;
+            }
+            else {
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, 
+                              APLOGNO(10498) "eng(%s): run shared session %s",
+                              ctx->id, session->id);
+                session->stream_input = shared_input;
+                session->stream_output = shared_output;
+            }
+        }
+
+        apr_thread_mutex_lock(wctx->mutex);
+        /* released by the last request leaving, closed on failure */
+        shared->p_conn = ctx->p_conn;
+        ctx->p_conn = NULL;
+        if (status == OK) {
+            shared->session = session;
+        }
+        else {
+            shared->closed = 1;
+        }
+        shared->driving = 0;
+        apr_thread_cond_broadcast(wctx->cond);
+    }
+    else {
+        apr_thread_mutex_lock(wctx->mutex);
+    }
+
+    while (!ctx->r_done) {
+        if (ctx->handoff != H2_PROXY_HANDOFF_NONE) {
+            shared_deliver(ctx);
+            continue;
+        }
+        if (ctx->queued && (shared->closed || ctx->owner->aborted)) {
+            /* never sent, may be retried on another session */
+            break;
+        }
+        if (ctx->owner->aborted && !ctx->cancelled) {
+            /* the driver resets the stream, and hands over its end */
+            ctx->cancelled = 1;
+            ctx->next = shared->cancels;
+            shared->cancels = ctx;
+            if (shared->driving && shared->session) {
+                h2_proxy_session_wakeup(shared->session);
+            }
+        }
+        if (!shared->driving && shared->session) {
+            shared_drive(shared, ctx);
+            continue;
+        }
+        /* the connection may be aborted by another thread (HTTP/2) */
+        apr_thread_cond_timedwait(wctx->cond, wctx->mutex,
+                                  H2_PROXY_SHARED_ABORT_CHECK);
+    }
+    shared_leave(shared, ctx);
+    
+    return (status == OK)? APR_SUCCESS : status;
+}
+#endif /* APR_HAS_THREADS */
+
 static int proxy_http2_handler(request_rec *r, 
                                proxy_worker *worker,
                                proxy_server_conf *conf,
@@ -311,13 +909,16 @@ static int proxy_http2_handler(request_rec *r,
                                apr_port_t proxyport)
 {
     const char *proxy_func;
-    char *locurl = url, *u;
+    char *u;
     apr_size_t slen;
     int is_ssl = 0;
     apr_status_t status;
     h2_proxy_ctx *ctx;
-    apr_uri_t uri;
     int reconnects = 0;
+#if APR_HAS_THREADS
+    h2_proxy_srv_conf *sconf;
+    h2_proxy_worker_ctx *wctx = NULL;
+#endif
     
     /* find the scheme */
     if ((url[0] != 'h' && url[0] != 'H') || url[1] != '2') {
@@ -365,63 +966,38 @@ static int proxy_http2_handler(request_rec *r,
     apr_table_setn(ctx->r->notes, H2_PROXY_REQ_URL_NOTE, url);
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, ctx->r, 
                   "H2: serving URL %s", url);
+
+#if APR_HAS_THREADS
+    /* Sharing sessions needs a worker bound to its backend */
+    sconf = ap_get_module_config(r->server->module_config,
+                                 &proxy_http2_module);
+    if (sconf->multiplex == 1 && !proxyname
+        && worker->s->is_address_reusable && !worker->s->disablereuse) {
+        wctx = worker_ctx_get(worker);
+    }
+#endif
     
 run_connect:    
     if (ctx->owner->aborted) goto cleanup;
 
-    /* Get a proxy_conn_rec from the worker, might be a new one, might
-     * be one still open from another request, or it might fail if the
-     * worker is stopped or in error. */
-    if ((status = ap_proxy_acquire_connection(ctx->proxy_func, &ctx->p_conn,
-                                              ctx->worker, ctx->server)) != OK) {
-        goto cleanup;
+#if APR_HAS_THREADS
+    if (wctx) {
+        if ((status = ctx_run_shared(ctx, wctx, url, proxyname,
+                                     proxyport)) != APR_SUCCESS) {
+            goto cleanup;
+        }
     }
+    else
+#endif
+    {
+        if ((status = ctx_connect(ctx, url, proxyname, proxyport)) != OK) {
+            goto cleanup;
+        }
 
-    ctx->p_conn->is_ssl = ctx->is_ssl;
-
-    /* Step One: Determine the URL to connect to (might be a proxy),
-     * initialize the backend accordingly and determine the server 
-     * port string we can expect in responses. */
-    if ((status = ap_proxy_determine_connection(ctx->pool, ctx->r, conf, worker, 
-                                                ctx->p_conn, &uri, &locurl, 
-                                                proxyname, proxyport, 
-                                                ctx->server_portstr,
-                                                sizeof(ctx->server_portstr))) != OK) {
-        goto cleanup;
-    }
-    
-    /* Step Two: Make the Connection (or check that an already existing
-     * socket is still usable). On success, we have a socket connected to
-     * backend->hostname. */
-    if (ap_proxy_connect_backend(ctx->proxy_func, ctx->p_conn, ctx->worker, 
-                                 ctx->server)) {
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(03352)
-                      "H2: failed to make connection to backend: %s",
-                      ctx->p_conn->hostname);
-        goto cleanup;
-    }
-    
-    /* Step Three: Create conn_rec for the socket we have open now. */
-    status = ap_proxy_connection_create_ex(ctx->proxy_func, ctx->p_conn, ctx->r);
-    if (status != OK) {
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, ctx->owner, APLOGNO(03353)
-                      "setup new connection: is_ssl=%d %s %s %s", 
-                      ctx->p_conn->is_ssl, ctx->p_conn->ssl_hostname, 
-                      locurl, ctx->p_conn->hostname);
-        ctx->r_status = status;
-        goto cleanup;
-    }
-    
-    if (!ctx->p_conn->data && ctx->is_ssl) {
-        /* New SSL connection: set a note on the connection about what
-         * protocol we need. */
-        apr_table_setn(ctx->p_conn->connection->notes,
-                       "proxy-request-alpn-protos", "h2");
+        if (ctx->owner->aborted) goto cleanup;
+        status = ctx_run(ctx);
     }
 
-    if (ctx->owner->aborted) goto cleanup;
-    status = ctx_run(ctx);
-
     if (ctx->r_status != APR_SUCCESS && ctx->r_may_retry && !ctx->owner->aborted) {
         /* Not successfully processed, but may retry, tear down old conn and start over */
         if (ctx->p_conn) {
@@ -460,9 +1036,68 @@ cleanup:
     return ctx->r_status;
 }
 
+static void *h2_proxy_create_sconf(apr_pool_t *p, server_rec *s)
+{
+    h2_proxy_srv_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+    (void)s;
+    conf->multiplex = -1;
+    return conf;
+}
+
+static void *h2_proxy_merge_sconf(apr_pool_t *p, void *basev, void *addv)
+{
+    h2_proxy_srv_conf *base = basev, *add = addv;
+    h2_proxy_srv_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+    conf->multiplex = (add->multiplex != -1)? add->multiplex : base->multiplex;
+    return conf;
+}
+
+static const char *h2_proxy_cmd_multiplex(cmd_parms *cmd, void *dirconf,
+                                          int flag)
+{
+    h2_proxy_srv_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                   &proxy_http2_module);
+
+    (void)dirconf;
+#if !APR_HAS_THREADS
+    if (flag) {
+        return "ProxyHTTP2Multiplex requires threads support in APR";
+    }
+#endif
+    conf->multiplex = flag;
+    return NULL;
+}
+
+static const command_rec h2_proxy_cmds[] = {
+    AP_INIT_FLAG("ProxyHTTP2Multiplex", h2_proxy_cmd_multiplex, NULL,
+                 RSRC_CONF, "Share the HTTP/2 backend sessions between "
+                 "concurrent requests, 'On' or 'Off' (default)"),
+    { NULL }
+};
+
+#if APR_HAS_THREADS
+static void h2_proxy_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+
+    h2_proxy_pchild = p;
+    rv = apr_thread_mutex_create(&h2_proxy_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10499)
+                     "could not create the mutex, sessions not shared");
+        h2_proxy_mutex = NULL;
+    }
+}
+#endif
+
 static void register_hook(apr_pool_t *p)
 {
     ap_hook_post_config(h2_proxy_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+#if APR_HAS_THREADS
+    ap_hook_child_init(h2_proxy_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
 
     proxy_hook_scheme_handler(proxy_http2_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_http2_canon, NULL, NULL, APR_HOOK_FIRST);
@@ -28,16 +28,22 @@ static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
 static int is_best_bybusyness(proxy_worker *current, proxy_worker *prev_best, void *baton)
 {
     int *total_factor = (int *)baton;
+    int lbstatus = ap_proxy_add_lbstatus(current, current->s->lbfactor);
+    apr_size_t busy = ap_proxy_get_busy_count(current);
+    apr_size_t prev_busy;
 
-    current->s->lbstatus += current->s->lbfactor;
     *total_factor += current->s->lbfactor;
 
+    if (!prev_best) {
+        return 1;
+    }
+    prev_busy = ap_proxy_get_busy_count(prev_best);
+
     return (
-        !prev_best
-        || (current->s->busy < prev_best->s->busy)
+        (busy < prev_busy)
         || (
-            (current->s->busy == prev_best->s->busy)
-            && (current->s->lbstatus > prev_best->s->lbstatus)
+            (busy == prev_busy)
+            && (lbstatus > ap_proxy_get_lbstatus(prev_best))
         )
     );
 }
@@ -51,7 +57,7 @@ static proxy_worker *find_best_bybusyness(proxy_balancer *balancer,
                                           &total_factor);
 
     if (worker) {
-        worker->s->lbstatus -= total_factor;
+        ap_proxy_add_lbstatus(worker, -total_factor);
     }
 
     return worker;
@@ -64,8 +70,8 @@ static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
     proxy_worker **worker;
     worker = (proxy_worker **)balancer->workers->elts;
     for (i = 0; i < balancer->workers->nelts; i++, worker++) {
-        (*worker)->s->lbstatus = 0;
-        (*worker)->s->busy = 0;
+        ap_proxy_set_lbstatus(*worker, 0);
+        ap_proxy_set_busy_count(*worker, 0);
     }
     return APR_SUCCESS;
 }
@@ -0,0 +1,559 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "ap_hooks.h"
+#include "ap_expr.h"
+#include "util_cookies.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_byhash_module;
+
+static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
+                            *ap_proxy_balancer_get_best_worker_fn = NULL;
+static APR_OPTIONAL_FN_TYPE(ap_proxy_retry_worker)
+                            *ap_proxy_retry_worker_fn = NULL;
+
+#define BYHASH_DEFAULT_BOUND 125
+
+typedef enum {
+    byhash_key_url,
+    byhash_key_header,
+    byhash_key_cookie,
+    byhash_key_expr
+} byhash_key_e;
+
+typedef struct {
+    byhash_key_e key;
+    const char *name;           /* header or cookie name */
+    ap_expr_info_t *expr;
+    int bound;                  /* max load of a worker in percent of the
+                                 * average, 0 for no bound */
+    unsigned int key_set:1;
+    unsigned int bound_set:1;
+} byhash_dir_conf;
+
+/*
+ * The Maglev lookup table of a balancer, hung to balancer->context.
+ *
+ * Each member worker fills the slots of its own permutation of the table,
+ * in turn, until the table is full. Adding or removing a member therefore
+ * only moves the slots it takes or leaves, the keys hashing to the other
+ * slots stay on their worker.
+ *
+ * The table is rebuilt whenever the set of members changes, into the
+ * entries not in use and published by switching "current", so lookups
+ * never wait for a rebuild.
+ */
+typedef struct {
+    apr_uint32_t size;          /* number of slots, a prime */
+    int capacity;               /* max number of members */
+    apr_uint32_t current;       /* the entries in use */
+    apr_uint32_t signature;     /* of the members the table was built for */
+    int *entries[2];            /* slot => index in balancer->workers */
+    int *index;                 /* the members, while building */
+    apr_uint32_t *offset;
+    apr_uint32_t *skip;
+    apr_uint32_t *weight;
+    apr_uint64_t *next;
+} byhash_table;
+
+/* A few primes, the table has about 100 slots per worker */
+static const apr_uint32_t byhash_sizes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521
+};
+
+/* FNV-1a, with the final mix of MurmurHash3 to spread the low bits */
+static apr_uint64_t byhash_hash(const char *key, apr_size_t len)
+{
+    apr_uint64_t h = APR_UINT64_C(0xcbf29ce484222325);
+    apr_size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= APR_UINT64_C(0x100000001b3);
+    }
+    h ^= h >> 33;
+    h *= APR_UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= APR_UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+
+    return h;
+}
+
+/*
+ * The members of the table are the usable workers of the lowest lbset
+ * which has any, spares and hot standbys left aside. Workers in error are
+ * given a chance to recover here, like ap_proxy_balancer_get_best_worker()
+ * does, since they would not be looked at otherwise.
+ */
+static int byhash_min_lbset(proxy_balancer *balancer, server_rec *s)
+{
+    int i, lbset = -1;
+
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        proxy_worker *worker = APR_ARRAY_IDX(balancer->workers, i,
+                                             proxy_worker *);
+        if (PROXY_WORKER_IS_SPARE(worker) || PROXY_WORKER_IS_STANDBY(worker)
+                || PROXY_WORKER_IS_DRAINING(worker)) {
+            continue;
+        }
+        if (!PROXY_WORKER_IS_USABLE(worker)) {
+            ap_proxy_retry_worker_fn("BALANCER", worker, s);
+        }
+        if (PROXY_WORKER_IS_USABLE(worker)
+                && (lbset < 0 || worker->s->lbset < lbset)) {
+            lbset = worker->s->lbset;
+        }
+    }
+
+    return lbset;
+}
+
+static APR_INLINE int byhash_is_member(proxy_worker *worker, int lbset)
+{
+    return (worker->s->lbset == lbset
+            && PROXY_WORKER_IS_USABLE(worker)
+            && !PROXY_WORKER_IS_SPARE(worker)
+            && !PROXY_WORKER_IS_STANDBY(worker)
+            && !PROXY_WORKER_IS_DRAINING(worker));
+}
+
+/* Identifies the members and their weights, and sums their load */
+static apr_uint32_t byhash_signature(proxy_balancer *balancer, int lbset,
+                                     int *count, apr_uint64_t *busy)
+{
+    apr_uint32_t sig = 2166136261U;
+    int i;
+
+    *count = 0;
+    *busy = 0;
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        proxy_worker *worker = APR_ARRAY_IDX(balancer->workers, i,
+                                             proxy_worker *);
+        if (lbset >= 0 && byhash_is_member(worker, lbset)) {
+            sig = (sig ^ (apr_uint32_t)i) * 16777619U;
+            sig = (sig ^ (apr_uint32_t)worker->s->lbfactor) * 16777619U;
+            *busy += ap_proxy_get_busy_count(worker);
+            (*count)++;
+        }
+    }
+    /* never 0, which is the signature of a table not built yet */
+    return sig ? sig : 1;
+}
+
+/* assumed to be mutex protected by caller */
+static void byhash_build(proxy_balancer *balancer, byhash_table *t,
+                         int lbset, apr_uint32_t sig)
+{
+    apr_uint32_t size = t->size, filled = 0, round = 0, wmax = 0;
+    apr_uint32_t inactive = !apr_atomic_read32(&t->current);
+    int *entries = t->entries[inactive];
+    int i, n = 0;
+
+    for (i = 0; i < balancer->workers->nelts && n < t->capacity; i++) {
+        proxy_worker *worker = APR_ARRAY_IDX(balancer->workers, i,
+                                             proxy_worker *);
+        if (lbset < 0 || !byhash_is_member(worker, lbset)) {
+            continue;
+        }
+        t->index[n] = i;
+        t->offset[n] = worker->hash.def % size;
+        t->skip[n] = worker->hash.fnv % (size - 1) + 1;
+        t->weight[n] = worker->s->lbfactor > 0 ? worker->s->lbfactor : 1;
+        t->next[n] = 0;
+        if (t->weight[n] > wmax) {
+            wmax = t->weight[n];
+        }
+        n++;
+    }
+
+    for (i = 0; i < (int)size; i++) {
+        entries[i] = -1;
+    }
+    if (n) {
+        /* Each round, a member takes weight/wmax turns in filling its next
+         * free slot, so that it gets its share of the table.
+         */
+        while (filled < size) {
+            for (i = 0; i < n && filled < size; i++) {
+                apr_uint64_t c;
+                if ((round + 1) * t->weight[i] / wmax
+                        == round * t->weight[i] / wmax) {
+                    continue;
+                }
+                do {
+                    c = (t->offset[i] + t->next[i] * t->skip[i]) % size;
+                    t->next[i]++;
+                } while (entries[c] >= 0);
+                entries[c] = t->index[i];
+                filled++;
+            }
+            round++;
+        }
+    }
+
+    apr_atomic_set32(&t->current, inactive);
+    apr_atomic_set32(&t->signature, sig);
+}
+
+static byhash_table *byhash_table_create(proxy_balancer *balancer)
+{
+    apr_pool_t *p = balancer->workers->pool;
+    byhash_table *t = apr_pcalloc(p, sizeof(*t));
+    int i;
+
+    t->capacity = balancer->max_workers > balancer->workers->nelts
+                  ? balancer->max_workers : balancer->workers->nelts;
+    if (t->capacity < 1) {
+        t->capacity = 1;
+    }
+    t->size = byhash_sizes[0];
+    for (i = 0; i < (int)(sizeof(byhash_sizes) / sizeof(byhash_sizes[0])); i++) {
+        t->size = byhash_sizes[i];
+        if (t->size >= (apr_uint32_t)t->capacity * 100) {
+            break;
+        }
+    }
+    t->entries[0] = apr_palloc(p, t->size * sizeof(int));
+    t->entries[1] = apr_palloc(p, t->size * sizeof(int));
+    t->index = apr_palloc(p, t->capacity * sizeof(int));
+    t->offset = apr_palloc(p, t->capacity * sizeof(apr_uint32_t));
+    t->skip = apr_palloc(p, t->capacity * sizeof(apr_uint32_t));
+    t->weight = apr_palloc(p, t->capacity * sizeof(apr_uint32_t));
+    t->next = apr_palloc(p, t->capacity * sizeof(apr_uint64_t));
+    for (i = 0; i < (int)t->size; i++) {
+        t->entries[0][i] = t->entries[1][i] = -1;
+    }
+
+    return t;
+}
+
+static const char *byhash_get_key(request_rec *r, byhash_dir_conf *conf,
+                                  apr_size_t *len)
+{
+    const char *key = NULL;
+
+    switch (conf->key) {
+    case byhash_key_header:
+        key = apr_table_get(r->headers_in, conf->name);
+        break;
+    case byhash_key_cookie:
+        ap_cookie_read(r, conf->name, &key, 0);
+        break;
+    case byhash_key_expr: {
+        const char *err = NULL;
+        key = ap_expr_str_exec(r, conf->expr, &err);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10467)
+                          "Can't evaluate BalancerHashKey expression: %s",
+                          err);
+            key = NULL;
+        }
+        break;
+    }
+    default:
+        key = r->unparsed_uri;
+        break;
+    }
+    if (key && !*key) {
+        key = NULL;
+    }
+    if (key) {
+        *len = strlen(key);
+    }
+
+    return key;
+}
+
+static int is_best_byhash(proxy_worker *current, proxy_worker *prev_best, void *baton)
+{
+    return (!prev_best
+            || ap_proxy_get_busy_count(current)
+               < ap_proxy_get_busy_count(prev_best));
+}
+
+/*
+ * The idea behind the find_best_byhash scheduler is the following:
+ *
+ * The key of the request (its URL by default) is hashed to a slot of the
+ * Maglev table of the balancer, which gives the worker. The same key thus
+ * always goes to the same worker, as long as the members don't change,
+ * which keeps the caches of the backends from all holding the same
+ * entities.
+ *
+ * To keep a popular key from overloading its worker, the load of a worker
+ * is bounded to BalancerHashBound percent of the average (in requests in
+ * flight). An overloaded worker makes the lookup go on to the next slots
+ * until a worker within the bound is found, so the overflow of a key goes
+ * to the same few workers too.
+ *
+ * Requests without a key, or when no member is usable, go to the least
+ * busy worker, spares and hot standbys included.
+ */
+static proxy_worker *find_best_byhash(proxy_balancer *balancer,
+                                      request_rec *r)
+{
+    byhash_dir_conf *conf = ap_get_module_config(r->per_dir_config,
+                                                 &lbmethod_byhash_module);
+    byhash_table *t = balancer->context;
+    const char *key;
+    apr_size_t len = 0;
+    apr_uint32_t sig, slot, i;
+    apr_uint64_t busy, capacity = 0;
+    int lbset, count, *entries;
+    apr_status_t rv;
+
+    key = byhash_get_key(r, conf, &len);
+    if (!key) {
+        goto fallback;
+    }
+
+    lbset = byhash_min_lbset(balancer, r->server);
+    sig = byhash_signature(balancer, lbset, &count, &busy);
+    if (!count) {
+        goto fallback;
+    }
+    if (!t || sig != apr_atomic_read32(&t->signature)) {
+#if APR_HAS_THREADS
+        if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10468)
+                          "%s: Lock failed for find_best_byhash()",
+                          balancer->s->name);
+            goto fallback;
+        }
+#endif
+        if (!balancer->context) {
+            balancer->context = byhash_table_create(balancer);
+        }
+        t = balancer->context;
+        if (sig != apr_atomic_read32(&t->signature)) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10469)
+                          "%s: rebuilding the hash table for %d workers",
+                          balancer->s->name, count);
+            byhash_build(balancer, t, lbset, sig);
+        }
+#if APR_HAS_THREADS
+        PROXY_THREAD_UNLOCK(balancer);
+#endif
+    }
+
+    if (conf->bound > 0) {
+        capacity = ((busy + 1) * conf->bound + 100 * count - 1)
+                   / (100 * count);
+    }
+
+    entries = t->entries[apr_atomic_read32(&t->current)];
+    slot = (apr_uint32_t)(byhash_hash(key, len) % t->size);
+    for (i = 0; i < t->size; i++) {
+        int idx = entries[(slot + i) % t->size];
+        proxy_worker *worker;
+        if (idx < 0 || idx >= balancer->workers->nelts) {
+            continue;
+        }
+        worker = APR_ARRAY_IDX(balancer->workers, idx, proxy_worker *);
+        if (!byhash_is_member(worker, lbset)) {
+            continue;
+        }
+        if (!capacity || ap_proxy_get_busy_count(worker) < capacity) {
+            return worker;
+        }
+    }
+
+fallback:
+    return ap_proxy_balancer_get_best_worker_fn(balancer, r, is_best_byhash,
+                                                NULL);
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int lbset, count;
+    apr_uint64_t busy;
+    apr_uint32_t sig;
+
+    /* Precompute the table, at child init or when the balancer-manager
+     * changed the balancer.
+     */
+    if (!balancer->context) {
+        balancer->context = byhash_table_create(balancer);
+    }
+    lbset = byhash_min_lbset(balancer, s);
+    sig = byhash_signature(balancer, lbset, &count, &busy);
+    byhash_build(balancer, balancer->context, lbset, sig);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method byhash =
+{
+    "byhash",
+    &find_best_byhash,
+    NULL,
+    &reset,
+    &age,
+    NULL
+};
+
+static void *create_byhash_dir_config(apr_pool_t *p, char *dummy)
+{
+    byhash_dir_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+    conf->key = byhash_key_url;
+    conf->bound = BYHASH_DEFAULT_BOUND;
+
+    return conf;
+}
+
+static void *merge_byhash_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    byhash_dir_conf *new = apr_pcalloc(p, sizeof(*new));
+    byhash_dir_conf *add = (byhash_dir_conf *)addv;
+    byhash_dir_conf *base = (byhash_dir_conf *)basev;
+
+    new->key = add->key_set ? add->key : base->key;
+    new->name = add->key_set ? add->name : base->name;
+    new->expr = add->key_set ? add->expr : base->expr;
+    new->key_set = add->key_set || base->key_set;
+    new->bound = add->bound_set ? add->bound : base->bound;
+    new->bound_set = add->bound_set || base->bound_set;
+
+    return new;
+}
+
+static const char *set_hash_key(cmd_parms *cmd, void *dconf,
+                                const char *type, const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+
+    if (!strcasecmp(type, "url")) {
+        if (arg) {
+            return "BalancerHashKey url takes no argument";
+        }
+        conf->key = byhash_key_url;
+    }
+    else if (!strcasecmp(type, "header") || !strcasecmp(type, "cookie")) {
+        if (!arg) {
+            return apr_pstrcat(cmd->pool, "BalancerHashKey ", type,
+                               " needs a name", NULL);
+        }
+        conf->key = (*type == 'h' || *type == 'H') ? byhash_key_header
+                                                   : byhash_key_cookie;
+        conf->name = arg;
+    }
+    else if (!strcasecmp(type, "expr")) {
+        const char *err = NULL;
+        if (!arg) {
+            return "BalancerHashKey expr needs an expression";
+        }
+        conf->expr = ap_expr_parse_cmd(cmd, arg, AP_EXPR_FLAG_STRING_RESULT,
+                                       &err, NULL);
+        if (err) {
+            return apr_pstrcat(cmd->pool,
+                               "Can't parse BalancerHashKey expression '",
+                               arg, "': ", err, NULL);
+        }
+        conf->key = byhash_key_expr;
+    }
+    else {
+        return "BalancerHashKey must be one of url, header, cookie or expr";
+    }
+    conf->key_set = 1;
+
+    return NULL;
+}
+
+static const char *set_hash_bound(cmd_parms *cmd, void *dconf,
+                                  const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+    char *end;
+    apr_int64_t val;
+
+    if (!strcasecmp(arg, "off")) {
+        conf->bound = 0;
+    }
+    else {
+        val = apr_strtoi64(arg, &end, 10);
+        if (*end || val <= 100 || val > 10000) {
+            return "BalancerHashBound must be 'off' or a percentage "
+                   "between 101 and 10000";
+        }
+        conf->bound = (int)val;
+    }
+    conf->bound_set = 1;
+
+    return NULL;
+}
+
+static const command_rec byhash_cmds[] =
+{
+    AP_INIT_TAKE12("BalancerHashKey", set_hash_key, NULL, RSRC_CONF|ACCESS_CONF,
+                   "What the byhash lbmethod hashes: url, header <name>, "
+                   "cookie <name> or expr <expression>"),
+    AP_INIT_TAKE1("BalancerHashBound", set_hash_bound, NULL, RSRC_CONF|ACCESS_CONF,
+                  "Maximum load of a worker for the byhash lbmethod, in "
+                  "percent of the average, or 'off'"),
+    {NULL}
+};
+
+/* post_config hook: */
+static int lbmethod_byhash_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptemp, server_rec *s)
+{
+
+    /* lbmethod_byhash_post_config() will be called twice during startup.  So, don't
+     * set up the static data the 1st time through. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    ap_proxy_balancer_get_best_worker_fn =
+                 APR_RETRIEVE_OPTIONAL_FN(proxy_balancer_get_best_worker);
+    ap_proxy_retry_worker_fn =
+                 APR_RETRIEVE_OPTIONAL_FN(ap_proxy_retry_worker);
+    if (!ap_proxy_balancer_get_best_worker_fn || !ap_proxy_retry_worker_fn) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10470)
+                     "mod_proxy must be loaded for mod_lbmethod_byhash");
+        return !OK;
+    }
+
+    return OK;
+}
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "byhash", "0", &byhash);
+    ap_hook_post_config(lbmethod_byhash_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(lbmethod_byhash) = {
+    STANDARD20_MODULE_STUFF,
+    create_byhash_dir_config,   /* create per-directory config structure */
+    merge_byhash_dir_config,    /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    byhash_cmds, /* command apr_table_t */
+    register_hook /* register hooks */
+};
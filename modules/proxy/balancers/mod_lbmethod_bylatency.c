@@ -0,0 +1,176 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "ap_hooks.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_bylatency_module;
+
+static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
+                            *ap_proxy_balancer_get_best_worker_fn = NULL;
+
+/*
+ * The candidates are sampled while ap_proxy_balancer_get_best_worker()
+ * walks the usable workers: two of them are kept at random (reservoir
+ * sampling), and the cheapest of the two is elected.
+ */
+typedef struct {
+    apr_uint32_t seen;
+    proxy_worker *choice[2];
+} bylatency_baton;
+
+static int is_best_bylatency(proxy_worker *current, proxy_worker *prev_best, void *baton)
+{
+    bylatency_baton *b = (bylatency_baton *)baton;
+    apr_uint32_t n = b->seen++;
+
+    if (n < 2) {
+        b->choice[n] = current;
+    }
+    else {
+        n = ap_random_pick(0, n);
+        if (n < 2) {
+            b->choice[n] = current;
+        }
+    }
+
+    /* The elected worker is picked from the baton, this only has to tell
+     * that there is one.
+     */
+    return !prev_best;
+}
+
+/*
+ * The cost of a worker is its (decayed) peak EWMA response time times
+ * the number of requests it has in flight, plus the one we would send,
+ * normalized by its lbfactor. A worker without latency samples yet costs
+ * one microsecond per request, so that it gets probed.
+ */
+static apr_uint64_t cost_bylatency(proxy_worker *worker, apr_time_t now)
+{
+    apr_uint64_t latency = ap_proxy_get_latency(worker, now);
+    apr_uint64_t busy = ap_proxy_get_busy_count(worker);
+    int lbfactor = worker->s->lbfactor > 0 ? worker->s->lbfactor : 1;
+
+    return (latency + 1) * (busy + 1) * 100 / lbfactor;
+}
+
+/*
+ * The idea behind the find_best_bylatency scheduler is the following:
+ *
+ * Each worker keeps a peak EWMA of its response times: a slower response
+ * than the current average is taken as is, faster ones only pull the
+ * average down progressively. Multiplied by the number of requests the
+ * worker is already busy with, this is an estimate of how long a new
+ * request would take there.
+ *
+ * Rather than the cheapest worker overall, which all the children would
+ * rush on at the same time, the cheapest of two workers chosen at random
+ * is elected (the "power of two choices"). This avoids herding while
+ * steering most of the load away from a worker which stalls, e.g. during
+ * a garbage collection pause.
+ */
+static proxy_worker *find_best_bylatency(proxy_balancer *balancer,
+                                         request_rec *r)
+{
+    bylatency_baton baton;
+    proxy_worker *worker;
+
+    memset(&baton, 0, sizeof(baton));
+    worker = ap_proxy_balancer_get_best_worker_fn(balancer, r,
+                                                  is_best_bylatency, &baton);
+    if (worker) {
+        worker = baton.choice[0];
+        if (baton.choice[1]) {
+            apr_time_t now = apr_time_now();
+            if (cost_bylatency(baton.choice[1], now)
+                    < cost_bylatency(worker, now)) {
+                worker = baton.choice[1];
+            }
+        }
+    }
+
+    return worker;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        apr_atomic_set32(&(*worker)->s->latency, 0);
+        proxy_atomic_set_time(&(*worker)->s->latency_updated, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method bylatency =
+{
+    "bylatency",
+    &find_best_bylatency,
+    NULL,
+    &reset,
+    &age,
+    NULL
+};
+
+/* post_config hook: */
+static int lbmethod_bylatency_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptemp, server_rec *s)
+{
+
+    /* lbmethod_bylatency_post_config() will be called twice during startup.  So, don't
+     * set up the static data the 1st time through. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    ap_proxy_balancer_get_best_worker_fn =
+                 APR_RETRIEVE_OPTIONAL_FN(proxy_balancer_get_best_worker);
+    if (!ap_proxy_balancer_get_best_worker_fn) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10466)
+                     "mod_proxy must be loaded for mod_lbmethod_bylatency");
+        return !OK;
+    }
+
+    return OK;
+}
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "bylatency", "0", &bylatency);
+    ap_hook_post_config(lbmethod_bylatency_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(lbmethod_bylatency) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,       /* create per-directory config structure */
+    NULL,       /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    NULL,       /* command apr_table_t */
+    register_hook /* register hooks */
+};
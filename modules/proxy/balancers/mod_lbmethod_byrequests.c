@@ -28,11 +28,11 @@ static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
 static int is_best_byrequests(proxy_worker *current, proxy_worker *prev_best, void *baton)
 {
     int *total_factor = (int *)baton;
+    int lbstatus = ap_proxy_add_lbstatus(current, current->s->lbfactor);
 
-    current->s->lbstatus += current->s->lbfactor;
     *total_factor += current->s->lbfactor;
 
-    return (!prev_best || (current->s->lbstatus > prev_best->s->lbstatus));
+    return (!prev_best || (lbstatus > ap_proxy_get_lbstatus(prev_best)));
 }
 
 /*
@@ -87,7 +87,7 @@ static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
     proxy_worker *worker = ap_proxy_balancer_get_best_worker_fn(balancer, r, is_best_byrequests, &total_factor);
 
     if (worker) {
-        worker->s->lbstatus -= total_factor;
+        ap_proxy_add_lbstatus(worker, -total_factor);
     }
 
     return worker;
@@ -100,7 +100,7 @@ static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
     proxy_worker **worker;
     worker = (proxy_worker **)balancer->workers->elts;
     for (i = 0; i < balancer->workers->nelts; i++, worker++) {
-        (*worker)->s->lbstatus = 0;
+        ap_proxy_set_lbstatus(*worker, 0);
     }
     return APR_SUCCESS;
 }
@@ -28,8 +28,8 @@ static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
 static int is_best_bytraffic(proxy_worker *current, proxy_worker *prev_best, void *baton)
 {
     apr_off_t *min_traffic = (apr_off_t *)baton;
-    apr_off_t traffic = (current->s->transferred / current->s->lbfactor)
-                        + (current->s->read / current->s->lbfactor);
+    apr_off_t traffic = (ap_proxy_get_transferred(current) / current->s->lbfactor)
+                        + (ap_proxy_get_read(current) / current->s->lbfactor);
 
     if (!prev_best || (traffic < *min_traffic)) {
         *min_traffic = traffic;
@@ -73,8 +73,8 @@ static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
     proxy_worker **worker;
     worker = (proxy_worker **)balancer->workers->elts;
     for (i = 0; i < balancer->workers->nelts; i++, worker++) {
-        (*worker)->s->lbstatus = 0;
-        (*worker)->s->busy = 0;
+        ap_proxy_set_lbstatus(*worker, 0);
+        ap_proxy_set_busy_count(*worker, 0);
         (*worker)->s->transferred = 0;
         (*worker)->s->read = 0;
     }
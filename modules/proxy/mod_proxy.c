@@ -21,6 +21,7 @@
 #include "scoreboard.h"
 #include "mod_status.h"
 #include "proxy_util.h"
+#include "mod_watchdog.h"
 
 #if (MODULE_MAGIC_NUMBER_MAJOR > 20020903)
 #include "mod_ssl.h"
@@ -43,6 +44,15 @@ APR_DECLARE_OPTIONAL_FN(int, ssl_engine_set, (conn_rec *,
  */
 static APR_OPTIONAL_FN_TYPE(set_worker_hc_param) *set_worker_hc_param_f = NULL;
 
+/*
+ * Likewise the idle connections of the workers with warm= and the address
+ * of those with addressttl= are maintained by a watchdog in each child only
+ * if mod_watchdog is loaded, otherwise the connections are established once
+ * in child_init and the addresses are resolved again by the requests.
+ */
+#define PROXY_WORKERS_WATCHDOG_NAME "_proxy_workers_"
+static ap_watchdog_t *proxy_workers_watchdog = NULL;
+
 /* Externals */
 proxy_hcmethods_t PROXY_DECLARE_DATA proxy_hcmethods[] = {
     {NONE, "NONE", 1},
@@ -135,6 +145,45 @@ static const char *set_worker_param(apr_pool_t *p,
             return "TTL must be at least one second";
         worker->s->ttl = apr_time_from_sec(ival);
     }
+    else if (!strcasecmp(key, "warm")) {
+        /* Number of idle connections to remote kept
+         * established in each child
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "Warm must be a positive number";
+        worker->s->warm = ival;
+    }
+    else if (!strcasecmp(key, "maxage")) {
+        /* Maximum lifetime of a connection to remote, in
+         * given unit (default is seconds)
+         */
+        if (ap_timeout_parameter_parse(val, &timeout, "s") != APR_SUCCESS)
+            return "MaxAge value has wrong format";
+        if (timeout < 1000)
+            return "MaxAge must be at least one millisecond";
+        worker->s->maxage = timeout;
+    }
+    else if (!strcasecmp(key, "maxidle")) {
+        /* Maximum time a connection to remote may stay
+         * unused in the pool, in given unit (default is seconds)
+         */
+        if (ap_timeout_parameter_parse(val, &timeout, "s") != APR_SUCCESS)
+            return "MaxIdle value has wrong format";
+        if (timeout < 1000)
+            return "MaxIdle must be at least one millisecond";
+        worker->s->maxidle = timeout;
+    }
+    else if (!strcasecmp(key, "addressttl")) {
+        /* Time to live of the resolved address of remote, in
+         * given unit (default is seconds)
+         */
+        if (ap_timeout_parameter_parse(val, &timeout, "s") != APR_SUCCESS)
+            return "AddressTTL value has wrong format";
+        if (timeout < 1000)
+            return "AddressTTL must be at least one millisecond";
+        worker->s->address_ttl = timeout;
+    }
     else if (!strcasecmp(key, "min")) {
         /* Initial number of connections to remote
          */
@@ -161,6 +210,22 @@ static const char *set_worker_param(apr_pool_t *p,
             return "Smax must be a positive number";
         worker->s->smax = ival;
     }
+    else if (!strcasecmp(key, "connectdelay")) {
+        /* Delay before trying the next address of the backend
+         * in parallel (Happy Eyeballs), in given unit (default
+         * is milliseconds), or "off" to try them in sequence.
+         */
+        if (!strcasecmp(val, "off")) {
+            worker->s->connect_delay = -1;
+        }
+        else {
+            if (ap_timeout_parameter_parse(val, &timeout, "ms") != APR_SUCCESS)
+                return "ConnectDelay value has wrong format";
+            if (timeout < 1000)
+                return "ConnectDelay must be at least one millisecond";
+            worker->s->connect_delay = timeout;
+        }
+    }
     else if (!strcasecmp(key, "acquire")) {
         /* Acquire timeout in given unit (default is milliseconds).
          * If set this will be the maximum time to
@@ -273,6 +338,19 @@ static const char *set_worker_param(apr_pool_t *p,
         else
             return "flushpackets must be on|off|auto";
     }
+    else if (!strcasecmp(key, "sendchunked")) {
+        /* Whether request bodies of unknown length are sent
+         * chunked, or spooled to send a Content-Length
+         */
+        if (!strcasecmp(val, "on"))
+            worker->s->sendchunked = PROXY_SENDCHUNKED_ON;
+        else if (!strcasecmp(val, "off"))
+            worker->s->sendchunked = PROXY_SENDCHUNKED_OFF;
+        else if (!strcasecmp(val, "probe"))
+            worker->s->sendchunked = PROXY_SENDCHUNKED_PROBE;
+        else
+            return "sendchunked must be on|off|probe";
+    }
     else if (!strcasecmp(key, "flushwait")) {
         if (ap_timeout_parameter_parse(val, &timeout, "ms") != APR_SUCCESS)
             return "flushwait has wrong format";
@@ -1018,9 +1096,209 @@ PROXY_DECLARE(int) ap_proxy_trans_match(request_rec *r, struct proxy_alias *ent,
     return HTTP_CONTINUE;
 }
 
+/*
+ * With many ProxyPass and ProxyPassMatch, walking all the aliases for each
+ * request shows, so at post_config they are compiled into:
+ * - a hash of the ProxyPass paths (slashes collapsed), which can only match
+ *   the prefixes of the URI-path (likewise) ending at a segment boundary,
+ *   so that a lookup per segment finds all the candidates,
+ * - a hash of the literal heads of the anchored ProxyPassMatch patterns,
+ *   looked up for each length of head configured,
+ * - the list of the other aliases (servlet mapping, interpolated paths,
+ *   patterns without a literal head), always candidates.
+ * This only prunes the aliases which cannot match, the candidates are still
+ * tried in the configuration order with ap_proxy_trans_match(), so the first
+ * match wins as before.
+ */
+#define PROXY_ALIASES_INDEX_MIN     16  /* below that, walking is cheaper */
+#define PROXY_ALIASES_CANDIDATES    32  /* above that, walk all the aliases */
+
+struct proxy_aliases_index {
+    apr_hash_t *paths;              /* path => apr_array_header_t of int */
+    apr_hash_t *heads;              /* head => apr_array_header_t of int */
+    apr_array_header_t *heads_len;  /* lengths of the heads (ascending) */
+    apr_array_header_t *others;     /* int (ascending) */
+};
+
+static char *alias_collapse_slashes(apr_pool_t *p, const char *path)
+{
+    char *collapsed = apr_palloc(p, strlen(path) + 1), *d = collapsed;
+
+    while (*path) {
+        if ((*d++ = *path++) == '/') {
+            while (*path == '/')
+                ++path;
+        }
+    }
+    *d = '\0';
+
+    return collapsed;
+}
+
+/* Length of the literal head of an anchored pattern, or zero */
+static apr_size_t alias_pattern_head(const char *pattern)
+{
+    const char *head = pattern + 1, *end = head;
+
+    /* An alternation could make the anchor or the head optional */
+    if (pattern[0] != '^' || ap_strchr_c(pattern, '|')) {
+        return 0;
+    }
+    while (*end && !ap_strchr_c(".[]()*+?{}^$\\", *end)) {
+        ++end;
+    }
+    /* The last character of the head is optional if quantified so */
+    if (end > head && (*end == '*' || *end == '?' || *end == '{')) {
+        --end;
+    }
+
+    return end - head;
+}
+
+static int compare_size(const void *a, const void *b)
+{
+    apr_size_t i = *(const apr_size_t *)a, j = *(const apr_size_t *)b;
+    return (i > j) - (i < j);
+}
+
+static void alias_index_add(apr_pool_t *p, apr_hash_t *hash,
+                            const char *key, apr_ssize_t klen, int i)
+{
+    apr_array_header_t *arr = apr_hash_get(hash, key, klen);
+    if (!arr) {
+        arr = apr_array_make(p, 1, sizeof(int));
+        apr_hash_set(hash, key, klen, arr);
+    }
+    APR_ARRAY_PUSH(arr, int) = i;
+}
+
+static struct proxy_aliases_index *proxy_index_aliases(apr_pool_t *p,
+                                                       apr_array_header_t *aliases)
+{
+    struct proxy_aliases_index *index;
+    struct proxy_alias *ent = (struct proxy_alias *)aliases->elts;
+    /* RegexDefaultOptions may turn on case-insensitive matching */
+    int icase = (ap_regcomp_get_default_cflags() & AP_REG_ICASE) != 0;
+    int i, j;
+
+    if (aliases->nelts < PROXY_ALIASES_INDEX_MIN) {
+        return NULL;
+    }
+
+    index = apr_pcalloc(p, sizeof(*index));
+    index->paths = apr_hash_make(p);
+    index->heads = apr_hash_make(p);
+    index->heads_len = apr_array_make(p, 4, sizeof(apr_size_t));
+    index->others = apr_array_make(p, 4, sizeof(int));
+    for (i = 0; i < aliases->nelts; ++i, ++ent) {
+        if (ent->regex) {
+            apr_size_t len = icase ? 0 : alias_pattern_head(ent->fake);
+            if (len) {
+                alias_index_add(p, index->heads, ent->fake + 1, len, i);
+                for (j = 0; j < index->heads_len->nelts; ++j) {
+                    if (APR_ARRAY_IDX(index->heads_len, j, apr_size_t) == len) {
+                        break;
+                    }
+                }
+                if (j == index->heads_len->nelts) {
+                    APR_ARRAY_PUSH(index->heads_len, apr_size_t) = len;
+                }
+                continue;
+            }
+        }
+        else if (ent->fake[0] == '/'
+                 && !(ent->flags & PROXYPASS_INTERPOLATE)
+                 && (ent->flags & PROXYPASS_MAP_SERVLET) != PROXYPASS_MAP_SERVLET) {
+            alias_index_add(p, index->paths,
+                            alias_collapse_slashes(p, ent->fake),
+                            APR_HASH_KEY_STRING, i);
+            continue;
+        }
+        APR_ARRAY_PUSH(index->others, int) = i;
+    }
+    qsort(index->heads_len->elts, index->heads_len->nelts,
+          sizeof(apr_size_t), compare_size);
+
+    return index;
+}
+
+static int alias_index_hits(apr_hash_t *hash, const char *key,
+                            apr_size_t klen, int *hits, int n)
+{
+    apr_array_header_t *arr;
+
+    if (n >= 0 && (arr = apr_hash_get(hash, key, klen))) {
+        if (n + arr->nelts > PROXY_ALIASES_CANDIDATES) {
+            return -1;
+        }
+        memcpy(hits + n, arr->elts, arr->nelts * sizeof(int));
+        n += arr->nelts;
+    }
+    return n;
+}
+
+/* Collects in hits the indexed aliases which may match the URI-path,
+ * returns how many or -1 if there are too many.
+ */
+static int alias_index_lookup(request_rec *r,
+                              const struct proxy_aliases_index *index,
+                              int *hits)
+{
+    const char *uri = r->uri;
+    apr_size_t i, len = strlen(uri);
+    int n = 0;
+
+    for (i = 0; i < (apr_size_t)index->heads_len->nelts; ++i) {
+        apr_size_t hlen = APR_ARRAY_IDX(index->heads_len, i, apr_size_t);
+        if (hlen > len) {
+            break;
+        }
+        n = alias_index_hits(index->heads, uri, hlen, hits, n);
+    }
+
+    if (apr_hash_count(index->paths)) {
+        if (strstr(uri, "//")) {
+            uri = alias_collapse_slashes(r->pool, uri);
+            len = strlen(uri);
+        }
+        for (i = 0; i < len && n >= 0; ++i) {
+            if (uri[i] == '/') {
+                /* "/path" and "/path/" may match "/path/..." */
+                if (i > 0) {
+                    n = alias_index_hits(index->paths, uri, i, hits, n);
+                }
+                n = alias_index_hits(index->paths, uri, i + 1, hits, n);
+            }
+        }
+        if (len > 0 && uri[len - 1] != '/') {
+            n = alias_index_hits(index->paths, uri, len, hits, n);
+        }
+    }
+
+    return n;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static APR_INLINE int proxy_trans_alias(request_rec *r,
+                                        struct proxy_alias *ent,
+                                        proxy_dir_conf *dconf,
+                                        int pre_trans)
+{
+    int enc = (ent->flags & PROXYPASS_MAP_ENCODED) != 0;
+    if (pre_trans ^ enc) {
+        return HTTP_CONTINUE;
+    }
+    return ap_proxy_trans_match(r, ent, dconf);
+}
+
 static int proxy_trans(request_rec *r, int pre_trans)
 {
-    int i, enc;
+    int i, n, rv;
+    int hits[PROXY_ALIASES_CANDIDATES];
     struct proxy_alias *ent;
     proxy_dir_conf *dconf;
     proxy_server_conf *conf;
@@ -1064,24 +1342,42 @@ static int proxy_trans(request_rec *r, int pre_trans)
 
     /* short way - this location is reverse proxied? */
     if (dconf->alias) {
-        enc = (dconf->alias->flags & PROXYPASS_MAP_ENCODED) != 0;
-        if (!(pre_trans ^ enc)) {
-            int rv = ap_proxy_trans_match(r, dconf->alias, dconf);
+        rv = proxy_trans_alias(r, dconf->alias, dconf, pre_trans);
+        if (rv != HTTP_CONTINUE) {
+            return rv;
+        }
+    }
+
+    ent = (struct proxy_alias *)conf->aliases->elts;
+
+    /* compiled way - try the candidates only, in order */
+    if (conf->aliases_index
+            && (n = alias_index_lookup(r, conf->aliases_index, hits)) >= 0) {
+        const apr_array_header_t *others = conf->aliases_index->others;
+        int j = 0, k = 0;
+
+        qsort(hits, n, sizeof(int), compare_int);
+        while (j < n || k < others->nelts) {
+            if (k == others->nelts
+                    || (j < n && hits[j] < APR_ARRAY_IDX(others, k, int))) {
+                i = hits[j++];
+            }
+            else {
+                i = APR_ARRAY_IDX(others, k++, int);
+            }
+            rv = proxy_trans_alias(r, &ent[i], dconf, pre_trans);
             if (rv != HTTP_CONTINUE) {
                 return rv;
             }
         }
+        return DECLINED;
     }
 
     /* long way - walk the list of aliases, find a match */
     for (i = 0; i < conf->aliases->nelts; i++) {
-        ent = &((struct proxy_alias *)conf->aliases->elts)[i];
-        enc = (ent->flags & PROXYPASS_MAP_ENCODED) != 0;
-        if (!(pre_trans ^ enc)) {
-            int rv = ap_proxy_trans_match(r, ent, dconf);
-            if (rv != HTTP_CONTINUE) {
-                return rv;
-            }
+        rv = proxy_trans_alias(r, &ent[i], dconf, pre_trans);
+        if (rv != HTTP_CONTINUE) {
+            return rv;
         }
     }
 
@@ -1277,6 +1573,24 @@ static int proxy_needsdomain(request_rec *r, const char *url, const char *domain
 /* -------------------------------------------------------------- */
 /* Invoke handler */
 
+/* The request of a scheme handler which returned SUSPENDED is completed
+ * later from an MPM callback, so post_request is run when it's destroyed.
+ */
+typedef struct {
+    request_rec *r;
+    proxy_worker *worker;
+    proxy_balancer *balancer;
+    proxy_server_conf *conf;
+} proxy_suspended_rec;
+
+static apr_status_t proxy_suspended_cleanup(void *data)
+{
+    proxy_suspended_rec *sr = data;
+
+    ap_proxy_post_request(sr->worker, sr->balancer, sr->r, sr->conf);
+    return APR_SUCCESS;
+}
+
 static int proxy_handler(request_rec *r)
 {
     char *uri, *scheme, *p;
@@ -1578,6 +1892,18 @@ static int proxy_handler(request_rec *r)
         goto cleanup;
     }
 cleanup:
+    /* Not done yet, the scheme handler will complete the request */
+    if (access_status == SUSPENDED) {
+        proxy_suspended_rec *sr = apr_palloc(r->pool, sizeof(*sr));
+        sr->r = r;
+        sr->worker = worker;
+        sr->balancer = balancer;
+        sr->conf = conf;
+        apr_pool_pre_cleanup_register(r->pool, sr, proxy_suspended_cleanup);
+        AP_PROXY_RUN_FINISHED(r, attempts, access_status);
+        return SUSPENDED;
+    }
+
     /*
      * Save current r->status and set it to the value of access_status which
      * might be different (e.g. r->status could be HTTP_OK if e.g. we override
@@ -3190,6 +3516,110 @@ PROXY_DECLARE(const char *) ap_proxy_ssl_val(apr_pool_t *p, server_rec *s,
     return ap_ssl_var_lookup(p, s, c, r, var);
 }
 
+static void proxy_maintain_worker(proxy_worker *worker, server_rec *s,
+                                  apr_pool_t *p, int in_child_init)
+{
+    if (!worker->cp || !(worker->local_status & PROXY_WORKER_INITIALIZED)) {
+        return;
+    }
+    if (worker->s->address_ttl > 0 && !in_child_init) {
+        ap_proxy_refresh_worker_address(worker, s);
+    }
+    /* The single connection of a worker (no reslist) is not thread safe,
+     * it can only be warmed before the requests are served. The reslist is
+     * filled by the watchdog, if any, so that child_init does not wait for
+     * the backends.
+     */
+    if (worker->s->warm > 0
+            && (worker->cp->res ? !in_child_init || !proxy_workers_watchdog
+                                : in_child_init)) {
+        ap_proxy_warm_worker(worker->s->scheme, worker, s, p);
+    }
+}
+
+#define PROXY_WORKER_NEEDS_MAINTENANCE(w) \
+    ((w)->s->warm > 0 || (w)->s->address_ttl > 0)
+
+static int proxy_maintain_workers(server_rec *s, apr_pool_t *p,
+                                  int in_child_init)
+{
+    int needed = 0;
+
+    for (; s; s = s->next) {
+        proxy_server_conf *conf =
+            ap_get_module_config(s->module_config, &proxy_module);
+        proxy_balancer *balancer;
+        proxy_worker *worker;
+        int i, n;
+
+        worker = (proxy_worker *)conf->workers->elts;
+        for (i = 0; i < conf->workers->nelts; i++, worker++) {
+            if (p) {
+                proxy_maintain_worker(worker, s, p, in_child_init);
+            }
+            needed |= PROXY_WORKER_NEEDS_MAINTENANCE(worker);
+        }
+        balancer = (proxy_balancer *)conf->balancers->elts;
+        for (i = 0; i < conf->balancers->nelts; i++, balancer++) {
+            proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; n++) {
+                if (p) {
+                    proxy_maintain_worker(workers[n], s, p, in_child_init);
+                }
+                needed |= PROXY_WORKER_NEEDS_MAINTENANCE(workers[n]);
+            }
+        }
+    }
+
+    return needed;
+}
+
+static apr_status_t proxy_workers_watchdog_callback(int state, void *data,
+                                                    apr_pool_t *pool)
+{
+    if (state == AP_WATCHDOG_STATE_RUNNING) {
+        proxy_maintain_workers((server_rec *)data, pool, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static int proxy_workers_post_config(apr_pool_t *pconf, server_rec *main_s)
+{
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+    apr_status_t rv;
+
+    proxy_workers_watchdog = NULL;
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG
+            || !proxy_maintain_workers(main_s, NULL, 0)) {
+        return OK;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register_callback) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, main_s, APLOGNO(10478)
+                     "mod_watchdog is not loaded, the warm connections "
+                     "and the addresses of the workers won't be maintained "
+                     "in the background");
+        return OK;
+    }
+    rv = wd_get_instance(&proxy_workers_watchdog, PROXY_WORKERS_WATCHDOG_NAME,
+                         0, 0, pconf);
+    if (rv == APR_SUCCESS) {
+        rv = wd_register_callback(proxy_workers_watchdog, AP_WD_TM_INTERVAL,
+                                  main_s, proxy_workers_watchdog_callback);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, main_s, APLOGNO(10479)
+                     "Failed to create watchdog instance (%s)",
+                     PROXY_WORKERS_WATCHDOG_NAME);
+        return !OK;
+    }
+
+    return OK;
+}
+
 static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *main_s)
 {
@@ -3222,9 +3652,11 @@ static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                 return rc;
             }
         }
+
+        sconf->aliases_index = proxy_index_aliases(pconf, sconf->aliases);
     }
 
-    return OK;
+    return proxy_workers_post_config(pconf, main_s);
 }
 
 /*
@@ -3272,6 +3704,7 @@ static int proxy_status_hook(request_rec *r, int flags)
                      "<th>Sch</th><th>Host</th><th>Stat</th>"
                      "<th>Route</th><th>Redir</th>"
                      "<th>F</th><th>Set</th><th>Acc</th><th>Busy</th><th>Wr</th><th>Rd</th>"
+                     "<th>Hits</th><th>Miss</th><th>Spl</th>"
                      "</tr>\n", r);
         }
         else {
@@ -3296,7 +3729,13 @@ static int proxy_status_hook(request_rec *r, int flags)
                 ap_rputs(apr_strfsize((*worker)->s->transferred, fbuf), r);
                 ap_rputs("</td><td>", r);
                 ap_rputs(apr_strfsize((*worker)->s->read, fbuf), r);
-                ap_rputs("</td>\n", r);
+                ap_rprintf(r, "</td><td>%" APR_SIZE_T_FMT "</td>",
+                           (*worker)->s->pool_hits);
+                ap_rprintf(r, "<td>%" APR_SIZE_T_FMT "</td><td>",
+                           (*worker)->s->pool_misses);
+                ap_rputs(apr_strfsize((*worker)->s->spooled, fbuf), r);
+                ap_rprintf(r, " (%" APR_SIZE_T_FMT ")</td>\n",
+                           (*worker)->s->spooled_reqs);
 
                 /* TODO: Add the rest of dynamic worker data */
                 ap_rputs("</tr>\n", r);
@@ -3318,6 +3757,18 @@ static int proxy_status_hook(request_rec *r, int flags)
                 ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]Rcvd: %"
                               APR_OFF_T_FMT "K\n",
                            i, n, (*worker)->s->read >> 10);
+                ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]PoolHits: %"
+                              APR_SIZE_T_FMT "\n",
+                           i, n, (*worker)->s->pool_hits);
+                ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]PoolMisses: %"
+                              APR_SIZE_T_FMT "\n",
+                           i, n, (*worker)->s->pool_misses);
+                ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]Spooled: %"
+                              APR_OFF_T_FMT "K\n",
+                           i, n, (*worker)->s->spooled >> 10);
+                ap_rprintf(r, "ProxyBalancer[%d]Worker[%d]SpooledRequests: %"
+                              APR_SIZE_T_FMT "\n",
+                           i, n, (*worker)->s->spooled_reqs);
 
                 /* TODO: Add the rest of dynamic worker data */
             }
@@ -3342,6 +3793,9 @@ static int proxy_status_hook(request_rec *r, int flags)
                  "<tr><th>Acc</th><td>Number of uses</td></tr>\n"
                  "<tr><th>Wr</th><td>Number of bytes transferred</td></tr>\n"
                  "<tr><th>Rd</th><td>Number of bytes read</td></tr>\n"
+                 "<tr><th>Hits</th><td>Number of pooled connections reused</td></tr>\n"
+                 "<tr><th>Miss</th><td>Number of connections established for requests</td></tr>\n"
+                 "<tr><th>Spl</th><td>Number of request body bytes (bodies) spooled</td></tr>\n"
                  "</table>", r);
     }
 
@@ -3351,6 +3805,7 @@ static int proxy_status_hook(request_rec *r, int flags)
 static void child_init(apr_pool_t *p, server_rec *s)
 {
     proxy_worker *reverse = NULL;
+    server_rec *main_s = s;
 
     apr_status_t rv = apr_global_mutex_child_init(&proxy_mutex,
                                       apr_global_mutex_lockfile(proxy_mutex),
@@ -3422,6 +3877,18 @@ static void child_init(apr_pool_t *p, server_rec *s)
         conf->reverse = reverse;
         s = s->next;
     }
+
+    /* Balancers' workers are initialized already (mod_proxy_balancer's
+     * child_init runs first), establish the warm connections which the
+     * watchdog can't (with a bounded connect timeout) now.
+     */
+    if (proxy_maintain_workers(main_s, NULL, 1)) {
+        apr_pool_t *ptemp;
+        apr_pool_create(&ptemp, p);
+        apr_pool_tag(ptemp, "proxy_warm");
+        proxy_maintain_workers(main_s, ptemp, 1);
+        apr_pool_destroy(ptemp);
+    }
 }
 
 /*
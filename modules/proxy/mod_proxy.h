@@ -47,6 +47,8 @@
 #include "util_mutex.h"
 #include "apr_global_mutex.h"
 #include "apr_thread_mutex.h"
+#include "apr_atomic.h"
+#include "apr_version.h"
 
 #include "httpd.h"
 #include "http_config.h"
@@ -113,6 +115,7 @@ typedef struct {
 typedef struct proxy_balancer  proxy_balancer;
 typedef struct proxy_worker    proxy_worker;
 typedef struct proxy_conn_pool proxy_conn_pool;
+typedef struct proxy_address proxy_address;
 typedef struct proxy_balancer_method proxy_balancer_method;
 
 /* static information about a remote proxy */
@@ -209,6 +212,7 @@ typedef struct {
     unsigned int ppinherit_set:1;
     unsigned int map_encoded_one:1;
     unsigned int map_encoded_all:1;
+    struct proxy_aliases_index *aliases_index; /* aliases compiled at post_config */
 } proxy_server_conf;
 
 typedef struct {
@@ -294,6 +298,9 @@ typedef struct {
                                 * and its scpool/bucket_alloc (NULL before),
                                 * must be left cleaned when used (locally).
                                 */
+    apr_time_t   established;  /* When the socket was connected */
+    apr_time_t   released;     /* When the connection was last released */
+    proxy_address *address;    /* Worker's address in use (refcounted) */
 } proxy_conn_rec;
 
 typedef struct {
@@ -304,10 +311,13 @@ typedef struct {
 /* Connection pool */
 struct proxy_conn_pool {
     apr_pool_t     *pool;     /* The pool used in constructor and destructor calls */
-    apr_sockaddr_t *addr;     /* Preparsed remote address info */
+    apr_sockaddr_t *addr;     /* Preparsed remote address info (of address below,
+                               * use conn->addr which remains valid for the
+                               * connection when the address is refreshed) */
     apr_reslist_t  *res;      /* Connection resource list */
     proxy_conn_rec *conn;     /* Single connection for prefork mpm */
     apr_pool_t     *dns_pool; /* The pool used for worker scoped DNS resolutions */
+    proxy_address  *address;  /* Refcounted address of the worker */
 };
 
 #define AP_VOLATILIZE_T(T, x) (*(T volatile *)&(x))
@@ -488,6 +498,21 @@ typedef struct {
     unsigned int     was_malloced:1;
     unsigned int     is_name_matchable:1;
     unsigned int     response_field_size_set:1;
+    apr_uint32_t    latency;    /* peak EWMA of the response time (usec) */
+    apr_time_t      latency_updated; /* time of the last latency sample */
+    int             warm;       /* Number of idle connections to keep established */
+    apr_interval_time_t maxage;  /* maximum lifetime of a connection */
+    apr_interval_time_t maxidle; /* maximum idle time of a connection */
+    apr_size_t      pool_hits;  /* Number of times a pooled connection was reused */
+    apr_size_t      pool_misses;/* Number of times a connection was established */
+    apr_interval_time_t connect_delay; /* delay between parallel connects, -1 for sequential */
+    int             family;     /* address family of the last connect */
+    apr_interval_time_t address_ttl; /* time to live of the resolved address */
+    int             sendchunked; /* chunked request bodies, PROXY_SENDCHUNKED_* */
+    apr_uint32_t    sendchunked_probed; /* what the probe learned, PROXY_SENDCHUNKED_PROBED_* */
+    apr_size_t      spooled_reqs; /* Number of request bodies spooled */
+    apr_off_t       spooled;    /* Number of request body bytes spooled */
+    apr_time_t      sendchunked_retry; /* when to probe again after a failure */
 } proxy_worker_shared;
 
 #define ALIGNED_PROXY_WORKER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_worker_shared)))
@@ -515,6 +540,22 @@ struct proxy_worker {
  */
 #define PROXY_FLUSH_WAIT 10000
 
+/*
+ * Whether the request bodies of unknown length can be sent to the backend
+ * with chunked transfer-encoding (sendchunked=), otherwise they are spooled
+ * to determine their Content-Length.
+ */
+#define PROXY_SENDCHUNKED_UNSET 0   /* unless "proxy-sendcl" is set */
+#define PROXY_SENDCHUNKED_ON    1   /* always */
+#define PROXY_SENDCHUNKED_OFF   2   /* never */
+#define PROXY_SENDCHUNKED_PROBE 3   /* if the backend accepts them (OPTIONS) */
+
+#define PROXY_SENDCHUNKED_PROBED_UNKNOWN 0
+#define PROXY_SENDCHUNKED_PROBED_YES     1
+#define PROXY_SENDCHUNKED_PROBED_NO      2
+#define PROXY_SENDCHUNKED_PROBED_BUSY    3  /* being probed */
+#define PROXY_SENDCHUNKED_PROBED_FAILED  4  /* no answer, until sendchunked_retry */
+
 typedef struct {
     char      sticky_path[PROXY_BALANCER_MAX_STICKY_SIZE];     /* URL sticky session identifier */
     char      sticky[PROXY_BALANCER_MAX_STICKY_SIZE];          /* sticky session identifier */
@@ -573,6 +614,8 @@ struct proxy_balancer {
 
 struct proxy_balancer_method {
     const char *name;            /* name of the load balancer method*/
+    /* called without the balancer lock, see ap_proxy_add_lbstatus() and
+     * friends for updating the workers */
     proxy_worker *(*finder)(proxy_balancer *balancer,
                             request_rec *r);
     void            *context;   /* general purpose storage */
@@ -589,6 +632,229 @@ struct proxy_balancer_method {
 #define PROXY_THREAD_UNLOCK(x)    (APR_SUCCESS)
 #endif
 
+/*
+ * The request path selects and accounts for the workers of a balancer
+ * without holding the balancer lock, so the counters of
+ * proxy_worker_shared it touches are updated atomically. 64bit atomics
+ * need APR 1.7, before that the 64bit counters get plain updates.
+ */
+#if APR_VERSION_AT_LEAST(1,7,0)
+#define PROXY_HAS_ATOMIC64 1
+#else
+#define PROXY_HAS_ATOMIC64 0
+#endif
+
+static APR_INLINE apr_size_t proxy_atomic_read_size(volatile apr_size_t *mem)
+{
+#if APR_SIZEOF_VOIDP == 4
+    return (apr_size_t)apr_atomic_read32((volatile apr_uint32_t *)mem);
+#elif PROXY_HAS_ATOMIC64
+    return (apr_size_t)apr_atomic_read64((volatile apr_uint64_t *)mem);
+#else
+    return *mem;
+#endif
+}
+
+static APR_INLINE void proxy_atomic_set_size(volatile apr_size_t *mem,
+                                             apr_size_t val)
+{
+#if APR_SIZEOF_VOIDP == 4
+    apr_atomic_set32((volatile apr_uint32_t *)mem, (apr_uint32_t)val);
+#elif PROXY_HAS_ATOMIC64
+    apr_atomic_set64((volatile apr_uint64_t *)mem, (apr_uint64_t)val);
+#else
+    *mem = val;
+#endif
+}
+
+static APR_INLINE void proxy_atomic_inc_size(volatile apr_size_t *mem)
+{
+#if APR_SIZEOF_VOIDP == 4
+    apr_atomic_inc32((volatile apr_uint32_t *)mem);
+#elif PROXY_HAS_ATOMIC64
+    apr_atomic_inc64((volatile apr_uint64_t *)mem);
+#else
+    (*mem)++;
+#endif
+}
+
+/* Decrement, but never below zero */
+static APR_INLINE void proxy_atomic_dec_size(volatile apr_size_t *mem)
+{
+#if APR_SIZEOF_VOIDP == 4
+    apr_uint32_t val;
+    do {
+        val = apr_atomic_read32((volatile apr_uint32_t *)mem);
+        if (!val) {
+            return;
+        }
+    } while (apr_atomic_cas32((volatile apr_uint32_t *)mem,
+                              val - 1, val) != val);
+#elif PROXY_HAS_ATOMIC64
+    apr_uint64_t val;
+    do {
+        val = apr_atomic_read64((volatile apr_uint64_t *)mem);
+        if (!val) {
+            return;
+        }
+    } while (apr_atomic_cas64((volatile apr_uint64_t *)mem,
+                              val - 1, val) != val);
+#else
+    if (*mem) {
+        (*mem)--;
+    }
+#endif
+}
+
+static APR_INLINE apr_off_t proxy_atomic_read_off(volatile apr_off_t *mem)
+{
+#if PROXY_HAS_ATOMIC64
+    if (sizeof(apr_off_t) == sizeof(apr_uint64_t)) {
+        return (apr_off_t)apr_atomic_read64((volatile apr_uint64_t *)mem);
+    }
+#endif
+    if (sizeof(apr_off_t) == sizeof(apr_uint32_t)) {
+        return (apr_off_t)apr_atomic_read32((volatile apr_uint32_t *)mem);
+    }
+    return *mem;
+}
+
+static APR_INLINE void proxy_atomic_add_off(volatile apr_off_t *mem,
+                                            apr_off_t val)
+{
+#if PROXY_HAS_ATOMIC64
+    if (sizeof(apr_off_t) == sizeof(apr_uint64_t)) {
+        apr_atomic_add64((volatile apr_uint64_t *)mem, (apr_uint64_t)val);
+        return;
+    }
+#endif
+    if (sizeof(apr_off_t) == sizeof(apr_uint32_t)) {
+        apr_atomic_add32((volatile apr_uint32_t *)mem, (apr_uint32_t)val);
+        return;
+    }
+    *mem += val;
+}
+
+/* The number of requests in flight on the worker */
+#define ap_proxy_get_busy_count(w)      proxy_atomic_read_size(&(w)->s->busy)
+#define ap_proxy_set_busy_count(w, n)   proxy_atomic_set_size(&(w)->s->busy, (n))
+#define ap_proxy_increase_busy_count(w) proxy_atomic_inc_size(&(w)->s->busy)
+#define ap_proxy_decrease_busy_count(w) proxy_atomic_dec_size(&(w)->s->busy)
+
+/* The number of times the worker was elected */
+#define ap_proxy_increase_elected(w)    proxy_atomic_inc_size(&(w)->s->elected)
+
+/* The number of connections reused from the pool, or established, for
+ * the requests
+ */
+#define ap_proxy_increase_pool_hits(w)   proxy_atomic_inc_size(&(w)->s->pool_hits)
+#define ap_proxy_increase_pool_misses(w) proxy_atomic_inc_size(&(w)->s->pool_misses)
+
+/* The lbstatus of the worker, ap_proxy_add_lbstatus() returns the
+ * value it set
+ */
+#define ap_proxy_get_lbstatus(w) \
+    ((int)apr_atomic_read32((volatile apr_uint32_t *)&(w)->s->lbstatus))
+#define ap_proxy_set_lbstatus(w, n) \
+    apr_atomic_set32((volatile apr_uint32_t *)&(w)->s->lbstatus, \
+                     (apr_uint32_t)(n))
+#define ap_proxy_add_lbstatus(w, n) \
+    ((int)(apr_atomic_add32((volatile apr_uint32_t *)&(w)->s->lbstatus, \
+                            (apr_uint32_t)(n)) + (apr_uint32_t)(n)))
+
+/* The response time of the worker is tracked as a peak EWMA: a sample
+ * above the current value replaces it, otherwise the value decays toward
+ * the samples with a time constant of PROXY_LATENCY_DECAY.
+ */
+#define PROXY_LATENCY_DECAY apr_time_from_sec(10)
+
+static APR_INLINE apr_uint32_t proxy_latency_ewma(apr_uint32_t prev,
+                                                  apr_uint32_t sample,
+                                                  apr_interval_time_t dt)
+{
+    apr_uint64_t tau = PROXY_LATENCY_DECAY;
+
+    if (dt <= 0) {
+        return prev;
+    }
+    if ((apr_uint64_t)dt > tau * 64) {
+        return sample;
+    }
+    return (apr_uint32_t)(((apr_uint64_t)prev * tau
+                           + (apr_uint64_t)sample * (apr_uint64_t)dt)
+                          / (tau + (apr_uint64_t)dt));
+}
+
+static APR_INLINE apr_time_t proxy_atomic_read_time(volatile apr_time_t *mem)
+{
+#if PROXY_HAS_ATOMIC64
+    return (apr_time_t)apr_atomic_read64((volatile apr_uint64_t *)mem);
+#else
+    return *mem;
+#endif
+}
+
+static APR_INLINE void proxy_atomic_set_time(volatile apr_time_t *mem,
+                                             apr_time_t val)
+{
+#if PROXY_HAS_ATOMIC64
+    apr_atomic_set64((volatile apr_uint64_t *)mem, (apr_uint64_t)val);
+#else
+    *mem = val;
+#endif
+}
+
+/* The current latency of the worker, decayed since the last sample */
+static APR_INLINE apr_uint32_t ap_proxy_get_latency(proxy_worker *worker,
+                                                    apr_time_t now)
+{
+    apr_uint32_t prev = apr_atomic_read32(&worker->s->latency);
+    return proxy_latency_ewma(prev, 0,
+            now - proxy_atomic_read_time(&worker->s->latency_updated));
+}
+
+/* Account a response time sample (usec) to the worker. The new value is
+ * only set if no other sample was accounted in between, otherwise it is
+ * computed again from the value that one left.
+ */
+static APR_INLINE void ap_proxy_add_latency(proxy_worker *worker,
+                                            apr_interval_time_t sample,
+                                            apr_time_t now)
+{
+    apr_uint32_t prev, val;
+    apr_time_t updated;
+
+    if (sample < 0) {
+        sample = 0;
+    }
+    else if (sample > APR_UINT32_MAX) {
+        sample = APR_UINT32_MAX;
+    }
+
+    do {
+        prev = apr_atomic_read32(&worker->s->latency);
+        updated = proxy_atomic_read_time(&worker->s->latency_updated);
+        val = (apr_uint32_t)sample;
+        if (val <= prev) {
+            val = proxy_latency_ewma(prev, val, now - updated);
+        }
+    } while (apr_atomic_cas32(&worker->s->latency, val, prev) != prev);
+
+    /* the time of the last sample only moves forward */
+    if (updated < now) {
+        proxy_atomic_set_time(&worker->s->latency_updated, now);
+    }
+}
+
+/* The traffic of the worker */
+#define ap_proxy_get_transferred(w)     proxy_atomic_read_off(&(w)->s->transferred)
+#define ap_proxy_get_read(w)            proxy_atomic_read_off(&(w)->s->read)
+#define ap_proxy_add_transferred(w, n)  proxy_atomic_add_off(&(w)->s->transferred, (n))
+#define ap_proxy_add_read(w, n)         proxy_atomic_add_off(&(w)->s->read, (n))
+#define ap_proxy_get_spooled(w)         proxy_atomic_read_off(&(w)->s->spooled)
+#define ap_proxy_add_spooled(w, n)      proxy_atomic_add_off(&(w)->s->spooled, (n))
+#define ap_proxy_increase_spooled_reqs(w) proxy_atomic_inc_size(&(w)->s->spooled_reqs)
+
 #define PROXY_GLOBAL_LOCK(x)      ( (x) && (x)->gmutex ? apr_global_mutex_lock((x)->gmutex) : APR_SUCCESS)
 #define PROXY_GLOBAL_UNLOCK(x)    ( (x) && (x)->gmutex ? apr_global_mutex_unlock((x)->gmutex) : APR_SUCCESS)
 
@@ -1120,6 +1386,7 @@ PROXY_DECLARE(int) ap_proxy_release_connection(const char *proxy_function,
  *         APR_ENOTEMPTY: connection established with data,
  *         APR_ENOSOCKET: not connected,
  *         APR_EINVAL: worker in error state (unusable),
+ *         APR_TIMEUP: connection expired (maxage/maxidle), closed,
  *         other: connection closed/aborted (remotely)
  */
 PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
@@ -1143,6 +1410,54 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                                             proxy_worker *worker,
                                             server_rec *s);
 
+/**
+ * Establish the idle connections of a worker's pool, up to its warm=
+ * parameter, in the calling process.
+ * @param proxy_function calling proxy scheme (http, ajp, ...)
+ * @param worker  worker to warm
+ * @param s       current server record
+ * @param p       pool for temporary allocations
+ * @return        number of connections established
+ * @note Expired connections are closed and established again. Only the
+ * TCP connection is made: TLS workers (and UDS ones) are not warmed.
+ */
+PROXY_DECLARE(int) ap_proxy_warm_worker(const char *proxy_function,
+                                        proxy_worker *worker,
+                                        server_rec *s,
+                                        apr_pool_t *p);
+
+/**
+ * Resolve the address of a worker again if it expires soon (addressttl=),
+ * and publish it to the threads of the calling process.
+ * @param worker  worker to refresh
+ * @param s       current server record
+ * @return        whether the worker's address changed
+ * @note The connections to the previous address are not reused anymore,
+ * those in use keep it valid until they are released.
+ */
+PROXY_DECLARE(int) ap_proxy_refresh_worker_address(proxy_worker *worker,
+                                                   server_rec *s);
+
+/**
+ * Get the address of hostname:port for a worker which does not use
+ * ap_proxy_determine_connection(). If the worker's address is reusable,
+ * this is the worker's one, resolved the first time and then refreshed
+ * like for the requests, otherwise hostname is resolved in p.
+ * @param worker   worker to connect to
+ * @param hostname host to resolve
+ * @param port     port to resolve
+ * @param p        pool for the lifetime of the returned address
+ * @param s        current server record
+ * @param addr     returned address(es)
+ * @return         APR_SUCCESS or the resolver's error
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_get_worker_address(proxy_worker *worker,
+                                                        const char *hostname,
+                                                        apr_port_t port,
+                                                        apr_pool_t *p,
+                                                        server_rec *s,
+                                                        apr_sockaddr_t **addr);
+
 /**
  * Make a connection to a Unix Domain Socket (UDS) path
  * @param sock     UDS to connect
@@ -237,7 +237,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
         conn->close = 1;
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00868)
                       "request failed to %pI (%s:%d)",
-                      conn->worker->cp->addr,
+                      conn->addr,
                       conn->worker->s->hostname_ex,
                       (int)conn->worker->s->port);
         if (status == AJP_EOVERFLOW)
@@ -335,7 +335,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                 apr_brigade_destroy(input_brigade);
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00876)
                               "send failed to %pI (%s:%d)",
-                              conn->worker->cp->addr,
+                              conn->addr,
                               conn->worker->s->hostname_ex,
                               (int)conn->worker->s->port);
                 /*
@@ -344,7 +344,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                  */
                 return HTTP_INTERNAL_SERVER_ERROR;
             }
-            conn->worker->s->transferred += bufsiz;
+            ap_proxy_add_transferred(conn->worker, bufsiz);
             send_body = 1;
         }
         else if (content_length > 0) {
@@ -377,7 +377,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
         apr_brigade_destroy(input_brigade);
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00878)
                       "read response failed from %pI (%s:%d)",
-                      conn->worker->cp->addr,
+                      conn->addr,
                       conn->worker->s->hostname_ex,
                       (int)conn->worker->s->port);
 
@@ -467,7 +467,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                         backend_failed = 1;
                         break;
                     }
-                    conn->worker->s->transferred += bufsiz;
+                    ap_proxy_add_transferred(conn->worker, bufsiz);
                 } else {
                     /*
                      * something is wrong TC asks for more body but we are
@@ -556,7 +556,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                             }
                             apr_brigade_length(output_brigade, 0, &bb_len);
                             if (bb_len != -1)
-                                conn->worker->s->read += bb_len;
+                                ap_proxy_add_read(conn->worker, bb_len);
                         }
                         if (headers_sent) {
                             if (ap_pass_brigade(r->output_filters,
@@ -677,7 +677,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
     else {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00892)
                       "got response from %pI (%s:%d)",
-                      conn->worker->cp->addr,
+                      conn->addr,
                       conn->worker->s->hostname_ex,
                       (int)conn->worker->s->port);
 
@@ -702,7 +702,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
     if (backend_failed) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00893)
                       "dialog to %pI (%s:%d) failed",
-                      conn->worker->cp->addr,
+                      conn->addr,
                       conn->worker->s->hostname_ex,
                       (int)conn->worker->s->port);
         /*
@@ -847,7 +847,7 @@ static int proxy_ajp_handler(request_rec *r, proxy_worker *worker,
                 backend->close = 1;
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00897)
                               "cping/cpong failed to %pI (%s:%d)",
-                              worker->cp->addr, worker->s->hostname_ex,
+                              backend->addr, worker->s->hostname_ex,
                               (int)worker->s->port);
                 status = HTTP_SERVICE_UNAVAILABLE;
                 retry++;
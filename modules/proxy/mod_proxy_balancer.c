@@ -364,33 +364,21 @@ static proxy_worker *find_session_route(proxy_balancer *balancer,
         return NULL;
 }
 
+/* Response time accounted to a worker for an error */
+#define PROXY_LATENCY_ERROR apr_time_from_sec(1)
+
 static proxy_worker *find_best_worker(proxy_balancer *balancer,
                                       request_rec *r)
 {
     proxy_worker *candidate = NULL;
-    apr_status_t rv;
-
-#if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01163)
-                      "%s: Lock failed for find_best_worker()",
-                      balancer->s->name);
-        return NULL;
-    }
-#endif
 
+    /* No balancer lock here, the lbmethods account for the workers
+     * with the atomic helpers of mod_proxy.h.
+     */
     candidate = (*balancer->lbmethod->finder)(balancer, r);
 
     if (candidate)
-        candidate->s->elected++;
-
-#if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01164)
-                      "%s: Unlock failed for find_best_worker()",
-                      balancer->s->name);
-    }
-#endif
+        ap_proxy_increase_elected(candidate);
 
     if (candidate == NULL) {
         /* All the workers are in error state or disabled.
@@ -474,6 +462,15 @@ static void force_recovery(proxy_balancer *balancer, server_rec *s)
     if (!ok && balancer->s->forcerecovery) {
         /* If all workers are in error state force the recovery.
          */
+#if APR_HAS_THREADS
+        apr_status_t rv;
+        if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10465)
+                         "%s: Lock failed for force_recovery()",
+                         balancer->s->name);
+            return;
+        }
+#endif
         worker = (proxy_worker **)balancer->workers->elts;
         for (i = 0; i < balancer->workers->nelts; i++, worker++) {
             ++(*worker)->s->retries;
@@ -483,16 +480,17 @@ static void force_recovery(proxy_balancer *balancer, server_rec *s)
                          balancer->s->name, (*worker)->s->hostname_ex,
                          (int)(*worker)->s->port);
         }
+#if APR_HAS_THREADS
+        PROXY_THREAD_UNLOCK(balancer);
+#endif
     }
 }
 
 static apr_status_t decrement_busy_count(void *worker_)
 {
     proxy_worker *worker = worker_;
-    
-    if (worker->s->busy) {
-        worker->s->busy--;
-    }
+
+    ap_proxy_decrease_busy_count(worker);
 
     return APR_SUCCESS;
 }
@@ -506,6 +504,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     proxy_worker *runtime;
     char *route = NULL;
     const char *sticky = NULL;
+    apr_time_t *start;
     apr_status_t rv;
 
     *worker = NULL;
@@ -518,30 +517,52 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         !(*balancer = ap_proxy_get_balancer(r->pool, conf, *url, 1)))
         return DECLINED;
 
-    /* Step 2: Lock the LoadBalancer
-     * XXX: perhaps we need the process lock here
+    /* Step 2: Update member list for the balancer, the lock is only
+     * taken when the balancer-manager changed something.
+     * TODO: Implement as provider!
      */
+    if ((*balancer)->s->wupdated > (*balancer)->wupdated) {
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01166)
-                      "%s: Lock failed for pre_request", (*balancer)->s->name);
-        return DECLINED;
-    }
+        if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01166)
+                          "%s: Lock failed for pre_request", (*balancer)->s->name);
+            return DECLINED;
+        }
 #endif
+        ap_proxy_sync_balancer(*balancer, r->server, conf);
+#if APR_HAS_THREADS
+        if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01169)
+                          "%s: Unlock failed for pre_request",
+                          (*balancer)->s->name);
+        }
+#endif
+    }
 
     /* Step 3: force recovery */
     force_recovery(*balancer, r->server);
 
-    /* Step 3.5: Update member list for the balancer */
-    /* TODO: Implement as provider! */
-    ap_proxy_sync_balancer(*balancer, r->server, conf);
-
     /* Step 4: find the session route */
     runtime = find_session_route(*balancer, r, &route, &sticky, url);
     if (runtime) {
         if ((*balancer)->lbmethod && (*balancer)->lbmethod->updatelbstatus) {
-            /* Call the LB implementation */
+            /* Call the LB implementation, which may expect the lock */
+#if APR_HAS_THREADS
+            if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01163)
+                              "%s: Lock failed for updatelbstatus()",
+                              (*balancer)->s->name);
+                return DECLINED;
+            }
+#endif
             (*balancer)->lbmethod->updatelbstatus(*balancer, runtime, r->server);
+#if APR_HAS_THREADS
+            if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01164)
+                              "%s: Unlock failed for updatelbstatus()",
+                              (*balancer)->s->name);
+            }
+#endif
         }
         else { /* Use the default one */
             int i, total_factor = 0;
@@ -557,14 +578,14 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
                  * not in error state or not disabled.
                  */
                 if (PROXY_WORKER_IS_USABLE(*workers)) {
-                    (*workers)->s->lbstatus += (*workers)->s->lbfactor;
+                    ap_proxy_add_lbstatus(*workers, (*workers)->s->lbfactor);
                     total_factor += (*workers)->s->lbfactor;
                 }
                 workers++;
             }
-            runtime->s->lbstatus -= total_factor;
+            ap_proxy_add_lbstatus(runtime, -total_factor);
         }
-        runtime->s->elected++;
+        ap_proxy_increase_elected(runtime);
 
         *worker = runtime;
     }
@@ -588,24 +609,10 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01167)
                           "%s: All workers are in error state for route (%s)",
                           (*balancer)->s->name, route);
-#if APR_HAS_THREADS
-            if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01168)
-                              "%s: Unlock failed for pre_request",
-                              (*balancer)->s->name);
-            }
-#endif
             return HTTP_SERVICE_UNAVAILABLE;
         }
     }
 
-#if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01169)
-                      "%s: Unlock failed for pre_request",
-                      (*balancer)->s->name);
-    }
-#endif
     if (!*worker) {
         runtime = find_best_worker(*balancer, r);
         if (!runtime) {
@@ -635,10 +642,19 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         *worker = runtime;
     }
 
-    (*worker)->s->busy++;
+    ap_proxy_increase_busy_count(*worker);
     apr_pool_cleanup_register(r->pool, *worker, decrement_busy_count,
                               apr_pool_cleanup_null);
 
+    /* Remember when the request went to the worker, for its latency */
+    start = ap_get_module_config(r->request_config, &proxy_balancer_module);
+    if (!start) {
+        start = apr_palloc(r->pool, sizeof(*start));
+        ap_set_module_config(r->request_config, &proxy_balancer_module,
+                             start);
+    }
+    *start = apr_time_now();
+
     /* Add balancer/worker info to env. */
     apr_table_setn(r->subprocess_env,
                    "BALANCER_NAME", (*balancer)->s->name);
@@ -676,17 +692,22 @@ static int proxy_balancer_post_request(proxy_worker *worker,
                                        request_rec *r,
                                        proxy_server_conf *conf)
 {
+    int in_error = 0;
+    apr_time_t *start;
 
-    apr_status_t rv;
-
-#if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01173)
-                      "%s: Lock failed for post_request",
-                      balancer->s->name);
-        return HTTP_INTERNAL_SERVER_ERROR;
+    /* Sample the response time of the worker, an error counts as at least
+     * PROXY_LATENCY_ERROR so that a failing worker does not look fast.
+     */
+    start = ap_get_module_config(r->request_config, &proxy_balancer_module);
+    if (start) {
+        apr_time_t now = apr_time_now();
+        apr_interval_time_t sample = now - *start;
+        if (ap_is_HTTP_SERVER_ERROR(r->status)
+                && sample < PROXY_LATENCY_ERROR) {
+            sample = PROXY_LATENCY_ERROR;
+        }
+        ap_proxy_add_latency(worker, sample, now);
     }
-#endif
 
     if (!apr_is_empty_array(balancer->errstatuses)
         && !(worker->s->status & PROXY_WORKER_IGNORE_ERRORS)) {
@@ -700,8 +721,7 @@ static int proxy_balancer_post_request(proxy_worker *worker,
                               "balancer parameter",
                               balancer->s->name, ap_proxy_worker_name(r->pool, worker),
                               val);
-                worker->s->status |= PROXY_WORKER_IN_ERROR;
-                worker->s->error_time = apr_time_now();
+                in_error = 1;
                 break;
             }
         }
@@ -714,16 +734,30 @@ static int proxy_balancer_post_request(proxy_worker *worker,
                       "%s: Forcing worker (%s) into error state "
                       "due to timeout and 'failontimeout' parameter being set",
                        balancer->s->name, ap_proxy_worker_name(r->pool, worker));
+        in_error = 1;
+    }
+
+    /* Only a worker going into error state needs the lock */
+    if (in_error) {
+#if APR_HAS_THREADS
+        apr_status_t rv;
+        if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01173)
+                          "%s: Lock failed for post_request",
+                          balancer->s->name);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+#endif
         worker->s->status |= PROXY_WORKER_IN_ERROR;
         worker->s->error_time = apr_time_now();
-
-    }
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01175)
-                      "%s: Unlock failed for post_request", balancer->s->name);
-    }
+        if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01175)
+                          "%s: Unlock failed for post_request",
+                          balancer->s->name);
+        }
 #endif
+    }
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01176)
                   "proxy_balancer_post_request for (%s)", balancer->s->name);
 
@@ -742,12 +776,13 @@ static void recalc_factors(proxy_balancer *balancer)
      * load factor will always be 100
      */
     if (balancer->workers->nelts == 1) {
-        (*workers)->s->lbstatus = (*workers)->s->lbfactor = 100;
+        (*workers)->s->lbfactor = 100;
+        ap_proxy_set_lbstatus(*workers, 100);
         return;
     }
     for (i = 0; i < balancer->workers->nelts; i++) {
         /* Update the status entries */
-        workers[i]->s->lbstatus = workers[i]->s->lbfactor;
+        ap_proxy_set_lbstatus(workers[i], workers[i]->s->lbfactor);
     }
 }
 
@@ -981,6 +1016,20 @@ static int balancer_post_config(apr_pool_t *pconf, apr_pool_t *plog,
             PROXY_STRNCPY(balancer->s->sname, sname); /* We know this will succeed */
 
             balancer->max_workers = balancer->workers->nelts + balancer->growth;
+            /* Reserve room for the workers the balancer-manager may add, so
+             * that ap_proxy_sync_balancer() never moves the array under the
+             * lbmethods walking it without the lock.
+             */
+            if (balancer->workers->nalloc < balancer->max_workers) {
+                char *elts = apr_pcalloc(pconf, balancer->max_workers
+                                                * balancer->workers->elt_size);
+                if (balancer->workers->nelts) {
+                    memcpy(elts, balancer->workers->elts,
+                           balancer->workers->nelts * balancer->workers->elt_size);
+                }
+                balancer->workers->elts = elts;
+                balancer->workers->nalloc = balancer->max_workers;
+            }
             /* Create global mutex */
             rv = ap_global_mutex_create(&(balancer->gmutex), NULL, balancer_mutex_type,
                                         balancer->s->sname, s, pconf, 0);
@@ -1567,6 +1616,18 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                 ap_rprintf(r,
                            "          <httpd:elected>%" APR_SIZE_T_FMT "</httpd:elected>\n",
                            worker->s->elected);
+                ap_rprintf(r,
+                           "          <httpd:poolhits>%" APR_SIZE_T_FMT "</httpd:poolhits>\n",
+                           worker->s->pool_hits);
+                ap_rprintf(r,
+                           "          <httpd:poolmisses>%" APR_SIZE_T_FMT "</httpd:poolmisses>\n",
+                           worker->s->pool_misses);
+                ap_rprintf(r,
+                           "          <httpd:spooled>%" APR_OFF_T_FMT "</httpd:spooled>\n",
+                           worker->s->spooled);
+                ap_rprintf(r,
+                           "          <httpd:spooledrequests>%" APR_SIZE_T_FMT "</httpd:spooledrequests>\n",
+                           worker->s->spooled_reqs);
                 ap_rvputs(r, "          <httpd:route>",
                           ap_escape_html(r->pool, worker->s->route),
                           "</httpd:route>\n", NULL);
@@ -1721,7 +1782,8 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                 "<th>Worker URL</th>"
                 "<th>Route</th><th>RouteRedir</th>"
                 "<th>Factor</th><th>Set</th><th>Status</th>"
-                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>", r);
+                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>"
+                "<th>Pool Hits</th><th>Pool Misses</th><th>Spooled</th>", r);
             if (set_worker_hc_param_f) {
                 ap_rputs("<th>HC Method</th><th>HC Interval</th><th>Passes</th><th>Fails</th><th>HC uri</th><th>HC Expr</th>", r);
             }
@@ -1753,6 +1815,10 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                 ap_rputs(apr_strfsize(worker->s->transferred, fbuf), r);
                 ap_rputs("</td><td>", r);
                 ap_rputs(apr_strfsize(worker->s->read, fbuf), r);
+                ap_rprintf(r, "</td><td>%" APR_SIZE_T_FMT "</td>", worker->s->pool_hits);
+                ap_rprintf(r, "<td>%" APR_SIZE_T_FMT "</td><td>", worker->s->pool_misses);
+                ap_rputs(apr_strfsize(worker->s->spooled, fbuf), r);
+                ap_rprintf(r, " (%" APR_SIZE_T_FMT ")", worker->s->spooled_reqs);
                 if (set_worker_hc_param_f) {
                     ap_rprintf(r, "</td><td>%s</td>", ap_proxy_show_hcmethod(worker->s->method));
                     ap_rprintf(r, "<td>%" APR_TIME_T_FMT "ms</td>", apr_time_as_msec(worker->s->interval));
@@ -18,6 +18,7 @@
 #include "util_fcgi.h"
 #include "util_script.h"
 #include "ap_expr.h"
+#include "apr_thread_cond.h"
 
 module AP_MODULE_DECLARE_DATA proxy_fcgi_module;
 
@@ -49,6 +50,15 @@ typedef struct {
     apr_array_header_t *env_fixups;
 } fcgi_dirconf_t;
 
+typedef struct {
+    int multiplex;
+} fcgi_srvconf_t;
+
+/* A request on a multiplexed connection */
+typedef struct fcgi_stream fcgi_stream;
+
+#define FCGI_SCHEME "FCGI"
+
 /*
  * Canonicalise http-like URLs.
  * scheme is the scheme for the URL
@@ -264,7 +274,7 @@ static apr_status_t send_data(proxy_conn_rec *conn,
         }
     }
 
-    conn->worker->s->transferred += written;
+    ap_proxy_add_transferred(conn->worker, written);
     *len = written;
 
     return rv;
@@ -278,12 +288,13 @@ static apr_status_t get_data(proxy_conn_rec *conn,
     apr_status_t rv = apr_socket_recv(conn->sock, buffer, buflen);
 
     if (rv == APR_SUCCESS) {
-        conn->worker->s->read += *buflen;
+        ap_proxy_add_read(conn->worker, *buflen);
     }
 
     return rv;
 }
 
+#if APR_HAS_THREADS
 static apr_status_t get_data_full(proxy_conn_rec *conn,
                                   char *buffer,
                                   apr_size_t buflen)
@@ -304,7 +315,899 @@ static apr_status_t get_data_full(proxy_conn_rec *conn,
     return APR_SUCCESS;
 }
 
+/* How long to wait for the answer to FCGI_GET_VALUES, which applications
+ * not knowing about it may never send.
+ */
+#define FCGI_GET_VALUES_TIMEOUT apr_time_from_sec(1)
+
+/* Name-value pairs of FCGI_GET_VALUES, with the empty values */
+static const char fcgi_get_values_body[] =
+    "\017\000" "FCGI_MPXS_CONNS"
+    "\015\000" "FCGI_MAX_REQS";
+
+/* Decodes the length of a name or value in a name-value pair */
+static int fcgi_pair_len(const unsigned char **cur, const unsigned char *end,
+                         apr_size_t *len)
+{
+    const unsigned char *p = *cur;
+
+    if (p >= end) {
+        return 0;
+    }
+    if (!(p[0] & 0x80)) {
+        *len = p[0];
+        *cur = p + 1;
+    }
+    else {
+        if (end - p < 4) {
+            return 0;
+        }
+        *len = ((apr_size_t)(p[0] & 0x7f) << 24) | ((apr_size_t)p[1] << 16)
+               | ((apr_size_t)p[2] << 8) | p[3];
+        *cur = p + 4;
+    }
+    return 1;
+}
+
+/* Sends FCGI_GET_VALUES and parses the answer, see fcgi_get_values() */
+static apr_status_t fcgi_get_values_exchange(proxy_conn_rec *conn,
+                                             request_rec *r,
+                                             int *mpxs, int *max_reqs)
+{
+    struct iovec vec[2];
+    ap_fcgi_header header;
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    unsigned char type, version, plen;
+    apr_uint16_t rid, clen;
+    const unsigned char *cur, *end;
+    char padding[255], *body;
+    apr_size_t len;
+    apr_status_t rv;
+
+    ap_fcgi_fill_in_header(&header, AP_FCGI_GET_VALUES, 0,
+                           sizeof(fcgi_get_values_body) - 1, 0);
+    ap_fcgi_header_to_array(&header, farray);
+    vec[0].iov_base = (void *)farray;
+    vec[0].iov_len = sizeof(farray);
+    vec[1].iov_base = (void *)fcgi_get_values_body;
+    vec[1].iov_len = sizeof(fcgi_get_values_body) - 1;
+    rv = send_data(conn, vec, 2, &len);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = get_data_full(conn, (char *)farray, AP_FCGI_HEADER_LEN);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    ap_fcgi_header_fields_from_array(&version, &type, &rid, &clen, &plen,
+                                     farray);
+    if (version != AP_FCGI_VERSION_1 || rid != 0
+            || (type != AP_FCGI_GET_VALUES_RESULT
+                && type != AP_FCGI_UNKNOWN_TYPE)) {
+        return APR_EINVAL;
+    }
+    body = apr_palloc(r->pool, clen + 1);
+    if (clen) {
+        rv = get_data_full(conn, body, clen);
+    }
+    if (rv == APR_SUCCESS && plen) {
+        rv = get_data_full(conn, padding, plen);
+    }
+    if (rv != APR_SUCCESS || type == AP_FCGI_UNKNOWN_TYPE) {
+        return rv;
+    }
+
+    cur = (const unsigned char *)body;
+    end = cur + clen;
+    while (cur < end) {
+        apr_size_t nlen, vlen;
+        const char *name;
+        char *value;
+
+        if (!fcgi_pair_len(&cur, end, &nlen)
+                || !fcgi_pair_len(&cur, end, &vlen)
+                || nlen > (apr_size_t)(end - cur)
+                || vlen > (apr_size_t)(end - cur) - nlen) {
+            return APR_EINVAL;
+        }
+        name = (const char *)cur;
+        value = apr_pstrmemdup(r->pool, name + nlen, vlen);
+        if (nlen == 15 && !memcmp(name, "FCGI_MPXS_CONNS", 15)) {
+            *mpxs = (atoi(value) > 0);
+        }
+        else if (nlen == 13 && !memcmp(name, "FCGI_MAX_REQS", 13)) {
+            *max_reqs = atoi(value);
+        }
+        cur += nlen + vlen;
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Asks the application whether it multiplexes connections (FCGI_MPXS_CONNS)
+ * and how many requests it handles at once (FCGI_MAX_REQS), before any
+ * request on this connection. *mpxs and *max_reqs are left untouched for the
+ * variables the application does not know about. The answer is waited for
+ * FCGI_GET_VALUES_TIMEOUT at most.
+ */
+static apr_status_t fcgi_get_values(proxy_conn_rec *conn, request_rec *r,
+                                    int *mpxs, int *max_reqs)
+{
+    apr_interval_time_t timeout;
+    apr_status_t rv;
+
+    /* Don't hold the request for the whole backend timeout */
+    apr_socket_timeout_get(conn->sock, &timeout);
+    if (timeout < 0 || timeout > FCGI_GET_VALUES_TIMEOUT) {
+        apr_socket_timeout_set(conn->sock, FCGI_GET_VALUES_TIMEOUT);
+    }
+    rv = fcgi_get_values_exchange(conn, r, mpxs, max_reqs);
+    apr_socket_timeout_set(conn->sock, timeout);
+
+    return rv;
+}
+
+/*
+ * Multiplexing (ProxyFCGIMultiplex on).
+ *
+ * When the application says it multiplexes (FCGI_MPXS_CONNS=1), concurrent
+ * requests of this child to the same worker share its connections, each
+ * request (stream) with its own id. A connection taken from the worker's
+ * pool is held by a mux for as long as it has streams, and released to the
+ * pool (kept alive) when the last one leaves.
+ *
+ * The records are written whole by one stream at a time. They are read by
+ * whichever stream needs one while no other stream is reading, and queued
+ * to the stream they belong to (leader/follower), so no thread is dedicated
+ * to a connection.
+ *
+ * FastCGI has no flow control per request, so when a stream does not keep
+ * up with what the application sends for it (e.g. slow client), the
+ * connection is not read anymore once FCGI_MUX_MAX_QUEUED bytes are queued
+ * for that stream, until it consumed them. This holds back the other
+ * streams of the connection too, rather than buffering without bounds.
+ */
+#define FCGI_MUX_MAX_STREAMS 64 /* per connection, unless FCGI_MAX_REQS */
+#define FCGI_MUX_MAX_QUEUED (4 * AP_FCGI_MAX_CONTENT_LEN) /* per stream */
+
+typedef struct fcgi_record fcgi_record;
+typedef struct fcgi_mux fcgi_mux;
+
+typedef struct {
+    apr_thread_mutex_t *mutex;  /* protects the muxes and their streams */
+    apr_thread_cond_t *cond;    /* signaled on any change */
+    fcgi_mux *muxes;            /* connections with streams */
+    int mpxs;                   /* FCGI_MPXS_CONNS, or -1 if not known yet */
+    int max_reqs;               /* streams per connection */
+} fcgi_worker_ctx;
+
+struct fcgi_record {
+    fcgi_record *next;
+    apr_uint16_t rid;
+    unsigned char type;
+    apr_size_t len;             /* content, padding stripped */
+    char *data;                 /* allocated with the record, past it */
+};
+
+struct fcgi_stream {
+    fcgi_stream *next;
+    fcgi_mux *mux;
+    apr_uint16_t rid;
+    fcgi_record *first, *last;  /* received but not handled yet */
+    apr_size_t queued;          /* content length of the above */
+    fcgi_record *rec;           /* being handled */
+    unsigned int ended:1;       /* FCGI_END_REQUEST received */
+};
+
+struct fcgi_mux {
+    fcgi_mux *next;
+    fcgi_worker_ctx *ctx;
+    proxy_conn_rec *conn;
+    fcgi_stream *streams;
+    int nstreams;
+    apr_uint32_t next_rid;
+    int held;                   /* streams with FCGI_MUX_MAX_QUEUED queued */
+    apr_status_t status;        /* first I/O error, fatal for all streams */
+    unsigned int reading:1;     /* a stream is reading the next record */
+    unsigned int writing:1;     /* a stream is writing its record(s) */
+    unsigned int aborted:1;     /* records of aborted streams may follow */
+};
+
+static apr_pool_t *fcgi_pchild;
+static apr_thread_mutex_t *fcgi_mutex;
+
+static fcgi_worker_ctx *fcgi_worker_ctx_get(proxy_worker *worker)
+{
+    fcgi_worker_ctx *ctx;
+
+    ctx = apr_atomic_casptr((volatile void **)&worker->context, NULL, NULL);
+    if (ctx || !fcgi_mutex) {
+        return ctx;
+    }
+
+    apr_thread_mutex_lock(fcgi_mutex);
+    ctx = worker->context;
+    if (!ctx) {
+        ctx = apr_pcalloc(fcgi_pchild, sizeof(*ctx));
+        if (apr_thread_mutex_create(&ctx->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                    fcgi_pchild) != APR_SUCCESS
+                || apr_thread_cond_create(&ctx->cond,
+                                          fcgi_pchild) != APR_SUCCESS) {
+            ctx = NULL;
+        }
+        else {
+            ctx->mpxs = -1;
+            ctx->max_reqs = FCGI_MUX_MAX_STREAMS;
+            apr_atomic_casptr((volatile void **)&worker->context, ctx, NULL);
+        }
+    }
+    apr_thread_mutex_unlock(fcgi_mutex);
+
+    return ctx;
+}
+
+static void fcgi_records_free(fcgi_record *rec)
+{
+    while (rec) {
+        fcgi_record *next = rec->next;
+        free(rec);
+        rec = next;
+    }
+}
+
+/* Frees a record from its content, for the heap buckets */
+static void fcgi_record_free(void *data)
+{
+    free((fcgi_record *)data - 1);
+}
+
+/* Called with the mutex held, takes ownership of rec */
+static void fcgi_mux_deliver(fcgi_mux *mux, fcgi_record *rec)
+{
+    fcgi_stream *stream;
+
+    for (stream = mux->streams; stream; stream = stream->next) {
+        if (stream->rid == rec->rid) {
+            if (stream->last) {
+                stream->last->next = rec;
+            }
+            else {
+                stream->first = rec;
+            }
+            stream->last = rec;
+            if (stream->queued < FCGI_MUX_MAX_QUEUED
+                    && stream->queued + rec->len >= FCGI_MUX_MAX_QUEUED) {
+                /* Stop reading until the stream catches up */
+                mux->held++;
+            }
+            stream->queued += rec->len;
+            if (rec->type == AP_FCGI_END_REQUEST) {
+                stream->ended = 1;
+            }
+            return;
+        }
+    }
+
+    /* Management record or aborted stream, nobody to tell */
+    free(rec);
+}
+
+/* Dequeues the next record of the stream, with the mutex held */
+static void fcgi_stream_dequeue(fcgi_stream *stream)
+{
+    fcgi_mux *mux = stream->mux;
+    fcgi_record *rec = stream->first;
+
+    stream->rec = rec;
+    stream->first = rec->next;
+    if (!stream->first) {
+        stream->last = NULL;
+    }
+    if (stream->queued >= FCGI_MUX_MAX_QUEUED
+            && stream->queued - rec->len < FCGI_MUX_MAX_QUEUED) {
+        /* The connection can be read again */
+        mux->held--;
+        apr_thread_cond_broadcast(mux->ctx->cond);
+    }
+    stream->queued -= rec->len;
+}
+
+/* Reads the next record of the connection, called by the reading stream
+ * only (without the mutex).
+ */
+static apr_status_t fcgi_mux_read(fcgi_mux *mux, fcgi_record **prec)
+{
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    unsigned char type, version, plen;
+    apr_uint16_t rid, clen;
+    char padding[255];
+    fcgi_record *rec;
+    apr_status_t rv;
+
+    rv = get_data_full(mux->conn, (char *)farray, AP_FCGI_HEADER_LEN);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    ap_fcgi_header_fields_from_array(&version, &type, &rid, &clen, &plen,
+                                     farray);
+    if (version != AP_FCGI_VERSION_1) {
+        return APR_EINVAL;
+    }
+
+    rec = ap_malloc(sizeof(*rec) + clen);
+    rec->next = NULL;
+    rec->rid = rid;
+    rec->type = type;
+    rec->len = clen;
+    rec->data = (char *)(rec + 1);
+    if (clen) {
+        rv = get_data_full(mux->conn, rec->data, clen);
+    }
+    if (rv == APR_SUCCESS && plen) {
+        rv = get_data_full(mux->conn, padding, plen);
+    }
+    if (rv != APR_SUCCESS) {
+        free(rec);
+        return rv;
+    }
+
+    *prec = rec;
+    return APR_SUCCESS;
+}
+
+/*
+ * Gets the next record of the stream in stream->rec, reading the connection
+ * if no other stream does. Without block, returns APR_EAGAIN if no record
+ * is available immediately.
+ */
+static apr_status_t fcgi_stream_recv(fcgi_stream *stream, int block)
+{
+    fcgi_mux *mux = stream->mux;
+    fcgi_worker_ctx *ctx = mux->ctx;
+    apr_interval_time_t timeout;
+    apr_status_t rv;
+
+    apr_socket_timeout_get(mux->conn->sock, &timeout);
+
+    apr_thread_mutex_lock(ctx->mutex);
+    for (;;) {
+        if (stream->first) {
+            fcgi_stream_dequeue(stream);
+            rv = APR_SUCCESS;
+            break;
+        }
+        if (mux->status != APR_SUCCESS) {
+            rv = mux->status;
+            break;
+        }
+
+        if (!mux->reading && !mux->held) {
+            fcgi_record *rec = NULL;
+            apr_pollfd_t pfd;
+            apr_int32_t n;
+
+            mux->reading = 1;
+            apr_thread_mutex_unlock(ctx->mutex);
+
+            /* Nothing is consumed until there is something to read, so
+             * that the connection remains usable if this stream gives up.
+             */
+            memset(&pfd, 0, sizeof(pfd));
+            pfd.desc_type = APR_POLL_SOCKET;
+            pfd.desc.s = mux->conn->sock;
+            pfd.reqevents = APR_POLLIN;
+            do {
+                rv = apr_poll(&pfd, 1, &n, block ? timeout : 0);
+            } while (APR_STATUS_IS_EINTR(rv));
+            if (rv == APR_SUCCESS) {
+                rv = fcgi_mux_read(mux, &rec);
+            }
+
+            apr_thread_mutex_lock(ctx->mutex);
+            mux->reading = 0;
+            if (rec) {
+                fcgi_mux_deliver(mux, rec);
+            }
+            else if (!APR_STATUS_IS_TIMEUP(rv)) {
+                mux->status = rv;
+            }
+            apr_thread_cond_broadcast(ctx->cond);
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                if (!stream->first) {
+                    if (!block) {
+                        rv = APR_EAGAIN;
+                    }
+                    break;
+                }
+            }
+            continue;
+        }
+
+        if (!block) {
+            rv = APR_EAGAIN;
+            break;
+        }
+        rv = apr_thread_cond_timedwait(ctx->cond, ctx->mutex, timeout);
+        if (APR_STATUS_IS_TIMEUP(rv) && !stream->first) {
+            break;
+        }
+    }
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    return rv;
+}
+
+/* The content of the current record, handed over as is: the heap bucket
+ * frees the record when done (see fcgi_record_free()).
+ */
+static void fcgi_stream_read(fcgi_stream *stream, apr_bucket_brigade *bb,
+                             apr_size_t *buflen)
+{
+    fcgi_record *rec = stream->rec;
+
+    *buflen = rec->len;
+    stream->rec = NULL;
+    if (bb && rec->len) {
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_heap_create(rec->data, rec->len,
+                                                           fcgi_record_free,
+                                                           bb->bucket_alloc));
+    }
+    else {
+        free(rec);
+    }
+}
+
+static void fcgi_stream_consumed(fcgi_stream *stream)
+{
+    free(stream->rec);
+    stream->rec = NULL;
+}
+
+static int fcgi_stream_pending(fcgi_stream *stream)
+{
+    int pending;
+
+    apr_thread_mutex_lock(stream->mux->ctx->mutex);
+    pending = (stream->first != NULL);
+    apr_thread_mutex_unlock(stream->mux->ctx->mutex);
+
+    return pending;
+}
+
+/* Writes whole records of the stream, like send_data() */
+static apr_status_t fcgi_stream_send(fcgi_stream *stream, struct iovec *vec,
+                                     int nvec, apr_size_t *len)
+{
+    fcgi_mux *mux = stream->mux;
+    fcgi_worker_ctx *ctx = mux->ctx;
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(ctx->mutex);
+    while (mux->writing && mux->status == APR_SUCCESS) {
+        apr_thread_cond_wait(ctx->cond, ctx->mutex);
+    }
+    if (mux->status != APR_SUCCESS) {
+        rv = mux->status;
+        apr_thread_mutex_unlock(ctx->mutex);
+        return rv;
+    }
+    mux->writing = 1;
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    rv = send_data(mux->conn, vec, nvec, len);
+
+    apr_thread_mutex_lock(ctx->mutex);
+    mux->writing = 0;
+    if (rv != APR_SUCCESS) {
+        mux->status = rv;
+    }
+    apr_thread_cond_broadcast(ctx->cond);
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    return rv;
+}
+
+/* Called with the mutex held */
+static fcgi_stream *fcgi_mux_add_stream(fcgi_mux *mux, request_rec *r)
+{
+    fcgi_stream *stream = apr_pcalloc(r->pool, sizeof(*stream));
+
+    stream->mux = mux;
+    stream->rid = (apr_uint16_t)mux->next_rid++;
+    stream->next = mux->streams;
+    mux->streams = stream;
+    mux->nstreams++;
+
+    return stream;
+}
+
+/* Joins a connection of the worker with room for another stream, if any */
+static fcgi_stream *fcgi_stream_join(fcgi_worker_ctx *ctx, request_rec *r)
+{
+    fcgi_stream *stream = NULL;
+    fcgi_mux *mux;
+
+    apr_thread_mutex_lock(ctx->mutex);
+    for (mux = ctx->muxes; mux; mux = mux->next) {
+        /* The ids are not reused on a connection, so that late records of
+         * an aborted stream can't be taken for another's.
+         */
+        if (mux->status == APR_SUCCESS && mux->nstreams < ctx->max_reqs
+                && mux->next_rid <= 0xffff) {
+            stream = fcgi_mux_add_stream(mux, r);
+            break;
+        }
+    }
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    return stream;
+}
+
+/* Shares a new connection, which the mux owns from now on */
+static fcgi_stream *fcgi_mux_create(fcgi_worker_ctx *ctx,
+                                    proxy_conn_rec *conn, request_rec *r)
+{
+    fcgi_stream *stream;
+    fcgi_mux *mux;
+
+    mux = ap_calloc(1, sizeof(*mux));
+    mux->ctx = ctx;
+    mux->conn = conn;
+    mux->next_rid = 1;
+    mux->status = APR_SUCCESS;
+
+    apr_thread_mutex_lock(ctx->mutex);
+    mux->next = ctx->muxes;
+    ctx->muxes = mux;
+    stream = fcgi_mux_add_stream(mux, r);
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    return stream;
+}
+
+/*
+ * Leaves the connection, aborting the request if the application did not
+ * end it. The last stream releases the connection to the worker's pool.
+ */
+static void fcgi_stream_leave(fcgi_stream *stream, request_rec *r)
+{
+    fcgi_mux *mux = stream->mux, **pmux;
+    fcgi_worker_ctx *ctx = mux->ctx;
+    fcgi_stream **pstream;
+    int last;
+
+    apr_thread_mutex_lock(ctx->mutex);
+    for (pstream = &mux->streams; *pstream; pstream = &(*pstream)->next) {
+        if (*pstream == stream) {
+            *pstream = stream->next;
+            break;
+        }
+    }
+    fcgi_records_free(stream->first);
+    stream->first = stream->last = NULL;
+    if (stream->queued >= FCGI_MUX_MAX_QUEUED) {
+        mux->held--;
+        apr_thread_cond_broadcast(ctx->cond);
+    }
+    stream->queued = 0;
+    if (stream->rec) {
+        fcgi_stream_consumed(stream);
+    }
+    if (!stream->ended) {
+        mux->aborted = 1;
+    }
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    if (!stream->ended) {
+        struct iovec vec[1];
+        ap_fcgi_header header;
+        unsigned char farray[AP_FCGI_HEADER_LEN];
+        apr_size_t len;
+
+        ap_fcgi_fill_in_header(&header, AP_FCGI_ABORT_REQUEST, stream->rid,
+                               0, 0);
+        ap_fcgi_header_to_array(&header, farray);
+        vec[0].iov_base = (void *)farray;
+        vec[0].iov_len = sizeof(farray);
+        fcgi_stream_send(stream, vec, 1, &len);
+    }
+
+    apr_thread_mutex_lock(ctx->mutex);
+    last = (--mux->nstreams == 0);
+    if (last) {
+        for (pmux = &ctx->muxes; *pmux; pmux = &(*pmux)->next) {
+            if (*pmux == mux) {
+                *pmux = mux->next;
+                break;
+            }
+        }
+    }
+    apr_thread_mutex_unlock(ctx->mutex);
+
+    if (last) {
+        /* Late records of the aborted requests would be mistaken for the
+         * ones of the next requests (ids start over), so close.
+         */
+        mux->conn->close = (mux->status != APR_SUCCESS || mux->aborted);
+        ap_proxy_release_connection(FCGI_SCHEME, mux->conn, r->server);
+        free(mux);
+    }
+}
+#endif /* APR_HAS_THREADS */
+
+/* Wrappers for exchanging the records either on the connection, or on the
+ * request's stream when multiplexing (stream != NULL).
+ *
+ * On the connection, what's read lands in heap buckets of the rb brigade,
+ * where the records are then parsed in place: their content is split off
+ * and passed along as is (no copy).
+ */
+static apr_status_t fcgi_send(proxy_conn_rec *conn, fcgi_stream *stream,
+                              struct iovec *vec, int nvec, apr_size_t *len)
+{
+#if APR_HAS_THREADS
+    if (stream) {
+        return fcgi_stream_send(stream, vec, nvec, len);
+    }
+#endif
+    return send_data(conn, vec, nvec, len);
+}
+
+/* Reads what's available on the connection (or waits for something) */
+static apr_status_t fcgi_read_more(proxy_conn_rec *conn,
+                                   apr_bucket_brigade *rb)
+{
+    apr_size_t size = AP_IOBUFSIZE, len;
+    apr_status_t rv;
+    char *buf;
+
+    if (conn->worker->s->io_buffer_size_set) {
+        size = conn->worker->s->io_buffer_size;
+    }
+    buf = apr_bucket_alloc(size, rb->bucket_alloc);
+    len = size;
+    rv = get_data(conn, buf, &len);
+    if (rv != APR_SUCCESS) {
+        apr_bucket_free(buf);
+        return rv;
+    }
+    APR_BRIGADE_INSERT_TAIL(rb, apr_bucket_heap_create(buf, len,
+                                                       apr_bucket_free,
+                                                       rb->bucket_alloc));
+    return APR_SUCCESS;
+}
+
+/* Moves the first *len bytes of rb (at most) to bb, or drops them if bb
+ * is NULL, and tells how many in *len.
+ */
+static apr_status_t fcgi_take(apr_bucket_brigade *rb,
+                              apr_bucket_brigade *bb, apr_size_t *len)
+{
+    apr_bucket *e, *b;
+    apr_off_t avail;
+    apr_status_t rv;
+
+    rv = apr_brigade_length(rb, 0, &avail);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    if ((apr_off_t)*len > avail) {
+        *len = (apr_size_t)avail;
+    }
+    rv = apr_brigade_partition(rb, *len, &e);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    while ((b = APR_BRIGADE_FIRST(rb)) != e) {
+        APR_BUCKET_REMOVE(b);
+        if (bb) {
+            APR_BRIGADE_INSERT_TAIL(bb, b);
+        }
+        else {
+            apr_bucket_destroy(b);
+        }
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t fcgi_poll(proxy_conn_rec *conn, fcgi_stream *stream,
+                              apr_bucket_brigade *rb, apr_pollfd_t *pfd)
+{
+    apr_interval_time_t timeout;
+    apr_int32_t n;
+
+#if APR_HAS_THREADS
+    if (stream) {
+        apr_status_t rv;
+
+        if (stream->rec) {
+            fcgi_stream_consumed(stream);
+        }
+        pfd->rtnevents = 0;
+        if (pfd->reqevents & APR_POLLOUT) {
+            /* Sending the body comes first, but take what's available */
+            pfd->rtnevents = APR_POLLOUT;
+            rv = fcgi_stream_recv(stream, 0);
+            if (rv == APR_SUCCESS) {
+                pfd->rtnevents |= APR_POLLIN;
+            }
+            else if (!APR_STATUS_IS_EAGAIN(rv)) {
+                return rv;
+            }
+            return APR_SUCCESS;
+        }
+        rv = fcgi_stream_recv(stream, 1);
+        if (rv == APR_SUCCESS) {
+            pfd->rtnevents = APR_POLLIN;
+        }
+        return rv;
+    }
+#endif
+
+    /* Parse what we have already first */
+    if (!APR_BRIGADE_EMPTY(rb)) {
+        pfd->rtnevents = APR_POLLIN;
+        return APR_SUCCESS;
+    }
+
+    /* We need SOME kind of timeout here, or virtually anything will
+     * cause timeout errors. */
+    apr_socket_timeout_get(conn->sock, &timeout);
+
+    return apr_poll(pfd, 1, &n, timeout);
+}
+
+static apr_status_t fcgi_recv_header(proxy_conn_rec *conn,
+                                     fcgi_stream *stream,
+                                     apr_bucket_brigade *rb,
+                                     unsigned char *farray)
+{
+    apr_size_t len = AP_FCGI_HEADER_LEN;
+    apr_off_t avail;
+    apr_status_t rv;
+
+#if APR_HAS_THREADS
+    if (stream) {
+        /* The record was received whole, padding stripped */
+        ap_fcgi_header header;
+        ap_fcgi_fill_in_header(&header, stream->rec->type, stream->rec->rid,
+                               (apr_uint16_t)stream->rec->len, 0);
+        ap_fcgi_header_to_array(&header, farray);
+        return APR_SUCCESS;
+    }
+#endif
+
+    for (;;) {
+        rv = apr_brigade_length(rb, 0, &avail);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (avail >= AP_FCGI_HEADER_LEN) {
+            break;
+        }
+        rv = fcgi_read_more(conn, rb);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+    rv = apr_brigade_flatten(rb, (char *)farray, &len);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    return fcgi_take(rb, NULL, &len);
+}
+
+/* Gets up to *buflen bytes of the current record's content in bb (the
+ * whole content when multiplexing), or drops them if bb is NULL.
+ */
+static apr_status_t fcgi_recv(proxy_conn_rec *conn, fcgi_stream *stream,
+                              apr_bucket_brigade *rb,
+                              apr_bucket_brigade *bb, apr_size_t *buflen)
+{
+#if APR_HAS_THREADS
+    if (stream) {
+        fcgi_stream_read(stream, bb, buflen);
+        return APR_SUCCESS;
+    }
+#endif
+    if (APR_BRIGADE_EMPTY(rb)) {
+        apr_status_t rv = fcgi_read_more(conn, rb);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+    return fcgi_take(rb, bb, buflen);
+}
+
+/* Whether more of the response is available already */
+static int fcgi_pending(fcgi_stream *stream, apr_bucket_brigade *rb,
+                        apr_pollfd_t *flushpoll,
+                        apr_interval_time_t flush_wait)
+{
+    apr_int32_t n;
+
+#if APR_HAS_THREADS
+    if (stream) {
+        return fcgi_stream_pending(stream);
+    }
+#endif
+    if (!APR_BRIGADE_EMPTY(rb)) {
+        return 1;
+    }
+    return apr_poll(flushpoll, 1, &n, flush_wait) != APR_TIMEUP;
+}
+
+#define FCGI_STDIN_IOVEC 16 /* iovecs per FCGI_STDIN record written */
+
+/* Sends the data of the brigade in FCGI_STDIN records, each record header
+ * written along with the buckets' data (no copy).
+ */
+static apr_status_t send_stdin(proxy_conn_rec *conn, fcgi_stream *stream,
+                               apr_uint16_t request_id,
+                               apr_bucket_brigade *bb)
+{
+    struct iovec vec[FCGI_STDIN_IOVEC];
+    ap_fcgi_header header;
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    apr_bucket *e = APR_BRIGADE_FIRST(bb);
+    const char *data = NULL;
+    apr_size_t avail = 0, len;
+    apr_status_t rv;
+
+    for (;;) {
+        apr_size_t clen = 0;
+        int nvec = 1;
+
+        while (nvec < FCGI_STDIN_IOVEC && clen < AP_FCGI_MAX_CONTENT_LEN) {
+            apr_size_t n;
+
+            if (!avail) {
+                if (e == APR_BRIGADE_SENTINEL(bb)) {
+                    break;
+                }
+                if (!APR_BUCKET_IS_METADATA(e)) {
+                    /* Morphing buckets insert the rest after e */
+                    rv = apr_bucket_read(e, &data, &avail, APR_BLOCK_READ);
+                    if (rv != APR_SUCCESS) {
+                        return rv;
+                    }
+                }
+                e = APR_BUCKET_NEXT(e);
+                continue;
+            }
+
+            n = AP_FCGI_MAX_CONTENT_LEN - clen;
+            if (n > avail) {
+                n = avail;
+            }
+            vec[nvec].iov_base = (void *)data;
+            vec[nvec].iov_len = n;
+            ++nvec;
+            data += n;
+            avail -= n;
+            clen += n;
+        }
+        if (!clen) {
+            return APR_SUCCESS;
+        }
+
+        ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
+                               (apr_uint16_t)clen, 0);
+        ap_fcgi_header_to_array(&header, farray);
+        vec[0].iov_base = (void *)farray;
+        vec[0].iov_len = sizeof(farray);
+
+        rv = fcgi_send(conn, stream, vec, nvec, &len);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+}
+
 static apr_status_t send_begin_request(proxy_conn_rec *conn,
+                                       fcgi_stream *stream,
                                        apr_uint16_t request_id)
 {
     struct iovec vec[2];
@@ -318,7 +1221,7 @@ static apr_status_t send_begin_request(proxy_conn_rec *conn,
                            sizeof(abrb), 0);
 
     ap_fcgi_fill_in_request_body(&brb, AP_FCGI_RESPONDER,
-                                 ap_proxy_connection_reusable(conn)
+                                 (stream || ap_proxy_connection_reusable(conn))
                                      ? AP_FCGI_KEEP_CONN : 0);
 
     ap_fcgi_header_to_array(&header, farray);
@@ -329,22 +1232,24 @@ static apr_status_t send_begin_request(proxy_conn_rec *conn,
     vec[1].iov_base = (void *)abrb;
     vec[1].iov_len = sizeof(abrb);
 
-    return send_data(conn, vec, 2, &len);
+    return fcgi_send(conn, stream, vec, 2, &len);
 }
 
-static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
+static apr_status_t send_environment(proxy_conn_rec *conn,
+                                     fcgi_stream *stream, request_rec *r,
                                      apr_pool_t *temp_pool,
                                      apr_uint16_t request_id)
 {
     const apr_array_header_t *envarr;
     const apr_table_entry_t *elts;
-    struct iovec vec[2];
+    struct iovec vec[3];
     ap_fcgi_header header;
     unsigned char farray[AP_FCGI_HEADER_LEN];
+    unsigned char farray_end[AP_FCGI_HEADER_LEN];
     char *body;
     apr_status_t rv;
     apr_size_t avail_len, len, required_len;
-    int next_elem, starting_elem;
+    int next_elem, starting_elem, nvec, done = 0;
     fcgi_req_config_t *rconf = ap_get_module_config(r->request_config, &proxy_fcgi_module);
     fcgi_dirconf_t *dconf = ap_get_module_config(r->per_dir_config, &proxy_fcgi_module);
 
@@ -457,14 +1362,28 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
         vec[0].iov_len = sizeof(farray);
         vec[1].iov_base = body;
         vec[1].iov_len = required_len;
+        nvec = 2;
+
+        if (next_elem >= envarr->nelts) {
+            /* The last ones, say we're done in the same write */
+            ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id, 0, 0);
+            ap_fcgi_header_to_array(&header, farray_end);
+            vec[2].iov_base = (void *)farray_end;
+            vec[2].iov_len = sizeof(farray_end);
+            nvec = 3;
+            done = 1;
+        }
 
-        rv = send_data(conn, vec, 2, &len);
+        rv = fcgi_send(conn, stream, vec, nvec, &len);
         apr_pool_clear(temp_pool);
 
         if (rv) {
             return rv;
         }
     }
+    if (done) {
+        return APR_SUCCESS;
+    }
 
     /* Envvars sent, so say we're done */
     ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id, 0, 0);
@@ -473,7 +1392,7 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
     vec[0].iov_base = (void *)farray;
     vec[0].iov_len = sizeof(farray);
 
-    return send_data(conn, vec, 1, &len);
+    return fcgi_send(conn, stream, vec, 1, &len);
 }
 
 enum {
@@ -544,32 +1463,28 @@ static int handle_headers(request_rec *r, int *state,
     return 0;
 }
 
-static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
-                             request_rec *r, apr_pool_t *setaside_pool,
+static apr_status_t dispatch(proxy_conn_rec *conn, fcgi_stream *stream,
+                             proxy_dir_conf *conf, request_rec *r,
                              apr_uint16_t request_id, const char **err,
                              int *bad_request, int *has_responded,
                              apr_bucket_brigade *input_brigade)
 {
-    apr_bucket_brigade *ib, *ob;
+    apr_bucket_brigade *ib, *ob, *rb, *cb;
     int seen_end_of_headers = 0, done = 0, ignore_body = 0;
     apr_status_t rv = APR_SUCCESS;
     int script_error_status = HTTP_OK;
     conn_rec *c = r->connection;
-    struct iovec vec[2];
+    struct iovec vec[1];
     ap_fcgi_header header;
     unsigned char farray[AP_FCGI_HEADER_LEN];
     apr_pollfd_t pfd;
     apr_pollfd_t *flushpoll = NULL;
-    apr_int32_t flushpoll_fd;
     int header_state = HDR_STATE_READING_HEADERS;
-    char stack_iobuf[AP_IOBUFSIZE];
     apr_size_t iobuf_size = AP_IOBUFSIZE;
-    char *iobuf = stack_iobuf;
 
     *err = NULL;
     if (conn->worker->s->io_buffer_size_set) {
         iobuf_size = conn->worker->s->io_buffer_size;
-        iobuf = apr_palloc(r->pool, iobuf_size);
     }
 
     pfd.desc_type = APR_POLL_SOCKET;
@@ -586,17 +1501,13 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
 
     ib = apr_brigade_create(r->pool, c->bucket_alloc);
     ob = apr_brigade_create(r->pool, c->bucket_alloc);
+    rb = apr_brigade_create(r->pool, c->bucket_alloc); /* read, unparsed */
+    cb = apr_brigade_create(r->pool, c->bucket_alloc); /* record content */
 
     while (! done) {
-        apr_interval_time_t timeout;
         apr_size_t len;
-        int n;
 
-        /* We need SOME kind of timeout here, or virtually anything will
-         * cause timeout errors. */
-        apr_socket_timeout_get(conn->sock, &timeout);
-
-        rv = apr_poll(&pfd, 1, &n, timeout);
+        rv = fcgi_poll(conn, stream, rb, &pfd);
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EINTR(rv)) {
                 continue;
@@ -606,9 +1517,7 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
         }
 
         if (pfd.rtnevents & APR_POLLOUT) {
-            apr_size_t to_send, writebuflen;
             int last_stdin = 0;
-            char *iobuf_cursor;
 
             if (APR_BRIGADE_EMPTY(input_brigade)) {
                 rv = ap_get_brigade(r->input_filters, ib,
@@ -640,49 +1549,12 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
                 last_stdin = 1;
             }
 
-            writebuflen = iobuf_size;
-
-            rv = apr_brigade_flatten(ib, iobuf, &writebuflen);
+            rv = send_stdin(conn, stream, request_id, ib);
 
             apr_brigade_cleanup(ib);
 
             if (rv != APR_SUCCESS) {
-                *err = "flattening brigade";
-                break;
-            }
-
-            to_send = writebuflen;
-            iobuf_cursor = iobuf;
-            while (to_send > 0) {
-                int nvec = 0;
-                apr_size_t write_this_time;
-
-                write_this_time =
-                    to_send < AP_FCGI_MAX_CONTENT_LEN ? to_send : AP_FCGI_MAX_CONTENT_LEN;
-
-                ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
-                                       (apr_uint16_t)write_this_time, 0);
-                ap_fcgi_header_to_array(&header, farray);
-
-                vec[nvec].iov_base = (void *)farray;
-                vec[nvec].iov_len = sizeof(farray);
-                ++nvec;
-                if (writebuflen) {
-                    vec[nvec].iov_base = iobuf_cursor;
-                    vec[nvec].iov_len = write_this_time;
-                    ++nvec;
-                }
-
-                rv = send_data(conn, vec, nvec, &len);
-                if (rv != APR_SUCCESS) {
-                    *err = "sending stdin";
-                    break;
-                }
-
-                to_send -= write_this_time;
-                iobuf_cursor += write_this_time;
-            }
-            if (rv != APR_SUCCESS) {
+                *err = "sending stdin";
                 break;
             }
 
@@ -697,7 +1569,7 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
                 vec[0].iov_base = (void *)farray;
                 vec[0].iov_len = sizeof(farray);
 
-                rv = send_data(conn, vec, 1, &len);
+                rv = fcgi_send(conn, stream, vec, 1, &len);
                 if (rv != APR_SUCCESS) {
                     *err = "sending empty stdin";
                     break;
@@ -714,7 +1586,7 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
             int mayflush = 0;
 
             /* First, we grab the header... */
-            rv = get_data_full(conn, (char *) farray, AP_FCGI_HEADER_LEN);
+            rv = fcgi_recv_header(conn, stream, rb, farray);
             if (rv != APR_SUCCESS) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01067)
                               "Failed to read FastCGI header");
@@ -734,7 +1606,9 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
                 break;
             }
 
-            if (rid != request_id) {
+            if (rid != request_id
+                    && !(rid == 0 && (type == AP_FCGI_GET_VALUES_RESULT
+                                      || type == AP_FCGI_UNKNOWN_TYPE))) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01069)
                               "Got bogus rid %d, expected %d",
                               rid, request_id);
@@ -743,17 +1617,12 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
             }
 
 recv_again:
-            if (clen > iobuf_size) {
-                readbuflen = iobuf_size;
-            } else {
-                readbuflen = clen;
-            }
-
-            /* Now get the actual data.  Yes it sucks to do this in a second
-             * recv call, this will eventually change when we move to real
-             * nonblocking recv calls. */
+            /* Now get the actual data, as much of it as we have, split
+             * from what was read. */
+            apr_brigade_cleanup(cb);
+            readbuflen = clen;
             if (readbuflen != 0) {
-                rv = get_data(conn, iobuf, &readbuflen);
+                rv = fcgi_recv(conn, stream, rb, cb, &readbuflen);
                 if (rv != APR_SUCCESS) {
                     *err = "reading response body";
                     break;
@@ -763,15 +1632,20 @@ recv_again:
             switch (type) {
             case AP_FCGI_STDOUT:
                 if (clen != 0) {
-                    b = apr_bucket_transient_create(iobuf,
-                                                    readbuflen,
-                                                    c->bucket_alloc);
+                    if (! seen_end_of_headers) {
+                        int st = 0;
 
-                    APR_BRIGADE_INSERT_TAIL(ob, b);
+                        for (b = APR_BRIGADE_FIRST(cb);
+                             b != APR_BRIGADE_SENTINEL(cb) && st != 1;
+                             b = APR_BUCKET_NEXT(b)) {
+                            const char *data;
+                            apr_size_t n;
 
-                    if (! seen_end_of_headers) {
-                        int st = handle_headers(r, &header_state,
-                                                iobuf, readbuflen);
+                            /* heap buckets, won't fail */
+                            apr_bucket_read(b, &data, &n, APR_BLOCK_READ);
+                            st = handle_headers(r, &header_state, data, n);
+                        }
+                        APR_BRIGADE_CONCAT(ob, cb);
 
                         if (st == 1) {
                             int status;
@@ -842,16 +1716,12 @@ recv_again:
                                 mayflush = 1;
                             }
                             apr_brigade_cleanup(ob);
-
-                            apr_pool_clear(setaside_pool);
-                        }
-                        else {
-                            /* We're still looking for the end of the
-                             * headers, so this part of the data will need
-                             * to persist. */
-                            apr_bucket_setaside(b, setaside_pool);
                         }
+                        /* else we're still looking for the end of the
+                         * headers, this part of the data persists in ob
+                         * (heap buckets). */
                     } else {
+                        APR_BRIGADE_CONCAT(ob, cb);
                         /* we've already passed along the headers, so now pass
                          * through the content.  we could simply continue to
                          * setaside the content and not pass until we see the
@@ -898,9 +1768,15 @@ recv_again:
 
             case AP_FCGI_STDERR:
                 /* TODO: Should probably clean up this logging a bit... */
-                if (clen) {
+                for (b = APR_BRIGADE_FIRST(cb);
+                     b != APR_BRIGADE_SENTINEL(cb);
+                     b = APR_BUCKET_NEXT(b)) {
+                    const char *data;
+                    apr_size_t n;
+
+                    apr_bucket_read(b, &data, &n, APR_BLOCK_READ);
                     ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01071)
-                                  "Got error '%.*s'", (int)readbuflen, iobuf);
+                                  "Got error '%.*s'", (int)n, data);
                 }
 
                 if (clen > readbuflen) {
@@ -913,29 +1789,44 @@ recv_again:
                 done = 1;
                 break;
 
+            case AP_FCGI_GET_VALUES_RESULT:
+            case AP_FCGI_UNKNOWN_TYPE:
+                /* Late answer to our FCGI_GET_VALUES, ignore */
+                if (clen > readbuflen) {
+                    clen -= readbuflen;
+                    goto recv_again;
+                }
+                break;
+
             default:
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01072)
                               "Got bogus record %d", type);
                 break;
             }
+            apr_brigade_cleanup(cb);
             /* Leave on above switch's inner error. */
             if (rv != APR_SUCCESS) {
                 break;
             }
 
-            if (plen) {
-                rv = get_data_full(conn, iobuf, plen);
+            while (plen) {
+                readbuflen = plen;
+                rv = fcgi_recv(conn, stream, rb, NULL, &readbuflen);
                 if (rv != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02537)
-                                  "Error occurred reading padding");
                     break;
                 }
+                plen -= (unsigned char)readbuflen;
+            }
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02537)
+                              "Error occurred reading padding");
+                break;
             }
 
             if (mayflush && ((conn->worker->s->flush_packets == flush_on) ||
                              ((conn->worker->s->flush_packets == flush_auto) && 
-                              (apr_poll(flushpoll, 1, &flushpoll_fd,
-                               conn->worker->s->flush_wait) == APR_TIMEUP)))) {
+                              !fcgi_pending(stream, rb, flushpoll,
+                                            conn->worker->s->flush_wait)))) {
                 apr_bucket* flush_b = apr_bucket_flush_create(r->connection->bucket_alloc);
                 APR_BRIGADE_INSERT_TAIL(ob, flush_b);
                 rv = ap_pass_brigade(r->output_filters, ob);
@@ -948,8 +1839,14 @@ recv_again:
         }
     }
 
+    /* Anything read past the end of the request would be lost */
+    if (!stream && !APR_BRIGADE_EMPTY(rb)) {
+        conn->close = 1;
+    }
     apr_brigade_destroy(ib);
     apr_brigade_destroy(ob);
+    apr_brigade_destroy(rb);
+    apr_brigade_destroy(cb);
 
     if (script_error_status != HTTP_OK) {
         ap_die(script_error_status, r); /* send ErrorDocument */
@@ -964,6 +1861,8 @@ recv_again:
  */
 static int fcgi_do_request(apr_pool_t *p, request_rec *r,
                            proxy_conn_rec *conn,
+                           fcgi_stream *stream,
+                           apr_uint16_t request_id,
                            conn_rec *origin,
                            proxy_dir_conf *conf,
                            apr_uri_t *uri,
@@ -971,11 +1870,10 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
                            apr_bucket_brigade *input_brigade)
 {
     /* Request IDs are arbitrary numbers that we assign to a
-     * single request. This would allow multiplex/pipelining of
-     * multiple requests to the same FastCGI connection, but
-     * we don't support that, and always use a value of '1' to
-     * keep things simple. */
-    apr_uint16_t request_id = 1;
+     * single request, always '1' unless the connection is
+     * multiplexed (stream != NULL). Failures local to the
+     * request don't close a multiplexed connection, the other
+     * requests on it go on (ours is aborted when leaving). */
     apr_status_t rv;
     apr_pool_t *temp_pool;
     const char *err;
@@ -983,11 +1881,13 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
         has_responded = 0;
 
     /* Step 1: Send AP_FCGI_BEGIN_REQUEST */
-    rv = send_begin_request(conn, request_id);
+    rv = send_begin_request(conn, stream, request_id);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01073)
                       "Failed Writing Request to %s:", server_portstr);
-        conn->close = 1;
+        if (!stream) {
+            conn->close = 1;
+        }
         return HTTP_SERVICE_UNAVAILABLE;
     }
 
@@ -995,16 +1895,18 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     apr_pool_tag(temp_pool, "proxy_fcgi_do_request");
 
     /* Step 2: Send Environment via FCGI_PARAMS */
-    rv = send_environment(conn, r, temp_pool, request_id);
+    rv = send_environment(conn, stream, r, temp_pool, request_id);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01074)
                       "Failed writing Environment to %s:", server_portstr);
-        conn->close = 1;
+        if (!stream) {
+            conn->close = 1;
+        }
         return HTTP_SERVICE_UNAVAILABLE;
     }
 
     /* Step 3: Read records from the back end server and handle them. */
-    rv = dispatch(conn, conf, r, temp_pool, request_id,
+    rv = dispatch(conn, stream, conf, r, request_id,
                   &err, &bad_request, &has_responded,
                   input_brigade);
     if (rv != APR_SUCCESS) {
@@ -1014,7 +1916,9 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
         if (r->connection->aborted) {
             ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r,
                           "The client aborted the connection.");
-            conn->close = 1;
+            if (!stream) {
+                conn->close = 1;
+            }
             return OK;
         }
 
@@ -1024,7 +1928,9 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
                       err ? "(" : "",
                       err ? err : "",
                       err ? ")" : "");
-        conn->close = 1;
+        if (!stream) {
+            conn->close = 1;
+        }
         if (has_responded) {
             return AP_FILTER_ERROR;
         }
@@ -1040,10 +1946,52 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     return OK;
 }
 
-#define FCGI_SCHEME "FCGI"
-
 #define MAX_MEM_SPOOL 16384
 
+static int fcgi_connect(proxy_conn_rec *backend, request_rec *r)
+{
+    if (ap_proxy_check_connection(FCGI_SCHEME, backend, r->server, 0,
+                                  PROXY_CHECK_CONN_EMPTY)
+            && ap_proxy_connect_backend(FCGI_SCHEME, backend, backend->worker,
+                                        r->server)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01079)
+                      "failed to make connection to backend: %s",
+                      backend->hostname);
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
+    return OK;
+}
+
+#if APR_HAS_THREADS
+/* Learns once per child whether the application multiplexes */
+static void fcgi_ask_values(fcgi_worker_ctx *ctx, proxy_conn_rec *backend,
+                            request_rec *r)
+{
+    int mpxs = 0, max_reqs = 0;
+    apr_status_t rv;
+
+    rv = fcgi_get_values(backend, r, &mpxs, &max_reqs);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, rv, r, APLOGNO(10491)
+                      "FCGI_GET_VALUES failed on %s, not multiplexing",
+                      ap_proxy_worker_name(r->pool, backend->worker));
+        mpxs = 0;
+    }
+    else {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10492)
+                      "%s: FCGI_MPXS_CONNS=%d, FCGI_MAX_REQS=%d",
+                      ap_proxy_worker_name(r->pool, backend->worker), mpxs, max_reqs);
+    }
+
+    apr_thread_mutex_lock(ctx->mutex);
+    if (mpxs && max_reqs > 0 && max_reqs < ctx->max_reqs) {
+        ctx->max_reqs = max_reqs;
+    }
+    ctx->mpxs = mpxs;
+    apr_thread_mutex_unlock(ctx->mutex);
+}
+#endif
+
 /*
  * This handles fcgi:(dest) URLs
  */
@@ -1062,6 +2010,14 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
 
     proxy_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
                                                  &proxy_module);
+    proxy_conn_rec *conn;
+    fcgi_stream *stream = NULL;
+    apr_uint16_t request_id = 1;
+#if APR_HAS_THREADS
+    fcgi_srvconf_t *sconf = ap_get_module_config(r->server->module_config,
+                                                 &proxy_fcgi_module);
+    fcgi_worker_ctx *ctx = NULL;
+#endif
 
     apr_pool_t *p = r->pool;
 
@@ -1205,24 +2161,67 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
         backend->close = 0;
     }
 
-    /* Step Two: Make the Connection */
-    if (ap_proxy_check_connection(FCGI_SCHEME, backend, r->server, 0,
-                                  PROXY_CHECK_CONN_EMPTY)
-            && ap_proxy_connect_backend(FCGI_SCHEME, backend, worker,
-                                        r->server)) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01079)
-                      "failed to make connection to backend: %s",
-                      backend->hostname);
-        status = HTTP_SERVICE_UNAVAILABLE;
-        goto cleanup;
+    conn = backend;
+#if APR_HAS_THREADS
+    /* Multiplexing needs a worker bound to its backend, and an application
+     * which does it.
+     */
+    if (sconf->multiplex == 1
+            && worker->s->is_address_reusable && !worker->s->disablereuse
+            && (ctx = fcgi_worker_ctx_get(worker)) && ctx->mpxs != 0) {
+        stream = fcgi_stream_join(ctx, r);
+        if (stream) {
+            /* Not needed, give it back as is */
+            backend->close = 0;
+            ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+            backend = NULL;
+        }
+    }
+    else {
+        ctx = NULL;
     }
+#endif
+
+    if (!stream) {
+        /* Step Two: Make the Connection */
+        status = fcgi_connect(backend, r);
+#if APR_HAS_THREADS
+        if (status == OK && ctx && ctx->mpxs < 0) {
+            fcgi_ask_values(ctx, backend, r);
+            /* The application may close the connection after answering */
+            status = fcgi_connect(backend, r);
+        }
+        if (status == OK && ctx && ctx->mpxs > 0) {
+            backend->close = 0;
+            stream = fcgi_mux_create(ctx, backend, r);
+            backend = NULL;
+        }
+#endif
+        if (status != OK) {
+            goto cleanup;
+        }
+    }
+#if APR_HAS_THREADS
+    if (stream) {
+        conn = stream->mux->conn;
+        request_id = stream->rid;
+    }
+#endif
 
     /* Step Three: Process the Request */
-    status = fcgi_do_request(p, r, backend, origin, dconf, uri, url,
-                             server_portstr, input_brigade);
+    status = fcgi_do_request(p, r, conn, stream, request_id, origin, dconf,
+                             uri, url, server_portstr, input_brigade);
+
+#if APR_HAS_THREADS
+    if (stream) {
+        fcgi_stream_leave(stream, r);
+    }
+#endif
 
 cleanup:
-    ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+    if (backend) {
+        ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+    }
     return status;
 }
 
@@ -1252,6 +2251,29 @@ static void *fcgi_merge_dconf(apr_pool_t *p, void *basev, void *overridesv)
     return a;
 }
 
+static void *fcgi_create_sconf(apr_pool_t *p, server_rec *s)
+{
+    fcgi_srvconf_t *a;
+
+    a = (fcgi_srvconf_t *)apr_pcalloc(p, sizeof(fcgi_srvconf_t));
+    a->multiplex = -1;
+
+    return a;
+}
+
+static void *fcgi_merge_sconf(apr_pool_t *p, void *basev, void *overridesv)
+{
+    fcgi_srvconf_t *a, *base, *over;
+
+    a     = (fcgi_srvconf_t *)apr_pcalloc(p, sizeof(fcgi_srvconf_t));
+    base  = (fcgi_srvconf_t *)basev;
+    over  = (fcgi_srvconf_t *)overridesv;
+
+    a->multiplex = (over->multiplex != -1) ? over->multiplex
+                                           : base->multiplex;
+    return a;
+}
+
 static const char *cmd_servertype(cmd_parms *cmd, void *in_dconf,
                                    const char *val)
 {
@@ -1320,10 +2342,44 @@ static const char *cmd_setenv(cmd_parms *cmd, void *in_dconf,
 
     return NULL;
 }
+
+static const char *cmd_multiplex(cmd_parms *cmd, void *dummy, int flag)
+{
+    fcgi_srvconf_t *sconf = ap_get_module_config(cmd->server->module_config,
+                                                 &proxy_fcgi_module);
+
+#if !APR_HAS_THREADS
+    if (flag) {
+        return "ProxyFCGIMultiplex requires threads support in APR";
+    }
+#endif
+    sconf->multiplex = flag;
+
+    return NULL;
+}
+
+#if APR_HAS_THREADS
+static void fcgi_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+
+    fcgi_pchild = p;
+    rv = apr_thread_mutex_create(&fcgi_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10493)
+                     "could not create the mutex, multiplexing disabled");
+        fcgi_mutex = NULL;
+    }
+}
+#endif
+
 static void register_hooks(apr_pool_t *p)
 {
     proxy_hook_scheme_handler(proxy_fcgi_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_fcgi_canon, NULL, NULL, APR_HOOK_FIRST);
+#if APR_HAS_THREADS
+    ap_hook_child_init(fcgi_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
 }
 
 static const command_rec command_table[] = {
@@ -1331,6 +2387,9 @@ static const command_rec command_table[] = {
                   "Specify the type of FastCGI server: 'Generic', 'FPM'"),
     AP_INIT_TAKE23("ProxyFCGISetEnvIf", cmd_setenv, NULL, OR_FILEINFO,
                   "expr-condition env-name expr-value"),
+    AP_INIT_FLAG("ProxyFCGIMultiplex", cmd_multiplex, NULL, RSRC_CONF,
+                 "Share the connections between concurrent requests if the "
+                 "FastCGI application multiplexes, 'On' or 'Off' (default)"),
     { NULL }
 };
 
@@ -1338,8 +2397,8 @@ AP_DECLARE_MODULE(proxy_fcgi) = {
     STANDARD20_MODULE_STUFF,
     fcgi_create_dconf,          /* create per-directory config structure */
     fcgi_merge_dconf,           /* merge per-directory config structures */
-    NULL,                       /* create per-server config structure */
-    NULL,                       /* merge per-server config structures */
+    fcgi_create_sconf,          /* create per-server config structure */
+    fcgi_merge_sconf,           /* merge per-server config structures */
     command_table,              /* command apr_table_t */
     register_hooks              /* register hooks */
 };
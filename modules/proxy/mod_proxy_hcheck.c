@@ -17,6 +17,9 @@
 #include "mod_watchdog.h"
 #include "ap_slotmem.h"
 #include "ap_expr.h"
+#include "apr_date.h"
+#include "apr_poll.h"
+#include "apr_ring.h"
 #if APR_HAS_THREADS
 #include "apr_thread_pool.h"
 #endif
@@ -26,6 +29,10 @@ module AP_MODULE_DECLARE_DATA proxy_hcheck_module;
 
 #define HCHECK_WATHCHDOG_NAME ("_proxy_hcheck_")
 #define HC_THREADPOOL_SIZE (16)
+/* Max number of checks in flight with ProxyHCAsync on */
+#define HC_ASYNC_SIZE (4096)
+/* Max response (headers and body) read by an asynchronous check */
+#define HC_ASYNC_MAX_RESPONSE (HUGE_STRING_LEN * 8)
 
 /* Why? So we can easily set/clear HC_USE_THREADS during dev testing */
 #if APR_HAS_THREADS
@@ -51,12 +58,17 @@ typedef struct {
     ap_expr_info_t *pexpr;       /* parsed expression */
 } hc_condition_t;
 
+typedef struct hc_async_t hc_async_t;
+
 typedef struct {
     apr_pool_t *p;
     apr_array_header_t *templates;
     apr_table_t *conditions;
     apr_hash_t *hcworkers;
     server_rec *s;
+    apr_pollset_t *pollset;     /* of the asynchronous checks */
+    APR_RING_HEAD(hc_async_ring, hc_async_t) checks;
+    int inflight;
 } sctx_t;
 
 /* Used in the HC worker via the context field */
@@ -88,10 +100,12 @@ static void *hc_create_config(apr_pool_t *p, server_rec *s)
     ctx->templates = apr_array_make(p, 10, sizeof(hc_template_t));
     ctx->conditions = apr_table_make(p, 10);
     ctx->hcworkers = apr_hash_make(p);
+    APR_RING_INIT(&ctx->checks, hc_async_t, link);
     return ctx;
 }
 
 static ap_watchdog_t *watchdog;
+static int hc_async_max;
 #if HC_USE_THREADS
 static apr_thread_pool_t *hctp;
 static int tpsize;
@@ -336,6 +350,27 @@ static const char *set_hc_tpsize (cmd_parms *cmd, void *dummy, const char *arg)
 }
 #endif
 
+static const char *set_hc_async(cmd_parms *cmd, void *dummy, const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err)
+        return err;
+
+    if (!strcasecmp(arg, "on")) {
+        hc_async_max = HC_ASYNC_SIZE;
+    }
+    else if (!strcasecmp(arg, "off")) {
+        hc_async_max = 0;
+    }
+    else {
+        hc_async_max = atoi(arg);
+        if (hc_async_max <= 0)
+            return "Invalid ProxyHCAsync parameter. Parameter must be "
+                   "on, off or the maximum number of checks in flight";
+    }
+    return NULL;
+}
+
 /*
  * Create a dummy request rec, simply so we can use ap_expr.
  * Use our short-lived pool for bucket_alloc so that we can simply move
@@ -522,6 +557,7 @@ static proxy_worker *hc_get_hcworker(sctx_t *ctx, proxy_worker *worker,
         ap_proxy_initialize_worker(hc, ctx->s, ctx->p);
         hc->s->is_address_reusable = worker->s->is_address_reusable;
         hc->s->disablereuse = worker->s->disablereuse;
+        hc->s->address_ttl = worker->s->address_ttl;
         hc->s->method = worker->s->method;
         rv = apr_uri_parse(p, url, &uri);
         if (rv == APR_SUCCESS) {
@@ -551,23 +587,21 @@ static proxy_worker *hc_get_hcworker(sctx_t *ctx, proxy_worker *worker,
 static int hc_determine_connection(sctx_t *ctx, proxy_worker *worker,
                                    apr_sockaddr_t **addr, apr_pool_t *p)
 {
-    apr_status_t rv = APR_SUCCESS;
+    apr_status_t rv;
     /*
      * normally, this is done in ap_proxy_determine_connection().
      * TODO: Look at using ap_proxy_determine_connection() with a
      * fake request_rec
+     *
+     * The worker's address is shared with the threads of the checks and
+     * possibly refreshed meanwhile, p holds a reference to it.
      */
-    if (worker->cp->addr) {
-        *addr = worker->cp->addr;
-    }
-    else {
-        rv = apr_sockaddr_info_get(addr, worker->s->hostname_ex,
-                                   APR_UNSPEC, worker->s->port, 0, p);
-        if (rv != APR_SUCCESS) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s, APLOGNO(03249)
-                         "DNS lookup failure for: %s:%d",
-                         worker->s->hostname_ex, (int)worker->s->port);
-        }
+    rv = ap_proxy_get_worker_address(worker, worker->s->hostname_ex,
+                                     worker->s->port, p, ctx->s, addr);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s, APLOGNO(03249)
+                     "DNS lookup failure for: %s:%d",
+                     worker->s->hostname_ex, (int)worker->s->port);
     }
     return (rv == APR_SUCCESS ? OK : !OK);
 }
@@ -587,11 +621,6 @@ static apr_status_t hc_init_worker(sctx_t *ctx, proxy_worker *worker)
             ap_log_error(APLOG_MARK, APLOG_EMERG, rv, ctx->s, APLOGNO(03250) "Cannot init worker");
             return rv;
         }
-        if (worker->s->is_address_reusable && !worker->s->disablereuse &&
-                hc_determine_connection(ctx, worker, &worker->cp->addr,
-                                        worker->cp->pool) != OK) {
-            rv = APR_EGENERAL;
-        }
     }
     return rv;
 }
@@ -620,7 +649,6 @@ static int hc_get_backend(const char *proxy_function, proxy_conn_rec **backend,
     int status;
     status = ap_proxy_acquire_connection(proxy_function, backend, hc, ctx->s);
     if (status == OK) {
-        (*backend)->addr = hc->cp->addr;
         (*backend)->hostname = hc->s->hostname_ex;
         if (strcmp(hc->s->scheme, "https") == 0 || strcmp(hc->s->scheme, "wss") == 0 ) {
             if (!ap_ssl_has_outgoing_handlers()) {
@@ -812,6 +840,46 @@ static int hc_read_body(request_rec *r, apr_bucket_brigade *bb)
     return (rv == APR_SUCCESS ? OK : !OK);
 }
 
+/*
+ * Apply the Conditions to the response read in r, or if there
+ * are none consider any status code 2xx or 3xx as "passing"
+ */
+static int hc_check_response(baton_t *baton, request_rec *r)
+{
+    sctx_t *ctx = baton->ctx;
+    proxy_worker *hc = baton->hc;
+    proxy_worker *worker = baton->worker;
+    hc_condition_t *cond;
+    int status = OK;
+
+    if (*worker->s->hcexpr &&
+            (cond = (hc_condition_t *)apr_table_get(ctx->conditions, worker->s->hcexpr)) != NULL) {
+        const char *err;
+        int ok = ap_expr_exec(r, cond->pexpr, &err);
+        if (ok > 0) {
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
+                         "Condition %s for %s (%s): passed", worker->s->hcexpr,
+                         hc->s->name, worker->s->name);
+        } else if (ok < 0 || err) {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, ctx->s, APLOGNO(03301)
+                         "Error on checking condition %s for %s (%s): %s", worker->s->hcexpr,
+                         hc->s->name, worker->s->name, err);
+            status = !OK;
+        } else {
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
+                         "Condition %s for %s (%s) : failed", worker->s->hcexpr,
+                         hc->s->name, worker->s->name);
+            status = !OK;
+        }
+    } else if (r->status < 200 || r->status > 399) {
+        ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
+                     "Response status %i for %s (%s): failed", r->status,
+                     hc->s->name, worker->s->name);
+        status = !OK;
+    }
+    return status;
+}
+
 /*
  * Send the HTTP OPTIONS, HEAD or GET request to the backend
  * server associated w/ worker. If we have Conditions,
@@ -824,11 +892,9 @@ static apr_status_t hc_check_http(baton_t *baton, apr_thread_t *thread)
     proxy_conn_rec *backend = NULL;
     sctx_t *ctx = baton->ctx;
     proxy_worker *hc = baton->hc;
-    proxy_worker *worker = baton->worker;
     apr_pool_t *ptemp = baton->ptemp;
     request_rec *r;
     wctx_t *wctx;
-    hc_condition_t *cond;
     apr_bucket_brigade *bb;
 
     wctx = (wctx_t *)hc->context;
@@ -870,56 +936,19 @@ static apr_status_t hc_check_http(baton_t *baton, apr_thread_t *thread)
         r->trailers_out = apr_table_copy(r->pool, r->trailers_in);
     }
 
-    if (*worker->s->hcexpr &&
-            (cond = (hc_condition_t *)apr_table_get(ctx->conditions, worker->s->hcexpr)) != NULL) {
-        const char *err;
-        int ok = ap_expr_exec(r, cond->pexpr, &err);
-        if (ok > 0) {
-            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
-                         "Condition %s for %s (%s): passed", worker->s->hcexpr,
-                         hc->s->name, worker->s->name);
-        } else if (ok < 0 || err) {
-            ap_log_error(APLOG_MARK, APLOG_INFO, 0, ctx->s, APLOGNO(03301)
-                         "Error on checking condition %s for %s (%s): %s", worker->s->hcexpr,
-                         hc->s->name, worker->s->name, err);
-            status = !OK;
-        } else {
-            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
-                         "Condition %s for %s (%s) : failed", worker->s->hcexpr,
-                         hc->s->name, worker->s->name);
-            status = !OK;
-        }
-    } else if (r->status < 200 || r->status > 399) {
-        ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, ctx->s,
-                     "Response status %i for %s (%s): failed", r->status,
-                     hc->s->name, worker->s->name);
-        status = !OK;
-    }
+    status = hc_check_response(baton, r);
     return backend_cleanup("HCOH", backend, ctx->s, status);
 }
 
-static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
+/*
+ * Account the result of the check to the worker, and release the baton
+ */
+static void hc_check_done(baton_t *baton, apr_status_t rv, const char *kind)
 {
-    baton_t *baton = (baton_t *)b;
     server_rec *s = baton->ctx->s;
     proxy_worker *worker = baton->worker;
     proxy_worker *hc = baton->hc;
     apr_time_t now;
-    apr_status_t rv;
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03256)
-                 "%sHealth checking %s", (thread ? "Threaded " : ""),
-                 worker->s->name);
-
-    if (hc->s->method == TCP) {
-        rv = hc_check_tcp(baton);
-    }
-    else if (hc->s->method == CPING) {
-        rv = hc_check_cping(baton, thread);
-    }
-    else {
-        rv = hc_check_http(baton, thread);
-    }
 
     now = apr_time_now();
     if (rv == APR_ENOTIMPL) {
@@ -936,7 +965,7 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
                 ap_proxy_set_wstatus(PROXY_WORKER_IN_ERROR_FLAG, 0, worker);
                 worker->s->pcount = 0;
                 ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03302)
-                             "%sHealth check ENABLING %s", (thread ? "Threaded " : ""),
+                             "%sHealth check ENABLING %s", kind,
                              worker->s->name);
 
             }
@@ -950,7 +979,7 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
                 ap_proxy_set_wstatus(PROXY_WORKER_HC_FAIL_FLAG, 1, worker);
                 worker->s->fcount = 0;
                 ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03303)
-                             "%sHealth check DISABLING %s", (thread ? "Threaded " : ""),
+                             "%sHealth check DISABLING %s", kind,
                              worker->s->name);
             }
         }
@@ -960,10 +989,448 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
     }
     apr_pool_destroy(baton->ptemp);
     worker->s->updated = now;
+}
+
+static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
+{
+    baton_t *baton = (baton_t *)b;
+    server_rec *s = baton->ctx->s;
+    proxy_worker *worker = baton->worker;
+    proxy_worker *hc = baton->hc;
+    apr_status_t rv;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03256)
+                 "%sHealth checking %s", (thread ? "Threaded " : ""),
+                 worker->s->name);
+
+    if (hc->s->method == TCP) {
+        rv = hc_check_tcp(baton);
+    }
+    else if (hc->s->method == CPING) {
+        rv = hc_check_cping(baton, thread);
+    }
+    else {
+        rv = hc_check_http(baton, thread);
+    }
+
+    hc_check_done(baton, rv, (thread ? "Threaded " : ""));
 
     return NULL;
 }
 
+/*
+ * Asynchronous checks (ProxyHCAsync)
+ *
+ * TCP, CPING and plain HTTP checks are driven by nonblocking sockets
+ * from a pollset per server, which the watchdog thread polls at each
+ * of its runs. Thus the number of workers checked concurrently does not
+ * depend on the number of threads. HTTPS and UDS checks still go through
+ * hc_check(), which needs a connection with its filters.
+ */
+typedef enum {
+    HC_ASYNC_CONNECT,
+    HC_ASYNC_SEND,
+    HC_ASYNC_RECV
+} hc_async_state_e;
+
+struct hc_async_t {
+    APR_RING_ENTRY(hc_async_t) link;
+    baton_t *baton;
+    apr_socket_t *sock;
+    apr_sockaddr_t *addr;
+    apr_pollfd_t pfd;
+    hc_async_state_e state;
+    const char *out;
+    apr_size_t outlen;
+    apr_size_t outpos;
+    char *in;
+    apr_size_t inlen;
+    apr_time_t deadline;
+};
+
+/* AJP13 CPING packet, and the CPONG we expect back */
+static const char hc_cping[] = { 0x12, 0x34, 0x00, 0x01, 0x0A };
+static const char hc_cpong[] = { 'A', 'B', 0x00, 0x01, 0x09 };
+
+static int hc_async_eligible(proxy_worker *hc)
+{
+    wctx_t *wctx = (wctx_t *)hc->context;
+
+    if (*hc->s->uds_path || strcmp(hc->s->scheme, "https") == 0
+            || strcmp(hc->s->scheme, "wss") == 0) {
+        return 0;
+    }
+    switch (hc->s->method) {
+    case TCP:
+        return 1;
+    case CPING:
+        return ajp_handle_cping_cpong != NULL;
+    case OPTIONS:
+    case HEAD:
+    case GET:
+    case OPTIONS11:
+    case HEAD11:
+    case GET11:
+        return wctx && wctx->req && wctx->method;
+    default:
+        return 0;
+    }
+}
+
+static void hc_async_finish(sctx_t *ctx, hc_async_t *check, apr_status_t rv)
+{
+    baton_t *baton = check->baton;
+
+    apr_pollset_remove(ctx->pollset, &check->pfd);
+    apr_socket_close(check->sock);
+    APR_RING_REMOVE(check, link);
+    ctx->inflight--;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ctx->s, APLOGNO(10471)
+                 "Health check %s Status (%d) for %s.",
+                 ap_proxy_show_hcmethod(baton->hc->s->method),
+                 rv == APR_SUCCESS ? OK : !OK, baton->hc->s->name);
+
+    /* destroys the check too */
+    hc_check_done(baton, rv, "Async ");
+}
+
+static apr_status_t hc_async_want(sctx_t *ctx, hc_async_t *check,
+                                  apr_int16_t events)
+{
+    if (check->pfd.reqevents == events) {
+        return APR_SUCCESS;
+    }
+    apr_pollset_remove(ctx->pollset, &check->pfd);
+    check->pfd.reqevents = events;
+    return apr_pollset_add(ctx->pollset, &check->pfd);
+}
+
+static char *hc_async_getline(char **pos, char *end)
+{
+    char *line = *pos, *eol;
+
+    eol = memchr(line, '\n', end - line);
+    if (!eol) {
+        return NULL;
+    }
+    *pos = eol + 1;
+    if (eol > line && eol[-1] == '\r') {
+        eol--;
+    }
+    *eol = '\0';
+    return line;
+}
+
+/* Decode a chunked body in place, returns its length */
+static apr_size_t hc_async_dechunk(char *body, apr_size_t len)
+{
+    char *pos = body, *end = body + len, *line;
+    apr_size_t out = 0;
+
+    while (pos < end && (line = hc_async_getline(&pos, end)) != NULL) {
+        char *stop;
+        apr_int64_t size = apr_strtoi64(line, &stop, 16);
+        if (size <= 0) {
+            break;
+        }
+        if (size > end - pos) {
+            size = end - pos;
+        }
+        memmove(body + out, pos, (apr_size_t)size);
+        out += (apr_size_t)size;
+        pos += size;
+        if (!hc_async_getline(&pos, end)) {
+            break;
+        }
+    }
+    return out;
+}
+
+/*
+ * Parse the response read by an HTTP check in a dummy request, like
+ * hc_read_headers() and hc_read_body() do, and apply the conditions.
+ */
+static apr_status_t hc_async_check_response(sctx_t *ctx, hc_async_t *check)
+{
+    baton_t *baton = check->baton;
+    wctx_t *wctx = (wctx_t *)baton->hc->context;
+    apr_pool_t *ptemp = baton->ptemp;
+    char *pos = check->in, *end = check->in + check->inlen, *line;
+    const char *val;
+    request_rec *r;
+    conn_rec *c;
+
+    r = create_request_rec(ptemp, ctx->s, baton->balancer, wctx->method,
+                           wctx->protocol);
+    c = apr_pcalloc(ptemp, sizeof(conn_rec));
+    c->pool = ptemp;
+    c->base_server = ctx->s;
+    c->conn_config = ap_create_conn_config(ptemp);
+    c->notes = apr_table_make(ptemp, 5);
+    c->client_addr = c->local_addr = check->addr;
+    apr_sockaddr_ip_get(&c->client_ip, check->addr);
+    c->local_ip = c->client_ip;
+    set_request_connection(r, c);
+
+    line = hc_async_getline(&pos, end);
+    if (!line || !apr_date_checkmask(line, "HTTP/#.# ###*")
+            || line[5] != '1') {
+        return APR_EGENERAL;
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s, APLOGNO(10472)
+                 "%s", line);
+    r->status = atoi(&line[9]);
+    r->status_line = apr_pstrdup(r->pool, &line[9]);
+
+    while ((line = hc_async_getline(&pos, end)) != NULL && *line) {
+        char *value, *last;
+        ap_log_error(APLOG_MARK, APLOG_TRACE7, 0, ctx->s, "%s", line);
+        if (!(value = strchr(line, ':'))) {
+            return APR_EGENERAL;
+        }
+        *value++ = '\0';
+        while (apr_isspace(*value))
+            ++value;
+        for (last = value + strlen(value); last > value && apr_isspace(last[-1]); )
+            *--last = '\0';
+        apr_table_add(r->headers_out, line, value);
+    }
+    if (!line) {
+        /* truncated headers */
+        return APR_EGENERAL;
+    }
+    if ((val = apr_table_get(r->headers_out, "Content-Type")) != NULL) {
+        ap_set_content_type(r, val);
+    }
+
+    if (!r->header_only && pos < end) {
+        apr_size_t len = end - pos;
+        if ((val = apr_table_get(r->headers_out, "Transfer-Encoding"))
+                && ap_is_chunked(r->pool, val)) {
+            len = hc_async_dechunk(pos, len);
+        }
+        else if ((val = apr_table_get(r->headers_out, "Content-Length"))) {
+            apr_off_t cl;
+            if (ap_parse_strict_length(&cl, val) && cl < (apr_off_t)len) {
+                len = (apr_size_t)cl;
+            }
+        }
+        APR_BRIGADE_INSERT_TAIL(r->kept_body,
+                                apr_bucket_pool_create(pos, len, r->pool,
+                                                       c->bucket_alloc));
+    }
+
+    return hc_check_response(baton, r) == OK ? APR_SUCCESS : APR_EGENERAL;
+}
+
+/* Response complete (or EOF), decide */
+static void hc_async_done_reading(sctx_t *ctx, hc_async_t *check)
+{
+    apr_status_t rv;
+
+    if (check->baton->hc->s->method == CPING) {
+        rv = (check->inlen >= sizeof(hc_cpong)
+              && !memcmp(check->in, hc_cpong, sizeof(hc_cpong)))
+             ? APR_SUCCESS : APR_EGENERAL;
+    }
+    else {
+        rv = hc_async_check_response(ctx, check);
+    }
+    hc_async_finish(ctx, check, rv);
+}
+
+static void hc_async_event(sctx_t *ctx, hc_async_t *check)
+{
+    apr_status_t rv;
+    apr_size_t len;
+
+    switch (check->state) {
+    case HC_ASYNC_CONNECT:
+        /* Connecting again tells how the first attempt went */
+        rv = apr_socket_connect(check->sock, check->addr);
+        if (APR_STATUS_IS_EINPROGRESS(rv) || rv == EALREADY) {
+            return;
+        }
+        if (rv != APR_SUCCESS) {
+            hc_async_finish(ctx, check, rv);
+            return;
+        }
+        if (!check->out) {
+            /* TCP check, connected is all we want */
+            hc_async_finish(ctx, check, APR_SUCCESS);
+            return;
+        }
+        check->state = HC_ASYNC_SEND;
+        /* fallthrough */
+
+    case HC_ASYNC_SEND:
+        while (check->outpos < check->outlen) {
+            len = check->outlen - check->outpos;
+            rv = apr_socket_send(check->sock, check->out + check->outpos,
+                                 &len);
+            check->outpos += len;
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                if ((rv = hc_async_want(ctx, check, APR_POLLOUT))) {
+                    hc_async_finish(ctx, check, rv);
+                }
+                return;
+            }
+            if (rv != APR_SUCCESS) {
+                hc_async_finish(ctx, check, rv);
+                return;
+            }
+        }
+        check->state = HC_ASYNC_RECV;
+        if ((rv = hc_async_want(ctx, check, APR_POLLIN))) {
+            hc_async_finish(ctx, check, rv);
+        }
+        return;
+
+    case HC_ASYNC_RECV:
+        for (;;) {
+            len = HC_ASYNC_MAX_RESPONSE - check->inlen;
+            rv = apr_socket_recv(check->sock, check->in + check->inlen, &len);
+            check->inlen += len;
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                if (check->baton->hc->s->method == CPING
+                        && check->inlen >= sizeof(hc_cpong)) {
+                    break;
+                }
+                return;
+            }
+            if (APR_STATUS_IS_EOF(rv) || check->inlen == HC_ASYNC_MAX_RESPONSE) {
+                break;
+            }
+            if (rv != APR_SUCCESS) {
+                hc_async_finish(ctx, check, rv);
+                return;
+            }
+        }
+        hc_async_done_reading(ctx, check);
+        return;
+    }
+}
+
+/* Start the check of the baton, or tell why it can't */
+static apr_status_t hc_async_start(sctx_t *ctx, baton_t *baton)
+{
+    proxy_worker *hc = baton->hc;
+    wctx_t *wctx = (wctx_t *)hc->context;
+    apr_pool_t *ptemp = baton->ptemp;
+    apr_interval_time_t timeout;
+    hc_async_t *check;
+    apr_status_t rv;
+
+    check = apr_pcalloc(ptemp, sizeof(hc_async_t));
+    check->baton = baton;
+    if (hc_determine_connection(ctx, hc, &check->addr, ptemp) != OK) {
+        return APR_EGENERAL;
+    }
+    rv = apr_socket_create(&check->sock, check->addr->family, SOCK_STREAM,
+                           APR_PROTO_TCP, ptemp);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    apr_socket_opt_set(check->sock, APR_SO_NONBLOCK, 1);
+    apr_socket_timeout_set(check->sock, 0);
+
+    if (hc->s->method == CPING) {
+        check->out = hc_cping;
+        check->outlen = sizeof(hc_cping);
+    }
+    else if (hc->s->method != TCP) {
+        /* Read the response until the backend closes */
+        apr_size_t len = strlen(wctx->req);
+        check->out = apr_pstrcat(ptemp,
+                                 apr_pstrmemdup(ptemp, wctx->req, len - 2),
+                                 "Connection: close\r\n\r\n", NULL);
+        check->outlen = strlen(check->out);
+    }
+    if (check->out) {
+        check->in = apr_palloc(ptemp, HC_ASYNC_MAX_RESPONSE);
+    }
+
+    if (hc->s->method == CPING && hc->s->ping_timeout_set) {
+        timeout = hc->s->ping_timeout;
+    } else if (hc->s->conn_timeout_set) {
+        timeout = hc->s->conn_timeout;
+    } else if (hc->s->timeout_set) {
+        timeout = hc->s->timeout;
+    } else {
+        timeout = ctx->s->timeout;
+    }
+    check->deadline = apr_time_now() + timeout;
+
+    rv = apr_socket_connect(check->sock, check->addr);
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_EINPROGRESS(rv)) {
+        apr_socket_close(check->sock);
+        return rv;
+    }
+
+    check->state = HC_ASYNC_CONNECT;
+    check->pfd.p = ptemp;
+    check->pfd.desc_type = APR_POLL_SOCKET;
+    check->pfd.desc.s = check->sock;
+    check->pfd.reqevents = APR_POLLOUT;
+    check->pfd.client_data = check;
+    rv = apr_pollset_add(ctx->pollset, &check->pfd);
+    if (rv != APR_SUCCESS) {
+        apr_socket_close(check->sock);
+        return rv;
+    }
+    APR_RING_INSERT_TAIL(&ctx->checks, check, hc_async_t, link);
+    ctx->inflight++;
+
+    return APR_SUCCESS;
+}
+
+/* Make progress on the checks in flight, without blocking */
+static void hc_async_run(sctx_t *ctx)
+{
+    const apr_pollfd_t *results;
+    apr_int32_t i, num;
+    hc_async_t *check, *next;
+    apr_time_t now;
+    int rounds = 0;
+
+    while (ctx->inflight && rounds++ < 16) {
+        if (apr_pollset_poll(ctx->pollset, 0, &num, &results) != APR_SUCCESS
+                || num <= 0) {
+            break;
+        }
+        for (i = 0; i < num; i++) {
+            hc_async_event(ctx, (hc_async_t *)results[i].client_data);
+        }
+    }
+
+    now = apr_time_now();
+    check = APR_RING_FIRST(&ctx->checks);
+    while (check != APR_RING_SENTINEL(&ctx->checks, hc_async_t, link)) {
+        next = APR_RING_NEXT(check, link);
+        if (now > check->deadline) {
+            hc_async_finish(ctx, check, APR_TIMEUP);
+        }
+        check = next;
+    }
+}
+
+/* Drop the checks in flight, they will be done again by the next watchdog */
+static void hc_async_abort(sctx_t *ctx)
+{
+    hc_async_t *check;
+
+    while (!APR_RING_EMPTY(&ctx->checks, hc_async_t, link)) {
+        check = APR_RING_FIRST(&ctx->checks);
+        apr_pollset_remove(ctx->pollset, &check->pfd);
+        apr_socket_close(check->sock);
+        APR_RING_REMOVE(check, link);
+        check->baton->worker->s->updated = apr_time_now();
+        apr_pool_destroy(check->baton->ptemp);
+    }
+    ctx->inflight = 0;
+}
+
 static apr_status_t hc_watchdog_callback(int state, void *data,
                                          apr_pool_t *pool)
 {
@@ -999,6 +1466,17 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                 hctp = NULL;
             }
 #endif
+            if (hc_async_max && ctx->pollset == NULL) {
+                rv = apr_pollset_create(&ctx->pollset, hc_async_max, ctx->p, 0);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10473)
+                                 "apr_pollset_create() for %d asynchronous "
+                                 "checks failed", hc_async_max);
+                    /* we can continue on with the synchronous checks */
+                    ctx->pollset = NULL;
+                    rv = APR_SUCCESS;
+                }
+            }
             break;
 
         case AP_WATCHDOG_STATE_RUNNING:
@@ -1025,6 +1503,8 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                             (now > worker->s->updated + worker->s->interval)) {
                             baton_t *baton;
                             apr_pool_t *ptemp;
+                            proxy_worker *hc;
+                            int async;
 
                             ap_log_error(APLOG_MARK, APLOG_TRACE3, 0, s,
                                          "Checking %s worker: %s  [%d] (%pp)", balancer->s->name,
@@ -1034,17 +1514,36 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                                 worker->s->updated = now;
                                 return rv;
                             }
-                            worker->s->updated = 0;
 
                             /* This pool has the lifetime of the check */
                             apr_pool_create(&ptemp, ctx->p);
                             apr_pool_tag(ptemp, "hc_request");
+                            hc = hc_get_hcworker(ctx, worker, ptemp);
+                            async = ctx->pollset && hc_async_eligible(hc);
+                            if (async && ctx->inflight >= hc_async_max) {
+                                /* Full, check it at the next run */
+                                apr_pool_destroy(ptemp);
+                                workers++;
+                                continue;
+                            }
+                            worker->s->updated = 0;
+
                             baton = apr_pcalloc(ptemp, sizeof(baton_t));
                             baton->ctx = ctx;
                             baton->balancer = balancer;
                             baton->worker = worker;
                             baton->ptemp = ptemp;
-                            baton->hc = hc_get_hcworker(ctx, worker, ptemp);
+                            baton->hc = hc;
+                            if (async) {
+                                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10474)
+                                             "Async Health checking %s",
+                                             worker->s->name);
+                                if ((rv = hc_async_start(ctx, baton)) != APR_SUCCESS) {
+                                    hc_check_done(baton, rv, "Async ");
+                                    rv = APR_SUCCESS;
+                                }
+                            }
+                            else
 #if HC_USE_THREADS
                             if (hctp) {
                                 apr_thread_pool_push(hctp, hc_check, (void *)baton,
@@ -1061,6 +1560,9 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                         workers++;
                     }
                 }
+                if (ctx->pollset) {
+                    hc_async_run(ctx);
+                }
             }
             break;
 
@@ -1078,6 +1580,11 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                 hctp = NULL;
             }
 #endif
+            if (ctx->pollset) {
+                hc_async_abort(ctx);
+                apr_pollset_destroy(ctx->pollset);
+                ctx->pollset = NULL;
+            }
             break;
     }
     return rv;
@@ -1089,6 +1596,7 @@ static int hc_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
     hctp = NULL;
     tpsize = HC_THREADPOOL_SIZE;
 #endif
+    hc_async_max = 0;
 
     ajp_handle_cping_cpong = APR_RETRIEVE_OPTIONAL_FN(ajp_handle_cping_cpong);
     if (ajp_handle_cping_cpong) {
@@ -1318,6 +1826,9 @@ static const command_rec command_table[] = {
     AP_INIT_TAKE1("ProxyHCTPsize", set_hc_tpsize, NULL, RSRC_CONF,
                      "Set size of health check thread pool"),
 #endif
+    AP_INIT_TAKE1("ProxyHCAsync", set_hc_async, NULL, RSRC_CONF,
+                     "Check workers asynchronously: on, off or the maximum "
+                     "number of checks in flight"),
     { NULL }
 };
 
@@ -278,6 +278,9 @@ static void add_cl(apr_pool_t *p,
 typedef enum {
     PROXY_HTTP_REQ_HAVE_HEADER = 0,
 
+    PROXY_HTTP_WAITING_RESPONSE,
+    PROXY_HTTP_WAITING_BODY,
+
     PROXY_HTTP_TUNNELING
 } proxy_http_state;
 
@@ -303,6 +306,8 @@ typedef struct {
     apr_bucket_alloc_t *bucket_alloc;
     apr_bucket_brigade *header_brigade;
     apr_bucket_brigade *input_brigade;
+    apr_bucket_brigade *response_brigade;
+    apr_bucket_brigade *pass_brigade;
 
     char *old_cl_val, *old_te_val;
     apr_off_t cl_val;
@@ -314,6 +319,7 @@ typedef struct {
     proxy_tunnel_rec *tunnel;
 
     apr_pool_t *async_pool;
+    apr_array_header_t *async_pfds;
     apr_interval_time_t idle_timeout;
 
     unsigned int can_go_async           :1,
@@ -330,10 +336,10 @@ static void proxy_http_async_finish(proxy_http_req_t *req)
                   "proxy %s: finish async", req->proto);
 
     /* Report bytes exchanged by the backend */
-    req->backend->worker->s->read +=
-        ap_proxy_tunnel_conn_bytes_in(req->tunnel->origin);
-    req->backend->worker->s->transferred +=
-        ap_proxy_tunnel_conn_bytes_out(req->tunnel->origin);
+    ap_proxy_add_read(req->backend->worker,
+                      ap_proxy_tunnel_conn_bytes_in(req->tunnel->origin));
+    ap_proxy_add_transferred(req->backend->worker,
+                             ap_proxy_tunnel_conn_bytes_out(req->tunnel->origin));
 
     proxy_run_detach_backend(req->r, req->backend);
     ap_proxy_release_connection(req->proto, req->backend, req->r->server);
@@ -346,6 +352,105 @@ static void proxy_http_async_finish(proxy_http_req_t *req)
     ap_mpm_resume_suspended(c);
 }
 
+static int ap_proxy_http_process_response(proxy_http_req_t *req);
+static int stream_resbody(proxy_http_req_t *req);
+static void proxy_http_async_cb(void *baton);
+static void proxy_http_async_cancel_cb(void *baton);
+
+/* Complete a request which was suspended while waiting for the backend's
+ * response, like proxy_http_handler() and the core would have.
+ */
+static void proxy_http_async_done(proxy_http_req_t *req, int status)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "proxy %s: done async (%i)", req->proto, status);
+
+    if (req->backend) {
+        proxy_run_detach_backend(r, req->backend);
+        if (status != OK) {
+            req->backend->close = 1;
+        }
+        ap_proxy_release_connection(req->proto, req->backend, r->server);
+        req->backend = NULL;
+    }
+
+    if (status == DONE) {
+        status = OK;
+    }
+    if (status == OK) {
+        ap_finalize_request_protocol(r);
+    }
+    else {
+        r->status = HTTP_OK;
+        ap_die(status, r);
+    }
+    ap_process_request_after_handler(r);
+    /* don't touch req or req->r from here */
+
+    ap_mpm_resume_suspended(c);
+}
+
+/* Poll the given descriptors from the MPM and call back when ready, or
+ * cancel after the timeout.
+ */
+static int proxy_http_async_wait(proxy_http_req_t *req,
+                                 apr_array_header_t *pfds,
+                                 apr_interval_time_t timeout)
+{
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
+                  "proxy %s: suspended, going async",
+                  req->proto);
+
+    if (!req->async_pool) {
+        /* Create the subpool used by the MPM to alloc its own
+         * temporary data, which we want to clear on the next
+         * round (in proxy_http_async_cb()) to avoid leaks.
+         */
+        apr_pool_create(&req->async_pool, req->p);
+    }
+
+    ap_mpm_register_poll_callback_timeout(req->async_pool, pfds,
+                                          proxy_http_async_cb,
+                                          proxy_http_async_cancel_cb,
+                                          req, timeout);
+    return SUSPENDED;
+}
+
+/* Wait for the backend to be readable, synchronously for ProxyAsyncDelay
+ * and then by suspending the request (in the given state) until it is.
+ * Returns OK if the backend is readable, or SUSPENDED.
+ */
+static int proxy_http_wait_backend(proxy_http_req_t *req,
+                                   proxy_http_state state)
+{
+    apr_pollfd_t *pfd;
+    apr_int32_t nfds;
+    apr_interval_time_t timeout;
+
+    if (!req->async_pfds) {
+        req->async_pfds = apr_array_make(req->p, 1, sizeof(apr_pollfd_t));
+        pfd = apr_array_push(req->async_pfds);
+        pfd->p = req->p;
+        pfd->desc_type = APR_POLL_SOCKET;
+        pfd->desc.s = req->backend->sock;
+        pfd->reqevents = APR_POLLIN;
+    }
+    pfd = (apr_pollfd_t *)req->async_pfds->elts;
+    pfd->rtnevents = 0;
+    if (apr_poll(pfd, 1, &nfds, req->dconf->async_delay) == APR_SUCCESS
+            && nfds > 0) {
+        return OK;
+    }
+
+    /* Same timeout as a blocking read on the backend */
+    apr_socket_timeout_get(req->backend->sock, &timeout);
+    req->state = state;
+    return proxy_http_async_wait(req, req->async_pfds, timeout);
+}
+
 /* If neither socket becomes readable in the specified timeout,
  * this callback will kill the request.
  * We do not have to worry about having a cancel and a IO both queued.
@@ -353,13 +458,45 @@ static void proxy_http_async_finish(proxy_http_req_t *req)
 static void proxy_http_async_cancel_cb(void *baton)
 { 
     proxy_http_req_t *req = (proxy_http_req_t *)baton;
+    request_rec *r = req->r;
+    apr_bucket_brigade *bb;
+    int status;
 
-    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
                   "proxy %s: cancel async", req->proto);
 
-    req->r->connection->keepalive = AP_CONN_CLOSE;
-    req->backend->close = 1;
-    proxy_http_async_finish(req);
+    switch (req->state) {
+    case PROXY_HTTP_WAITING_RESPONSE:
+        /* As if the blocking read of the status line timed out */
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, APR_TIMEUP, r, APLOGNO(10475)
+                      "error reading status line from remote "
+                      "server %s:%d", req->backend->hostname,
+                      req->backend->port);
+        apr_table_setn(r->notes, "proxy_timedout", "1");
+        status = ap_proxyerror(r, HTTP_BAD_GATEWAY,
+                               "Error reading from remote server");
+        proxy_http_async_done(req, status);
+        break;
+
+    case PROXY_HTTP_WAITING_BODY:
+        /* Half way through the response, abort the client connection */
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, APR_TIMEUP, r, APLOGNO(10476)
+                      "Network error reading response");
+        apr_table_setn(r->notes, "proxy_timedout", "1");
+        bb = req->response_brigade;
+        apr_brigade_cleanup(bb);
+        ap_proxy_fill_error_brigade(r, HTTP_BAD_GATEWAY, bb, 1);
+        ap_pass_brigade(r->output_filters, bb);
+        apr_brigade_cleanup(bb);
+        proxy_http_async_done(req, DONE);
+        break;
+
+    default:
+        r->connection->keepalive = AP_CONN_CLOSE;
+        req->backend->close = 1;
+        proxy_http_async_finish(req);
+        break;
+    }
 }
 
 /* Invoked by the event loop when data is ready on either end. 
@@ -377,6 +514,23 @@ static void proxy_http_async_cb(void *baton)
     }
 
     switch (req->state) {
+    case PROXY_HTTP_WAITING_RESPONSE:
+        /* Going async again or tunneling is handled from there */
+        status = ap_proxy_http_process_response(req);
+        if (status != SUSPENDED) {
+            proxy_http_async_done(req, status);
+        }
+        return;
+
+    case PROXY_HTTP_WAITING_BODY:
+        status = stream_resbody(req);
+        if (status != SUSPENDED) {
+            apr_brigade_cleanup(req->response_brigade);
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, req->r, "end body send");
+            proxy_http_async_done(req, status);
+        }
+        return;
+
     case PROXY_HTTP_TUNNELING:
         /* Pump both ends until they'd block and then start over again */
         status = ap_proxy_tunnel_run(req->tunnel);
@@ -394,23 +548,7 @@ static void proxy_http_async_cb(void *baton)
     }
 
     if (status == SUSPENDED) {
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
-                      "proxy %s: suspended, going async",
-                      req->proto);
-
-        if (!req->async_pool) {
-            /* Create the subpool used by the MPM to alloc its own
-             * temporary data, which we want to clear on the next
-             * round (above) to avoid leaks.
-             */
-            apr_pool_create(&req->async_pool, req->p);
-        }
-
-        ap_mpm_register_poll_callback_timeout(req->async_pool,
-                                              req->tunnel->pfds,
-                                              proxy_http_async_cb, 
-                                              proxy_http_async_cancel_cb, 
-                                              req, req->idle_timeout);
+        proxy_http_async_wait(req, req->tunnel->pfds, req->idle_timeout);
     }
     else if (ap_is_HTTP_ERROR(status)) {
         proxy_http_async_cancel_cb(req);
@@ -555,6 +693,25 @@ static void terminate_headers(proxy_http_req_t *req)
     ap_h1_terminate_header(req->header_brigade);
 }
 
+/* Whether a request body of unknown length can be sent chunked */
+static int proxy_http_sendchunked(proxy_http_req_t *req)
+{
+    proxy_worker_shared *s = req->worker->s;
+
+    switch (s->sendchunked) {
+    case PROXY_SENDCHUNKED_ON:
+        return 1;
+    case PROXY_SENDCHUNKED_OFF:
+        return 0;
+    case PROXY_SENDCHUNKED_PROBE:
+        /* Spool until we know */
+        return (apr_atomic_read32(&s->sendchunked_probed)
+                == PROXY_SENDCHUNKED_PROBED_YES);
+    default:
+        return !apr_table_get(req->r->subprocess_env, "proxy-sendcl");
+    }
+}
+
 static int ap_proxy_http_prefetch(proxy_http_req_t *req,
                                   apr_uri_t *uri, char *url)
 {
@@ -641,7 +798,8 @@ static int ap_proxy_http_prefetch(proxy_http_req_t *req,
      *   chain thus none should change the body => RB_STREAM_CL.
      *
      *   The administrator has not SetEnv "force-proxy-request-1.0" or
-     *   "proxy-sendcl" which prevents T-E => RB_STREAM_CHUNKED.
+     *   "proxy-sendcl" which prevents T-E, or the worker is known to accept
+     *   it (sendchunked=) => RB_STREAM_CHUNKED.
      *
      * Otherwise we need to determine and set a content-length, so spool the
      * entire request body to memory or temporary file (above MAX_MEM_SPOOL),
@@ -672,8 +830,7 @@ static int ap_proxy_http_prefetch(proxy_http_req_t *req,
         }
         req->rb_method = RB_STREAM_CL;
     }
-    else if (!req->force10 && !apr_table_get(r->subprocess_env,
-                                             "proxy-sendcl")) {
+    else if (!req->force10 && proxy_http_sendchunked(req)) {
         /* Streaming is possible using T-E: chunked */
         req->rb_method = RB_STREAM_CHUNKED;
     }
@@ -1060,6 +1217,198 @@ static int send_continue_body(proxy_http_req_t *req)
     return status;
 }
 
+/*
+ * Forward the body of the response to the client, until the end or until
+ * reading from the backend would block and the request goes async.
+ * Returns OK when done, DONE if either end broke, or SUSPENDED.
+ */
+static int stream_resbody(proxy_http_req_t *req)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+    proxy_conn_rec *backend = req->backend;
+    apr_bucket_brigade *bb = req->response_brigade;
+    apr_bucket_brigade *pass_bb = req->pass_brigade;
+    apr_read_type_e mode = APR_NONBLOCK_READ;
+    int finish = FALSE;
+    int backend_broke = 0;
+    apr_bucket *e;
+
+    do {
+        apr_off_t readbytes;
+        apr_status_t rv;
+
+        rv = ap_get_brigade(backend->r->input_filters, bb,
+                            AP_MODE_READBYTES, mode,
+                            req->sconf->io_buffer_size);
+
+        /* ap_get_brigade will return success with an empty brigade
+         * for a non-blocking read which would block: */
+        if (mode == APR_NONBLOCK_READ
+            && (APR_STATUS_IS_EAGAIN(rv)
+                || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
+            /* flush to the client and wait for the backend */
+            e = apr_bucket_flush_create(c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+            if (ap_pass_brigade(r->output_filters, bb)
+                || c->aborted) {
+                backend->close = 1;
+                break;
+            }
+            apr_brigade_cleanup(bb);
+            if (req->can_go_async) {
+                /* Don't hold this thread while the backend is idle */
+                if (proxy_http_wait_backend(req, PROXY_HTTP_WAITING_BODY)
+                        == SUSPENDED) {
+                    return SUSPENDED;
+                }
+                continue;
+            }
+            mode = APR_BLOCK_READ;
+            continue;
+        }
+        if (rv == APR_EOF) {
+            backend->close = 1;
+            break;
+        }
+        if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(bb)) {
+            int error_status = HTTP_BAD_GATEWAY;
+            if (rv == APR_ENOSPC) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02475)
+                              "Response chunk/line was too large to parse");
+            }
+            else if (rv == APR_ENOTIMPL) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02476)
+                              "Response Transfer-Encoding was not recognised");
+            }
+            else if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01110)
+                              "Network error reading response");
+            }
+            else {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10293)
+                              "Unexpected empty data reading response");
+                error_status = HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            /* In this case, we are in real trouble because
+             * our backend bailed on us. Given we're half way
+             * through a response, our only option is to
+             * disconnect the client too.
+             */
+            apr_brigade_cleanup(bb);
+            ap_proxy_fill_error_brigade(r, error_status, bb, 1);
+            ap_pass_brigade(r->output_filters, bb);
+
+            backend_broke = 1;
+            backend->close = 1;
+            break;
+        }
+        /* next time try a non-blocking read */
+        mode = APR_NONBLOCK_READ;
+
+        if (!apr_is_empty_table(backend->r->trailers_in)) {
+            apr_table_do(add_trailers, r->trailers_out,
+                    backend->r->trailers_in, NULL);
+            apr_table_clear(backend->r->trailers_in);
+        }
+
+        apr_brigade_length(bb, 0, &readbytes);
+        ap_proxy_add_read(backend->worker, readbytes);
+#if DEBUGGING
+        {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
+                      "readbytes: %#x", readbytes);
+        }
+#endif
+
+        /* Switch the allocator lifetime of the buckets */
+        rv = ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
+        if (rv != APR_SUCCESS) {
+            /* Same, half way through a response, our only option is
+             * to notice the output filters and then disconnect the
+             * client and backend.
+             */
+            if (!APR_BRIGADE_EMPTY(pass_bb)) {
+                /* Pass what we have still */
+                ap_pass_brigade(r->output_filters, pass_bb);
+                apr_brigade_cleanup(pass_bb);
+            }
+            ap_proxy_fill_error_brigade(r, HTTP_INTERNAL_SERVER_ERROR,
+                                        pass_bb, 1);
+            ap_pass_brigade(r->output_filters, pass_bb);
+            apr_brigade_cleanup(pass_bb);
+
+            backend_broke = 1;
+            backend->close = 1;
+            break;
+        }
+
+        /* found the last brigade? */
+        if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
+
+            /* signal that we must leave */
+            finish = TRUE;
+
+            /* the brigade may contain transient buckets that contain
+             * data that lives only as long as the backend connection.
+             * Force a setaside so these transient buckets become heap
+             * buckets that live as long as the request.
+             */
+            for (e = APR_BRIGADE_FIRST(pass_bb); e
+                    != APR_BRIGADE_SENTINEL(pass_bb); e
+                    = APR_BUCKET_NEXT(e)) {
+                apr_bucket_setaside(e, r->pool);
+            }
+
+            /* finally it is safe to clean up the brigade from the
+             * connection pool, as we have forced a setaside on all
+             * buckets.
+             */
+            apr_brigade_cleanup(bb);
+
+            /* make sure we release the backend connection as soon
+             * as we know we are done, so that the backend isn't
+             * left waiting for a slow client to eventually
+             * acknowledge the data.
+             */
+            proxy_run_detach_backend(r, backend);
+            ap_proxy_release_connection(backend->worker->s->scheme,
+                    backend, r->server);
+            /* Ensure that the backend is not reused */
+            req->backend = NULL;
+
+        }
+
+        /* try send what we read */
+        if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
+            || c->aborted) {
+            /* Ack! Phbtt! Die! User aborted! */
+            /* Only close backend if we haven't got all from the
+             * backend. Furthermore if req->backend is NULL it is no
+             * longer safe to fiddle around with backend as it might
+             * be already in use by another thread.
+             */
+            if (req->backend) {
+                /* this causes socket close below */
+                req->backend->close = 1;
+            }
+            finish = TRUE;
+        }
+
+        /* make sure we always clean up after ourselves */
+        apr_brigade_cleanup(pass_bb);
+        apr_brigade_cleanup(bb);
+
+    } while (!finish);
+
+    /* If our connection with the client is to be aborted, return DONE. */
+    if (c->aborted || backend_broke) {
+        return DONE;
+    }
+    return OK;
+}
+
 static
 int ap_proxy_http_process_response(proxy_http_req_t *req)
 {
@@ -1218,7 +1567,7 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
                                  "Error reading from remote server");
         }
         /* XXX: Is this a real headers length send from remote? */
-        backend->worker->s->read += len;
+        ap_proxy_add_read(backend->worker, len);
 
         /* Is it an HTTP/1 response?
          * This is buggy if we ever see an HTTP/1.10
@@ -1572,10 +1921,10 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
             status = ap_proxy_tunnel_run(req->tunnel);
 
             /* Report bytes exchanged by the backend */
-            backend->worker->s->read +=
-                ap_proxy_tunnel_conn_bytes_in(req->tunnel->origin);
-            backend->worker->s->transferred +=
-                ap_proxy_tunnel_conn_bytes_out(req->tunnel->origin);
+            ap_proxy_add_read(backend->worker,
+                              ap_proxy_tunnel_conn_bytes_in(req->tunnel->origin));
+            ap_proxy_add_transferred(backend->worker,
+                                     ap_proxy_tunnel_conn_bytes_out(req->tunnel->origin));
 
             /* We are done with both connections */
             r->connection->keepalive = AP_CONN_CLOSE;
@@ -1673,8 +2022,6 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
 
         /* send body - but only if a body is expected */
         if (!r->header_only && !AP_STATUS_IS_HEADER_ONLY(proxy_status)) {
-            apr_read_type_e mode;
-            int finish;
 
             /* We need to copy the output headers and treat them as input
              * headers as well.  BUT, we need to do this before we remove
@@ -1707,167 +2054,15 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
                 r->status_line = original_status_line;
             }
 
-            mode = APR_NONBLOCK_READ;
-            finish = FALSE;
-            do {
-                apr_off_t readbytes;
-                apr_status_t rv;
-
-                rv = ap_get_brigade(backend->r->input_filters, bb,
-                                    AP_MODE_READBYTES, mode,
-                                    req->sconf->io_buffer_size);
-
-                /* ap_get_brigade will return success with an empty brigade
-                 * for a non-blocking read which would block: */
-                if (mode == APR_NONBLOCK_READ
-                    && (APR_STATUS_IS_EAGAIN(rv)
-                        || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
-                    /* flush to the client and switch to blocking mode */
-                    e = apr_bucket_flush_create(c->bucket_alloc);
-                    APR_BRIGADE_INSERT_TAIL(bb, e);
-                    if (ap_pass_brigade(r->output_filters, bb)
-                        || c->aborted) {
-                        backend->close = 1;
-                        break;
-                    }
-                    apr_brigade_cleanup(bb);
-                    mode = APR_BLOCK_READ;
-                    continue;
-                }
-                if (rv == APR_EOF) {
-                    backend->close = 1;
-                    break;
-                }
-                if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(bb)) {
-                    int error_status = HTTP_BAD_GATEWAY;
-                    if (rv == APR_ENOSPC) {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02475)
-                                      "Response chunk/line was too large to parse");
-                    }
-                    else if (rv == APR_ENOTIMPL) {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02476)
-                                      "Response Transfer-Encoding was not recognised");
-                    }
-                    else if (rv != APR_SUCCESS) {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01110)
-                                      "Network error reading response");
-                    }
-                    else {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10293)
-                                      "Unexpected empty data reading response");
-                        error_status = HTTP_INTERNAL_SERVER_ERROR;
-                    }
-
-                    /* In this case, we are in real trouble because
-                     * our backend bailed on us. Given we're half way
-                     * through a response, our only option is to
-                     * disconnect the client too.
-                     */
-                    apr_brigade_cleanup(bb);
-                    ap_proxy_fill_error_brigade(r, error_status, bb, 1);
-                    ap_pass_brigade(r->output_filters, bb);
-
-                    backend_broke = 1;
-                    backend->close = 1;
-                    break;
-                }
-                /* next time try a non-blocking read */
-                mode = APR_NONBLOCK_READ;
-
-                if (!apr_is_empty_table(backend->r->trailers_in)) {
-                    apr_table_do(add_trailers, r->trailers_out,
-                            backend->r->trailers_in, NULL);
-                    apr_table_clear(backend->r->trailers_in);
-                }
-
-                apr_brigade_length(bb, 0, &readbytes);
-                backend->worker->s->read += readbytes;
-#if DEBUGGING
-                {
-                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
-                              "readbytes: %#x", readbytes);
-                }
-#endif
-
-                /* Switch the allocator lifetime of the buckets */
-                rv = ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
-                if (rv != APR_SUCCESS) {
-                    /* Same, half way through a response, our only option is
-                     * to notice the output filters and then disconnect the
-                     * client and backend.
-                     */
-                    if (!APR_BRIGADE_EMPTY(pass_bb)) {
-                        /* Pass what we have still */
-                        ap_pass_brigade(r->output_filters, pass_bb);
-                        apr_brigade_cleanup(pass_bb);
-                    }
-                    ap_proxy_fill_error_brigade(r, HTTP_INTERNAL_SERVER_ERROR,
-                                                pass_bb, 1);
-                    ap_pass_brigade(r->output_filters, pass_bb);
-                    apr_brigade_cleanup(pass_bb);
-
-                    backend_broke = 1;
-                    backend->close = 1;
-                    break;
-                }
-
-                /* found the last brigade? */
-                if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
-
-                    /* signal that we must leave */
-                    finish = TRUE;
-
-                    /* the brigade may contain transient buckets that contain
-                     * data that lives only as long as the backend connection.
-                     * Force a setaside so these transient buckets become heap
-                     * buckets that live as long as the request.
-                     */
-                    for (e = APR_BRIGADE_FIRST(pass_bb); e
-                            != APR_BRIGADE_SENTINEL(pass_bb); e
-                            = APR_BUCKET_NEXT(e)) {
-                        apr_bucket_setaside(e, r->pool);
-                    }
-
-                    /* finally it is safe to clean up the brigade from the
-                     * connection pool, as we have forced a setaside on all
-                     * buckets.
-                     */
-                    apr_brigade_cleanup(bb);
-
-                    /* make sure we release the backend connection as soon
-                     * as we know we are done, so that the backend isn't
-                     * left waiting for a slow client to eventually
-                     * acknowledge the data.
-                     */
-                    proxy_run_detach_backend(r, backend);
-                    ap_proxy_release_connection(backend->worker->s->scheme,
-                            backend, r->server);
-                    /* Ensure that the backend is not reused */
-                    req->backend = NULL;
-
-                }
-
-                /* try send what we read */
-                if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
-                    || c->aborted) {
-                    /* Ack! Phbtt! Die! User aborted! */
-                    /* Only close backend if we haven't got all from the
-                     * backend. Furthermore if req->backend is NULL it is no
-                     * longer safe to fiddle around with backend as it might
-                     * be already in use by another thread.
-                     */
-                    if (req->backend) {
-                        /* this causes socket close below */
-                        req->backend->close = 1;
-                    }
-                    finish = TRUE;
-                }
-
-                /* make sure we always clean up after ourselves */
-                apr_brigade_cleanup(pass_bb);
-                apr_brigade_cleanup(bb);
-
-            } while (!finish);
+            req->response_brigade = bb;
+            req->pass_brigade = pass_bb;
+            status = stream_resbody(req);
+            if (status == SUSPENDED) {
+                return SUSPENDED;
+            }
+            if (status == DONE) {
+                backend_broke = 1;
+            }
 
             ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "end body send");
         }
@@ -1914,6 +2109,134 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
     return OK;
 }
 
+/* How long to spool before probing again a backend which did not answer */
+#define PROXY_SENDCHUNKED_PROBE_RETRY apr_time_from_sec(30)
+
+/* Whether the backend needs to be probed (again) */
+static int proxy_http_should_probe(proxy_worker *worker, apr_uint32_t *state)
+{
+    *state = apr_atomic_read32(&worker->s->sendchunked_probed);
+    switch (*state) {
+    case PROXY_SENDCHUNKED_PROBED_UNKNOWN:
+        return 1;
+    case PROXY_SENDCHUNKED_PROBED_FAILED:
+        return apr_time_now() >= proxy_atomic_read_time(
+                                     &worker->s->sendchunked_retry);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Learn whether the backend accepts chunked request bodies (sendchunked=probe)
+ * by sending it an "OPTIONS *" request with an empty chunked body. This is
+ * done once per worker, on a connection of its own which is closed after, so
+ * that what follows the status line is of no concern. The backends not
+ * speaking HTTP/1.1 or refusing the body (400, 411, 501) will have the bodies
+ * spooled, until restart. If the backend could not be asked, it is asked
+ * again after PROXY_SENDCHUNKED_PROBE_RETRY, spooling meanwhile.
+ */
+static void proxy_http_probe_chunked(request_rec *r, proxy_worker *worker,
+                                     proxy_server_conf *conf,
+                                     const char *scheme, int is_ssl,
+                                     char *url, apr_uint32_t state)
+{
+    proxy_conn_rec *backend = NULL;
+    apr_bucket_alloc_t *bucket_alloc = r->connection->bucket_alloc;
+    apr_bucket_brigade *bb;
+    request_rec *rp = NULL;
+    apr_uri_t *uri;
+    char server_portstr[32];
+    char buffer[HUGE_STRING_LEN];
+    const char *host, *probe;
+    char *locurl = url;
+    apr_uint32_t probed = PROXY_SENDCHUNKED_PROBED_FAILED;
+    apr_status_t rv;
+    int len;
+
+    if (apr_atomic_cas32(&worker->s->sendchunked_probed,
+                         PROXY_SENDCHUNKED_PROBED_BUSY, state) != state) {
+        return;
+    }
+
+    if (ap_proxy_acquire_connection(scheme, &backend, worker,
+                                    r->server) != OK) {
+        goto done;
+    }
+    backend->is_ssl = is_ssl;
+    uri = apr_palloc(r->pool, sizeof(*uri));
+    if (ap_proxy_determine_connection(r->pool, r, conf, worker, backend, uri,
+                                      &locurl, NULL, 0, server_portstr,
+                                      sizeof(server_portstr)) != OK
+            || ap_proxy_connect_backend(scheme, backend, worker,
+                                        r->server) != OK
+            || ap_proxy_connection_create_ex(scheme, backend, r) != OK) {
+        goto done;
+    }
+
+    host = uri->hostname;
+    if (ap_strchr_c(host, ':')) {
+        host = apr_pstrcat(r->pool, "[", host, "]", NULL);
+    }
+    probe = apr_pstrcat(r->pool, "OPTIONS * HTTP/1.1" CRLF
+                        "Host: ", host, server_portstr, CRLF
+                        "Transfer-Encoding: chunked" CRLF
+                        "Connection: close" CRLF CRLF
+                        "0" CRLF CRLF, NULL);
+    bb = apr_brigade_create(r->pool, bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_pool_create(probe, strlen(probe),
+                                                       r->pool, bucket_alloc));
+    if (ap_proxy_pass_brigade(bucket_alloc, r, backend, backend->connection,
+                              bb, 1) != OK) {
+        goto done;
+    }
+
+    rp = make_fake_req(backend->connection, r);
+    rv = ap_proxygetline(backend->tmp_bb, buffer, sizeof(buffer), rp, 0, &len);
+    if (rv != APR_SUCCESS || len <= 0
+            || !apr_date_checkmask(buffer, "HTTP/#.# ###*")) {
+        goto done;
+    }
+    if (buffer[5] == '1' && buffer[7] == '0') {
+        probed = PROXY_SENDCHUNKED_PROBED_NO;
+    }
+    else {
+        int status = atoi(&buffer[9]);
+        if (status == HTTP_BAD_REQUEST
+                || status == HTTP_LENGTH_REQUIRED
+                || status == HTTP_NOT_IMPLEMENTED) {
+            probed = PROXY_SENDCHUNKED_PROBED_NO;
+        }
+        else {
+            probed = PROXY_SENDCHUNKED_PROBED_YES;
+        }
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10494)
+                  "HTTP: %s accepts chunked request bodies: %s (%.*s)",
+                  ap_proxy_worker_name(r->pool, worker),
+                  probed == PROXY_SENDCHUNKED_PROBED_YES ? "yes" : "no",
+                  len, buffer);
+
+done:
+    if (rp) {
+        apr_pool_destroy(rp->pool);
+    }
+    if (backend) {
+        backend->close = 1;
+        ap_proxy_release_connection(scheme, backend, r->server);
+    }
+    if (probed == PROXY_SENDCHUNKED_PROBED_FAILED) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10534)
+                      "HTTP: could not probe %s for chunked request bodies, "
+                      "spooling them for %" APR_TIME_T_FMT "s",
+                      ap_proxy_worker_name(r->pool, worker),
+                      apr_time_sec(PROXY_SENDCHUNKED_PROBE_RETRY));
+        proxy_atomic_set_time(&worker->s->sendchunked_retry,
+                              apr_time_now() + PROXY_SENDCHUNKED_PROBE_RETRY);
+    }
+    apr_atomic_set32(&worker->s->sendchunked_probed, probed);
+}
+
 /*
  * This handles http:// URLs, and other URLs using a remote proxy over http
  * If proxyhost is NULL, then contact the server directly, otherwise
@@ -1936,6 +2259,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     apr_bucket_brigade *input_brigade = NULL;
     int mpm_can_poll = 0;
     int is_ssl = 0;
+    apr_uint32_t probe_state;
     conn_rec *c = r->connection;
     proxy_dir_conf *dconf;
     int retry = 0;
@@ -1966,6 +2290,16 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     }
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "HTTP: serving URL %s", url);
 
+    /* Learn whether the backend accepts chunked request bodies, when it
+     * matters (body of unknown length) and before holding a connection.
+     */
+    if (worker->s->sendchunked == PROXY_SENDCHUNKED_PROBE && !proxyname
+            && proxy_http_should_probe(worker, &probe_state)
+            && apr_table_get(r->headers_in, "Transfer-Encoding")) {
+        proxy_http_probe_chunked(r, worker, conf, scheme, is_ssl, url,
+                                 probe_state);
+    }
+
     /* create space for state information */
     if ((status = ap_proxy_acquire_connection(scheme, &backend,
                                               worker, r->server)) != OK) {
@@ -1985,9 +2319,15 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     req->backend = backend;
     req->proto = scheme;
     req->bucket_alloc = c->bucket_alloc;
+    /* Only the initial request of a primary connection can be suspended,
+     * subrequests, internal redirects and requests of secondary connections
+     * (e.g. HTTP/2 streams) are run by callers not expecting SUSPENDED.
+     */
     req->can_go_async = (mpm_can_poll &&
                          dconf->async_delay_set &&
-                         dconf->async_delay >= 0);
+                         dconf->async_delay >= 0 &&
+                         ap_is_initial_req(r) &&
+                         !c->master);
     req->state = PROXY_HTTP_REQ_HAVE_HEADER;
     req->rb_method = RB_INIT;
 
@@ -2158,7 +2498,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
             if (req->do_100_continue && status == HTTP_SERVICE_UNAVAILABLE) {
                 ap_log_rerror(APLOG_MARK, APLOG_INFO, status, r, APLOGNO(01115)
                               "HTTP: 100-Continue failed to %pI (%s:%d)",
-                              worker->cp->addr, worker->s->hostname_ex,
+                              backend->addr, worker->s->hostname_ex,
                               (int)worker->s->port);
                 backend->close = 1;
                 retry++;
@@ -2167,7 +2507,15 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
             break;
         }
 
-        /* Step Five: Receive the Response... Fall thru to cleanup */
+        /* Step Five: Receive the Response... Fall thru to cleanup
+         * If it's not there yet, wait for it without holding this thread
+         * (unless 100-continue is pinged, which needs the ping timeout).
+         */
+        if (req->can_go_async && !req->do_100_continue
+                && proxy_http_wait_backend(req, PROXY_HTTP_WAITING_RESPONSE)
+                   == SUSPENDED) {
+            return SUSPENDED;
+        }
         status = ap_proxy_http_process_response(req);
         if (status == SUSPENDED) {
             return SUSPENDED;
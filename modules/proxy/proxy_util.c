@@ -34,6 +34,9 @@
 #if APR_HAVE_SYS_UN_H
 #include <sys/un.h>
 #endif
+#if HAVE_SPLICE
+#include <fcntl.h>          /* for splice() */
+#endif
 #if (APR_MAJOR_VERSION < 2)
 #include "apr_support.h"        /* for apr_wait_for_io_or_timeout() */
 #endif
@@ -1464,7 +1467,9 @@ static proxy_worker *proxy_balancer_get_best_worker(proxy_balancer *balancer,
     if (best_worker) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(10123)
                      "proxy: %s selected worker \"%s\" : busy %" APR_SIZE_T_FMT " : lbstatus %d",
-                     balancer->lbmethod->name, best_worker->s->name, best_worker->s->busy, best_worker->s->lbstatus);
+                     balancer->lbmethod->name, best_worker->s->name,
+                     ap_proxy_get_busy_count(best_worker),
+                     ap_proxy_get_lbstatus(best_worker));
     }
 
     return best_worker;
@@ -1497,6 +1502,346 @@ static apr_status_t conn_pool_cleanup(void *theworker)
     return APR_SUCCESS;
 }
 
+/*
+ * The resolved address of a reusable worker. It's shared by the worker
+ * and the connections which use it (refcount), so that a new resolution
+ * can be published while the previous one is still in use: the last one
+ * releasing it destroys its (unmanaged) pool.
+ */
+struct proxy_address {
+    apr_pool_t *pool;         /* Pool of this resolution */
+    apr_sockaddr_t *addr;     /* Resolved addresses */
+    const char *hostname;     /* Resolved host name */
+    apr_port_t port;          /* Resolved port */
+    apr_time_t expiry;        /* When to resolve again (0 for never) */
+    apr_uint32_t refcount;    /* References from the worker and conns */
+    apr_uint32_t resolving;   /* A new resolution is in progress */
+};
+
+/* Resolve again at most this often when the DNS fails */
+#define PROXY_ADDRESS_RETRY apr_time_from_sec(5)
+/* How long before the expiry the background refresh happens */
+#define PROXY_ADDRESS_REFRESH_AHEAD apr_time_from_sec(2)
+
+/* The expiry is read by all the threads while one may update it */
+#define address_get_expiry(a)    proxy_atomic_read_time(&(a)->expiry)
+#define address_set_expiry(a, t) proxy_atomic_set_time(&(a)->expiry, (t))
+
+static void address_release(proxy_address *address)
+{
+    if (address && !apr_atomic_dec32(&address->refcount)) {
+        apr_pool_destroy(address->pool);
+    }
+}
+
+static apr_status_t conn_address_cleanup(void *theconn)
+{
+    proxy_conn_rec *conn = theconn;
+
+    address_release(conn->address);
+    conn->address = NULL;
+    return APR_SUCCESS;
+}
+
+static apr_status_t cp_address_cleanup(void *thecp)
+{
+    proxy_conn_pool *cp = thecp;
+
+    address_release(cp->address);
+    cp->address = NULL;
+    cp->addr = NULL;
+    return APR_SUCCESS;
+}
+
+/* Resolve hostname:port in a new address (with a reference) */
+static apr_status_t address_resolve(proxy_worker *worker,
+                                    const char *hostname, apr_port_t port,
+                                    apr_time_t now, proxy_address **paddress)
+{
+    proxy_address *address;
+    apr_pool_t *pool;
+    apr_status_t rv;
+
+    rv = apr_pool_create_unmanaged_ex(&pool, NULL, NULL);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    apr_pool_tag(pool, "proxy_worker_address");
+
+    address = apr_pcalloc(pool, sizeof(*address));
+    address->pool = pool;
+    address->hostname = apr_pstrdup(pool, hostname);
+    address->port = port;
+    rv = apr_sockaddr_info_get(&address->addr, hostname, APR_UNSPEC,
+                               port, 0, pool);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return rv;
+    }
+    if (worker->s->address_ttl > 0) {
+        address->expiry = now + worker->s->address_ttl;
+    }
+    address->refcount = 1;
+
+    *paddress = address;
+    return APR_SUCCESS;
+}
+
+static int address_equal(proxy_address *a1, proxy_address *a2)
+{
+    apr_sockaddr_t *sa1, *sa2;
+
+    if (a1->port != a2->port || strcmp(a1->hostname, a2->hostname)) {
+        return 0;
+    }
+    for (sa1 = a1->addr, sa2 = a2->addr; sa1 && sa2;
+         sa1 = sa1->next, sa2 = sa2->next) {
+        if (!apr_sockaddr_equal(sa1, sa2) || sa1->port != sa2->port) {
+            return 0;
+        }
+    }
+    return !sa1 && !sa2;
+}
+
+/*
+ * Publish the (referenced) address as the worker's one, with the lock
+ * held. If the resolution did not change only the expiry is updated, so
+ * that the connections to the current address remain reusable. Returns
+ * the worker's address, with a reference for the caller.
+ */
+static proxy_address *address_publish(proxy_worker *worker,
+                                      proxy_address *address)
+{
+    proxy_address *old = worker->cp->address;
+
+    if (old && address_equal(old, address)) {
+        address_set_expiry(old, address_get_expiry(address));
+        apr_atomic_inc32(&old->refcount);
+        address_release(address);
+        return old;
+    }
+
+    /* One reference for the worker, one for the caller */
+    apr_atomic_inc32(&address->refcount);
+    worker->cp->address = address;
+    worker->cp->addr = address->addr;
+    address_release(old);
+    return address;
+}
+
+/* Get the worker's current address, with a reference (or NULL) */
+static apr_status_t address_get(proxy_worker *worker, server_rec *s,
+                                proxy_address **paddress)
+{
+    proxy_address *address;
+    apr_status_t rv;
+
+    if ((rv = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00945) "lock");
+        return rv;
+    }
+    address = worker->cp->address;
+    if (address) {
+        apr_atomic_inc32(&address->refcount);
+    }
+    if ((rv = PROXY_THREAD_UNLOCK(worker)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00946) "unlock");
+    }
+
+    *paddress = address;
+    return APR_SUCCESS;
+}
+
+/*
+ * Resolve the (referenced) address again, unless another thread does
+ * it already. On success the address is replaced by the worker's new one,
+ * otherwise it's kept (stale) until the next retry.
+ */
+static apr_status_t address_refresh(proxy_worker *worker, server_rec *s,
+                                    apr_time_t now, proxy_address **paddress)
+{
+    proxy_address *address = *paddress, *fresh;
+    apr_status_t rv;
+
+    if (apr_atomic_cas32(&address->resolving, 1, 0) != 0) {
+        return APR_EAGAIN;
+    }
+
+    rv = address_resolve(worker, address->hostname, address->port, now,
+                         &fresh);
+    if (rv == APR_SUCCESS) {
+        if ((rv = PROXY_THREAD_LOCK(worker)) == APR_SUCCESS) {
+            fresh = address_publish(worker, fresh);
+            PROXY_THREAD_UNLOCK(worker);
+            if (fresh != address) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10488)
+                             "new address %pI for worker %s",
+                             fresh->addr, worker->s->name);
+                *paddress = fresh;
+            }
+            else {
+                ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                             "address %pI of worker %s unchanged",
+                             fresh->addr, worker->s->name);
+                /* We already hold a reference */
+                address_release(fresh);
+            }
+        }
+        else {
+            address_release(fresh);
+        }
+    }
+    else {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10489)
+                     "DNS lookup failure for %s:%d, keeping the current "
+                     "address of worker %s", address->hostname,
+                     (int)address->port, worker->s->name);
+        address_set_expiry(address,
+                           now + (worker->s->address_ttl < PROXY_ADDRESS_RETRY
+                                  ? worker->s->address_ttl
+                                  : PROXY_ADDRESS_RETRY));
+    }
+
+    apr_atomic_set32(&address->resolving, 0);
+    if (*paddress != address) {
+        address_release(address);
+    }
+    return rv;
+}
+
+/*
+ * Get the address of the worker for hostname:port, resolving it the first
+ * time, or when it expired and the background refresh did not happen.
+ */
+static apr_status_t worker_address(proxy_worker *worker,
+                                   const char *hostname, apr_port_t port,
+                                   server_rec *s, proxy_address **paddress)
+{
+    proxy_address *address;
+    apr_status_t rv;
+
+    rv = address_get(worker, s, &address);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    if (address) {
+        apr_time_t expiry = address_get_expiry(address);
+        if (expiry) {
+            apr_time_t now = apr_time_now();
+            if (now >= expiry) {
+                /* Keep using the current one if this fails */
+                address_refresh(worker, s, now, &address);
+            }
+        }
+        *paddress = address;
+        return APR_SUCCESS;
+    }
+
+    /*
+     * First resolution for the worker, the threads wait for it. Recheck
+     * the address after we got the lock, another thread may have resolved
+     * it while we were waiting.
+     */
+    if ((rv = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10490) "lock");
+        return rv;
+    }
+    address = AP_VOLATILIZE_T(proxy_address *, worker->cp->address);
+    if (address) {
+        apr_atomic_inc32(&address->refcount);
+    }
+    else {
+        rv = address_resolve(worker, hostname, port, apr_time_now(),
+                             &address);
+        if (rv == APR_SUCCESS) {
+            address = address_publish(worker, address);
+        }
+    }
+    PROXY_THREAD_UNLOCK(worker);
+
+    *paddress = address;
+    return rv;
+}
+
+/* Use the (referenced) address for the connection */
+static void conn_set_address(proxy_conn_rec *conn, proxy_address *address)
+{
+    if (conn->address != address) {
+        if (conn->address) {
+            /* Don't reuse a connection to a previous address */
+            if (conn->sock) {
+                socket_cleanup(conn);
+            }
+            address_release(conn->address);
+        }
+        conn->address = address;
+    }
+    else {
+        address_release(address);
+    }
+    conn->addr = address->addr;
+}
+
+PROXY_DECLARE(int) ap_proxy_refresh_worker_address(proxy_worker *worker,
+                                                   server_rec *s)
+{
+    proxy_address *address;
+    apr_time_t now, expiry;
+    int refreshed = 0;
+
+    if (!worker->cp || worker->s->address_ttl <= 0
+            || !worker->s->is_address_reusable || worker->s->disablereuse
+            || address_get(worker, s, &address) != APR_SUCCESS
+            || !address) {
+        return 0;
+    }
+
+    /* Refresh ahead of the expiry so that the requests don't have to */
+    now = apr_time_now();
+    expiry = address_get_expiry(address);
+    if (expiry && now + PROXY_ADDRESS_REFRESH_AHEAD >= expiry) {
+        proxy_address *current = address;
+        if (address_refresh(worker, s, now, &address) == APR_SUCCESS) {
+            refreshed = (address != current);
+        }
+    }
+    address_release(address);
+
+    return refreshed;
+}
+
+static apr_status_t address_pool_cleanup(void *theaddress)
+{
+    address_release(theaddress);
+    return APR_SUCCESS;
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_get_worker_address(proxy_worker *worker,
+                                                        const char *hostname,
+                                                        apr_port_t port,
+                                                        apr_pool_t *p,
+                                                        server_rec *s,
+                                                        apr_sockaddr_t **addr)
+{
+    proxy_address *address;
+    apr_status_t rv;
+
+    if (!worker->cp || !worker->s->is_address_reusable
+            || worker->s->disablereuse) {
+        return apr_sockaddr_info_get(addr, hostname, APR_UNSPEC, port, 0, p);
+    }
+
+    rv = worker_address(worker, hostname, port, s, &address);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    /* Keep it valid until p goes, even if the worker's one changes */
+    apr_pool_cleanup_register(p, address, address_pool_cleanup,
+                              apr_pool_cleanup_null);
+    *addr = address->addr;
+    return APR_SUCCESS;
+}
+
 static void init_conn_pool(apr_pool_t *p, proxy_worker *worker)
 {
     apr_pool_t *pool;
@@ -1529,6 +1874,8 @@ static void init_conn_pool(apr_pool_t *p, proxy_worker *worker)
     worker->cp = cp;
 
     apr_pool_pre_cleanup_register(p, worker, conn_pool_cleanup);
+    apr_pool_cleanup_register(pool, cp, cp_address_cleanup,
+                              apr_pool_cleanup_null);
 }
 
 PROXY_DECLARE(int) ap_proxy_connection_reusable(proxy_conn_rec *conn)
@@ -1569,7 +1916,10 @@ static apr_status_t connection_cleanup(void *theconn)
     }
     else if (conn->close
                 || (conn->connection
-                    && conn->connection->keepalive == AP_CONN_CLOSE)) {
+                    && conn->connection->keepalive == AP_CONN_CLOSE)
+                || (conn->sock && worker->s->maxage
+                    && apr_time_now() - conn->established
+                       > worker->s->maxage)) {
         socket_cleanup(conn);
         conn->close = 0;
     }
@@ -1581,6 +1931,10 @@ static apr_status_t connection_cleanup(void *theconn)
         ap_proxy_ssl_engine(conn->connection, worker->section_config, 1);
     }
 
+    if (worker->s->maxidle) {
+        conn->released = apr_time_now();
+    }
+
     if (worker->s->hmax && worker->cp->res) {
         conn->inreslist = 1;
         apr_reslist_release(worker->cp->res, (void *)conn);
@@ -1661,6 +2015,9 @@ static apr_status_t connection_constructor(void **resource, void *params,
     conn->inreslist = 1;
     *resource = conn;
 
+    apr_pool_cleanup_register(ctx, conn, conn_address_cleanup,
+                              apr_pool_cleanup_null);
+
     return APR_SUCCESS;
 }
 
@@ -2222,10 +2579,17 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
             if (worker->s->min > worker->s->smax) {
                 worker->s->min = worker->s->smax;
             }
+            /* Warm connections are kept, so they can't exceed smax */
+            if (worker->s->warm > worker->s->smax) {
+                worker->s->warm = worker->s->smax;
+            }
         }
         else {
             /* This will suppress the apr_reslist creation */
             worker->s->min = worker->s->smax = worker->s->hmax = 0;
+            if (worker->s->warm > 1) {
+                worker->s->warm = 1;
+            }
         }
     }
 
@@ -2633,9 +2997,6 @@ ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
 {
     int server_port;
     apr_status_t err = APR_SUCCESS;
-#if APR_HAS_THREADS
-    apr_status_t uerr = APR_SUCCESS;
-#endif
     const char *uds_path;
 
     /*
@@ -2772,49 +3133,15 @@ ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
              * Looking up the backend address for the worker only makes sense if
              * we can reuse the address.
              *
-             * As we indicate in the comment below that for retriggering a DNS
-             * lookup worker->cp->addr should be set to NULL we need to avoid
-             * a race that worker->cp->addr switches to NULL after we checked
-             * it to be non NULL but before we assign it to conn->addr in an
-             * else tree which would leave it to NULL and likely cause a
-             * segfault later.
+             * The worker's address is refcounted, so that it remains valid
+             * for this connection even if a new resolution is published by
+             * another thread meanwhile (see ap_proxy_refresh_worker_address).
              */
-            conn->addr = worker->cp->addr;
-            if (!conn->addr) {
-                if ((err = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, err, r, APLOGNO(00945) "lock");
-                    return HTTP_INTERNAL_SERVER_ERROR;
-                }
-
-                /*
-                 * Recheck addr after we got the lock. This may have changed
-                 * while waiting for the lock.
-                 */
-                conn->addr = AP_VOLATILIZE_T(apr_sockaddr_t *, worker->cp->addr);
-                if (!conn->addr) {
-
-                    apr_sockaddr_t *addr;
-
-                    /*
-                     * Worker can have the single constant backend address.
-                     * The single DNS lookup is used once per worker.
-                     * If dynamic change is needed then set the addr to NULL
-                     * inside dynamic config to force the lookup.
-                     *
-                     * Clear the dns_pool before to avoid a memory leak in case
-                     * we did the lookup already in the past.
-                     */
-                    apr_pool_clear(worker->cp->dns_pool);
-                    err = apr_sockaddr_info_get(&addr,
-                                                conn->hostname, APR_UNSPEC,
-                                                conn->port, 0,
-                                                worker->cp->dns_pool);
-                    conn->addr = addr;
-                    worker->cp->addr = addr;
-                }
-                if ((uerr = PROXY_THREAD_UNLOCK(worker)) != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, uerr, r, APLOGNO(00946) "unlock");
-                }
+            proxy_address *address;
+            err = worker_address(worker, conn->hostname, conn->port,
+                                 r->server, &address);
+            if (err == APR_SUCCESS) {
+                conn_set_address(conn, address);
             }
         }
     }
@@ -3110,6 +3437,27 @@ PROXY_DECLARE(apr_status_t) ap_proxy_connect_uds(apr_socket_t *sock,
 #endif
 }
 
+/* Happy Eyeballs connection attempts, per RFC 8305 */
+#define PROXY_CONNECT_DELAY_DEFAULT apr_time_from_msec(250)
+#define PROXY_CONNECT_ATTEMPTS_MAX  8
+
+/* Bound of the connect timeout when warming the workers, which runs in
+ * child_init or in the watchdog: a backend not connected by then is left
+ * to the requests.
+ */
+#define PROXY_WARM_CONNECT_TIMEOUT  apr_time_from_msec(500)
+
+/* Whether the connection lived or idled longer than the worker allows */
+static int proxy_conn_expired(proxy_conn_rec *conn, apr_time_t now)
+{
+    proxy_worker *worker = conn->worker;
+
+    return ((worker->s->maxage
+             && now - conn->established > worker->s->maxage)
+            || (worker->s->maxidle
+                && now - conn->released > worker->s->maxidle));
+}
+
 PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
                                                       proxy_conn_rec *conn,
                                                       server_rec *server,
@@ -3127,6 +3475,9 @@ PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
          */
         rv = APR_EINVAL;
     }
+    else if (conn->sock && proxy_conn_expired(conn, apr_time_now())) {
+        rv = APR_TIMEUP;
+    }
     else if (conn->connection) {
         /* We have a conn_rec, check the full filter stack for things like
          * SSL alert/shutdown, filters aside data...
@@ -3186,7 +3537,12 @@ PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
         }
 
         socket_cleanup(conn);
-        if (rv != APR_ENOTEMPTY) {
+        if (rv == APR_TIMEUP) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, server, APLOGNO(10480)
+                         "%s: reusable backend connection has expired: "
+                         "closed", scheme);
+        }
+        else if (rv != APR_ENOTEMPTY) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, server, APLOGNO(00951)
                          "%s: backend socket is disconnected.", scheme);
         }
@@ -3204,16 +3560,283 @@ PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
     return rv;
 }
 
-PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
-                                            proxy_conn_rec *conn,
-                                            proxy_worker *worker,
-                                            server_rec *s)
+static apr_interval_time_t proxy_connect_timeout(proxy_worker *worker,
+                                                 proxy_server_conf *conf,
+                                                 server_rec *s, int warming)
+{
+    apr_interval_time_t timeout;
+
+    if (worker->s->conn_timeout_set) {
+        timeout = worker->s->conn_timeout;
+    }
+    else if (worker->s->timeout_set) {
+        timeout = worker->s->timeout;
+    }
+    else if (conf->timeout_set) {
+        timeout = conf->timeout;
+    }
+    else {
+        timeout = s->timeout;
+    }
+    if (warming && timeout > PROXY_WARM_CONNECT_TIMEOUT) {
+        timeout = PROXY_WARM_CONNECT_TIMEOUT;
+    }
+    return timeout;
+}
+
+/*
+ * Create a socket to connect to addr, with the worker's settings and
+ * the connect timeout (restored to the I/O timeout once connected).
+ */
+static apr_status_t proxy_socket_create(const char *proxy_function,
+                                        proxy_conn_rec *conn,
+                                        proxy_worker *worker,
+                                        server_rec *s,
+                                        proxy_server_conf *conf,
+                                        apr_sockaddr_t *addr,
+                                        apr_socket_t **psock, int warming)
 {
     apr_status_t rv;
-    int loglevel;
-    apr_sockaddr_t *backend_addr = conn->addr;
+    apr_socket_t *newsock;
     /* the local address to use for the outgoing connection */
     apr_sockaddr_t *local_addr;
+
+    if ((rv = apr_socket_create(&newsock, addr->family,
+                                SOCK_STREAM, APR_PROTO_TCP,
+                                conn->scpool)) != APR_SUCCESS) {
+        int loglevel = addr->next ? APLOG_DEBUG : APLOG_ERR;
+        ap_log_error(APLOG_MARK, loglevel, rv, s, APLOGNO(00952)
+                     "%s: error creating fam %d socket for "
+                     "target %s:%d",
+                     proxy_function,
+                     addr->family,
+                     worker->s->hostname_ex,
+                     (int)worker->s->port);
+        return rv;
+    }
+
+    if (worker->s->recv_buffer_size > 0 &&
+        (rv = apr_socket_opt_set(newsock, APR_SO_RCVBUF,
+                                 worker->s->recv_buffer_size))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00953)
+                     "apr_socket_opt_set(SO_RCVBUF): Failed to set "
+                     "ProxyReceiveBufferSize, using default");
+    }
+
+    rv = apr_socket_opt_set(newsock, APR_TCP_NODELAY, 1);
+    if (rv != APR_SUCCESS && rv != APR_ENOTIMPL) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00954)
+                     "apr_socket_opt_set(APR_TCP_NODELAY): "
+                     "Failed to set");
+    }
+
+    /* Set a timeout for connecting to the backend on the socket */
+    apr_socket_timeout_set(newsock, proxy_connect_timeout(worker, conf, s,
+                                                          warming));
+
+    /* Set a keepalive option */
+    if (worker->s->keepalive) {
+        if ((rv = apr_socket_opt_set(newsock,
+                                     APR_SO_KEEPALIVE, 1)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00955)
+                         "apr_socket_opt_set(SO_KEEPALIVE): Failed to set"
+                         " Keepalive");
+        }
+    }
+    ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                 "%s: fam %d socket created to connect to %s:%d",
+                 proxy_function, addr->family,
+                 worker->s->hostname_ex, (int)worker->s->port);
+
+    if (conf->source_address_set) {
+        local_addr = apr_pmemdup(conn->scpool, conf->source_address,
+                                 sizeof(apr_sockaddr_t));
+        local_addr->pool = conn->scpool;
+        rv = apr_socket_bind(newsock, local_addr);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00956)
+                         "%s: failed to bind socket to local address",
+                         proxy_function);
+        }
+    }
+
+    *psock = newsock;
+    return APR_SUCCESS;
+}
+
+/* The next address of the list, from sa, (not) in the given family */
+static apr_sockaddr_t *next_addr_of_family(apr_sockaddr_t *sa, int family,
+                                           int same)
+{
+    while (sa && (sa->family == family) != same) {
+        sa = sa->next;
+    }
+    return sa;
+}
+
+/*
+ * Happy Eyeballs (RFC 8305) connect to the addresses of a backend: the
+ * attempts run in parallel on nonblocking sockets, each one started after
+ * the connect delay of the previous one (or as soon as it failed), and
+ * the first connected socket wins. The address families are interleaved,
+ * starting with the one which connected last for the worker (or with the
+ * first address' one), so that an unreachable family costs the delay only.
+ */
+static apr_status_t proxy_connect_eyeballs(const char *proxy_function,
+                                           proxy_conn_rec *conn,
+                                           proxy_worker *worker,
+                                           server_rec *s,
+                                           proxy_server_conf *conf,
+                                           apr_sockaddr_t **paddr,
+                                           apr_socket_t **psock, int warming)
+{
+    apr_sockaddr_t *addrs[PROXY_CONNECT_ATTEMPTS_MAX], *pref, *other;
+    apr_socket_t *socks[PROXY_CONNECT_ATTEMPTS_MAX];
+    apr_pollfd_t pfds[PROXY_CONNECT_ATTEMPTS_MAX];
+    apr_interval_time_t timeout, delay;
+    apr_time_t now, next, deadline;
+    apr_status_t rv = APR_ENOSOCKET;
+    int family, naddrs = 0, started = 0, npfds = 0, winner = -1, i;
+
+    family = worker->s->family ? worker->s->family : (*paddr)->family;
+    pref = next_addr_of_family(*paddr, family, 1);
+    other = next_addr_of_family(*paddr, family, 0);
+    while (naddrs < PROXY_CONNECT_ATTEMPTS_MAX && (pref || other)) {
+        if (pref && (!other || !(naddrs & 1))) {
+            addrs[naddrs++] = pref;
+            pref = next_addr_of_family(pref->next, family, 1);
+        }
+        else {
+            addrs[naddrs++] = other;
+            other = next_addr_of_family(other->next, family, 0);
+        }
+    }
+
+    timeout = proxy_connect_timeout(worker, conf, s, warming);
+    delay = worker->s->connect_delay ? worker->s->connect_delay
+                                     : PROXY_CONNECT_DELAY_DEFAULT;
+    now = next = apr_time_now();
+    deadline = now + timeout;
+    while (winner < 0) {
+        if (started < naddrs && (!npfds || now >= next)) {
+            apr_sockaddr_t *addr = addrs[started];
+            apr_socket_t *sock;
+
+            /* Each attempt has the full connect timeout */
+            next = now + delay;
+            deadline = now + timeout;
+            i = started++;
+            rv = proxy_socket_create(proxy_function, conn, worker, s, conf,
+                                     addr, &sock, warming);
+            if (rv != APR_SUCCESS) {
+                next = now;
+                continue;
+            }
+            apr_socket_timeout_set(sock, 0);
+            rv = apr_socket_connect(sock, addr);
+            if (rv == APR_SUCCESS) {
+                socks[i] = sock;
+                winner = i;
+                break;
+            }
+            if (!APR_STATUS_IS_EINPROGRESS(rv)) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10484)
+                             "%s: attempt to connect to %pI (%s:%d) failed",
+                             proxy_function, addr,
+                             worker->s->hostname_ex, (int)worker->s->port);
+                apr_socket_close(sock);
+                next = now;
+                continue;
+            }
+            socks[i] = sock;
+            memset(&pfds[npfds], 0, sizeof(apr_pollfd_t));
+            pfds[npfds].p = conn->scpool;
+            pfds[npfds].desc_type = APR_POLL_SOCKET;
+            pfds[npfds].desc.s = sock;
+            pfds[npfds].reqevents = APR_POLLOUT;
+            pfds[npfds].client_data = (void *)(apr_uintptr_t)i;
+            npfds++;
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                         "%s: connecting to %pI (%s:%d), attempt %d/%d",
+                         proxy_function, addr, worker->s->hostname_ex,
+                         (int)worker->s->port, started, naddrs);
+            continue;
+        }
+        if (!npfds) {
+            /* All the attempts failed already */
+            break;
+        }
+        if (now >= deadline) {
+            rv = APR_TIMEUP;
+            break;
+        }
+
+        {
+            apr_interval_time_t wait = deadline - now;
+            apr_int32_t nready = 0;
+            int n;
+
+            if (started < naddrs && next - now < wait) {
+                wait = next > now ? next - now : 0;
+            }
+            rv = apr_poll(pfds, npfds, &nready, wait);
+            now = apr_time_now();
+            if (rv != APR_SUCCESS && !APR_STATUS_IS_TIMEUP(rv)
+                    && !APR_STATUS_IS_EINTR(rv)) {
+                break;
+            }
+            for (n = 0; n < npfds && nready > 0; ++n) {
+                if (!pfds[n].rtnevents) {
+                    continue;
+                }
+                nready--;
+                i = (int)(apr_uintptr_t)pfds[n].client_data;
+                /* Connecting again gives the outcome */
+                rv = apr_socket_connect(socks[i], addrs[i]);
+                if (rv == APR_SUCCESS) {
+                    winner = i;
+                    break;
+                }
+                if (APR_STATUS_IS_EINPROGRESS(rv) || rv == EALREADY) {
+                    continue;
+                }
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10485)
+                             "%s: attempt to connect to %pI (%s:%d) failed",
+                             proxy_function, addrs[i],
+                             worker->s->hostname_ex, (int)worker->s->port);
+                apr_socket_close(socks[i]);
+                socks[i] = NULL;
+                pfds[n--] = pfds[--npfds];
+                /* Start the next attempt now */
+                next = now;
+            }
+        }
+    }
+
+    /* Abort the pending attempts which lost the race */
+    for (i = 0; i < npfds; ++i) {
+        apr_socket_t *sock = pfds[i].desc.s;
+        if (winner < 0 || sock != socks[winner]) {
+            apr_socket_close(sock);
+        }
+    }
+    if (winner < 0) {
+        return rv != APR_SUCCESS ? rv : APR_ENOSOCKET;
+    }
+
+    *paddr = addrs[winner];
+    *psock = socks[winner];
+    return APR_SUCCESS;
+}
+
+static int proxy_connect_backend(const char *proxy_function,
+                                 proxy_conn_rec *conn,
+                                 proxy_worker *worker,
+                                 server_rec *s, int warming)
+{
+    apr_status_t rv;
+    int loglevel, reused;
+    apr_sockaddr_t *backend_addr = conn->addr;
     apr_socket_t *newsock;
     void *sconf = s->module_config;
     int did_dns_lookup = 0;
@@ -3224,6 +3847,7 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     if (rv == APR_EINVAL) {
         return DECLINED;
     }
+    reused = (rv == APR_SUCCESS);
 
     while (rv != APR_SUCCESS && (backend_addr || conn->uds_path)) {
 #if APR_HAVE_SYS_UN_H
@@ -3266,18 +3890,43 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
         }
         else
 #endif
-        {
-            if ((rv = apr_socket_create(&newsock, backend_addr->family,
-                                        SOCK_STREAM, APR_PROTO_TCP,
-                                        conn->scpool)) != APR_SUCCESS) {
-                loglevel = backend_addr->next ? APLOG_DEBUG : APLOG_ERR;
-                ap_log_error(APLOG_MARK, loglevel, rv, s, APLOGNO(00952)
-                             "%s: error creating fam %d socket for "
-                             "target %s:%d",
+        if (backend_addr->next && worker->s->connect_delay >= 0) {
+            /* Multiple addresses, connect to them in parallel */
+            rv = proxy_connect_eyeballs(proxy_function, conn, worker, s,
+                                        conf, &backend_addr, &newsock,
+                                        warming);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10486)
+                             "%s: attempts to connect to %pI and the other "
+                             "addresses of (%s:%d) failed",
                              proxy_function,
-                             backend_addr->family,
+                             backend_addr,
                              worker->s->hostname_ex,
                              (int)worker->s->port);
+                backend_addr = NULL;
+                /* Retry with a new DNS lookup, like below */
+                if (!did_dns_lookup && worker->cp->addr) {
+                    apr_sockaddr_info_get(&backend_addr,
+                                          conn->hostname, APR_UNSPEC,
+                                          conn->port, 0,
+                                          conn->pool);
+                    did_dns_lookup = 1;
+                }
+                continue;
+            }
+            conn->connection = NULL;
+
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10487)
+                         "%s: connection established with %pI (%s:%d)",
+                         proxy_function,
+                         backend_addr,
+                         worker->s->hostname_ex,
+                         (int)worker->s->port);
+        }
+        else {
+            rv = proxy_socket_create(proxy_function, conn, worker, s, conf,
+                                     backend_addr, &newsock, warming);
+            if (rv != APR_SUCCESS) {
                 /*
                  * this could be an IPv6 address from the DNS but the
                  * local machine won't give us an IPv6 socket; hopefully the
@@ -3288,60 +3937,6 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
             }
             conn->connection = NULL;
 
-            if (worker->s->recv_buffer_size > 0 &&
-                (rv = apr_socket_opt_set(newsock, APR_SO_RCVBUF,
-                                         worker->s->recv_buffer_size))) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00953)
-                             "apr_socket_opt_set(SO_RCVBUF): Failed to set "
-                             "ProxyReceiveBufferSize, using default");
-            }
-
-            rv = apr_socket_opt_set(newsock, APR_TCP_NODELAY, 1);
-            if (rv != APR_SUCCESS && rv != APR_ENOTIMPL) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00954)
-                             "apr_socket_opt_set(APR_TCP_NODELAY): "
-                             "Failed to set");
-            }
-
-            /* Set a timeout for connecting to the backend on the socket */
-            if (worker->s->conn_timeout_set) {
-                apr_socket_timeout_set(newsock, worker->s->conn_timeout);
-            }
-            else if (worker->s->timeout_set) {
-                apr_socket_timeout_set(newsock, worker->s->timeout);
-            }
-            else if (conf->timeout_set) {
-                apr_socket_timeout_set(newsock, conf->timeout);
-            }
-            else {
-                apr_socket_timeout_set(newsock, s->timeout);
-            }
-            /* Set a keepalive option */
-            if (worker->s->keepalive) {
-                if ((rv = apr_socket_opt_set(newsock,
-                                             APR_SO_KEEPALIVE, 1)) != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00955)
-                                 "apr_socket_opt_set(SO_KEEPALIVE): Failed to set"
-                                 " Keepalive");
-                }
-            }
-            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
-                         "%s: fam %d socket created to connect to %s:%d",
-                         proxy_function, backend_addr->family,
-                         worker->s->hostname_ex, (int)worker->s->port);
-
-            if (conf->source_address_set) {
-                local_addr = apr_pmemdup(conn->scpool, conf->source_address,
-                                         sizeof(apr_sockaddr_t));
-                local_addr->pool = conn->scpool;
-                rv = apr_socket_bind(newsock, local_addr);
-                if (rv != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00956)
-                                 "%s: failed to bind socket to local address",
-                                 proxy_function);
-                }
-            }
-
             /* make the connection out of the socket */
             rv = apr_socket_connect(newsock, backend_addr);
 
@@ -3396,6 +3991,11 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
         }
 
         conn->sock = newsock;
+        conn->established = conn->released = apr_time_now();
+        if (!conn->uds_path && !(worker->s->status & PROXY_WORKER_GENERIC)) {
+            /* Remember the family which works for the next attempts */
+            worker->s->family = backend_addr->family;
+        }
 
         if (!conn->uds_path && conn->forward) {
             forward_info *forward = (forward_info *)conn->forward;
@@ -3432,7 +4032,9 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
          * no further connections to the worker could be made
          */
         if (rv != APR_SUCCESS) {
-            if (!(worker->s->status & PROXY_WORKER_IGNORE_ERRORS)) {
+            /* Warming may time out before the backend's connect timeout */
+            if (!(worker->s->status & PROXY_WORKER_IGNORE_ERRORS)
+                    && !(warming && APR_STATUS_IS_TIMEUP(rv))) {
                 worker->s->error_time = apr_time_now();
                 worker->s->status |= PROXY_WORKER_IN_ERROR;
                 ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00959)
@@ -3452,6 +4054,15 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
             }
             worker->s->error_time = 0;
             worker->s->retries = 0;
+            /* Account for the pool usage of the requests only */
+            if (!warming) {
+                if (reused) {
+                    ap_proxy_increase_pool_hits(worker);
+                }
+                else {
+                    ap_proxy_increase_pool_misses(worker);
+                }
+            }
         }
     }
     else {
@@ -3468,13 +4079,15 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
 
     if ((rv == APR_SUCCESS) && did_dns_lookup) {
         /*
-         * A local DNS lookup caused a successful connect. Trigger to update
-         * the worker cache next time.
+         * A local DNS lookup caused a successful connect. Expire the
+         * worker's address to trigger an update next time.
          * We don't care handling any locking errors. If something fails we
          * just continue with the existing cache value.
          */
         if (PROXY_THREAD_LOCK(worker) == APR_SUCCESS) {
-            worker->cp->addr = NULL;
+            if (worker->cp->address) {
+                address_set_expiry(worker->cp->address, apr_time_now());
+            }
             PROXY_THREAD_UNLOCK(worker);
         }
     }
@@ -3482,6 +4095,119 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     return rv == APR_SUCCESS ? OK : DECLINED;
 }
 
+PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
+                                            proxy_conn_rec *conn,
+                                            proxy_worker *worker,
+                                            server_rec *s)
+{
+    return proxy_connect_backend(proxy_function, conn, worker, s, 0);
+}
+
+static int proxy_worker_can_warm(proxy_worker *worker)
+{
+    return (worker->s->warm > 0
+            && worker->cp
+            && worker->s->is_address_reusable
+            && !worker->s->disablereuse
+            && !(worker->s->status & PROXY_WORKER_GENERIC)
+            && !*worker->s->uds_path
+            && ap_cstr_casecmp(worker->s->scheme, "https")
+            && ap_cstr_casecmp(worker->s->scheme, "wss")
+            && ap_cstr_casecmp(worker->s->scheme, "h2"));
+}
+
+PROXY_DECLARE(int) ap_proxy_warm_worker(const char *proxy_function,
+                                        proxy_worker *worker,
+                                        server_rec *s,
+                                        apr_pool_t *p)
+{
+    proxy_conn_rec **conns;
+    proxy_address *address;
+    apr_status_t rv;
+    int warm, n, i, count = 0;
+
+    if (!proxy_worker_can_warm(worker) || !PROXY_WORKER_IS_USABLE(worker)) {
+        return 0;
+    }
+
+    /* Don't wait for the connections used by the requests, nor steal the
+     * last one available. Without a reslist, the single connection of the
+     * worker is not thread safe, so this must not run concurrently with the
+     * requests (e.g. in child_init only).
+     */
+    warm = worker->s->warm;
+    if (worker->s->hmax && worker->cp->res) {
+        n = worker->s->hmax - apr_reslist_acquired_count(worker->cp->res);
+        if (warm > n - 1) {
+            warm = n - 1;
+        }
+    }
+    else if (!worker->cp->conn) {
+        /* The single connection is in use */
+        return 0;
+    }
+    else {
+        warm = 1;
+    }
+    if (warm <= 0) {
+        return 0;
+    }
+
+    /* Resolve the worker's address like ap_proxy_determine_connection()
+     * does for the first request.
+     */
+    rv = worker_address(worker, worker->s->hostname_ex, worker->s->port,
+                        s, &address);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10482)
+                     "%s: DNS lookup failure for %s, "
+                     "can't warm worker %s", proxy_function,
+                     worker->s->hostname_ex,
+                     ap_proxy_worker_name(p, worker));
+        return 0;
+    }
+
+    conns = apr_pcalloc(p, warm * sizeof(proxy_conn_rec *));
+    for (n = 0; n < warm; ++n) {
+        proxy_conn_rec *conn;
+        apr_time_t established;
+
+        if (ap_proxy_acquire_connection(proxy_function, &conns[n],
+                                        worker, s) != OK) {
+            break;
+        }
+        conn = conns[n];
+        if (!conn->hostname) {
+            conn->hostname = apr_pstrdup(conn->pool, worker->s->hostname_ex);
+            conn->port = worker->s->port;
+        }
+        apr_atomic_inc32(&address->refcount);
+        conn_set_address(conn, address);
+
+        established = conn->sock ? conn->established : 0;
+        if (proxy_connect_backend(proxy_function, conn, worker, s, 1) != OK) {
+            /* The worker may be in error now, stop here */
+            conn->close = 1;
+            ++n;
+            break;
+        }
+        if (conn->established != established) {
+            ++count;
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        ap_proxy_release_connection(proxy_function, conns[i], s);
+    }
+    address_release(address);
+
+    if (count) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10483)
+                     "%s: established %d idle connection(s) for worker %s",
+                     proxy_function, count, ap_proxy_worker_name(p, worker));
+    }
+    return count;
+}
+
 static apr_status_t connection_shutdown(void *theconn)
 {
     proxy_conn_rec *conn = (proxy_conn_rec *)theconn;
@@ -3860,24 +4586,39 @@ PROXY_DECLARE(apr_status_t) ap_proxy_sync_balancer(proxy_balancer *b, server_rec
             }
         }
         if (!found) {
-            proxy_worker **runtime;
+            proxy_worker *runtime;
             /* XXX: a thread mutex is maybe enough here */
             apr_global_mutex_lock(proxy_mutex);
-            runtime = apr_array_push(b->workers);
-            *runtime = apr_pcalloc(conf->pool, sizeof(proxy_worker));
+            runtime = apr_pcalloc(conf->pool, sizeof(proxy_worker));
             apr_global_mutex_unlock(proxy_mutex);
-            (*runtime)->hash = shm->hash;
-            (*runtime)->balancer = b;
-            (*runtime)->s = shm;
+            runtime->hash = shm->hash;
+            runtime->balancer = b;
+            runtime->s = shm;
 
-            rv = ap_proxy_initialize_worker(*runtime, s, conf->pool);
+            rv = ap_proxy_initialize_worker(runtime, s, conf->pool);
             if (rv != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_EMERG, rv, s, APLOGNO(00966) "Cannot init worker");
                 return rv;
             }
+            /*
+             * Only publish the worker once it is initialized, the lbmethods
+             * walk b->workers without the balancer lock. The array has been
+             * sized for max_workers at post_config, so appending does not
+             * move it and the new element is visible with nelts.
+             */
+            if (b->workers->nelts < b->workers->nalloc) {
+                ((proxy_worker **)b->workers->elts)[b->workers->nelts] = runtime;
+                apr_atomic_set32((volatile apr_uint32_t *)&b->workers->nelts,
+                                 (apr_uint32_t)(b->workers->nelts + 1));
+            }
+            else {
+                apr_global_mutex_lock(proxy_mutex);
+                APR_ARRAY_PUSH(b->workers, proxy_worker *) = runtime;
+                apr_global_mutex_unlock(proxy_mutex);
+            }
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02403)
                          "grabbing shm[%d] (0x%pp) for worker: %s", i, (void *)shm,
-                         (*runtime)->s->name);
+                         runtime->s->name);
         }
     }
     if (b->s->need_reset) {
@@ -4507,6 +5248,10 @@ PROXY_DECLARE(int) ap_proxy_spool_input(request_rec *r,
         e = apr_bucket_eos_create(bucket_alloc);
         APR_BRIGADE_INSERT_TAIL(input_brigade, e);
     }
+
+    ap_proxy_add_spooled(backend->worker, *bytes_spooled);
+    ap_proxy_increase_spooled_reqs(backend->worker);
+
     return OK;
 }
 
@@ -4850,8 +5595,15 @@ struct proxy_tunnel_conn {
     apr_off_t bytes_in,
               bytes_out;
 
+#if HAVE_SPLICE
+    /* data read from this side and not written to the other yet */
+    int pipefd[2];
+    apr_size_t pipelen;
+#endif
+
     unsigned int down_in:1,
-                 down_out:1;
+                 down_out:1,
+                 splice:1;
 };
 
 PROXY_DECLARE(apr_off_t) ap_proxy_tunnel_conn_bytes_in(
@@ -4865,6 +5617,145 @@ PROXY_DECLARE(apr_off_t) ap_proxy_tunnel_conn_bytes_out(
     return tc->bytes_out;
 }
 
+#if HAVE_SPLICE
+/* Size of the pipe, and hence of what's moved at once by splice() */
+#define PROXY_SPLICE_SIZE (64 * 1024)
+
+static APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_in) *tunnel_logio_add_bytes_in;
+static APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_out) *tunnel_logio_add_bytes_out;
+
+/* Whether the data of connection c can bypass its filters, that is the
+ * connection has only the core filters (plus mod_logio's, which we account
+ * for).
+ */
+static int tunnel_conn_can_splice(conn_rec *c)
+{
+    ap_filter_t *f;
+
+    for (f = c->input_filters; f; f = f->next) {
+        if (f->frec != ap_core_input_filter_handle
+                && ap_cstr_casecmp(f->frec->name, "LOG_INPUT_OUTPUT") != 0) {
+            return 0;
+        }
+    }
+    for (f = c->output_filters; f; f = f->next) {
+        if (f->frec != ap_core_output_filter_handle) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static apr_status_t tunnel_pipe_cleanup(void *data)
+{
+    proxy_tunnel_conn_t *tc = data;
+
+    close(tc->pipefd[0]);
+    close(tc->pipefd[1]);
+    return APR_SUCCESS;
+}
+
+/*
+ * Forward from in to out with splice(), through a pipe so that the data
+ * don't go to user space. Returns like proxy_transfer() does, or
+ * APR_ENOTIMPL if splice() can't be used for these sockets.
+ */
+static apr_status_t proxy_tunnel_splice(proxy_tunnel_rec *tunnel,
+                                        proxy_tunnel_conn_t *in)
+{
+    proxy_tunnel_conn_t *out = in->other;
+    unsigned int num_reads = 0;
+    apr_os_sock_t fd_in, fd_out;
+    ssize_t n;
+
+    if (!in->pipelen) {
+        /* Data buffered by the filters (before tunneling) go first, and
+         * proxy_transfer() is the one which knows how to get them.
+         */
+        if (ap_filter_input_pending(in->c) == OK) {
+            return APR_EAGAIN;
+        }
+    }
+    if (ap_filter_should_yield(out->c->output_filters)) {
+        return APR_INCOMPLETE;
+    }
+
+    if (in->pipefd[0] < 0) {
+        if (pipe(in->pipefd) < 0) {
+            in->pipefd[0] = in->pipefd[1] = -1;
+            return APR_ENOTIMPL;
+        }
+        fcntl(in->pipefd[0], F_SETFL, O_NONBLOCK);
+        fcntl(in->pipefd[1], F_SETFL, O_NONBLOCK);
+        fcntl(in->pipefd[0], F_SETFD, FD_CLOEXEC);
+        fcntl(in->pipefd[1], F_SETFD, FD_CLOEXEC);
+        apr_pool_cleanup_register(tunnel->r->pool, in, tunnel_pipe_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+    apr_os_sock_get(&fd_in, in->pfd->desc.s);
+    apr_os_sock_get(&fd_out, out->pfd->desc.s);
+
+    for (;;) {
+        /* Write what's in the pipe first */
+        while (in->pipelen) {
+            n = splice(in->pipefd[0], NULL, fd_out, NULL, in->pipelen,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN) {
+                    return APR_INCOMPLETE;
+                }
+                return APR_FROM_OS_ERROR(errno);
+            }
+            in->pipelen -= n;
+            out->bytes_out += n;
+            if (tunnel_logio_add_bytes_out && out->c == tunnel->r->connection) {
+                tunnel_logio_add_bytes_out(out->c, n);
+            }
+        }
+
+        /* Yield if we keep hold of the thread for too long, like
+         * proxy_transfer() with AP_PROXY_TRANSFER_YIELD_MAX_READS.
+         */
+        if (++num_reads > PROXY_TRANSFER_MAX_READS) {
+            return APR_SUCCESS;
+        }
+
+        n = splice(fd_in, NULL, in->pipefd[1], NULL, PROXY_SPLICE_SIZE,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return APR_SUCCESS;
+            }
+            if ((errno == EINVAL || errno == ENOSYS)
+                    && !in->bytes_in && !out->bytes_out) {
+                return APR_ENOTIMPL;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, errno, tunnel->r,
+                          APLOGNO(10477) "proxy: %s: can't splice data from %s",
+                          tunnel->scheme, in->name);
+            return APR_FROM_OS_ERROR(errno);
+        }
+        if (n == 0) {
+            return APR_EOF;
+        }
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, tunnel->r,
+                      "proxy: %s: spliced %" APR_SSIZE_T_FMT " bytes "
+                      "from %s", tunnel->scheme, (apr_ssize_t)n, in->name);
+        in->pipelen = n;
+        in->bytes_in += n;
+        if (tunnel_logio_add_bytes_in && in->c == tunnel->r->connection) {
+            tunnel_logio_add_bytes_in(in->c, n);
+        }
+    }
+}
+#endif /* HAVE_SPLICE */
+
 PROXY_DECLARE(apr_status_t) ap_proxy_tunnel_create(proxy_tunnel_rec **ptunnel,
                                                    request_rec *r, conn_rec *c_o,
                                                    const char *scheme)
@@ -4922,8 +5813,12 @@ PROXY_DECLARE(apr_status_t) ap_proxy_tunnel_create(proxy_tunnel_rec **ptunnel,
     apr_socket_opt_set(tunnel->client->pfd->desc.s, APR_SO_NONBLOCK, 1);
     apr_socket_opt_set(tunnel->origin->pfd->desc.s, APR_SO_NONBLOCK, 1);
 
-    /* Bidirectional non-HTTP stream will confuse mod_reqtimeoout */
+    /* Bidirectional non-HTTP stream will confuse mod_reqtimeoout, whose
+     * output filter (pausing the timeouts after EOR) has nothing to do
+     * either, and would prevent splicing below.
+     */
     ap_remove_input_filter_byhandle(c_i->input_filters, "reqtimeout");
+    ap_remove_output_filter_byhandle(c_i->output_filters, "reqtimeout");
 
     /* The input/output filter stacks should contain connection filters only */
     r->input_filters = r->proto_input_filters = c_i->input_filters;
@@ -4938,6 +5833,23 @@ PROXY_DECLARE(apr_status_t) ap_proxy_tunnel_create(proxy_tunnel_rec **ptunnel,
         tunnel->nohalfclose = 1;
     }
 
+#if HAVE_SPLICE
+    /* Forward with splice() if no filter or hook wants to see the data */
+    if (!apr_table_get(r->subprocess_env, "proxy-nosplice")
+            && tunnel_conn_can_splice(c_i) && tunnel_conn_can_splice(c_o)) {
+        apr_array_header_t *hooks = apr_optional_hook_get("tunnel_forward");
+        if (!hooks || !hooks->nelts) {
+            tunnel->client->splice = tunnel->origin->splice = 1;
+            tunnel->client->pipefd[0] = tunnel->client->pipefd[1] = -1;
+            tunnel->origin->pipefd[0] = tunnel->origin->pipefd[1] = -1;
+            tunnel_logio_add_bytes_in =
+                APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_in);
+            tunnel_logio_add_bytes_out =
+                APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_out);
+        }
+    }
+#endif
+
     /* Start with POLLOUT and let ap_proxy_tunnel_run() schedule both
      * directions when there are no output data pending (anymore).
      */
@@ -5015,6 +5927,21 @@ static int proxy_tunnel_transfer(proxy_tunnel_rec *tunnel,
                   "proxy: %s: %s input ready",
                   tunnel->scheme, in->name);
 
+#if HAVE_SPLICE
+    if (in->splice) {
+        rv = proxy_tunnel_splice(tunnel, in);
+        if (rv == APR_ENOTIMPL) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, tunnel->r,
+                          "proxy: %s: splice() not usable, copying",
+                          tunnel->scheme);
+            in->splice = 0;
+        }
+        if (rv != APR_ENOTIMPL && rv != APR_EAGAIN) {
+            goto transferred;
+        }
+    }
+#endif
+
     rv = proxy_transfer(tunnel->r,
                         in->c, out->c,
                         in->bb, out->bb,
@@ -5023,6 +5950,9 @@ static int proxy_tunnel_transfer(proxy_tunnel_rec *tunnel,
                         AP_PROXY_TRANSFER_YIELD_MAX_READS,
                         &in->bytes_in, &out->bytes_out,
                         tunnel);
+#if HAVE_SPLICE
+transferred:
+#endif
     if (rv != APR_SUCCESS) {
         if (APR_STATUS_IS_INCOMPLETE(rv)) {
             /* Pause POLLIN while waiting for POLLOUT on the other
@@ -19,6 +19,7 @@ APACHE_MODPATH_INIT(ssl)
 dnl #  list of module object files
 ssl_objs="dnl
 mod_ssl.lo dnl
+ssl_engine_async.lo dnl
 ssl_engine_config.lo dnl
 ssl_engine_init.lo dnl
 ssl_engine_io.lo dnl
@@ -30,6 +31,7 @@ ssl_engine_rand.lo dnl
 ssl_engine_vars.lo dnl
 ssl_scache.lo dnl
 ssl_util_stapling.lo dnl
+ssl_util_ticket_keys.lo dnl
 ssl_util.lo dnl
 ssl_util_ssl.lo dnl
 ssl_engine_ocsp.lo dnl
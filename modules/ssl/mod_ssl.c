@@ -32,6 +32,8 @@
 #include "http_config.h"
 
 #include "mod_proxy.h" /* for proxy_hook_section_post_config() */
+#include "ap_mpm.h"
+#include "mpm_common.h"
 
 #include <assert.h>
 
@@ -123,6 +125,12 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(SessionTicketKeyFile, TAKE1,
                 "TLS session ticket encryption/decryption key file (RFC 5077) "
                 "('/path/to/file' - file with 48 bytes of random data)")
+    SSL_CMD_SRV(SessionTicketKeyDir, TAKE1,
+                "TLS session ticket keys rotated from a directory "
+                "('/path/to/dir' - with *.key files, the newest name is current)")
+    SSL_CMD_SRV(SessionTicketKeyRefresh, TAKE1,
+                "Seconds between two scans of the session ticket key "
+                "directories ('N' - number of seconds)")
 #endif
     SSL_CMD_ALL(CACertificatePath, TAKE1,
                 "SSL CA Certificate path "
@@ -174,6 +182,30 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(SessionTickets, FLAG,
                 "Enable or disable TLS session tickets"
                 "(`on', `off')")
+    SSL_CMD_SRV(RecordWarmUpSize, TAKE1,
+                "Amount of data sent in small TLS records before going "
+                "to full size ('N' - number of bytes, 0 to disable)")
+    SSL_CMD_SRV(RecordCoolDownSecs, TAKE1,
+                "Idle time after which small TLS records are used again "
+                "('N' - number of seconds, 0 to disable)")
+    SSL_CMD_SRV(ContextOnDemand, FLAG,
+                "Create the SSL context on the first SNI match instead of "
+                "at startup (`on', `off')")
+    SSL_CMD_SRV(ContextCacheSize, TAKE1,
+                "Number of SSL contexts created on demand kept per child "
+                "('N' - number of contexts)")
+    SSL_CMD_SRV(AsyncKeyOps, FLAG,
+                "Do the private key operations of handshakes in a thread "
+                "pool (`on', `off')")
+    SSL_CMD_SRV(AsyncKeyOpsThreads, TAKE1,
+                "Number of threads doing private key operations per child "
+                "('N' - number of threads)")
+    SSL_CMD_SRV(EarlyData, FLAG,
+                "Accept TLS 1.3 early data on resumed sessions "
+                "(`on', `off')")
+    SSL_CMD_SRV(EarlyDataMaxSize, TAKE1,
+                "Max. amount of early data a client may send "
+                "('N' - number of bytes)")
     SSL_CMD_SRV(InsecureRenegotiation, FLAG,
                 "Enable support for insecure renegotiation")
     SSL_CMD_ALL(UserName, TAKE1,
@@ -594,6 +626,7 @@ int ssl_init_ssl_connection(conn_rec *c, request_rec *r)
     int rc;
     modssl_ctx_t *mctx;
     server_rec *server;
+    SSL_CTX *ctx, *od_ctx = NULL;
 
     /*
      * Create or retrieve SSL context
@@ -609,13 +642,27 @@ int ssl_init_ssl_connection(conn_rec *c, request_rec *r)
                   c->outgoing ? "Proxy: " : "Server: ");
 
     mctx = myConnCtxConfig(c, sc);
+    ctx = mctx->ssl_ctx;
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+    if (!c->outgoing && sc->ctx_on_demand == TRUE
+        && !(ctx = od_ctx = ssl_init_ctx_on_demand(server, sc))) {
+        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(10536)
+                      "No SSL context for %s, closing the connection",
+                      sc->vhost_id);
+        c->aborted = 1;
+        return DECLINED;
+    }
+#endif
 
     /*
      * Create a new SSL connection with the configured server SSL context and
      * attach this to the socket. Additionally we register this attachment
      * so we can detach later.
      */
-    if (!(sslconn->ssl = ssl = SSL_new(mctx->ssl_ctx))) {
+    sslconn->ssl = ssl = SSL_new(ctx);
+    /* the SSL holds its own reference */
+    SSL_CTX_free(od_ctx);
+    if (!ssl) {
         ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(01962)
                       "Unable to create a new SSL connection from the SSL "
                       "context");
@@ -626,6 +673,19 @@ int ssl_init_ssl_connection(conn_rec *c, request_rec *r)
         return DECLINED; /* XXX */
     }
 
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    if (!c->outgoing && sc->async_keyops == TRUE) {
+        SSL_set_mode(ssl, SSL_MODE_ASYNC);
+    }
+#endif
+#ifdef HAVE_TLS_EARLY_DATA
+    /* The virtual host accepting early data may only be known from SNI,
+     * look for it from the start if any does */
+    if (!c->outgoing && myModConfig(server)->early_data) {
+        sslconn->early_data = MODSSL_EARLY_DATA_ACCEPTING;
+    }
+#endif
+
     rc = ssl_run_pre_handshake(c, ssl, c->outgoing ? 1 : 0);
     if (rc != OK && rc != DECLINED) {
         return rc;
@@ -691,6 +751,98 @@ static int ssl_hook_pre_connection(conn_rec *c, void *csd)
     return ssl_init_ssl_connection(c, NULL);
 }
 
+static apr_status_t ssl_init_handshake(conn_rec *c, SSLConnRec *sslconn)
+{
+    apr_bucket_brigade* temp;
+    apr_status_t rv;
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    int can_poll = 0;
+
+    /* While a private key operation is in the crypto thread pool, the
+     * handshake returns here if the MPM can park the connection. */
+    if (c->cs && ap_mpm_query(AP_MPMQ_CAN_POLL, &can_poll) == APR_SUCCESS
+        && can_poll) {
+        sslconn->async_park = 1;
+    }
+#endif
+
+    temp = apr_brigade_create(c->pool, c->bucket_alloc);
+    rv = ap_get_brigade(c->input_filters, temp,
+                        AP_MODE_INIT, APR_BLOCK_READ, 0);
+    apr_brigade_destroy(temp);
+
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    sslconn->async_park = 0;
+#endif
+    return rv;
+}
+
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+static void ssl_async_handshake_cb(void *baton);
+
+/* Have the MPM call back when the parked handshake can go on */
+static void ssl_async_handshake_poll(conn_rec *c, SSLConnRec *sslconn)
+{
+    apr_array_header_t *pfds;
+    apr_status_t rv = APR_EGENERAL;
+
+    sslconn->async_parked = 0;
+    if ((pfds = ssl_async_keyops_pollfds(c, sslconn->ssl))) {
+        rv = ap_mpm_register_poll_callback_timeout(c->pool, pfds,
+                                                   ssl_async_handshake_cb,
+                                                   NULL, c, 0);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, rv, c, APLOGNO(10515)
+                      "SSL handshake: cannot poll for the private key "
+                      "operation, waiting for it");
+        ssl_async_keyops_wait(c, sslconn->ssl);
+        ssl_async_handshake_cb(c);
+    }
+}
+
+static void ssl_async_handshake_cb(void *baton)
+{
+    conn_rec *c = baton;
+    SSLConnRec *sslconn = myConnConfig(c);
+    apr_status_t rv;
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                  "SSL handshake: resuming after the private key operation");
+    rv = ssl_init_handshake(c, sslconn);
+    if (sslconn->async_parked) {
+        ssl_async_handshake_poll(c, sslconn);
+        return;
+    }
+
+    if (rv == APR_SUCCESS) {
+        /* Let the MPM wait for the first request like it does on kept
+         * alive connections */
+        c->keepalive = AP_CONN_KEEPALIVE;
+    }
+    else {
+        ap_log_cerror(APLOG_MARK, APLOG_INFO, rv, c, APLOGNO(10516)
+                      "SSL handshake was not completed, "
+                      "closing connection");
+        c->cs->state = CONN_STATE_LINGER;
+    }
+    ap_mpm_resume_suspended(c);
+}
+
+static void ssl_hook_suspend_connection(conn_rec *c, request_rec *r)
+{
+    SSLConnRec *sslconn = myConnConfig(c);
+
+    /* The MPM has marked the connection suspended already, so it can be
+     * resumed from the callback as soon as the poll is registered, in
+     * another thread possibly. Nothing may touch the connection here
+     * afterwards, hence this hook runs last. */
+    if (sslconn && sslconn->async_parked) {
+        ssl_async_handshake_poll(c, sslconn);
+    }
+}
+#endif
+
 static int ssl_hook_process_connection(conn_rec* c)
 {
     SSLConnRec *sslconn = myConnConfig(c);
@@ -700,13 +852,18 @@ static int ssl_hook_process_connection(conn_rec* c)
          * themselves which triggers the handshake, which again triggers
          * all kinds of useful things such as SNI and ALPN.
          */
-        apr_bucket_brigade* temp;
         apr_status_t rv;
 
-        temp = apr_brigade_create(c->pool, c->bucket_alloc);
-        rv = ap_get_brigade(c->input_filters, temp,
-                            AP_MODE_INIT, APR_BLOCK_READ, 0);
-        apr_brigade_destroy(temp);
+        rv = ssl_init_handshake(c, sslconn);
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+        if (sslconn->async_parked) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                          "SSL handshake: parking the connection during "
+                          "the private key operation");
+            c->cs->state = CONN_STATE_SUSPENDED;
+            return OK;
+        }
+#endif
 
         if (APR_SUCCESS != APR_SUCCESS) {
             if (c->cs) {
@@ -741,6 +898,10 @@ static void ssl_register_hooks(apr_pool_t *p)
     ssl_io_filter_register(p);
 
     ap_hook_pre_connection(ssl_hook_pre_connection,NULL,NULL, APR_HOOK_MIDDLE);
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    ap_hook_suspend_connection(ssl_hook_suspend_connection,
+                               NULL, NULL, APR_HOOK_REALLY_LAST);
+#endif
     ap_hook_process_connection(ssl_hook_process_connection, 
                                                    NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_test_config   (ssl_hook_ConfigTest,    NULL,NULL, APR_HOOK_MIDDLE);
@@ -108,6 +108,10 @@ SOURCE=.\mod_ssl.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\ssl_engine_async.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\ssl_engine_config.c
 # End Source File
 # Begin Source File
@@ -160,6 +164,10 @@ SOURCE=.\ssl_util_stapling.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\ssl_util_ticket_keys.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\ssl_util.c
 # End Source File
 # Begin Source File
@@ -0,0 +1,537 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_engine_async.c
+ *  Private key operations in a thread pool
+ */
+
+#include "ssl_private.h"
+
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+
+#include "ap_mpm.h"
+#include "apr_atomic.h"
+#include "apr_poll.h"
+#include "apr_portable.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_pool.h"
+#include "mod_status.h"
+
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+/*
+ * The RSA and ECDSA keys of servers with SSLAsyncKeyOps get methods
+ * whose private key operations, when called from the ASYNC job of a
+ * handshake (SSL_MODE_ASYNC), are handed to the crypto thread pool of
+ * the child while the job pauses. SSL_accept() then fails with
+ * SSL_ERROR_WANT_ASYNC, and the connection waits for the pipe of its
+ * ASYNC_WAIT_CTX to be readable before resuming the handshake (parked
+ * by the MPM when it can poll, see mod_ssl.c).
+ * Outside of a job, or without the thread pool, the operations run
+ * inline like with the default methods.
+ */
+
+static RSA_METHOD *keyops_rsa_meth;
+#ifndef OPENSSL_NO_EC
+static EC_KEY_METHOD *keyops_ec_meth;
+#endif
+
+static int (*rsa_priv_enc_orig)(int flen, const unsigned char *from,
+                                unsigned char *to, RSA *rsa, int padding);
+static int (*rsa_priv_dec_orig)(int flen, const unsigned char *from,
+                                unsigned char *to, RSA *rsa, int padding);
+#ifndef OPENSSL_NO_EC
+static int (*ec_sign_orig)(int type, const unsigned char *dgst, int dlen,
+                           unsigned char *sig, unsigned int *siglen,
+                           const BIGNUM *kinv, const BIGNUM *r,
+                           EC_KEY *eckey);
+#endif
+
+/* Per child */
+static apr_thread_pool_t *keyops_tp;
+static apr_thread_mutex_t *keyops_mutex;
+static struct {
+    apr_uint64_t ops;
+    apr_interval_time_t sum_delay;
+    apr_interval_time_t max_delay;
+} keyops_stats;
+
+/* The pipe waking up the handshake of a connection, registered as wait
+ * fd of its ASYNC_WAIT_CTX. The crypto thread running an operation holds
+ * a reference so that it outlives an SSL freed meanwhile. */
+typedef struct {
+    int fds[2];
+    apr_uint32_t refs;
+} keyops_chan_t;
+
+static const int keyops_chan_key;
+
+typedef struct keyops_op_t keyops_op_t;
+struct keyops_op_t {
+    int (*run)(keyops_op_t *op);
+    union {
+        struct {
+            int flen;
+            const unsigned char *from;
+            unsigned char *to;
+            RSA *rsa;
+            int padding;
+        } rsa;
+        struct {
+            int type;
+            const unsigned char *dgst;
+            int dlen;
+            unsigned char *sig;
+            unsigned int *siglen;
+            const BIGNUM *kinv;
+            const BIGNUM *r;
+            EC_KEY *eckey;
+        } ec;
+    } u;
+    keyops_chan_t *chan;
+    apr_time_t queued;
+    int ret;
+    apr_uint32_t done;
+};
+
+static void keyops_chan_release(keyops_chan_t *chan)
+{
+    if (!apr_atomic_dec32(&chan->refs)) {
+        close(chan->fds[0]);
+        close(chan->fds[1]);
+        free(chan);
+    }
+}
+
+static void keyops_chan_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+                                OSSL_ASYNC_FD fd, void *custom)
+{
+    keyops_chan_release(custom);
+}
+
+static keyops_chan_t *keyops_chan_get(ASYNC_JOB *job)
+{
+    ASYNC_WAIT_CTX *waitctx = ASYNC_get_wait_ctx(job);
+    keyops_chan_t *chan;
+    OSSL_ASYNC_FD fd;
+    void *custom;
+
+    if (!waitctx) {
+        return NULL;
+    }
+    if (ASYNC_WAIT_CTX_get_fd(waitctx, &keyops_chan_key, &fd, &custom)) {
+        return custom;
+    }
+
+    if (!(chan = malloc(sizeof(*chan)))) {
+        return NULL;
+    }
+    if (pipe(chan->fds) != 0) {
+        free(chan);
+        return NULL;
+    }
+    fcntl(chan->fds[0], F_SETFL, fcntl(chan->fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(chan->fds[1], F_SETFL, fcntl(chan->fds[1], F_GETFL) | O_NONBLOCK);
+    apr_atomic_set32(&chan->refs, 1);
+
+    if (!ASYNC_WAIT_CTX_set_wait_fd(waitctx, &keyops_chan_key, chan->fds[0],
+                                    chan, keyops_chan_cleanup)) {
+        keyops_chan_release(chan);
+        return NULL;
+    }
+    return chan;
+}
+
+static void * APR_THREAD_FUNC keyops_op_run(apr_thread_t *thread, void *data)
+{
+    keyops_op_t *op = data;
+    keyops_chan_t *chan = op->chan;
+    apr_interval_time_t delay = apr_time_now() - op->queued;
+    char c = 0;
+
+    apr_thread_mutex_lock(keyops_mutex);
+    keyops_stats.ops++;
+    keyops_stats.sum_delay += delay;
+    if (delay > keyops_stats.max_delay) {
+        keyops_stats.max_delay = delay;
+    }
+    apr_thread_mutex_unlock(keyops_mutex);
+
+    op->ret = op->run(op);
+    /* The op lives on the stack of the paused job, which may go away
+     * as soon as it sees this. */
+    apr_atomic_set32(&op->done, 1);
+
+    while (write(chan->fds[1], &c, 1) < 0 && errno == EINTR)
+        ;
+    keyops_chan_release(chan);
+
+    return NULL;
+}
+
+static int keyops_offload(keyops_op_t *op)
+{
+    ASYNC_JOB *job;
+    keyops_chan_t *chan;
+    char buf[16];
+
+    if (!keyops_tp
+        || !(job = ASYNC_get_current_job())
+        || !(chan = keyops_chan_get(job))) {
+        return op->run(op);
+    }
+
+    op->chan = chan;
+    op->queued = apr_time_now();
+    apr_atomic_set32(&op->done, 0);
+    apr_atomic_inc32(&chan->refs);
+    if (apr_thread_pool_push(keyops_tp, keyops_op_run, op,
+                             APR_THREAD_TASK_PRIORITY_NORMAL,
+                             NULL) != APR_SUCCESS) {
+        keyops_chan_release(chan);
+        return op->run(op);
+    }
+
+    /* Wakeups left over by the previous operation are drained here,
+     * hence the loop. */
+    for (;;) {
+        while (read(chan->fds[0], buf, sizeof(buf)) > 0)
+            ;
+        if (apr_atomic_read32(&op->done)) {
+            break;
+        }
+        if (!ASYNC_pause_job()) {
+            struct pollfd pfd;
+
+            pfd.fd = chan->fds[0];
+            pfd.events = POLLIN;
+            poll(&pfd, 1, -1);
+        }
+    }
+
+    return op->ret;
+}
+
+static int keyops_rsa_priv_enc_run(keyops_op_t *op)
+{
+    return rsa_priv_enc_orig(op->u.rsa.flen, op->u.rsa.from, op->u.rsa.to,
+                             op->u.rsa.rsa, op->u.rsa.padding);
+}
+
+static int keyops_rsa_priv_dec_run(keyops_op_t *op)
+{
+    return rsa_priv_dec_orig(op->u.rsa.flen, op->u.rsa.from, op->u.rsa.to,
+                             op->u.rsa.rsa, op->u.rsa.padding);
+}
+
+static int keyops_rsa_priv_enc(int flen, const unsigned char *from,
+                               unsigned char *to, RSA *rsa, int padding)
+{
+    keyops_op_t op;
+
+    op.run = keyops_rsa_priv_enc_run;
+    op.u.rsa.flen = flen;
+    op.u.rsa.from = from;
+    op.u.rsa.to = to;
+    op.u.rsa.rsa = rsa;
+    op.u.rsa.padding = padding;
+    return keyops_offload(&op);
+}
+
+static int keyops_rsa_priv_dec(int flen, const unsigned char *from,
+                               unsigned char *to, RSA *rsa, int padding)
+{
+    keyops_op_t op;
+
+    op.run = keyops_rsa_priv_dec_run;
+    op.u.rsa.flen = flen;
+    op.u.rsa.from = from;
+    op.u.rsa.to = to;
+    op.u.rsa.rsa = rsa;
+    op.u.rsa.padding = padding;
+    return keyops_offload(&op);
+}
+
+#ifndef OPENSSL_NO_EC
+static int keyops_ec_sign_run(keyops_op_t *op)
+{
+    return ec_sign_orig(op->u.ec.type, op->u.ec.dgst, op->u.ec.dlen,
+                        op->u.ec.sig, op->u.ec.siglen, op->u.ec.kinv,
+                        op->u.ec.r, op->u.ec.eckey);
+}
+
+static int keyops_ec_sign(int type, const unsigned char *dgst, int dlen,
+                          unsigned char *sig, unsigned int *siglen,
+                          const BIGNUM *kinv, const BIGNUM *r,
+                          EC_KEY *eckey)
+{
+    keyops_op_t op;
+
+    op.run = keyops_ec_sign_run;
+    op.u.ec.type = type;
+    op.u.ec.dgst = dgst;
+    op.u.ec.dlen = dlen;
+    op.u.ec.sig = sig;
+    op.u.ec.siglen = siglen;
+    op.u.ec.kinv = kinv;
+    op.u.ec.r = r;
+    op.u.ec.eckey = eckey;
+    return keyops_offload(&op);
+}
+#endif
+
+/* The methods are created once and kept for the lifetime of the
+ * process, keys of old generations may still refer to them. */
+void ssl_async_keyops_init(void)
+{
+    if (!keyops_rsa_meth
+        && (keyops_rsa_meth = RSA_meth_dup(RSA_get_default_method()))) {
+        rsa_priv_enc_orig = RSA_meth_get_priv_enc(keyops_rsa_meth);
+        rsa_priv_dec_orig = RSA_meth_get_priv_dec(keyops_rsa_meth);
+        RSA_meth_set1_name(keyops_rsa_meth, "mod_ssl async RSA");
+        RSA_meth_set_priv_enc(keyops_rsa_meth, keyops_rsa_priv_enc);
+        RSA_meth_set_priv_dec(keyops_rsa_meth, keyops_rsa_priv_dec);
+    }
+#ifndef OPENSSL_NO_EC
+    if (!keyops_ec_meth
+        && (keyops_ec_meth = EC_KEY_METHOD_new(EC_KEY_get_default_method()))) {
+        int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+        ECDSA_SIG *(*sign_sig)(const unsigned char *, int, const BIGNUM *,
+                               const BIGNUM *, EC_KEY *);
+
+        EC_KEY_METHOD_get_sign(keyops_ec_meth, &ec_sign_orig,
+                               &sign_setup, &sign_sig);
+        EC_KEY_METHOD_set_sign(keyops_ec_meth, keyops_ec_sign,
+                               sign_setup, sign_sig);
+    }
+#endif
+}
+
+/* Copy of a software RSA or EC key using our methods, NULL for other
+ * types or keys already handled by some engine or provider. */
+static EVP_PKEY *keyops_wrap_key(EVP_PKEY *pkey)
+{
+    EVP_PKEY *wrapped = NULL;
+
+    switch (EVP_PKEY_base_id(pkey)) {
+    case EVP_PKEY_RSA: {
+        const RSA *key = EVP_PKEY_get0_RSA(pkey);
+        RSA *rsa;
+
+        if (!keyops_rsa_meth || !key
+            || RSA_get_method(key) != RSA_get_default_method()
+            || !(rsa = RSAPrivateKey_dup((RSA *)key))) {
+            break;
+        }
+        if (!RSA_set_method(rsa, keyops_rsa_meth)
+            || !(wrapped = EVP_PKEY_new())
+            || !EVP_PKEY_assign_RSA(wrapped, rsa)) {
+            EVP_PKEY_free(wrapped);
+            RSA_free(rsa);
+            wrapped = NULL;
+        }
+        break;
+    }
+#ifndef OPENSSL_NO_EC
+    case EVP_PKEY_EC: {
+        const EC_KEY *key = EVP_PKEY_get0_EC_KEY(pkey);
+        EC_KEY *ec;
+
+        if (!keyops_ec_meth || !key
+            || EC_KEY_get_method(key) != EC_KEY_get_default_method()
+            || !(ec = EC_KEY_dup(key))) {
+            break;
+        }
+        if (!EC_KEY_set_method(ec, keyops_ec_meth)
+            || !(wrapped = EVP_PKEY_new())
+            || !EVP_PKEY_assign_EC_KEY(wrapped, ec)) {
+            EVP_PKEY_free(wrapped);
+            EC_KEY_free(ec);
+            wrapped = NULL;
+        }
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    return wrapped;
+}
+
+apr_status_t ssl_async_keyops_init_ctx(server_rec *s, modssl_ctx_t *mctx)
+{
+    SSL_CTX *ctx = mctx->ssl_ctx;
+    EVP_PKEY *pkey, *wrapped;
+    int ret, n = 0, i = 0;
+
+    ret = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+    while (ret) {
+        if ((pkey = SSL_CTX_get0_privatekey(ctx))) {
+            if ((wrapped = keyops_wrap_key(pkey))
+                && SSL_CTX_use_PrivateKey(ctx, wrapped) == 1) {
+                n++;
+            }
+            else {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10517)
+                             "Init: private key %s:%d does not support "
+                             "SSLAsyncKeyOps, it will be used in the "
+                             "handshakes directly",
+                             mySrvConfig(s)->vhost_id, i);
+                ERR_clear_error();
+            }
+            EVP_PKEY_free(wrapped);
+        }
+        ret = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT);
+        i++;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10518)
+                 "Init: %d private key(s) of %s use the crypto thread pool",
+                 n, mySrvConfig(s)->vhost_id);
+
+    return APR_SUCCESS;
+}
+
+void ssl_async_keyops_init_child(apr_pool_t *p, server_rec *s)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    server_rec *ws;
+    apr_status_t rv;
+
+    for (ws = s; ws; ws = ws->next) {
+        if (mySrvConfig(ws)->async_keyops == TRUE) {
+            break;
+        }
+    }
+    if (!ws) {
+        return;
+    }
+
+    rv = apr_thread_mutex_create(&keyops_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_pool_create(&keyops_tp, 0,
+                                    mc->async_keyops_threads, p);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10519)
+                     "could not create the crypto thread pool, private "
+                     "key operations will be done in the handshakes");
+        keyops_tp = NULL;
+    }
+}
+
+apr_array_header_t *ssl_async_keyops_pollfds(conn_rec *c, SSL *ssl)
+{
+    apr_array_header_t *pfds;
+    OSSL_ASYNC_FD *fds;
+    size_t i, n = 0;
+
+    if (!SSL_get_all_async_fds(ssl, NULL, &n) || !n) {
+        return NULL;
+    }
+    fds = apr_palloc(c->pool, n * sizeof(*fds));
+    if (!SSL_get_all_async_fds(ssl, fds, &n)) {
+        return NULL;
+    }
+
+    pfds = apr_array_make(c->pool, n, sizeof(apr_pollfd_t));
+    for (i = 0; i < n; i++) {
+        apr_pollfd_t *pfd = apr_array_push(pfds);
+        apr_file_t *f = NULL;
+
+        apr_os_file_put(&f, &fds[i], APR_FOPEN_READ, c->pool);
+        memset(pfd, 0, sizeof(*pfd));
+        pfd->p = c->pool;
+        pfd->desc_type = APR_POLL_FILE;
+        pfd->desc.f = f;
+        pfd->reqevents = APR_POLLIN;
+    }
+
+    return pfds;
+}
+
+apr_status_t ssl_async_keyops_wait(conn_rec *c, SSL *ssl)
+{
+    apr_array_header_t *pfds = ssl_async_keyops_pollfds(c, ssl);
+    apr_int32_t nsds;
+    apr_status_t rv;
+
+    if (!pfds) {
+        return APR_EGENERAL;
+    }
+    do {
+        rv = apr_poll((apr_pollfd_t *)pfds->elts, pfds->nelts, &nsds,
+                      c->base_server->timeout);
+    } while (APR_STATUS_IS_EINTR(rv));
+
+    return rv;
+}
+
+void ssl_async_keyops_status(request_rec *r, int flags)
+{
+    apr_uint64_t ops;
+    apr_interval_time_t avg, max;
+    apr_size_t queued, busy;
+
+    if (!keyops_tp) {
+        return;
+    }
+    apr_thread_mutex_lock(keyops_mutex);
+    ops = keyops_stats.ops;
+    avg = ops ? keyops_stats.sum_delay / (apr_int64_t)ops : 0;
+    max = keyops_stats.max_delay;
+    apr_thread_mutex_unlock(keyops_mutex);
+    queued = apr_thread_pool_tasks_count(keyops_tp);
+    busy = apr_thread_pool_busy_count(keyops_tp);
+
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "TLSKeyOps: %" APR_UINT64_T_FMT "\n", ops);
+        ap_rprintf(r, "TLSKeyOpsQueued: %" APR_SIZE_T_FMT "\n", queued);
+        ap_rprintf(r, "TLSKeyOpsBusyThreads: %" APR_SIZE_T_FMT "\n", busy);
+        ap_rprintf(r, "TLSKeyOpsQueueAvgUs: %" APR_TIME_T_FMT "\n", avg);
+        ap_rprintf(r, "TLSKeyOpsQueueMaxUs: %" APR_TIME_T_FMT "\n", max);
+        return;
+    }
+
+    ap_rputs("<hr>\n", r);
+    ap_rputs("<table cellspacing=0 cellpadding=0>\n", r);
+    ap_rputs("<tr><td bgcolor=\"#000000\">\n", r);
+    ap_rputs("<b><font color=\"#ffffff\" face=\"Arial,Helvetica\">SSL/TLS Private Key Operations:</font></b>\r", r);
+    ap_rputs("</td></tr>\n", r);
+    ap_rputs("<tr><td bgcolor=\"#ffffff\">\n", r);
+    ap_rprintf(r, "child pid: <b>%" APR_PID_T_FMT "</b>, operations: <b>%"
+               APR_UINT64_T_FMT "</b>, queued: <b>%" APR_SIZE_T_FMT "</b>, "
+               "busy threads: <b>%" APR_SIZE_T_FMT "</b><br>",
+               getpid(), ops, queued, busy);
+    ap_rprintf(r, "queueing delay: average <b>%" APR_TIME_T_FMT "us</b>, "
+               "max <b>%" APR_TIME_T_FMT "us</b><br>", avg, max);
+    ap_rputs("</td></tr>\n", r);
+    ap_rputs("</table>\n", r);
+}
+
+#endif /* HAVE_SSL_ASYNC_KEYOPS */
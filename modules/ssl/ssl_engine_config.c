@@ -68,6 +68,12 @@ static SSLModConfigRec *ssl_config_global_create(apr_pool_t *pool, server_rec *s
     mc->fips = UNSET;
 #endif
 
+    mc->ctx_cache_size         = UNSET;
+    mc->async_keyops_threads   = UNSET;
+#ifdef HAVE_TLS_SESSION_TICKETS
+    mc->ticket_keys_refresh    = UNSET;
+#endif
+
     mc->retained = ap_retained_data_get(MODSSL_RETAINED_KEY);
     if (!mc->retained) {
         /* Allocate the retained data; the hash table is allocated out
@@ -103,6 +109,22 @@ static apr_status_t modssl_ctx_config_cleanup(void *ctx)
     SSL_CONF_CTX_free(ctx);
     return APR_SUCCESS;
 }
+
+/*
+ * The configuration context applying the SSLOpenSSLConfCmd of a server,
+ * freed with the pool.
+ */
+SSL_CONF_CTX *ssl_config_conf_ctx_create(apr_pool_t *p)
+{
+    SSL_CONF_CTX *cctx = SSL_CONF_CTX_new();
+
+    apr_pool_cleanup_register(p, cctx, modssl_ctx_config_cleanup,
+                              apr_pool_cleanup_null);
+    SSL_CONF_CTX_set_flags(cctx, SSL_CONF_FLAG_FILE);
+    SSL_CONF_CTX_set_flags(cctx, SSL_CONF_FLAG_SERVER);
+    SSL_CONF_CTX_set_flags(cctx, SSL_CONF_FLAG_CERTIFICATE);
+    return cctx;
+}
 #endif
 
 static void modssl_ctx_init(modssl_ctx_t *mctx, apr_pool_t *p)
@@ -171,13 +193,7 @@ static void modssl_ctx_init(modssl_ctx_t *mctx, apr_pool_t *p)
     mctx->srp_vbase =             NULL;
 #endif
 #ifdef HAVE_SSL_CONF_CMD
-    mctx->ssl_ctx_config = SSL_CONF_CTX_new();
-    apr_pool_cleanup_register(p, mctx->ssl_ctx_config,
-                              modssl_ctx_config_cleanup,
-                              apr_pool_cleanup_null);
-    SSL_CONF_CTX_set_flags(mctx->ssl_ctx_config, SSL_CONF_FLAG_FILE);
-    SSL_CONF_CTX_set_flags(mctx->ssl_ctx_config, SSL_CONF_FLAG_SERVER);
-    SSL_CONF_CTX_set_flags(mctx->ssl_ctx_config, SSL_CONF_FLAG_CERTIFICATE);
+    mctx->ssl_ctx_config = ssl_config_conf_ctx_create(p);
     mctx->ssl_ctx_param = apr_array_make(p, 5, sizeof(ssl_ctx_param_t));
 #endif
 
@@ -222,6 +238,12 @@ static SSLSrvConfigRec *ssl_config_server_new(apr_pool_t *p)
     sc->compression            = UNSET;
 #endif
     sc->session_tickets        = UNSET;
+    sc->record_warmup_size     = UNSET;
+    sc->record_cooldown_secs   = UNSET;
+    sc->ctx_on_demand          = UNSET;
+    sc->async_keyops           = UNSET;
+    sc->early_data             = UNSET;
+    sc->early_data_max_size    = UNSET;
 
     modssl_ctx_init_server(sc, p);
 
@@ -335,6 +357,7 @@ static void modssl_ctx_cfg_merge_server(apr_pool_t *p,
 
 #ifdef HAVE_TLS_SESSION_TICKETS
     cfgMergeString(ticket_key->file_path);
+    cfgMergeString(ticket_key->dir_path);
 #endif
 }
 
@@ -356,6 +379,12 @@ void *ssl_config_server_merge(apr_pool_t *p, void *basev, void *addv)
     cfgMergeBool(compression);
 #endif
     cfgMergeBool(session_tickets);
+    cfgMerge(record_warmup_size, UNSET);
+    cfgMergeInt(record_cooldown_secs);
+    cfgMergeBool(ctx_on_demand);
+    cfgMergeBool(async_keyops);
+    cfgMergeBool(early_data);
+    cfgMergeInt(early_data_max_size);
 
     modssl_ctx_cfg_merge_server(p, base->server, add->server, mrg->server);
 
@@ -1083,6 +1112,46 @@ const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd,
 
     return NULL;
 }
+
+const char *ssl_cmd_SSLSessionTicketKeyDir(cmd_parms *cmd,
+                                           void *dcfg,
+                                           const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ssl_cmd_check_dir(cmd, &arg))) {
+        return err;
+    }
+
+    sc->server->ticket_key->dir_path = arg;
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLSessionTicketKeyRefresh(cmd_parms *cmd,
+                                               void *dcfg,
+                                               const char *arg)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLSessionTicketKeyRefresh: cannot be used inside "
+               "SSLPolicyDefine";
+    }
+
+    mc->ticket_keys_refresh = atoi(arg);
+
+    if (mc->ticket_keys_refresh < 1) {
+        return "SSLSessionTicketKeyRefresh: Invalid argument";
+    }
+
+    return NULL;
+}
 #endif
 
 #define NO_PER_DIR_SSL_CA \
@@ -1418,6 +1487,139 @@ const char *ssl_cmd_SSLSessionCacheTimeout(cmd_parms *cmd,
     return NULL;
 }
 
+const char *ssl_cmd_SSLRecordWarmUpSize(cmd_parms *cmd,
+                                        void *dcfg,
+                                        const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    apr_off_t size;
+
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS || size < 0) {
+        return "SSLRecordWarmUpSize: Invalid argument";
+    }
+    sc->record_warmup_size = size;
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLRecordCoolDownSecs(cmd_parms *cmd,
+                                          void *dcfg,
+                                          const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+
+    sc->record_cooldown_secs = atoi(arg);
+
+    if (sc->record_cooldown_secs < 0) {
+        return "SSLRecordCoolDownSecs: Invalid argument";
+    }
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLContextOnDemand(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+
+    sc->ctx_on_demand = flag ? TRUE : FALSE;
+
+    return NULL;
+#else
+    return "The SSLContextOnDemand directive is not available "
+        "with this SSL library";
+#endif
+}
+
+const char *ssl_cmd_SSLContextCacheSize(cmd_parms *cmd,
+                                        void *dcfg,
+                                        const char *arg)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLContextCacheSize: cannot be used inside SSLPolicyDefine";
+    }
+
+    mc->ctx_cache_size = atoi(arg);
+
+    if (mc->ctx_cache_size < 1) {
+        return "SSLContextCacheSize: Invalid argument";
+    }
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLAsyncKeyOps(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+
+    sc->async_keyops = flag ? TRUE : FALSE;
+
+    return NULL;
+#else
+    return "The SSLAsyncKeyOps directive is not available "
+        "with this SSL library";
+#endif
+}
+
+const char *ssl_cmd_SSLAsyncKeyOpsThreads(cmd_parms *cmd,
+                                          void *dcfg,
+                                          const char *arg)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLAsyncKeyOpsThreads: cannot be used inside SSLPolicyDefine";
+    }
+
+    mc->async_keyops_threads = atoi(arg);
+
+    if (mc->async_keyops_threads < 1) {
+        return "SSLAsyncKeyOpsThreads: Invalid argument";
+    }
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLEarlyData(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_TLS_EARLY_DATA
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+
+    sc->early_data = flag ? TRUE : FALSE;
+
+    return NULL;
+#else
+    return "The SSLEarlyData directive is not available "
+        "with this SSL library";
+#endif
+}
+
+const char *ssl_cmd_SSLEarlyDataMaxSize(cmd_parms *cmd,
+                                        void *dcfg,
+                                        const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+
+    sc->early_data_max_size = atoi(arg);
+
+    if (sc->early_data_max_size < 1) {
+        return "SSLEarlyDataMaxSize: Invalid argument";
+    }
+
+    return NULL;
+}
+
 const char *ssl_cmd_SSLOptions(cmd_parms *cmd,
                                void *dcfg,
                                const char *arg)
@@ -2620,6 +2822,7 @@ static void modssl_ctx_dump(modssl_ctx_t *ctx, apr_pool_t *p, int proxy,
 #ifdef HAVE_TLS_SESSION_TICKETS
         if (ctx->ticket_key) {
             DMP_STRING("SSLSessionTicketKeyFile", ctx->ticket_key->file_path);
+            DMP_STRING("SSLSessionTicketKeyDir", ctx->ticket_key->dir_path);
         }
 #endif
     }
@@ -2651,6 +2854,12 @@ static void ssl_srv_dump(SSLSrvConfigRec *sc, apr_pool_t *p,
     DMP_ON_OFF("SSLInsecureRenegotiation", sc->insecure_reneg);
     DMP_ON_OFF("SSLStrictSNIVHostCheck", sc->strict_sni_vhost_check);
     DMP_ON_OFF("SSLSessionTickets", sc->session_tickets);
+    DMP_LONG(  "SSLRecordWarmUpSize", (long)sc->record_warmup_size);
+    DMP_LONG(  "SSLRecordCoolDownSecs", sc->record_cooldown_secs);
+    DMP_ON_OFF("SSLContextOnDemand", sc->ctx_on_demand);
+    DMP_ON_OFF("SSLAsyncKeyOps", sc->async_keyops);
+    DMP_ON_OFF("SSLEarlyData", sc->early_data);
+    DMP_LONG(  "SSLEarlyDataMaxSize", sc->early_data_max_size);
 }
 
 static void ssl_policy_dump(SSLSrvConfigRec *policy, apr_pool_t *p, 
@@ -31,6 +31,8 @@
 #include "mpm_common.h"
 #include "mod_md.h"
 #include "util_md5.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
 
 static apr_status_t ssl_init_ca_cert_path(server_rec *, apr_pool_t *, const char *,
                                           STACK_OF(X509_NAME) *, STACK_OF(X509_INFO) *);
@@ -275,6 +277,18 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
      */
     ssl_config_global_fix(mc);
 
+    if (mc->ctx_cache_size == UNSET) {
+        mc->ctx_cache_size = SSL_CTX_CACHE_SIZE;
+    }
+    if (mc->async_keyops_threads == UNSET) {
+        mc->async_keyops_threads = SSL_ASYNC_KEYOPS_THREADS;
+    }
+#ifdef HAVE_TLS_SESSION_TICKETS
+    if (mc->ticket_keys_refresh == UNSET) {
+        mc->ticket_keys_refresh = SSL_TICKET_KEYS_REFRESH;
+    }
+#endif
+
     /*
      *  try to fix the configuration and open the dedicated SSL
      *  logfile as early as possible
@@ -318,6 +332,33 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
             sc->enabled = SSL_ENABLED_FALSE;
         }
 
+        if (sc->ctx_on_demand == UNSET || sc->enabled == SSL_ENABLED_FALSE) {
+            sc->ctx_on_demand = FALSE;
+        }
+
+        if (sc->async_keyops == UNSET || sc->enabled == SSL_ENABLED_FALSE) {
+            sc->async_keyops = FALSE;
+        }
+
+        if (sc->early_data == UNSET || sc->enabled == SSL_ENABLED_FALSE) {
+            sc->early_data = FALSE;
+        }
+        if (sc->early_data_max_size == UNSET) {
+            sc->early_data_max_size = SSL_EARLY_DATA_MAX_SIZE;
+        }
+#ifdef HAVE_TLS_EARLY_DATA
+        if (sc->early_data == TRUE) {
+            /* Replays of early data are detected in the session cache */
+            if (mc->sesscache == NULL) {
+                ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10520)
+                             "SSLEarlyData: no session cache available "
+                             "[hint: SSLSessionCache]");
+                return ssl_die(s);
+            }
+            mc->early_data = TRUE;
+        }
+#endif
+
         if (sc->session_cache_timeout == UNSET) {
             sc->session_cache_timeout = SSL_SESSION_CACHE_TIMEOUT;
         }
@@ -399,6 +440,19 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         return rv;
     }
 
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    ssl_async_keyops_init();
+#endif
+
+#ifdef HAVE_TLS_SESSION_TICKETS
+    /*
+     * load the session ticket keys rotated from directories
+     */
+    if ((rv = ssl_ticket_keys_init(base_server, p, ptemp)) != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
     pphrases = apr_array_make(ptemp, 2, sizeof(char *));
 
     /*
@@ -438,12 +492,26 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         return rv;
     }
 
+#ifdef HAVE_OCSP_STAPLING
+    if ((rv = ssl_stapling_init_watchdog(base_server, p)) != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
+#ifdef HAVE_TLS_SESSION_TICKETS
+    if ((rv = ssl_ticket_keys_init_watchdog(base_server, p)) != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
     for (s = base_server; s; s = s->next) {
         SSLDirConfigRec *sdc = ap_get_module_config(s->lookup_defaults,
                                                     &ssl_module);
 
         sc = mySrvConfig(s);
-        if (sc->enabled == SSL_ENABLED_TRUE || sc->enabled == SSL_ENABLED_OPTIONAL) {
+        /* contexts created on demand run the hook when they are created */
+        if ((sc->enabled == SSL_ENABLED_TRUE || sc->enabled == SSL_ENABLED_OPTIONAL)
+            && sc->ctx_on_demand != TRUE) {
             if ((rv = ssl_run_init_server(s, p, 0, sc->server->ssl_ctx)) != APR_SUCCESS) {
                 return rv;
             }
@@ -464,6 +532,9 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
     ssl_add_version_components(ptemp, p, base_server);
 
     modssl_init_app_data2_idx(); /* for modssl_get_app_data2() at request time */
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+    ssl_init_ctx_cache_idx();
+#endif
 
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
     init_dh_params();
@@ -910,6 +981,23 @@ static void ssl_init_ctx_session_cache(server_rec *s,
         SSL_CTX_sess_set_get_cb(ctx,    ssl_callback_GetSessionCacheEntry);
         SSL_CTX_sess_set_remove_cb(ctx, ssl_callback_DelSessionCacheEntry);
     }
+
+#ifdef HAVE_TLS_EARLY_DATA
+    if (mctx->pks) {
+        SSLSrvConfigRec *sc = mySrvConfig(s);
+
+        /* The max. early data goes into the session tickets issued, the
+         * SNI callback adjusts it for the virtual host selected. */
+        if (sc->early_data == TRUE) {
+            SSL_CTX_set_max_early_data(ctx, sc->early_data_max_size);
+            if (sc->early_data_max_size > SSL3_RT_MAX_PLAIN_LENGTH) {
+                SSL_CTX_set_recv_max_early_data(ctx, sc->early_data_max_size);
+            }
+        }
+        SSL_CTX_set_allow_early_data_cb(ctx, ssl_callback_AllowEarlyData,
+                                        NULL);
+    }
+#endif
 }
 
 #ifdef SSL_OP_NO_RENEGOTIATION
@@ -1497,8 +1585,11 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 
             ERR_clear_error();
 
-            /* perhaps it's an encrypted private key, so try again */
-            ssl_load_encrypted_pkey(s, ptemp, i, keyfile, &pphrases);
+            /* perhaps it's an encrypted private key, so try again
+             * (not possible for contexts created on demand) */
+            if (pphrases) {
+                ssl_load_encrypted_pkey(s, ptemp, i, keyfile, &pphrases);
+            }
 
             if (!(asn1 = ssl_asn1_table_get(mc->retained->privkeys, key_id)) ||
                 !(ptr = asn1->cpData) ||
@@ -1663,24 +1754,15 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 }
 
 #ifdef HAVE_TLS_SESSION_TICKETS
-static apr_status_t ssl_init_ticket_key(server_rec *s,
-                                        apr_pool_t *p,
-                                        apr_pool_t *ptemp,
-                                        modssl_ctx_t *mctx)
+static apr_status_t ssl_load_ticket_key_file(server_rec *s,
+                                             apr_pool_t *ptemp,
+                                             modssl_ticket_key_t *ticket_key,
+                                             const char *path)
 {
     apr_status_t rv;
     apr_file_t *fp;
     apr_size_t len;
-    char buf[TLSEXT_TICKET_KEY_LEN];
-    char *path;
-    modssl_ticket_key_t *ticket_key = mctx->ticket_key;
-    int res;
-
-    if (!ticket_key->file_path) {
-        return APR_SUCCESS;
-    }
-
-    path = ap_server_root_relative(p, ticket_key->file_path);
+    unsigned char buf[TLSEXT_TICKET_KEY_LEN];
 
     rv = apr_file_open(&fp, path, APR_READ|APR_BINARY,
                        APR_OS_DEFAULT, ptemp);
@@ -1701,30 +1783,57 @@ static apr_status_t ssl_init_ticket_key(server_rec *s,
         return ssl_die(s);
     }
 
-    memcpy(ticket_key->key_name, buf, 16);
-    memcpy(ticket_key->aes_key, buf + 32, 16);
+    ssl_ticket_key_set(ticket_key, buf);
+    OPENSSL_cleanse(buf, sizeof(buf));
+
+    return APR_SUCCESS;
+}
+
+/*
+ * For the contexts created on demand, the key of SSLSessionTicketKeyFile
+ * is loaded at startup (it's shared by the copies of the server's mctx).
+ */
+static apr_status_t ssl_init_ticket_key(server_rec *s,
+                                        apr_pool_t *p,
+                                        apr_pool_t *ptemp,
+                                        modssl_ctx_t *mctx,
+                                        int on_demand)
+{
+    apr_status_t rv;
+    const char *path;
+    modssl_ticket_key_t *ticket_key = mctx->ticket_key;
+    int res;
+
+    if (ticket_key->keys) {
+        /* the keys of SSLSessionTicketKeyDir take precedence, they
+         * are loaded by ssl_ticket_keys_init() */
+        path = ticket_key->dir_path;
+    }
+    else if (!ticket_key->file_path) {
+        return APR_SUCCESS;
+    }
+    else {
+        path = ap_server_root_relative(p, ticket_key->file_path);
+        if (!on_demand
+            && (rv = ssl_load_ticket_key_file(s, ptemp, ticket_key,
+                                              path)) != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
 #if OPENSSL_VERSION_NUMBER < 0x30000000L
-    memcpy(ticket_key->hmac_secret, buf + 16, 16);
     res = SSL_CTX_set_tlsext_ticket_key_cb(mctx->ssl_ctx,
                                            ssl_callback_SessionTicket);
 #else
-    ticket_key->mac_params[0] =
-        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
-                                          apr_pmemdup(p, buf + 16, 16), 16);
-    ticket_key->mac_params[1] =
-        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
-    ticket_key->mac_params[2] =
-        OSSL_PARAM_construct_end();
     res = SSL_CTX_set_tlsext_ticket_key_evp_cb(mctx->ssl_ctx,
                                                ssl_callback_SessionTicket);
 #endif
-    OPENSSL_cleanse(buf, sizeof(buf));
     if (!res) {
         ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(01913)
                      "Unable to initialize TLS session ticket key callback "
                      "(incompatible OpenSSL version?)");
         ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
-        return ssl_die(s);
+        return on_demand ? APR_EGENERAL : ssl_die(s);
     }
 
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(02288)
@@ -2005,74 +2114,52 @@ static apr_status_t ssl_init_proxy_ctx(server_rec *s,
     return APR_SUCCESS;
 }
 
-static apr_status_t ssl_init_server_ctx(server_rec *s,
-                                        apr_pool_t *p,
-                                        apr_pool_t *ptemp,
-                                        SSLSrvConfigRec *sc,
-                                        apr_array_header_t *pphrases)
+/*
+ * Create the SSL context of a server into mctx, which is mctx at
+ * startup. For contexts created on demand in a child, mctx is a copy
+ * and pphrases is NULL: there is no way to ask for pass phrases then,
+ * the certificates are not registered for OCSP stapling, and failures
+ * are returned rather than fatal. Such builds may run concurrently, so
+ * they only read what the copy shares with the server's mctx (e.g. pks),
+ * and apply SSLOpenSSLConfCmd with a configuration context of their own.
+ */
+static apr_status_t ssl_init_server_ctx_load(server_rec *s,
+                                             apr_pool_t *p,
+                                             apr_pool_t *ptemp,
+                                             SSLSrvConfigRec *sc,
+                                             modssl_ctx_t *mctx,
+                                             apr_array_header_t *pphrases)
 {
     apr_status_t rv;
-    modssl_pk_server_t *pks;
+    int on_demand = (pphrases == NULL);
+    int loglevel = on_demand ? APLOG_ERR : APLOG_EMERG;
 #ifdef HAVE_SSL_CONF_CMD
-    ssl_ctx_param_t *param = (ssl_ctx_param_t *)sc->server->ssl_ctx_param->elts;
-    SSL_CONF_CTX *cctx = sc->server->ssl_ctx_config;
+    ssl_ctx_param_t *param = (ssl_ctx_param_t *)mctx->ssl_ctx_param->elts;
+    SSL_CONF_CTX *cctx;
     int i;
 #endif
-    int n;
 
-    /*
-     *  Check for problematic re-initializations
-     */
-    if (sc->server->ssl_ctx) {
-        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02569)
-                     "Illegal attempt to re-initialise SSL for server "
-                     "(SSLEngine On should go in the VirtualHost, not in global scope.)");
-        return APR_EGENERAL;
-    }
-
-    /* Allow others to provide certificate files */
-    pks = sc->server->pks;
-    n = pks->cert_files->nelts;
-    ap_ssl_add_cert_files(s, p, pks->cert_files, pks->key_files);
-    ssl_run_add_cert_files(s, p, pks->cert_files, pks->key_files);
-
-    if (apr_is_empty_array(pks->cert_files)) {
-        /* does someone propose a certiciate to fall back on here? */
-        ap_ssl_add_fallback_cert_files(s, p, pks->cert_files, pks->key_files);
-        ssl_run_add_fallback_cert_files(s, p, pks->cert_files, pks->key_files);
-        if (n < pks->cert_files->nelts) {
-            pks->service_unavailable = 1;
-            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10085)
-                         "Init: %s will respond with '503 Service Unavailable' for now. There "
-                         "are no SSL certificates configured and no other module contributed any.",
-                         ssl_util_vhostid(p, s));
-        }
-    }
-    
-    if (n < pks->cert_files->nelts) {
-        /* additionally installed certs overrides any old chain configuration */
-        sc->server->cert_chain = NULL;
-    }
-    
-    if ((rv = ssl_init_ctx(s, p, ptemp, sc->server)) != APR_SUCCESS) {
+    if ((rv = ssl_init_ctx(s, p, ptemp, mctx)) != APR_SUCCESS) {
         return rv;
     }
 
-    if ((rv = ssl_init_server_certs(s, p, ptemp, sc->server, pphrases))
+    if ((rv = ssl_init_server_certs(s, p, ptemp, mctx, pphrases))
         != APR_SUCCESS) {
         return rv;
     }
 
 #ifdef HAVE_SSL_CONF_CMD
-    SSL_CONF_CTX_set_ssl_ctx(cctx, sc->server->ssl_ctx);
-    for (i = 0; i < sc->server->ssl_ctx_param->nelts; i++, param++) {
+    cctx = on_demand ? ssl_config_conf_ctx_create(ptemp)
+                     : mctx->ssl_ctx_config;
+    SSL_CONF_CTX_set_ssl_ctx(cctx, mctx->ssl_ctx);
+    for (i = 0; i < mctx->ssl_ctx_param->nelts; i++, param++) {
         ERR_clear_error();
         if (SSL_CONF_cmd(cctx, param->name, param->value) <= 0) {
-            ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02407)
+            ap_log_error(APLOG_MARK, loglevel, 0, s, APLOGNO(02407)
                          "\"SSLOpenSSLConfCmd %s %s\" failed for %s",
                          param->name, param->value, sc->vhost_id);
-            ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
-            return ssl_die(s);
+            ssl_log_ssl_error(SSLLOG_MARK, loglevel, s);
+            return on_demand ? APR_EGENERAL : ssl_die(s);
         } else {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02556)
                          "\"SSLOpenSSLConfCmd %s %s\" applied to %s",
@@ -2080,21 +2167,27 @@ static apr_status_t ssl_init_server_ctx(server_rec *s,
         }
     }
     if (SSL_CONF_CTX_finish(cctx) == 0) {
-            ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02547)
+            ap_log_error(APLOG_MARK, loglevel, 0, s, APLOGNO(02547)
                          "SSL_CONF_CTX_finish() failed");
-            SSL_CONF_CTX_free(cctx);
-            ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
-            return ssl_die(s);
+            ssl_log_ssl_error(SSLLOG_MARK, loglevel, s);
+            return on_demand ? APR_EGENERAL : ssl_die(s);
     }
 #endif
 
-    if (SSL_CTX_check_private_key(sc->server->ssl_ctx) != 1) {
-        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02572)
+    if (SSL_CTX_check_private_key(mctx->ssl_ctx) != 1) {
+        ap_log_error(APLOG_MARK, loglevel, 0, s, APLOGNO(02572)
                      "Failed to configure at least one certificate and key "
                      "for %s", sc->vhost_id);
-        ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
-        return ssl_die(s);
+        ssl_log_ssl_error(SSLLOG_MARK, loglevel, s);
+        return on_demand ? APR_EGENERAL : ssl_die(s);
+    }
+
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    if (sc->async_keyops == TRUE
+        && (rv = ssl_async_keyops_init_ctx(s, mctx)) != APR_SUCCESS) {
+        return rv;
     }
+#endif
 
 #if defined(HAVE_OCSP_STAPLING) && defined(SSL_CTRL_SET_CURRENT_CERT)
     /*
@@ -2102,40 +2195,115 @@ static apr_status_t ssl_init_server_ctx(server_rec *s,
      * by means of SSL_CTX_set_current_cert. Enabling stapling at this
      * (late) point makes sure that we catch both certificates loaded
      * via SSLCertificateFile and SSLOpenSSLConfCmd Certificate.
+     * Contexts created on demand do not staple.
      */
-    do {
+    if (!on_demand) {
         X509 *cert;
         int i = 0;
-        int ret = SSL_CTX_set_current_cert(sc->server->ssl_ctx,
+        int ret = SSL_CTX_set_current_cert(mctx->ssl_ctx,
                                            SSL_CERT_SET_FIRST);
         while (ret) {
-            cert = SSL_CTX_get0_certificate(sc->server->ssl_ctx);
-            if (!cert || !ssl_stapling_init_cert(s, p, ptemp, sc->server,
+            cert = SSL_CTX_get0_certificate(mctx->ssl_ctx);
+            if (!cert || !ssl_stapling_init_cert(s, p, ptemp, mctx,
                                                  cert)) {
                 ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(02604)
                              "Unable to configure certificate %s:%d "
                              "for stapling", sc->vhost_id, i);
             }
-            ret = SSL_CTX_set_current_cert(sc->server->ssl_ctx,
+            ret = SSL_CTX_set_current_cert(mctx->ssl_ctx,
                                            SSL_CERT_SET_NEXT);
             i++;
         }
-    } while(0);
+    }
 #endif
 
 #ifdef HAVE_TLS_SESSION_TICKETS
-    if ((rv = ssl_init_ticket_key(s, p, ptemp, sc->server)) != APR_SUCCESS) {
+    if ((rv = ssl_init_ticket_key(s, p, ptemp, mctx,
+                                  on_demand)) != APR_SUCCESS) {
         return rv;
     }
 #endif
 
-    SSL_CTX_set_timeout(sc->server->ssl_ctx,
+    SSL_CTX_set_timeout(mctx->ssl_ctx,
                         sc->session_cache_timeout == UNSET ?
                         SSL_SESSION_CACHE_TIMEOUT : sc->session_cache_timeout);
 
     return APR_SUCCESS;
 }
 
+static apr_status_t ssl_init_server_ctx(server_rec *s,
+                                        apr_pool_t *p,
+                                        apr_pool_t *ptemp,
+                                        SSLSrvConfigRec *sc,
+                                        apr_array_header_t *pphrases)
+{
+    modssl_pk_server_t *pks;
+#if defined(HAVE_SSL_CTX_ON_DEMAND) && defined(HAVE_TLS_SESSION_TICKETS)
+    modssl_ticket_key_t *ticket_key;
+#endif
+    int n;
+
+    /*
+     *  Check for problematic re-initializations
+     */
+    if (sc->server->ssl_ctx) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02569)
+                     "Illegal attempt to re-initialise SSL for server "
+                     "(SSLEngine On should go in the VirtualHost, not in global scope.)");
+        return APR_EGENERAL;
+    }
+
+    /* Allow others to provide certificate files */
+    pks = sc->server->pks;
+    n = pks->cert_files->nelts;
+    ap_ssl_add_cert_files(s, p, pks->cert_files, pks->key_files);
+    ssl_run_add_cert_files(s, p, pks->cert_files, pks->key_files);
+
+    if (apr_is_empty_array(pks->cert_files)) {
+        /* does someone propose a certiciate to fall back on here? */
+        ap_ssl_add_fallback_cert_files(s, p, pks->cert_files, pks->key_files);
+        ssl_run_add_fallback_cert_files(s, p, pks->cert_files, pks->key_files);
+        if (n < pks->cert_files->nelts) {
+            pks->service_unavailable = 1;
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10085)
+                         "Init: %s will respond with '503 Service Unavailable' for now. There "
+                         "are no SSL certificates configured and no other module contributed any.",
+                         ssl_util_vhostid(p, s));
+        }
+    }
+    
+    if (n < pks->cert_files->nelts) {
+        /* additionally installed certs overrides any old chain configuration */
+        sc->server->cert_chain = NULL;
+    }
+    
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+    if (sc->ctx_on_demand == TRUE) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10508)
+                     "Init: SSL context for %s will be created on demand",
+                     sc->vhost_id);
+#ifdef HAVE_OCSP_STAPLING
+        if (sc->server->stapling_enabled == TRUE) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10509)
+                         "Init: OCSP stapling is not available for %s, "
+                         "its SSL context is created on demand",
+                         sc->vhost_id);
+        }
+#endif
+#ifdef HAVE_TLS_SESSION_TICKETS
+        ticket_key = sc->server->ticket_key;
+        if (!ticket_key->keys && ticket_key->file_path) {
+            return ssl_load_ticket_key_file(s, ptemp, ticket_key,
+                        ap_server_root_relative(p, ticket_key->file_path));
+        }
+#endif
+        return APR_SUCCESS;
+    }
+#endif
+
+    return ssl_init_server_ctx_load(s, p, ptemp, sc, sc->server, pphrases);
+}
+
 /*
  * Configure a particular server
  */
@@ -2372,6 +2540,276 @@ STACK_OF(X509_NAME) *ssl_init_FindCAList(server_rec *s,
     return ca_list;
 }
 
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+/*
+ * SSL contexts of the servers with SSLContextOnDemand, created in each
+ * child on the first SNI match and kept in a LRU list of at most
+ * SSLContextCacheSize entries. The cache holds a reference on every
+ * SSL_CTX and the connections using one hold their own, so an evicted
+ * context stays valid until its last connection is done. The entry,
+ * allocated from its own pool, goes away with the SSL_CTX by means of
+ * the ex_data free callback. A context is built by the first handshake
+ * needing it, the concurrent ones for the same host wait for it.
+ */
+typedef struct ssl_ctx_entry ssl_ctx_entry;
+struct ssl_ctx_entry {
+    ssl_ctx_entry *prev, *next;  /* most recently used first */
+    apr_pool_t *pool;
+    SSLSrvConfigRec *sc;
+    modssl_ctx_t *mctx;          /* copy of sc->server, owning the SSL_CTX */
+};
+
+typedef struct {
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *built;    /* signaled when a build is done */
+    apr_hash_t *building;        /* SSLSrvConfigRecs being built */
+#endif
+    apr_hash_t *entries;         /* by SSLSrvConfigRec */
+    ssl_ctx_entry *first, *last;
+    int count;
+    int max;
+} ssl_ctx_cache_t;
+
+static ssl_ctx_cache_t *ctx_cache;
+static int ctx_cache_idx = -1;
+
+static void ssl_ctx_entry_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                               int idx, long argl, void *argp)
+{
+    ssl_ctx_entry *e = ptr;
+
+    if (e) {
+#ifdef HAVE_SRP
+        if (e->mctx->srp_vbase != NULL) {
+            SRP_VBASE_free(e->mctx->srp_vbase);
+        }
+#endif
+        apr_pool_destroy(e->pool);
+    }
+}
+
+/* like SSL_get_ex_new_index(), this has to be called at startup */
+static void ssl_init_ctx_cache_idx(void)
+{
+    if (ctx_cache_idx < 0) {
+        ctx_cache_idx = SSL_CTX_get_ex_new_index(0,
+                                                 "mod_ssl context on demand",
+                                                 NULL, NULL,
+                                                 ssl_ctx_entry_free);
+    }
+}
+
+static ssl_ctx_entry *ssl_ctx_entry_create(server_rec *s,
+                                           SSLSrvConfigRec *sc)
+{
+    ssl_ctx_entry *e;
+    apr_pool_t *pool, *ptemp;
+    apr_time_t start = apr_time_now();
+    apr_status_t rv;
+
+    /* unmanaged, since it is destroyed by whichever thread frees
+     * the last reference on the SSL_CTX */
+    rv = apr_pool_create_unmanaged_ex(&pool, NULL, NULL);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10510)
+                     "Unable to create pool for the SSL context of %s",
+                     sc->vhost_id);
+        return NULL;
+    }
+    apr_pool_tag(pool, "modssl_ctx_on_demand");
+    apr_pool_create(&ptemp, pool);
+
+    e = apr_pcalloc(pool, sizeof(*e));
+    e->pool = pool;
+    e->sc = sc;
+    e->mctx = apr_pmemdup(pool, sc->server, sizeof(*sc->server));
+    e->mctx->ssl_ctx = NULL;
+#ifdef HAVE_OCSP_STAPLING
+    e->mctx->stapling_enabled = FALSE;
+#endif
+#ifdef HAVE_SRP
+    e->mctx->srp_vbase = NULL;
+#endif
+
+    rv = ssl_init_server_ctx_load(s, pool, ptemp, sc, e->mctx, NULL);
+    if (rv == APR_SUCCESS) {
+        rv = ssl_run_init_server(s, pool, 0, e->mctx->ssl_ctx);
+    }
+    apr_pool_destroy(ptemp);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10511)
+                     "Unable to create the SSL context of %s on demand",
+                     sc->vhost_id);
+        ssl_init_ctx_cleanup(e->mctx);
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+    SSL_CTX_set_ex_data(e->mctx->ssl_ctx, ctx_cache_idx, e);
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10512)
+                 "SSL context of %s created on demand in %" APR_TIME_T_FMT
+                 "ms", sc->vhost_id, apr_time_as_msec(apr_time_now() - start));
+    return e;
+}
+
+static void ssl_ctx_cache_unlink(ssl_ctx_cache_t *cache, ssl_ctx_entry *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    }
+    else {
+        cache->first = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    else {
+        cache->last = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void ssl_ctx_cache_push(ssl_ctx_cache_t *cache, ssl_ctx_entry *e)
+{
+    e->prev = NULL;
+    e->next = cache->first;
+    if (cache->first) {
+        cache->first->prev = e;
+    }
+    else {
+        cache->last = e;
+    }
+    cache->first = e;
+}
+
+static void ssl_ctx_cache_evict(ssl_ctx_cache_t *cache, ssl_ctx_entry *e)
+{
+    ssl_ctx_cache_unlink(cache, e);
+    apr_hash_set(cache->entries, &e->sc, sizeof(e->sc), NULL);
+    cache->count--;
+    /* e is gone when no connection uses the context any more */
+    SSL_CTX_free(e->mctx->ssl_ctx);
+}
+
+static apr_status_t ssl_ctx_cache_cleanup(void *data)
+{
+    ssl_ctx_cache_t *cache = data;
+
+    while (cache->first) {
+        ssl_ctx_cache_evict(cache, cache->first);
+    }
+    ctx_cache = NULL;
+    return APR_SUCCESS;
+}
+
+static void ssl_init_ctx_cache(apr_pool_t *p, server_rec *base_server)
+{
+    SSLModConfigRec *mc = myModConfig(base_server);
+    ssl_ctx_cache_t *cache;
+    server_rec *s;
+
+    for (s = base_server; s; s = s->next) {
+        if (mySrvConfig(s)->ctx_on_demand == TRUE) {
+            break;
+        }
+    }
+    if (!s) {
+        return;
+    }
+
+    cache = apr_pcalloc(p, sizeof(*cache));
+    cache->entries = apr_hash_make(p);
+    cache->max = mc->ctx_cache_size;
+#if APR_HAS_THREADS
+    cache->building = apr_hash_make(p);
+    if (apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                p) != APR_SUCCESS
+        || apr_thread_cond_create(&cache->built, p) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10513)
+                     "Unable to create the mutex of the SSL context cache, "
+                     "no SSL contexts will be created on demand");
+        return;
+    }
+#endif
+    apr_pool_cleanup_register(p, cache, ssl_ctx_cache_cleanup,
+                              apr_pool_cleanup_null);
+    ctx_cache = cache;
+}
+
+SSL_CTX *ssl_init_ctx_on_demand(server_rec *s, SSLSrvConfigRec *sc)
+{
+    ssl_ctx_cache_t *cache = ctx_cache;
+    ssl_ctx_entry *e;
+    SSL_CTX *ctx;
+
+    if (!cache) {
+        return NULL;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+    /* Wait for the context being built by another thread, if any */
+    while (!(e = apr_hash_get(cache->entries, &sc, sizeof(sc)))
+           && apr_hash_get(cache->building, &sc, sizeof(sc))) {
+        apr_thread_cond_wait(cache->built, cache->mutex);
+    }
+#else
+    e = apr_hash_get(cache->entries, &sc, sizeof(sc));
+#endif
+    if (e) {
+        ssl_ctx_cache_unlink(cache, e);
+        ssl_ctx_cache_push(cache, e);
+        ctx = e->mctx->ssl_ctx;
+        SSL_CTX_up_ref(ctx);
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(cache->mutex);
+#endif
+        return ctx;
+    }
+#if APR_HAS_THREADS
+    /* Loading the certificates and keys takes a while, don't hold up
+     * the handshakes of the other hosts meanwhile, while those of this
+     * host wait for the build in flight. The key of the mark (sc) lives
+     * until it's removed below.
+     */
+    apr_hash_set(cache->building, &sc, sizeof(sc), sc);
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+
+    e = ssl_ctx_entry_create(s, sc);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+    apr_hash_set(cache->building, &sc, sizeof(sc), NULL);
+    apr_thread_cond_broadcast(cache->built);
+#endif
+    if (!e) {
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(cache->mutex);
+#endif
+        return NULL;
+    }
+    apr_hash_set(cache->entries, &e->sc, sizeof(e->sc), e);
+    cache->count++;
+    ssl_ctx_cache_push(cache, e);
+    ctx = e->mctx->ssl_ctx;
+    SSL_CTX_up_ref(ctx);
+
+    while (cache->count > cache->max) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10514)
+                     "Evicting the SSL context of %s from the cache",
+                     cache->last->sc->vhost_id);
+        ssl_ctx_cache_evict(cache, cache->last);
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+
+    return ctx;
+}
+#endif /* HAVE_SSL_CTX_ON_DEMAND */
+
 void ssl_init_Child(apr_pool_t *p, server_rec *s)
 {
 #ifdef MODSSL_USE_SSLRAND
@@ -2387,6 +2825,12 @@ void ssl_init_Child(apr_pool_t *p, server_rec *s)
 #ifdef HAVE_OCSP_STAPLING
     ssl_stapling_mutex_reinit(s, p);
 #endif
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+    ssl_init_ctx_cache(p, s);
+#endif
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    ssl_async_keyops_init_child(p, s);
+#endif
 }
 
 apr_status_t ssl_init_ModuleKill(void *data)
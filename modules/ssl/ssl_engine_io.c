@@ -108,6 +108,12 @@ typedef struct {
     ap_filter_t        *pInputFilter;
     ap_filter_t        *pOutputFilter;
     SSLConnRec         *config;
+    int                 record_init;     /* record sizing configured */
+    apr_size_t          record_size;     /* max plaintext per record, 0 for no limit */
+    apr_off_t           record_warmup;   /* bytes to send before going full size */
+    apr_interval_time_t record_cooldown; /* idle time before starting small again */
+    apr_off_t           record_bytes;    /* bytes sent since (re)starting small */
+    apr_time_t          record_last;     /* last time data was written */
 } ssl_filter_ctx_t;
 
 typedef struct {
@@ -626,6 +632,27 @@ void free_bio_methods(void)
 }
 #endif
 
+#ifdef HAVE_TLS_EARLY_DATA
+/* Read the early data of the client like SSL_read(), then continue
+ * with SSL_read() which completes the handshake. */
+static int ssl_read_early_data(ssl_filter_ctx_t *filter_ctx,
+                               char *buf, int len)
+{
+    size_t readbytes;
+
+    switch (SSL_read_early_data(filter_ctx->pssl, buf, len, &readbytes)) {
+    case SSL_READ_EARLY_DATA_SUCCESS:
+        return (int)readbytes;
+    case SSL_READ_EARLY_DATA_FINISH:
+        filter_ctx->config->early_data = MODSSL_EARLY_DATA_NONE;
+        filter_ctx->config->early_data_end = apr_time_now();
+        return SSL_read(filter_ctx->pssl, buf, len);
+    default:
+        return -1;
+    }
+}
+#endif
+
 static apr_status_t ssl_io_input_read(bio_filter_in_ctx_t *inctx,
                                       char *buf,
                                       apr_size_t *len)
@@ -680,6 +707,14 @@ static apr_status_t ssl_io_input_read(bio_filter_in_ctx_t *inctx,
          * from the stack.  This is where we want to consider all of
          * the blocking and SPECULATIVE semantics
          */
+#ifdef HAVE_TLS_EARLY_DATA
+        if (inctx->filter_ctx->config->early_data
+            == MODSSL_EARLY_DATA_READING) {
+            rc = ssl_read_early_data(inctx->filter_ctx, buf + bytes,
+                                     wanted - bytes);
+        }
+        else
+#endif
         rc = SSL_read(inctx->filter_ctx->pssl, buf + bytes, wanted - bytes);
 
         if (rc > 0) {
@@ -869,6 +904,16 @@ static apr_status_t ssl_filter_write(ap_filter_t *f,
     ERR_clear_error();
 
     outctx = (bio_filter_out_ctx_t *)BIO_get_data(filter_ctx->pbioWrite);
+#ifdef HAVE_TLS_EARLY_DATA
+    if (filter_ctx->config->early_data == MODSSL_EARLY_DATA_READING) {
+        /* Answer ahead of the client's Finished, as 0.5-RTT data */
+        size_t written;
+
+        res = SSL_write_early_data(filter_ctx->pssl, data, len, &written) ?
+              (int)written : -1;
+    }
+    else
+#endif
     res = SSL_write(filter_ctx->pssl, (unsigned char *)data, len);
 
     if (res < 0) {
@@ -1161,6 +1206,37 @@ static apr_status_t ssl_io_filter_cleanup(void *data)
  * ap_hook_process_connection hook.
  */
 
+/* Run SSL_accept(), or start by reading the early data of the client
+ * if some server accepts it. Accepted early data is kept for the input
+ * filter and the handshake completes while reading on. */
+static int ssl_io_accept(ssl_filter_ctx_t *filter_ctx)
+{
+#ifdef HAVE_TLS_EARLY_DATA
+    SSLConnRec *sslconn = filter_ctx->config;
+
+    if (sslconn->early_data == MODSSL_EARLY_DATA_ACCEPTING) {
+        bio_filter_in_ctx_t *inctx = (bio_filter_in_ctx_t *)
+                                     BIO_get_data(filter_ctx->pbioRead);
+        size_t readbytes;
+
+        switch (SSL_read_early_data(filter_ctx->pssl, inctx->buffer,
+                                    sizeof(inctx->buffer), &readbytes)) {
+        case SSL_READ_EARLY_DATA_SUCCESS:
+            sslconn->early_data = MODSSL_EARLY_DATA_READING;
+            char_buffer_write(inctx, inctx->buffer, (int)readbytes);
+            return 1;
+        case SSL_READ_EARLY_DATA_FINISH:
+            /* None sent or rejected */
+            sslconn->early_data = MODSSL_EARLY_DATA_NONE;
+            break;
+        default:
+            return -1;
+        }
+    }
+#endif
+    return SSL_accept(filter_ctx->pssl);
+}
+
 /* Perform the SSL handshake (whether in client or server mode), if
  * necessary, for the given connection. */
 static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
@@ -1174,7 +1250,11 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
     long verify_result;
     server_rec *server;
 
-    if (SSL_is_init_finished(filter_ctx->pssl)) {
+    if (SSL_is_init_finished(filter_ctx->pssl)
+#ifdef HAVE_TLS_EARLY_DATA
+        || sslconn->early_data == MODSSL_EARLY_DATA_READING
+#endif
+        ) {
         return APR_SUCCESS;
     }
 
@@ -1405,7 +1485,25 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
      */
     ERR_clear_error();
 
-    if ((n = SSL_accept(filter_ctx->pssl)) <= 0) {
+    n = ssl_io_accept(filter_ctx);
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    while (n <= 0
+           && SSL_get_error(filter_ctx->pssl, n) == SSL_ERROR_WANT_ASYNC) {
+        /* A private key operation is in the crypto thread pool, let
+         * the connection be parked meanwhile if possible, otherwise
+         * wait for it here. */
+        if (sslconn->async_park) {
+            sslconn->async_parked = 1;
+            return APR_EAGAIN;
+        }
+        if (ssl_async_keyops_wait(c, filter_ctx->pssl) != APR_SUCCESS) {
+            break;
+        }
+        ERR_clear_error();
+        n = ssl_io_accept(filter_ctx);
+    }
+#endif
+    if (n <= 0) {
         bio_filter_in_ctx_t *inctx = (bio_filter_in_ctx_t *)
                                      BIO_get_data(filter_ctx->pbioRead);
         bio_filter_out_ctx_t *outctx = (bio_filter_out_ctx_t *)
@@ -1464,6 +1562,10 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
         ssl_filter_io_shutdown(filter_ctx, c, 1);
         return inctx->rc;
     }
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    /* Reads and writes are not prepared to be paused */
+    SSL_clear_mode(filter_ctx->pssl, SSL_MODE_ASYNC);
+#endif
     sc = mySrvConfig(sslconn->server);
 
     /*
@@ -1904,6 +2006,76 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     return ap_pass_brigade(f->next, bb);
 }
 
+/*
+ * Dynamic TLS record sizing: at the start of a connection and after it
+ * has been idle for a while, data is written in records small enough to
+ * fit a single TCP segment, so the client can decrypt and process the
+ * first bytes without waiting for a complete 16KB record (which, on a
+ * lossy network, may need several round trips). Once the configured
+ * amount has been sent, records go back to the size OpenSSL chooses.
+ */
+static void ssl_io_record_sizing(ssl_filter_ctx_t *filter_ctx, conn_rec *c)
+{
+    apr_time_t now;
+
+    if (!filter_ctx->record_init) {
+        filter_ctx->record_init = 1;
+        if (!c->outgoing) {
+            SSLSrvConfigRec *sc = mySrvConfigFromConn(c);
+
+            filter_ctx->record_warmup = (sc->record_warmup_size == UNSET)?
+                SSL_RECORD_WARMUP_SIZE : sc->record_warmup_size;
+            filter_ctx->record_cooldown = apr_time_from_sec(
+                (sc->record_cooldown_secs == UNSET)?
+                SSL_RECORD_COOLDOWN_SECS : sc->record_cooldown_secs);
+        }
+        if (filter_ctx->record_warmup > 0) {
+            filter_ctx->record_size = SSL_RECORD_SIZE_INITIAL;
+        }
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, c,
+                      "ssl record sizing: warmup=%" APR_OFF_T_FMT
+                      ", cooldown=%" APR_TIME_T_FMT "ms",
+                      filter_ctx->record_warmup,
+                      apr_time_as_msec(filter_ctx->record_cooldown));
+    }
+    if (filter_ctx->record_warmup <= 0) {
+        return;
+    }
+
+    now = apr_time_now();
+    if (filter_ctx->record_size == 0
+        && filter_ctx->record_cooldown > 0
+        && (now - filter_ctx->record_last) >= filter_ctx->record_cooldown) {
+        /* long time not written, congestion window is likely reset */
+        filter_ctx->record_size = SSL_RECORD_SIZE_INITIAL;
+        filter_ctx->record_bytes = 0;
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, c,
+                      "ssl record sizing: idle, back to small records");
+    }
+}
+
+static void ssl_io_record_written(ssl_filter_ctx_t *filter_ctx, conn_rec *c,
+                                  apr_size_t len)
+{
+    /* Only application data written counts as activity, not the
+     * flushes or metadata passed while the connection is idle.
+     */
+    if (filter_ctx->record_warmup > 0 && filter_ctx->record_cooldown > 0
+        && len > 0) {
+        filter_ctx->record_last = apr_time_now();
+    }
+    if (filter_ctx->record_size) {
+        filter_ctx->record_bytes += len;
+        if (filter_ctx->record_bytes >= filter_ctx->record_warmup) {
+            /* connection is hot, use max size */
+            filter_ctx->record_size = 0;
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, c,
+                          "ssl record sizing: warmed up after %"
+                          APR_OFF_T_FMT " bytes", filter_ctx->record_bytes);
+        }
+    }
+}
+
 static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                                          apr_bucket_brigade *bb)
 {
@@ -1941,6 +2113,8 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
         return ssl_io_filter_error(inctx, bb, status, 0);
     }
 
+    ssl_io_record_sizing(filter_ctx, f->c);
+
     while (!APR_BRIGADE_EMPTY(bb) && status == APR_SUCCESS) {
         apr_bucket *bucket = APR_BRIGADE_FIRST(bb);
 
@@ -1996,8 +2170,18 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                 break;
             }
 
+            if (filter_ctx->record_size && len > filter_ctx->record_size) {
+                /* write one small record, the rest of the bucket
+                 * follows in the next iteration */
+                apr_bucket_split(bucket, filter_ctx->record_size);
+                len = filter_ctx->record_size;
+            }
+
             status = ssl_filter_write(f, data, len);
             apr_bucket_delete(bucket);
+            if (status == APR_SUCCESS) {
+                ssl_io_record_written(filter_ctx, f->c, len);
+            }
         }
 
     }
@@ -2254,6 +2438,12 @@ apr_status_t ssl_io_filter_init(conn_rec *c, request_rec *r, SSL *ssl)
     filter_ctx = apr_palloc(c->pool, sizeof(ssl_filter_ctx_t));
 
     filter_ctx->config          = myConnConfig(c);
+    filter_ctx->record_init     = 0;
+    filter_ctx->record_size     = 0;
+    filter_ctx->record_warmup   = 0;
+    filter_ctx->record_cooldown = 0;
+    filter_ctx->record_bytes    = 0;
+    filter_ctx->record_last     = 0;
 
     ap_add_output_filter(ssl_io_coalesce, NULL, r, c);
 
@@ -407,6 +407,24 @@ int ssl_hook_ReadReq(request_rec *r)
 #endif
     modssl_set_app_data2(ssl, r);
 
+#ifdef HAVE_TLS_EARLY_DATA
+    /*
+     * A request received in early data, even partly, may be a replay
+     * (RFC 8470). Only safe methods are served from early data, others
+     * are answered with a 425 for the client to retry them. Handlers
+     * and proxied backends see the Early-Data header.
+     */
+    if (ap_is_initial_req(r) && MODSSL_REQUEST_IN_EARLY_DATA(sslconn, r)) {
+        apr_table_setn(r->headers_in, "Early-Data", "1");
+        if (r->method_number != M_GET && r->method_number != M_OPTIONS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10521)
+                          "%s request received in TLS early data, "
+                          "asking the client to retry", r->method);
+            return HTTP_TOO_EARLY;
+        }
+    }
+#endif
+
     /*
      * Log information about incoming HTTPS requests
      */
@@ -1240,7 +1258,12 @@ int ssl_hook_Access(request_rec *r)
      * The access is still forbidden in the latter case, let ap_die() handle
      * this recursive (same) error.
      */
-    if (ssl && !SSL_is_init_finished(ssl)) {
+    if (ssl && !SSL_is_init_finished(ssl)
+#ifdef HAVE_TLS_EARLY_DATA
+        /* requests in early data are served ahead of the handshake */
+        && SSL_get_early_data_status(ssl) != SSL_EARLY_DATA_ACCEPTED
+#endif
+        ) {
         return HTTP_FORBIDDEN;
     }
 
@@ -2215,6 +2238,55 @@ void ssl_callback_DelSessionCacheEntry(SSL_CTX *ctx,
     return;
 }
 
+#ifdef HAVE_TLS_EARLY_DATA
+/*
+ *  This callback function is executed by OpenSSL when a client sends
+ *  early data on a resumed TLS 1.3 session. Each session ticket may
+ *  carry early data only once: the resumption secret, unique to the
+ *  ticket, is recorded in the inter-process cache and early data with
+ *  a ticket seen before is rejected. The client sends it again once
+ *  the handshake is complete.
+ */
+int ssl_callback_AllowEarlyData(SSL *ssl, void *arg)
+{
+    /* Get Apache context back through OpenSSL context */
+    conn_rec *conn = (conn_rec *)SSL_get_app_data(ssl);
+    server_rec *s  = mySrvFromConn(conn);
+    SSL_SESSION *session = SSL_get_session(ssl);
+    unsigned char secret[SSL_MAX_MASTER_KEY_LENGTH];
+    /* a prefix keeps these apart from the session ids in the cache */
+    unsigned char id[6 + EVP_MAX_MD_SIZE] = "0-RTT:";
+    unsigned int idlen;
+    size_t len;
+    BOOL ok;
+
+    if (mySrvConfig(s)->early_data != TRUE || !session
+        || !(len = SSL_SESSION_get_master_key(session, secret,
+                                              sizeof(secret)))) {
+        return 0;
+    }
+
+    ok = EVP_Digest(secret, len, id + 6, &idlen, EVP_sha256(), NULL);
+    OPENSSL_cleanse(secret, sizeof(secret));
+    if (!ok) {
+        return 0;
+    }
+
+    if (!ssl_scache_store_once(s, id, 6 + idlen,
+                               apr_time_from_sec(SSL_SESSION_get_time(session)
+                                   + SSL_SESSION_get_timeout(session)),
+                               conn->pool)) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, conn, APLOGNO(10522)
+                      "Rejecting early data, the session ticket was "
+                      "used before (server %s)",
+                      ssl_util_vhostid(conn->pool, s));
+        return 0;
+    }
+
+    return 1;
+}
+#endif
+
 /* Dump debugginfo trace to the log file. */
 static void log_tracing_state(const SSL *ssl, conn_rec *c,
                               server_rec *s, int where, int rc)
@@ -2400,6 +2472,11 @@ static apr_status_t init_vhost(conn_rec *c, SSL *ssl, const char *servername)
     if (c) {
         SSLConnRec *sslcon = myConnConfig(c);
 
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+        if (sslcon->ctx_failed) {
+            return APR_EGENERAL;
+        }
+#endif
         if (sslcon->vhost_found) {
             /* already found the vhost? */
             return sslcon->vhost_found > 0 ? APR_SUCCESS : APR_NOTFOUND;
@@ -2412,6 +2489,11 @@ static apr_status_t init_vhost(conn_rec *c, SSL *ssl, const char *servername)
         if (servername) {
             if (ap_vhost_iterate_given_conn(c, ssl_find_vhost,
                                             (void *)servername)) {
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+                if (sslcon->ctx_failed) {
+                    return APR_EGENERAL;
+                }
+#endif
                 ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(02043)
                               "SSL virtual host for servername %s found",
                               servername);
@@ -2460,6 +2542,10 @@ int ssl_callback_ServerNameIndication(SSL *ssl, int *al, modssl_ctx_t *mctx)
     conn_rec *c = (conn_rec *)SSL_get_app_data(ssl);
     apr_status_t status = init_vhost(c, ssl, NULL);
     
+    if (status == APR_EGENERAL) {
+        *al = SSL_AD_INTERNAL_ERROR;
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
     return (status == APR_SUCCESS)? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
 }
 
@@ -2518,7 +2604,10 @@ int ssl_callback_ClientHello(SSL *ssl, int *al, void *arg)
     servername = apr_pstrmemdup(c->pool, (const char *)pos, len);
 
 give_up:
-    init_vhost(c, ssl, servername);
+    if (init_vhost(c, ssl, servername) == APR_EGENERAL) {
+        *al = SSL_AD_INTERNAL_ERROR;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
     return SSL_CLIENT_HELLO_SUCCESS;
 }
 #endif /* OPENSSL_VERSION_NUMBER < 0x10101000L */
@@ -2541,7 +2630,33 @@ static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s)
     sslcon = myConnConfig(c);
     if (found && (ssl = sslcon->ssl) &&
         (sc = mySrvConfig(s))) {
-        SSL_CTX *ctx = SSL_set_SSL_CTX(ssl, sc->server->ssl_ctx);
+        SSL_CTX *ctx = sc->server->ssl_ctx;
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+        SSL_CTX *od_ctx = NULL;
+
+        if (sc->ctx_on_demand == TRUE
+            && !(ctx = od_ctx = ssl_init_ctx_on_demand(s, sc))) {
+            /* don't fall back to the default certificate, the client
+             * asked for this host */
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(10537)
+                          "No SSL context for servername %s, failing "
+                          "the handshake", (const char *)servername);
+            sslcon->ctx_failed = 1;
+            return 1;
+        }
+#endif
+        ctx = SSL_set_SSL_CTX(ssl, ctx);
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+        /* the SSL holds its own reference */
+        SSL_CTX_free(od_ctx);
+#endif
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+        /* Never cleared here, a paused handshake must resume in its
+         * ASYNC job */
+        if (sc->async_keyops == TRUE && !c->outgoing) {
+            SSL_set_mode(ssl, SSL_MODE_ASYNC);
+        }
+#endif
 
         /*
          * SSL_set_SSL_CTX() only deals with the server cert,
@@ -2560,6 +2675,11 @@ static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s)
             SSL_set_min_proto_version(ssl, SSL_CTX_get_min_proto_version(ctx));
             SSL_set_max_proto_version(ssl, SSL_CTX_get_max_proto_version(ctx));
         }
+#endif
+#ifdef HAVE_TLS_EARLY_DATA
+        SSL_set_max_early_data(ssl, SSL_CTX_get_max_early_data(ctx));
+        SSL_set_recv_max_early_data(ssl,
+                                    SSL_CTX_get_recv_max_early_data(ctx));
 #endif
         if ((SSL_get_verify_mode(ssl) == SSL_VERIFY_NONE) ||
             (SSL_num_renegotiations(ssl) == 0)) {
@@ -2640,6 +2760,8 @@ int ssl_callback_SessionTicket(SSL *ssl,
     SSLSrvConfigRec *sc = mySrvConfig(s);
     modssl_ctx_t *mctx = myConnCtxConfig(c, sc);
     modssl_ticket_key_t *ticket_key = mctx->ticket_key;
+    modssl_ticket_key_t ring_key;
+    int found = 1;
 
     if (mode == 1) {
         /* 
@@ -2651,9 +2773,17 @@ int ssl_callback_SessionTicket(SSL *ssl,
             /* should never happen, but better safe than sorry */
             return -1;
         }
+        if (ticket_key->keys) {
+            /* encrypt with the current key of the ring */
+            if (!ssl_ticket_keys_get(ticket_key->keys, NULL, &ring_key)) {
+                return -1;
+            }
+            ticket_key = &ring_key;
+        }
 
         memcpy(keyname, ticket_key->key_name, 16);
         if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
+            OPENSSL_cleanse(&ring_key, sizeof(ring_key));
             return -1;
         }
         EVP_EncryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
@@ -2665,6 +2795,7 @@ int ssl_callback_SessionTicket(SSL *ssl,
 #else
         EVP_MAC_CTX_set_params(mac_ctx, ticket_key->mac_params);
 #endif
+        OPENSSL_cleanse(&ring_key, sizeof(ring_key));
 
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(02289)
                       "TLS session ticket key for %s successfully set, "
@@ -2679,7 +2810,17 @@ int ssl_callback_SessionTicket(SSL *ssl,
          */
 
         /* check key name */
-        if (ticket_key == NULL || memcmp(keyname, ticket_key->key_name, 16)) {
+        if (ticket_key && ticket_key->keys) {
+            /* any key of the ring decrypts, tickets of the previous
+             * keys are renewed with the current one */
+            if (!(found = ssl_ticket_keys_get(ticket_key->keys, keyname,
+                                              &ring_key))) {
+                return 0;
+            }
+            ticket_key = &ring_key;
+        }
+        else if (ticket_key == NULL
+                 || memcmp(keyname, ticket_key->key_name, 16)) {
             return 0;
         }
 
@@ -2692,12 +2833,14 @@ int ssl_callback_SessionTicket(SSL *ssl,
 #else
         EVP_MAC_CTX_set_params(mac_ctx, ticket_key->mac_params);
 #endif
+        OPENSSL_cleanse(&ring_key, sizeof(ring_key));
 
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(02290)
                       "TLS session ticket key for %s successfully set, "
-                      "decrypting existing session ticket", sc->vhost_id);
+                      "decrypting existing session ticket%s", sc->vhost_id,
+                      (found == 2)? " of a previous key" : "");
 
-        return 1;
+        return found;
     }
 
     /* OpenSSL is not expected to call us with modes other than 1 or 0 */
@@ -2764,7 +2907,9 @@ int ssl_callback_alpn_select(SSL *ssl,
      * they callback the SNI. We need to make sure that we know which vhost
      * we are dealing with so we respect the correct protocols.
      */
-    init_vhost(c, ssl, NULL);
+    if (init_vhost(c, ssl, NULL) == APR_EGENERAL) {
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
     
     proposed = ap_select_protocol(c, NULL, sslconn->server, client_protos);
     if (!proposed) {
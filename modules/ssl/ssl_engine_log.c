@@ -65,6 +65,11 @@ static const char *ssl_log_annotation(const char *error)
 
 apr_status_t ssl_die(server_rec *s)
 {
+    /* Contexts created on demand in a child fail on their own,
+     * the server keeps running. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_RUN_MPM)
+        return APR_EGENERAL;
+
     if (s != NULL && s->is_virtual && s->error_fname != NULL)
         ap_log_error(APLOG_MARK, APLOG_EMERG, 0, NULL, APLOGNO(02311)
                      "Fatal error initialising mod_ssl, exiting. "
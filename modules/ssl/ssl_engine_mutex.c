@@ -37,9 +37,14 @@ int ssl_mutex_init(server_rec *s, apr_pool_t *p)
 
     /* A mutex is only needed if a session cache is configured, and
      * the provider used is not internally multi-process/thread
-     * safe. */
+     * safe, or replays of early data are checked in it (which is
+     * a retrieve then store). */
     if (!mc->sesscache
-        || (mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) == 0) {
+        || ((mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) == 0
+#ifdef HAVE_TLS_EARLY_DATA
+            && !mc->early_data
+#endif
+            )) {
         return TRUE;
     }
 
@@ -62,8 +67,7 @@ int ssl_mutex_reinit(server_rec *s, apr_pool_t *p)
     apr_status_t rv;
     const char *lockfile;
 
-    if (mc->pMutex == NULL || !mc->sesscache
-        || (mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) == 0) {
+    if (mc->pMutex == NULL || !mc->sesscache) {
         return TRUE;
     }
 
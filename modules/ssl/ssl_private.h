@@ -245,6 +245,11 @@
 #define HAVE_TLS_ALPN
 #endif
 
+/* SSL contexts created on demand, on the first SNI match */
+#if !MODSSL_USE_OPENSSL_PRE_1_1_API
+#define HAVE_SSL_CTX_ON_DEMAND
+#endif
+
 #endif /* !defined(OPENSSL_NO_TLSEXT) && defined(SSL_set_tlsext_host_name) */
 
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
@@ -294,6 +299,19 @@ void free_bio_methods(void);
 #define HAVE_OPENSSL_KEYLOG
 #endif
 
+/* Private key operations of handshakes offloaded to a thread pool,
+ * pausing the handshakes with SSL_MODE_ASYNC */
+#if !MODSSL_USE_OPENSSL_PRE_1_1_API && !defined(LIBRESSL_VERSION_NUMBER) \
+    && !defined(OPENSSL_NO_ASYNC) && APR_HAS_THREADS && !defined(WIN32)
+#define HAVE_SSL_ASYNC_KEYOPS
+#include <openssl/async.h>
+#endif
+
+/* TLS 1.3 early data (0-RTT) */
+#if defined(SSL_READ_EARLY_DATA_SUCCESS) && !defined(LIBRESSL_VERSION_NUMBER)
+#define HAVE_TLS_EARLY_DATA
+#endif
+
 #ifdef HAVE_FIPS
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
 #define modssl_fips_is_enabled() EVP_default_properties_is_fips_enabled(NULL)
@@ -368,6 +386,50 @@ APLOG_USE_MODULE(ssl);
 #define SSL_SESSION_CACHE_TIMEOUT  300
 #endif
 
+/* Plaintext written per TLS record while a connection warms up.
+ * Assuming MTU 1500: 1500 - 40 (IP) - 20 (TCP) - 40 (TCP options)
+ * - TLS record overhead (up to ~100 with CBC ciphers) ~= 1300,
+ * so each record fits in a single TCP segment. */
+#ifndef SSL_RECORD_SIZE_INITIAL
+#define SSL_RECORD_SIZE_INITIAL    1300
+#endif
+
+/* Default amount of data sent in small records before going to
+ * full size records, and idle seconds before starting over. */
+#ifndef SSL_RECORD_WARMUP_SIZE
+#define SSL_RECORD_WARMUP_SIZE     (1024 * 1024)
+#endif
+#ifndef SSL_RECORD_COOLDOWN_SECS
+#define SSL_RECORD_COOLDOWN_SECS   1
+#endif
+
+/* Default number of SSL contexts created on demand that a child
+ * keeps around. */
+#ifndef SSL_CTX_CACHE_SIZE
+#define SSL_CTX_CACHE_SIZE         1000
+#endif
+
+/* Default number of threads per child doing private key operations
+ * for SSLAsyncKeyOps. */
+#ifndef SSL_ASYNC_KEYOPS_THREADS
+#define SSL_ASYNC_KEYOPS_THREADS   4
+#endif
+
+/* Default max. amount of early data a client may send on resumption
+ * for SSLEarlyData. */
+#ifndef SSL_EARLY_DATA_MAX_SIZE
+#define SSL_EARLY_DATA_MAX_SIZE    16384
+#endif
+
+/* Max. number of keys taken from a SSLSessionTicketKeyDir, and the
+ * default seconds between two scans of the directory. */
+#ifndef SSL_TICKET_KEYS_MAX
+#define SSL_TICKET_KEYS_MAX        8
+#endif
+#ifndef SSL_TICKET_KEYS_REFRESH
+#define SSL_TICKET_KEYS_REFRESH    60
+#endif
+
 /* Default setting for per-dir reneg buffer. */
 #ifndef DEFAULT_RENEG_BUFFER_SIZE
 #define DEFAULT_RENEG_BUFFER_SIZE (128 * 1024)
@@ -553,6 +615,25 @@ typedef enum {
                      * connection */
 } modssl_reneg_state;
 
+#ifdef HAVE_TLS_EARLY_DATA
+typedef enum {
+    MODSSL_EARLY_DATA_NONE = 0,  /* Not (or no longer) reading early data */
+    MODSSL_EARLY_DATA_ACCEPTING, /* Handshake starts by reading early data */
+    MODSSL_EARLY_DATA_READING    /* Early data of the client was accepted,
+                                  * the handshake awaits its completion */
+} modssl_early_data_state;
+
+/* Whether the request may be a replay: some of it may have come in the
+ * early data of the client, since it was started (HTTP/1) or received
+ * (HTTP/2) before the early data ended. The state of the handshake does
+ * not tell, a request read from early data can well be processed after
+ * the handshake completed. */
+#define MODSSL_REQUEST_IN_EARLY_DATA(sslconn, r) \
+    (SSL_get_early_data_status((sslconn)->ssl) == SSL_EARLY_DATA_ACCEPTED \
+     && (!(sslconn)->early_data_end \
+         || (r)->request_time <= (sslconn)->early_data_end))
+#endif
+
 /**
  * Define the mod_ssl per-module configuration structure
  * (i.e. the global configuration for each httpd process)
@@ -598,6 +679,17 @@ typedef struct {
     const char *cipher_suite; /* cipher suite used in last reneg */
     int service_unavailable;  /* thouugh we negotiate SSL, no requests will be served */
     int vhost_found;          /* whether we found vhost from SNI already */
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+    int ctx_failed;           /* the SSL context of the vhost is unavailable */
+#endif
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    int async_park;           /* handshake may return to park the connection */
+    int async_parked;         /* handshake waits for a private key operation */
+#endif
+#ifdef HAVE_TLS_EARLY_DATA
+    modssl_early_data_state early_data;
+    apr_time_t early_data_end;  /* when all early data was read */
+#endif
 } SSLConnRec;
 
 /* Private keys are retained across reloads, since decryption
@@ -671,6 +763,22 @@ typedef struct {
 #ifdef HAVE_FIPS
     BOOL             fips;
 #endif
+
+    /* Max. number of SSL contexts created on demand, per child */
+    int              ctx_cache_size;
+
+    /* Max. number of threads doing private key operations, per child */
+    int              async_keyops_threads;
+
+#ifdef HAVE_TLS_EARLY_DATA
+    /* Whether some server accepts early data */
+    BOOL             early_data;
+#endif
+
+#ifdef HAVE_TLS_SESSION_TICKETS
+    /* Seconds between two scans of the SSLSessionTicketKeyDirs */
+    int              ticket_keys_refresh;
+#endif
 } SSLModConfigRec;
 
 /** Structure representing configured filenames for certs and keys for
@@ -722,12 +830,16 @@ typedef struct {
 } modssl_auth_ctx_t;
 
 #ifdef HAVE_TLS_SESSION_TICKETS
+/** Ring of the session ticket keys in a SSLSessionTicketKeyDir */
+typedef struct modssl_ticket_keys_t modssl_ticket_keys_t;
+
 typedef struct {
     const char *file_path;
+    const char *dir_path;
+    modssl_ticket_keys_t *keys;
     unsigned char key_name[16];
-#if OPENSSL_VERSION_NUMBER < 0x30000000L
     unsigned char hmac_secret[16];
-#else
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
     OSSL_PARAM mac_params[3];
 #endif
     unsigned char aes_key[16];
@@ -830,7 +942,12 @@ struct SSLSrvConfigRec {
     BOOL             compression;
 #endif
     BOOL             session_tickets;
-    
+    apr_off_t        record_warmup_size;
+    int              record_cooldown_secs;
+    BOOL             ctx_on_demand;
+    BOOL             async_keyops;
+    BOOL             early_data;
+    int              early_data_max_size;
 };
 
 /**
@@ -873,6 +990,9 @@ void        *ssl_config_perdir_create(apr_pool_t *, char *);
 void        *ssl_config_perdir_merge(apr_pool_t *, void *, void *);
 void         ssl_config_proxy_merge(apr_pool_t *,
                                     SSLDirConfigRec *, SSLDirConfigRec *);
+#ifdef HAVE_SSL_CONF_CMD
+SSL_CONF_CTX *ssl_config_conf_ctx_create(apr_pool_t *);
+#endif
 const char  *ssl_cmd_SSLPolicyApply(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLPassPhraseDialog(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLCryptoDevice(cmd_parms *, void *, const char *);
@@ -896,6 +1016,14 @@ const char  *ssl_cmd_SSLVerifyClient(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLVerifyDepth(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLSessionCache(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLSessionCacheTimeout(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLRecordWarmUpSize(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLRecordCoolDownSecs(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLContextOnDemand(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLContextCacheSize(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLAsyncKeyOps(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLAsyncKeyOpsThreads(cmd_parms *, void *, const char *);
+const char  *ssl_cmd_SSLEarlyData(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLEarlyDataMaxSize(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLProtocol(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLOptions(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLRequireSSL(cmd_parms *, void *);
@@ -920,6 +1048,8 @@ const char  *ssl_cmd_SSLProxyMachineCertificateFile(cmd_parms *, void *, const c
 const char  *ssl_cmd_SSLProxyMachineCertificateChainFile(cmd_parms *, void *, const char *);
 #ifdef HAVE_TLS_SESSION_TICKETS
 const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd, void *dcfg, const char *arg);
+const char *ssl_cmd_SSLSessionTicketKeyDir(cmd_parms *cmd, void *dcfg, const char *arg);
+const char *ssl_cmd_SSLSessionTicketKeyRefresh(cmd_parms *cmd, void *dcfg, const char *arg);
 #endif
 const char  *ssl_cmd_SSLProxyCheckPeerExpire(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLProxyCheckPeerCN(cmd_parms *cmd, void *dcfg, int flag);
@@ -963,6 +1093,13 @@ STACK_OF(X509_NAME)
             *ssl_init_FindCAList(server_rec *, apr_pool_t *, const char *, const char *);
 void         ssl_init_Child(apr_pool_t *, server_rec *);
 apr_status_t ssl_init_ModuleKill(void *data);
+#ifdef HAVE_SSL_CTX_ON_DEMAND
+/** Get the SSL context of a server configured with SSLContextOnDemand,
+ *  creating it if not cached in this child. The caller owns a reference
+ *  to the returned context and has to SSL_CTX_free() it. Returns NULL
+ *  if the context cannot be created. */
+SSL_CTX     *ssl_init_ctx_on_demand(server_rec *, SSLSrvConfigRec *);
+#endif
 
 /**  Apache API hooks  */
 int          ssl_hook_Auth(request_rec *);
@@ -992,6 +1129,9 @@ int          ssl_callback_ServerNameIndication(SSL *, int *, modssl_ctx_t *);
 #if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
 int          ssl_callback_ClientHello(SSL *, int *, void *);
 #endif
+#ifdef HAVE_TLS_EARLY_DATA
+int          ssl_callback_AllowEarlyData(SSL *, void *);
+#endif
 #ifdef HAVE_TLS_SESSION_TICKETS
 int ssl_callback_SessionTicket(SSL *ssl,
                                unsigned char *keyname,
@@ -1020,6 +1160,8 @@ BOOL         ssl_scache_store(server_rec *, IDCONST UCHAR *, int,
 SSL_SESSION *ssl_scache_retrieve(server_rec *, IDCONST UCHAR *, int, apr_pool_t *);
 void         ssl_scache_remove(server_rec *, IDCONST UCHAR *, int,
                                apr_pool_t *);
+BOOL         ssl_scache_store_once(server_rec *, IDCONST UCHAR *, int,
+                                   apr_time_t, apr_pool_t *);
 
 /** OCSP Stapling Support */
 #ifdef HAVE_OCSP_STAPLING
@@ -1037,6 +1179,36 @@ apr_status_t modssl_init_stapling(server_rec *, apr_pool_t *, apr_pool_t *, mods
 void         ssl_stapling_certinfo_hash_init(apr_pool_t *);
 int          ssl_stapling_init_cert(server_rec *, apr_pool_t *, apr_pool_t *,
                                     modssl_ctx_t *, X509 *);
+apr_status_t ssl_stapling_init_watchdog(server_rec *, apr_pool_t *);
+void         ssl_stapling_status(request_rec *, int);
+#endif
+
+/**  Session ticket keys  */
+#ifdef HAVE_TLS_SESSION_TICKETS
+/** Set the name, HMAC secret and AES key of a ticket key from the
+ *  TLSEXT_TICKET_KEY_LEN bytes of a key file */
+void         ssl_ticket_key_set(modssl_ticket_key_t *, const unsigned char *);
+apr_status_t ssl_ticket_keys_init(server_rec *, apr_pool_t *, apr_pool_t *);
+apr_status_t ssl_ticket_keys_init_watchdog(server_rec *, apr_pool_t *);
+/** Get the current key of a ring (name NULL) or the key with the given
+ *  name. Returns 0 when there is no such key, 1 for the current key or
+ *  a newer one not yet current, and 2 for a previous one, whose tickets
+ *  are to be renewed */
+int          ssl_ticket_keys_get(modssl_ticket_keys_t *, const unsigned char *,
+                                 modssl_ticket_key_t *);
+#endif
+
+/**  Private key operations in a thread pool  */
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+void         ssl_async_keyops_init(void);
+apr_status_t ssl_async_keyops_init_ctx(server_rec *, modssl_ctx_t *);
+void         ssl_async_keyops_init_child(apr_pool_t *, server_rec *);
+/** Get the descriptors to poll for the paused handshake of an SSL,
+ *  NULL if it does not wait for any */
+apr_array_header_t *ssl_async_keyops_pollfds(conn_rec *, SSL *);
+/** Wait for the paused handshake of an SSL to be resumable */
+apr_status_t ssl_async_keyops_wait(conn_rec *, SSL *);
+void         ssl_async_keyops_status(request_rec *, int);
 #endif
 #ifdef HAVE_SRP
 int          ssl_callback_SRPServerParams(SSL *, int *, void *);
@@ -1177,13 +1349,14 @@ int modssl_verify_ocsp(X509_STORE_CTX *ctx, SSLSrvConfigRec *sc,
                        server_rec *s, conn_rec *c, apr_pool_t *pool);
 
 /* OCSP helper interface; dispatches the given OCSP request to the
- * responder at the given URI.  Returns the decoded OCSP response
- * object, or NULL on error (in which case, errors will have been
- * logged).  Pool 'p' is used for temporary allocations. */
+ * responder at the given URI, through the SSLOCSPProxyURL of server
+ * 's' if set.  Returns the decoded OCSP response object, or NULL on
+ * error (in which case, errors will have been logged).  Pool 'p' is
+ * used for temporary allocations. */
 OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
                                             apr_interval_time_t timeout,
                                             OCSP_REQUEST *request,
-                                            conn_rec *c, apr_pool_t *p);
+                                            server_rec *s, apr_pool_t *p);
 
 /* Initialize OCSP trusted certificate list */
 void ssl_init_ocsp_certificates(server_rec *s, modssl_ctx_t *mctx);
@@ -189,18 +189,50 @@ void ssl_scache_remove(server_rec *s, IDCONST UCHAR *id, int idlen,
     }
 }
 
+/*
+ * Record an id in the cache. Returns FALSE if it was recorded before
+ * (or cannot be recorded). The socache API has no atomic add, so the
+ * check and the store always happen under the ssl-cache mutex, even
+ * for providers which are MP-safe otherwise (ssl_mutex_init() creates
+ * it then). That makes them atomic within this server only: with a
+ * cache shared between machines (memcache, redis), two of them may
+ * still both record the same id.
+ */
+BOOL ssl_scache_store_once(server_rec *s, IDCONST UCHAR *id, int idlen,
+                           apr_time_t expiry, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    unsigned char seen[1];
+    unsigned int seenlen = sizeof seen;
+    apr_status_t rv;
+
+    if (!mc->pMutex || !ssl_mutex_on(s)) {
+        return FALSE;
+    }
+
+    rv = mc->sesscache->retrieve(mc->sesscache_context, s, id, idlen,
+                                 seen, &seenlen, p);
+    if (APR_STATUS_IS_NOTFOUND(rv)) {
+        rv = mc->sesscache->store(mc->sesscache_context, s, id, idlen,
+                                  expiry, (unsigned char *)"1", 1, p);
+    }
+    else if (rv == APR_SUCCESS) {
+        rv = APR_EEXIST;
+    }
+
+    ssl_mutex_off(s);
+
+    return rv == APR_SUCCESS ? TRUE : FALSE;
+}
+
 /*  _________________________________________________________________
 **
 **  SSL Extension to mod_status
 **  _________________________________________________________________
 */
-static int ssl_ext_status_hook(request_rec *r, int flags)
+static void ssl_ext_sesscache_status(request_rec *r, int flags,
+                                     SSLModConfigRec *mc)
 {
-    SSLModConfigRec *mc = myModConfig(r->server);
-
-    if (mc == NULL || mc->sesscache == NULL)
-        return OK;
-
     if (!(flags & AP_STATUS_SHORT)) {
         ap_rputs("<hr>\n", r);
         ap_rputs("<table cellspacing=0 cellpadding=0>\n", r);
@@ -227,6 +259,24 @@ static int ssl_ext_status_hook(request_rec *r, int flags)
         ap_rputs("</td></tr>\n", r);
         ap_rputs("</table>\n", r);
     }
+}
+
+static int ssl_ext_status_hook(request_rec *r, int flags)
+{
+    SSLModConfigRec *mc = myModConfig(r->server);
+
+    if (mc == NULL)
+        return OK;
+
+    if (mc->sesscache != NULL) {
+        ssl_ext_sesscache_status(r, flags, mc);
+    }
+#ifdef HAVE_OCSP_STAPLING
+    ssl_stapling_status(r, flags);
+#endif
+#ifdef HAVE_SSL_ASYNC_KEYOPS
+    ssl_async_keyops_status(r, flags);
+#endif
 
     return OK;
 }
@@ -31,7 +31,10 @@
 #include "ssl_private.h"
 
 #include "ap_mpm.h"
+#include "apr_shm.h"
 #include "apr_thread_mutex.h"
+#include "mod_status.h"
+#include "mod_watchdog.h"
 
 APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ssl, SSL, int, init_stapling_status,
                                     (server_rec *s, apr_pool_t *p, 
@@ -53,6 +56,10 @@ static int stapling_cache_mutex_off(server_rec *s);
 
 static int stapling_cb(SSL *ssl, void *arg);
 
+/* Non-zero when the responses are refreshed by the watchdog, the
+ * handshakes never querying the responder then. */
+static int stapling_watched;
+
 /**
  * Maximum OCSP stapling response size. This should be the response for a
  * single certificate and will typically include the responder certificate chain
@@ -70,6 +77,13 @@ typedef struct {
     OCSP_CERTID *cid;
     /* URI of the OCSP responder */
     char *uri;
+    /* Server and configuration to refresh the response with */
+    server_rec *s;
+    modssl_ctx_t *mctx;
+    /* When the watchdog refreshes the response next (per process) */
+    apr_time_t next_refresh;
+    /* Whether the last refresh of the watchdog got a valid response */
+    int refreshed;
 } certinfo;
 
 static apr_status_t ssl_stapling_certid_free(void *data)
@@ -217,6 +231,8 @@ int ssl_stapling_init_cert(server_rec *s, apr_pool_t *p, apr_pool_t *ptemp,
     cinf = apr_pcalloc(p, sizeof(certinfo));
     memcpy (cinf->idx, idx, sizeof(idx));
     cinf->cid = cid;
+    cinf->s = s;
+    cinf->mctx = mctx;
     /* make sure cid is also freed at pool cleanup */
     apr_pool_cleanup_register(p, cid, ssl_stapling_certid_free,
                               apr_pool_cleanup_null);
@@ -472,11 +488,14 @@ static int stapling_check_response(server_rec *s, modssl_ctx_t *mctx,
     return rv;
 }
 
+/* Query the responder and cache its response. 'ssl' is the handshake
+ * the request is made for, or NULL when refreshing in the background;
+ * then 'keep_good' avoids replacing a valid cached response by an error.
+ */
 static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
                                     certinfo *cinf, OCSP_RESPONSE **prsp,
-                                    BOOL *pok, apr_pool_t *pool)
+                                    BOOL *pok, BOOL keep_good, apr_pool_t *pool)
 {
-    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
     apr_pool_t *vpool;
     OCSP_REQUEST *req = NULL;
     OCSP_CERTID *id = NULL;
@@ -501,11 +520,13 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
         goto err;
     id = NULL;
     /* Add any extensions to the request */
-    SSL_get_tlsext_status_exts(ssl, &exts);
-    for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
-        X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
-        if (!OCSP_REQUEST_add_ext(req, ext, -1)) 
-            goto err;
+    if (ssl) {
+        SSL_get_tlsext_status_exts(ssl, &exts);
+        for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
+            X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
+            if (!OCSP_REQUEST_add_ext(req, ext, -1)) 
+                goto err;
+        }
     }
 
     if (mctx->stapling_force_url)
@@ -520,7 +541,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     /* Create a temporary pool to constrain memory use */
-    apr_pool_create(&vpool, conn->pool);
+    apr_pool_create(&vpool, pool);
     apr_pool_tag(vpool, "modssl_stapling_renew");
 
     if (apr_uri_parse(vpool, ocspuri, &uri) != APR_SUCCESS) {
@@ -542,7 +563,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     *prsp = modssl_dispatch_ocsp_request(&uri, mctx->stapling_responder_timeout,
-                                         req, conn, vpool);
+                                         req, s, vpool);
 
     apr_pool_destroy(vpool);
 
@@ -576,6 +597,23 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
             *pok = FALSE;
         }
     }
+    if (keep_good && *pok == FALSE) {
+        OCSP_RESPONSE *cached = NULL;
+        BOOL cached_ok = FALSE;
+
+        stapling_get_cached_response(s, &cached, &cached_ok, cinf, pool);
+        if (cached && cached_ok == TRUE
+            && stapling_check_response(s, mctx, cinf, cached,
+                                       NULL) == SSL_TLSEXT_ERR_OK) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10500)
+                         "stapling_renew_response: keeping valid cached "
+                         "response");
+            OCSP_RESPONSE_free(cached);
+            rv = TRUE;
+            goto err;
+        }
+        OCSP_RESPONSE_free(cached); /* NULL safe */
+    }
     if (stapling_cache_response(s, mctx, *prsp, cinf, *pok, pool) == FALSE) {
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(01945)
                      "stapling_renew_response: error caching response!");
@@ -793,7 +831,7 @@ static void copy_ocsp_resp(const unsigned char *der, apr_size_t der_len, void *u
  *
  * Check for cached responses in session cache. If valid send back to
  * client.  If absent or no longer valid, query responder and update
- * cache.
+ * cache, unless the watchdog refreshes it (nothing is stapled then).
  */
 static int stapling_cb(SSL *ssl, void *arg)
 {
@@ -858,7 +896,14 @@ static int stapling_cb(SSL *ssl, void *arg)
         return rv;
     }
 
-    if (rsp == NULL) {
+    if (rsp == NULL && stapling_watched) {
+        /* Don't hold the handshake for the responder, the watchdog
+         * fetches the response (or retries after an error).
+         */
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10538)
+                     "stapling_cb: no cached response, left to the watchdog");
+    }
+    else if (rsp == NULL) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(01954)
                      "stapling_cb: renewing cached response");
         stapling_refresh_mutex_on(s);
@@ -885,7 +930,7 @@ static int stapling_cb(SSL *ssl, void *arg)
                          "stapling_cb: still must refresh cached response "
                          "after obtaining refresh mutex");
             rv = stapling_renew_response(s, mctx, ssl, cinf, &rsp, &ok,
-                                         conn->pool);
+                                         FALSE, conn->pool);
             stapling_refresh_mutex_off(s);
 
             if ((rv == TRUE) && (ok == TRUE) && rsp) {
@@ -920,6 +965,294 @@ static int stapling_cb(SSL *ssl, void *arg)
     return rv;
 }
 
+/*
+ * Background refresh of the OCSP responses. A singleton watchdog in
+ * one of the children queries the responders for every certificate
+ * before the cached response expires, so handshakes do not have to
+ * wait for a responder once a response is cached. Refresh statistics
+ * are kept in shared memory created at startup, written by the
+ * watchdog only and read (unlocked, like the scoreboard) for mod_status.
+ */
+#define SSL_STAPLING_WATCHDOG_NAME  "_ssl_stapling_"
+
+/* How often the watchdog checks that the responses are still cached */
+#define SSL_STAPLING_WATCHDOG_CHECK apr_time_from_sec(60)
+
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_set_callback_interval) *wd_set_interval;
+
+typedef struct {
+    apr_uint32_t refreshes;           /* responder queries */
+    apr_uint32_t failures;            /* queries without a valid response */
+    apr_time_t last_refresh;          /* time of the last query */
+    apr_interval_time_t last_latency; /* duration of the last query */
+    apr_interval_time_t max_latency;
+    apr_interval_time_t sum_latency;
+} stapling_stats;
+
+static stapling_stats *stapling_stats_shared;
+
+typedef struct {
+    server_rec *s;
+    ap_watchdog_t *watchdog;
+} stapling_watchdog_ctx;
+
+static stapling_stats *stapling_stats_create(server_rec *s, apr_pool_t *p)
+{
+    apr_shm_t *shm;
+    apr_status_t rv;
+
+    /* anonymous, inherited by the children */
+    rv = apr_shm_create(&shm, sizeof(stapling_stats), NULL, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, rv, s, APLOGNO(10535)
+                     "OCSP stapling refresh statistics are not shared "
+                     "between child processes");
+        return apr_pcalloc(p, sizeof(stapling_stats));
+    }
+    memset(apr_shm_baseaddr_get(shm), 0, sizeof(stapling_stats));
+    return apr_shm_baseaddr_get(shm);
+}
+
+/* When the response should be refreshed, before it leaves the cache or
+ * its nextUpdate has passed, whichever comes first: a quarter of its
+ * lifetime ahead, or the responder timeout if longer, up to half of it.
+ */
+static apr_time_t stapling_refresh_time(modssl_ctx_t *mctx, certinfo *cinf,
+                                        OCSP_RESPONSE *rsp, apr_time_t now)
+{
+    apr_time_t expires = now + apr_time_from_sec(mctx->stapling_cache_timeout);
+    apr_interval_time_t lifetime, margin;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    ASN1_GENERALIZEDTIME *rev, *thisupd, *nextupd = NULL;
+    OCSP_BASICRESP *bs;
+    int status, reason, days, secs;
+
+    if (rsp && (bs = OCSP_response_get1_basic(rsp)) != NULL) {
+        if (OCSP_resp_find_status(bs, cinf->cid, &status, &reason, &rev,
+                                  &thisupd, &nextupd)
+            && nextupd && ASN1_TIME_diff(&days, &secs, NULL, nextupd)) {
+            apr_time_t next_update = now + apr_time_from_sec(
+                                        (apr_time_t)days * 86400 + secs);
+            if (next_update < expires) {
+                expires = next_update;
+            }
+        }
+        OCSP_BASICRESP_free(bs);
+    }
+#endif
+
+    lifetime = expires - now;
+    margin = lifetime / 4;
+    if (margin < mctx->stapling_responder_timeout) {
+        margin = mctx->stapling_responder_timeout;
+    }
+    if (margin > lifetime / 2) {
+        margin = lifetime / 2;
+    }
+    return expires - margin;
+}
+
+static void stapling_refresh(stapling_watchdog_ctx *wctx, certinfo *cinf,
+                             apr_pool_t *ptemp)
+{
+    modssl_ctx_t *mctx = cinf->mctx;
+    stapling_stats *stats = stapling_stats_shared;
+    OCSP_RESPONSE *rsp = NULL;
+    BOOL ok = FALSE, rv;
+    apr_time_t start, now;
+    apr_interval_time_t latency;
+
+    start = apr_time_now();
+    rv = stapling_renew_response(cinf->s, mctx, NULL, cinf, &rsp, &ok,
+                                 TRUE, ptemp);
+    now = apr_time_now();
+    latency = now - start;
+
+    stats->refreshes++;
+    stats->last_refresh = now;
+    stats->last_latency = latency;
+    stats->sum_latency += latency;
+    if (latency > stats->max_latency) {
+        stats->max_latency = latency;
+    }
+
+    cinf->refreshed = (rv == TRUE && ok == TRUE);
+    if (cinf->refreshed) {
+        cinf->next_refresh = stapling_refresh_time(mctx, cinf, rsp, now);
+    }
+    else {
+        stats->failures++;
+        cinf->next_refresh = now + apr_time_from_sec(mctx->stapling_errcache_timeout);
+    }
+    OCSP_RESPONSE_free(rsp); /* NULL safe */
+    if (cinf->next_refresh < now + apr_time_from_sec(1)) {
+        cinf->next_refresh = now + apr_time_from_sec(1);
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, cinf->s, APLOGNO(10502)
+                 "stapling_refresh: %s response for server %s in %"
+                 APR_TIME_T_FMT "ms, next refresh in %" APR_TIME_T_FMT "s",
+                 (rv == TRUE && ok == TRUE)? "valid" : "no valid",
+                 mctx->sc->vhost_id, apr_time_as_msec(latency),
+                 apr_time_sec(cinf->next_refresh - now));
+}
+
+/* Whether the cache still has the response, which it may have evicted */
+static int stapling_is_cached(certinfo *cinf, apr_pool_t *ptemp)
+{
+    OCSP_RESPONSE *rsp = NULL;
+    BOOL ok = FALSE;
+
+    stapling_get_cached_response(cinf->s, &rsp, &ok, cinf, ptemp);
+    if (rsp == NULL) {
+        return 0;
+    }
+    OCSP_RESPONSE_free(rsp);
+    return 1;
+}
+
+static apr_status_t stapling_run_watchdog(int state, void *baton,
+                                          apr_pool_t *ptemp)
+{
+    stapling_watchdog_ctx *wctx = baton;
+    apr_hash_index_t *hi;
+    apr_time_t now, next_run;
+
+    switch (state) {
+    case AP_WATCHDOG_STATE_STARTING:
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wctx->s, APLOGNO(10503)
+                     "OCSP stapling watchdog started for %u certificates",
+                     apr_hash_count(stapling_certinfo));
+        break;
+
+    case AP_WATCHDOG_STATE_RUNNING:
+        now = apr_time_now();
+        next_run = now + SSL_STAPLING_WATCHDOG_CHECK;
+        for (hi = apr_hash_first(ptemp, stapling_certinfo); hi;
+             hi = apr_hash_next(hi)) {
+            certinfo *cinf;
+            void *val;
+
+            apr_hash_this(hi, NULL, NULL, &val);
+            cinf = val;
+
+            /* The handshakes don't fetch the missing responses, so an
+             * evicted one is fetched again now (but a failed fetch only
+             * after SSLStaplingErrorCacheTimeout).
+             */
+            if (cinf->next_refresh <= now
+                || (cinf->refreshed && !stapling_is_cached(cinf, ptemp))) {
+                stapling_refresh(wctx, cinf, ptemp);
+            }
+            if (cinf->next_refresh < next_run) {
+                next_run = cinf->next_refresh;
+            }
+        }
+        now = apr_time_now();
+        wd_set_interval(wctx->watchdog, (next_run > now)? next_run - now : 0,
+                        wctx, stapling_run_watchdog);
+        break;
+
+    case AP_WATCHDOG_STATE_STOPPING:
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wctx->s, APLOGNO(10504)
+                     "OCSP stapling watchdog stopping");
+        break;
+    }
+
+    return APR_SUCCESS;
+}
+
+apr_status_t ssl_stapling_init_watchdog(server_rec *s, apr_pool_t *p)
+{
+    stapling_watchdog_ctx *wctx;
+    apr_status_t rv;
+
+    stapling_watched = 0;
+    if (apr_hash_count(stapling_certinfo) == 0) {
+        return APR_SUCCESS;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    wd_set_interval = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_set_callback_interval);
+    if (!wd_get_instance || !wd_register_callback || !wd_set_interval) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10505)
+                     "mod_watchdog not loaded, OCSP stapling responses "
+                     "are renewed during handshakes");
+        return APR_SUCCESS;
+    }
+
+    stapling_stats_shared = stapling_stats_create(s, p);
+    wctx = apr_pcalloc(p, sizeof(*wctx));
+    wctx->s = s;
+    rv = wd_get_instance(&wctx->watchdog, SSL_STAPLING_WATCHDOG_NAME, 0, 1, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10506)
+                     "Failed to create OCSP stapling watchdog (%s)",
+                     SSL_STAPLING_WATCHDOG_NAME);
+        return rv;
+    }
+    rv = wd_register_callback(wctx->watchdog, 0, wctx, stapling_run_watchdog);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10507)
+                     "Failed to register OCSP stapling watchdog (%s)",
+                     SSL_STAPLING_WATCHDOG_NAME);
+        return rv;
+    }
+    stapling_watched = 1;
+
+    return APR_SUCCESS;
+}
+
+void ssl_stapling_status(request_rec *r, int flags)
+{
+    stapling_stats stats;
+    apr_interval_time_t avg;
+
+    if (!stapling_watched) {
+        return;
+    }
+    stats = *stapling_stats_shared;
+    avg = stats.refreshes? stats.sum_latency / stats.refreshes : 0;
+
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "TLSStaplingRefreshes: %u\n", stats.refreshes);
+        ap_rprintf(r, "TLSStaplingRefreshFailures: %u\n", stats.failures);
+        ap_rprintf(r, "TLSStaplingRefreshLastMs: %" APR_TIME_T_FMT "\n",
+                   apr_time_as_msec(stats.last_latency));
+        ap_rprintf(r, "TLSStaplingRefreshAvgMs: %" APR_TIME_T_FMT "\n",
+                   apr_time_as_msec(avg));
+        ap_rprintf(r, "TLSStaplingRefreshMaxMs: %" APR_TIME_T_FMT "\n",
+                   apr_time_as_msec(stats.max_latency));
+        return;
+    }
+
+    ap_rputs("<hr>\n", r);
+    ap_rputs("<table cellspacing=0 cellpadding=0>\n", r);
+    ap_rputs("<tr><td bgcolor=\"#000000\">\n", r);
+    ap_rputs("<b><font color=\"#ffffff\" face=\"Arial,Helvetica\">OCSP Stapling Status:</font></b>\r", r);
+    ap_rputs("</td></tr>\n", r);
+    ap_rputs("<tr><td bgcolor=\"#ffffff\">\n", r);
+    ap_rprintf(r, "responder queries: <b>%u</b>, failed: <b>%u</b><br>",
+               stats.refreshes, stats.failures);
+    if (stats.refreshes) {
+        char ts[APR_CTIME_LEN];
+
+        apr_ctime(ts, stats.last_refresh);
+        ap_rprintf(r, "last query: <b>%s</b><br>", ts);
+        ap_rprintf(r, "query time: last <b>%" APR_TIME_T_FMT "ms</b>, "
+                   "average <b>%" APR_TIME_T_FMT "ms</b>, "
+                   "max <b>%" APR_TIME_T_FMT "ms</b><br>",
+                   apr_time_as_msec(stats.last_latency),
+                   apr_time_as_msec(avg),
+                   apr_time_as_msec(stats.max_latency));
+    }
+    ap_rputs("</td></tr>\n", r);
+    ap_rputs("</table>\n", r);
+}
+
 apr_status_t modssl_init_stapling(server_rec *s, apr_pool_t *p,
                                   apr_pool_t *ptemp, modssl_ctx_t *mctx)
 {
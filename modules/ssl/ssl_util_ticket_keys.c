@@ -0,0 +1,349 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_util_ticket_keys.c
+ *  Rotation of the session ticket keys
+ */
+
+#include "ssl_private.h"
+
+#ifdef HAVE_TLS_SESSION_TICKETS
+
+#include "apr_thread_rwlock.h"
+#include "mod_watchdog.h"
+
+/*
+ * A SSLSessionTicketKeyDir holds files named "*.key" with 48 bytes of
+ * random data each. The key in the file whose name sorts last, among
+ * those modified at least one refresh interval ago, is the current one
+ * and encrypts new tickets. The keys of the files before it still
+ * decrypt tickets, which are then renewed with the current key, those
+ * of newer files decrypt tickets of the nodes which already promoted
+ * them. Servers sharing the directory, e.g. all nodes behind a load
+ * balancer with the directory distributed to them, resume each other's
+ * sessions, and a new key arriving at the nodes at different times is
+ * not used before all of them can decrypt with it.
+ *
+ * Every child rescans the directories with a watchdog, so keys can be
+ * added and removed without a restart.
+ */
+#define SSL_TICKET_KEYS_WATCHDOG_NAME   "_ssl_ticket_keys_"
+#define SSL_TICKET_KEYS_SUFFIX          ".key"
+
+struct modssl_ticket_keys_t {
+    const char *path;
+#if APR_HAS_THREADS
+    apr_thread_rwlock_t *lock;
+#endif
+    int nelts;
+    int current;    /* index of the current key, newer ones only decrypt */
+    /* newest first */
+    unsigned char keys[SSL_TICKET_KEYS_MAX][TLSEXT_TICKET_KEY_LEN];
+};
+
+/* The rings of this generation, by directory */
+static apr_hash_t *ticket_keys_dirs;
+
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+
+void ssl_ticket_key_set(modssl_ticket_key_t *ticket_key,
+                        const unsigned char *buf)
+{
+    memcpy(ticket_key->key_name, buf, 16);
+    memcpy(ticket_key->hmac_secret, buf + 16, 16);
+    memcpy(ticket_key->aes_key, buf + 32, 16);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    ticket_key->mac_params[0] =
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                          ticket_key->hmac_secret, 16);
+    ticket_key->mac_params[1] =
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+    ticket_key->mac_params[2] =
+        OSSL_PARAM_construct_end();
+#endif
+}
+
+static int ticket_keys_name_cmp(const void *a, const void *b)
+{
+    /* descending, the newest key first */
+    return strcmp(*(const char * const *)b, *(const char * const *)a);
+}
+
+/*
+ * Scan the directory of a ring and replace its keys when they changed.
+ * Returns the number of keys found, the ring is left alone when there
+ * are none.
+ */
+static int ticket_keys_load(server_rec *s, modssl_ticket_keys_t *tk,
+                            apr_pool_t *ptemp)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    unsigned char keys[SSL_TICKET_KEYS_MAX][TLSEXT_TICKET_KEY_LEN];
+    const char *loaded[SSL_TICKET_KEYS_MAX];
+    apr_array_header_t *names;
+    apr_time_t settled = apr_time_now()
+                         - apr_time_from_sec(mc->ticket_keys_refresh);
+    apr_finfo_t finfo;
+    apr_dir_t *dir;
+    apr_file_t *fp;
+    apr_size_t len;
+    apr_status_t rv;
+    int i, n = 0, current = -1;
+
+    rv = apr_dir_open(&dir, tk->path, ptemp);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10523)
+                     "Failed to open ticket key directory %s", tk->path);
+        return 0;
+    }
+    names = apr_array_make(ptemp, SSL_TICKET_KEYS_MAX, sizeof(const char *));
+    while (apr_dir_read(&finfo, APR_FINFO_NAME, dir) == APR_SUCCESS) {
+        apr_size_t nlen = strlen(finfo.name);
+
+        /* skip hidden files, e.g. the staging links of mounted secrets */
+        if (finfo.name[0] == '.' || nlen <= sizeof(SSL_TICKET_KEYS_SUFFIX) - 1
+            || strcmp(finfo.name + nlen - (sizeof(SSL_TICKET_KEYS_SUFFIX) - 1),
+                      SSL_TICKET_KEYS_SUFFIX)) {
+            continue;
+        }
+        APR_ARRAY_PUSH(names, const char *) = apr_pstrdup(ptemp, finfo.name);
+    }
+    apr_dir_close(dir);
+
+    qsort(names->elts, names->nelts, sizeof(const char *),
+          ticket_keys_name_cmp);
+
+    for (i = 0; i < names->nelts && n < SSL_TICKET_KEYS_MAX; ++i) {
+        const char *name = APR_ARRAY_IDX(names, i, const char *);
+        const char *path = apr_pstrcat(ptemp, tk->path, "/", name, NULL);
+
+        rv = apr_file_open(&fp, path, APR_READ|APR_BINARY,
+                           APR_OS_DEFAULT, ptemp);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_info_get(&finfo, APR_FINFO_MTIME, fp);
+            if (rv == APR_SUCCESS) {
+                rv = apr_file_read_full(fp, keys[n], TLSEXT_TICKET_KEY_LEN,
+                                        &len);
+            }
+            apr_file_close(fp);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10524)
+                         "Ignoring ticket key file %s, failed to read %d "
+                         "bytes", path, TLSEXT_TICKET_KEY_LEN);
+            continue;
+        }
+        /* A key just added may not have reached the other nodes yet,
+         * it only becomes current after a refresh interval */
+        if (current < 0 && finfo.mtime <= settled) {
+            current = n;
+        }
+        loaded[n++] = name;
+    }
+
+    if (n == 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(10525)
+                     "No ticket key files (*" SSL_TICKET_KEYS_SUFFIX ") "
+                     "found in %s", tk->path);
+        return 0;
+    }
+    if (current < 0) {
+        /* all keys are new, as on a first start: the oldest one is the
+         * most likely to be present everywhere */
+        current = n - 1;
+    }
+
+    if (n != tk->nelts || current != tk->current
+        || memcmp(keys, tk->keys, sizeof(keys[0]) * n)) {
+#if APR_HAS_THREADS
+        apr_thread_rwlock_wrlock(tk->lock);
+#endif
+        memcpy(tk->keys, keys, sizeof(keys[0]) * n);
+        if (n < tk->nelts) {
+            OPENSSL_cleanse(tk->keys[n], sizeof(keys[0]) * (tk->nelts - n));
+        }
+        tk->nelts = n;
+        tk->current = current;
+#if APR_HAS_THREADS
+        apr_thread_rwlock_unlock(tk->lock);
+#endif
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10526)
+                     "TLS session ticket keys loaded from %s: %d keys, "
+                     "current key %s", tk->path, n, loaded[current]);
+    }
+    OPENSSL_cleanse(keys, sizeof(keys));
+
+    return n;
+}
+
+static apr_status_t ticket_keys_cleanup(void *data)
+{
+    modssl_ticket_keys_t *tk = data;
+
+    OPENSSL_cleanse(tk->keys, sizeof(tk->keys));
+    return APR_SUCCESS;
+}
+
+apr_status_t ssl_ticket_keys_init(server_rec *base_server, apr_pool_t *p,
+                                  apr_pool_t *ptemp)
+{
+    server_rec *s;
+
+    ticket_keys_dirs = apr_hash_make(p);
+
+    for (s = base_server; s; s = s->next) {
+        SSLSrvConfigRec *sc = mySrvConfig(s);
+        modssl_ticket_key_t *ticket_key;
+        modssl_ticket_keys_t *tk;
+        apr_status_t rv;
+
+        if (!sc->server || !(ticket_key = sc->server->ticket_key)
+            || !ticket_key->dir_path) {
+            continue;
+        }
+
+        tk = apr_hash_get(ticket_keys_dirs, ticket_key->dir_path,
+                          APR_HASH_KEY_STRING);
+        if (!tk) {
+            tk = apr_pcalloc(p, sizeof(*tk));
+            tk->path = ticket_key->dir_path;
+#if APR_HAS_THREADS
+            rv = apr_thread_rwlock_create(&tk->lock, p);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_EMERG, rv, s, APLOGNO(10527)
+                             "Failed to create the lock of the ticket keys "
+                             "in %s", tk->path);
+                return ssl_die(s);
+            }
+#endif
+            apr_pool_cleanup_register(p, tk, ticket_keys_cleanup,
+                                      apr_pool_cleanup_null);
+            if (!ticket_keys_load(s, tk, ptemp)) {
+                return ssl_die(s);
+            }
+            apr_hash_set(ticket_keys_dirs, tk->path, APR_HASH_KEY_STRING, tk);
+        }
+        ticket_key->keys = tk;
+    }
+
+    return APR_SUCCESS;
+}
+
+int ssl_ticket_keys_get(modssl_ticket_keys_t *tk, const unsigned char *name,
+                        modssl_ticket_key_t *ticket_key)
+{
+    int i, found = 0;
+
+#if APR_HAS_THREADS
+    apr_thread_rwlock_rdlock(tk->lock);
+#endif
+    if (!name) {
+        ssl_ticket_key_set(ticket_key, tk->keys[tk->current]);
+        found = 1;
+    }
+    else {
+        for (i = 0; i < tk->nelts; ++i) {
+            if (!memcmp(name, tk->keys[i], 16)) {
+                ssl_ticket_key_set(ticket_key, tk->keys[i]);
+                /* renew the tickets of previous keys only, newer keys
+                 * are about to become current */
+                found = (i <= tk->current)? 1 : 2;
+                break;
+            }
+        }
+    }
+#if APR_HAS_THREADS
+    apr_thread_rwlock_unlock(tk->lock);
+#endif
+
+    return found;
+}
+
+static apr_status_t ticket_keys_run_watchdog(int state, void *baton,
+                                             apr_pool_t *ptemp)
+{
+    server_rec *s = baton;
+    apr_hash_index_t *hi;
+
+    switch (state) {
+    case AP_WATCHDOG_STATE_STARTING:
+        /* the keys may have changed since the parent loaded them */
+        /* fall through */
+    case AP_WATCHDOG_STATE_RUNNING:
+        for (hi = apr_hash_first(ptemp, ticket_keys_dirs); hi;
+             hi = apr_hash_next(hi)) {
+            void *val;
+
+            apr_hash_this(hi, NULL, NULL, &val);
+            ticket_keys_load(s, val, ptemp);
+        }
+        break;
+
+    case AP_WATCHDOG_STATE_STOPPING:
+        break;
+    }
+
+    return APR_SUCCESS;
+}
+
+apr_status_t ssl_ticket_keys_init_watchdog(server_rec *s, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    ap_watchdog_t *watchdog;
+    apr_status_t rv;
+
+    if (apr_hash_count(ticket_keys_dirs) == 0) {
+        return APR_SUCCESS;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register_callback) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10528)
+                     "mod_watchdog not loaded, TLS session ticket keys "
+                     "are only reloaded on restart");
+        return APR_SUCCESS;
+    }
+
+    /* not a singleton, every child keeps its own copy of the keys */
+    rv = wd_get_instance(&watchdog, SSL_TICKET_KEYS_WATCHDOG_NAME, 0, 0, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10529)
+                     "Failed to create TLS session ticket keys watchdog "
+                     "(%s)", SSL_TICKET_KEYS_WATCHDOG_NAME);
+        return rv;
+    }
+    rv = wd_register_callback(watchdog,
+                              apr_time_from_sec(mc->ticket_keys_refresh),
+                              s, ticket_keys_run_watchdog);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10530)
+                     "Failed to register TLS session ticket keys watchdog "
+                     "(%s)", SSL_TICKET_KEYS_WATCHDOG_NAME);
+        return rv;
+    }
+
+    return APR_SUCCESS;
+}
+
+#endif /* HAVE_TLS_SESSION_TICKETS */
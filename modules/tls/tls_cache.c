@@ -277,7 +277,7 @@ static rustls_result tls_cache_put(
     if (!sc->global->session_cache) goto not_stored;
     tls_cache_lock(sc->global);
 
-    expires_at = apr_time_now() + apr_time_from_sec(300);
+    expires_at = apr_time_now() + sc->global->session_cache_timeout;
     kdata = key->data;
     klen = (unsigned int)key->len;
     vlen = (unsigned int)val->len;
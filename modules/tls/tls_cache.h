@@ -19,6 +19,9 @@
 /* name of the global session cache mutex, should we need it */
 #define TLS_SESSION_CACHE_MUTEX_TYPE    "tls-session-cache"
 
+/* default seconds a session stays resumable in the cache */
+#define TLS_SESSION_CACHE_TIMEOUT       300
+
 
 /**
  * Set the specification of the session cache to use. The syntax is
@@ -61,6 +61,7 @@ static tls_conf_global_t *conf_global_get_or_make(apr_pool_t *pool, server_rec *
     gconf->var_lookups = apr_hash_make(pool);
     tls_var_init_lookup_hash(pool, gconf->var_lookups);
     gconf->session_cache_spec = "default";
+    gconf->session_cache_timeout = apr_time_from_sec(TLS_SESSION_CACHE_TIMEOUT);
 
     return gconf;
 }
@@ -589,6 +590,27 @@ cleanup:
     return err;
 }
 
+static const char *tls_conf_set_session_cache_timeout(
+    cmd_parms *cmd, void *dc, const char *value)
+{
+    tls_conf_server_t *sc = tls_conf_server_get(cmd->server);
+    apr_interval_time_t timeout;
+    const char *err = NULL;
+
+    (void)dc;
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) goto cleanup;
+
+    if (ap_timeout_parameter_parse(value, &timeout, "s") != APR_SUCCESS
+        || timeout <= 0) {
+        err = apr_pstrcat(cmd->pool, cmd->cmd->name,
+                          ": invalid timeout '", value, "'", NULL);
+        goto cleanup;
+    }
+    sc->global->session_cache_timeout = timeout;
+cleanup:
+    return err;
+}
+
 static const char *tls_conf_set_proxy_engine(cmd_parms *cmd, void *dir_conf, int flag)
 {
     tls_conf_dir_t *dc = dir_conf;
@@ -754,6 +776,8 @@ const command_rec tls_conf_cmds[] = {
         "Set strictness of client server name (SNI) check against hosts, default on."),
     AP_INIT_TAKE1("TLSSessionCache", tls_conf_set_session_cache, NULL, RSRC_CONF,
         "Set which cache to use for TLS sessions."),
+    AP_INIT_TAKE1("TLSSessionCacheTimeout", tls_conf_set_session_cache_timeout, NULL, RSRC_CONF,
+        "Set how long TLS sessions can be resumed from the cache, default 300 seconds."),
     AP_INIT_FLAG("TLSProxyEngine", tls_conf_set_proxy_engine, NULL, RSRC_CONF|PROXY_CONF,
         "Enable TLS encryption of outgoing connections in this location/server."),
     AP_INIT_TAKE1("TLSProxyCA", tls_conf_set_proxy_ca, NULL, RSRC_CONF|PROXY_CONF,
@@ -84,6 +84,7 @@ typedef struct {
     const struct ap_socache_provider_t *session_cache_provider; /* provider used for session cache */
     struct ap_socache_instance_t *session_cache; /* session cache instance */
     struct apr_global_mutex_t *session_cache_mutex; /* global mutex for access to session cache */
+    apr_interval_time_t session_cache_timeout; /* how long sessions stay resumable */
 
     const rustls_server_config *rustls_hello_config; /* used for initial client hello parsing */
 } tls_conf_global_t;
@@ -862,9 +862,11 @@ static apr_status_t decrement_connection_count(void *cs_)
 
 static void notify_suspend(event_conn_state_t *cs)
 {
-    ap_run_suspend_connection(cs->c, cs->r);
+    /* Mark the connection suspended before the hooks run, they may hand
+     * it over to a callback which resumes it from another thread */
     cs->c->sbh = NULL;
     cs->suspended = 1;
+    ap_run_suspend_connection(cs->c, cs->r);
 }
 
 static void notify_resume(event_conn_state_t *cs, int cleanup)
@@ -71,6 +71,12 @@
 
 #define DIRINFO (APR_FINFO_MTIME|APR_FINFO_SIZE|APR_FINFO_TYPE|APR_FINFO_LINK)
 
+#define INDEX_MAGIC   "htcacheclean index 1"
+#define JOURNAL_WORK  CACHE_JOURNAL_FILE ".work"
+#define JOURNAL_NEW   CACHE_JOURNAL_FILE ".new"
+#define INDEX_NEW     CACHE_INDEX_FILE ".new"
+#define LINE_LEN      (APR_PATH_MAX + 64)
+
 typedef struct _direntry {
     APR_RING_ENTRY(_direntry) link;
     int type;         /* type of file/fileset: TEMP, HEADER, DATA, HEADERDATA */
@@ -92,6 +98,13 @@ typedef struct _entry {
     char *basename;           /* fileset base name */
 } ENTRY;
 
+typedef struct _ientry {
+    APR_RING_ENTRY(_ientry) link;
+    apr_time_t atime;         /* time the entity was last stored or served */
+    apr_off_t size;           /* entity file size */
+    char basename[1];         /* entity base name, allocated along */
+} IENTRY;
+
 
 static int delcount;    /* file deletion count for nice mode */
 static int interrupted; /* flag: true if SIGINT or SIGTERM occurred */
@@ -103,6 +116,7 @@ static int dryrun;      /* flag: true means dry run, don't actually delete
 static int deldirs;     /* flag: true means directories should be deleted */
 static int listurls;    /* flag: true means list cached urls */
 static int listextended;/* flag: true means list cached urls */
+static int indexed;     /* 0: no index, 1: index wanted, 2: index loaded */
 static int baselen;     /* string length of the path to the proxy directory */
 static apr_time_t now;  /* start time of this processing run */
 
@@ -111,6 +125,11 @@ static apr_file_t *outfile;   /* stdout file handle */
 static apr_off_t unsolicited; /* file size summary for deleted unsolicited
                                  files */
 static ENTRY root; /* ENTRY ring anchor */
+static IENTRY iroot; /* IENTRY ring anchor, least recently used first */
+static apr_hash_t *ihash; /* IENTRY by base name */
+static apr_off_t isum;     /* rounded size of the indexed entities */
+static apr_off_t ientries; /* number of indexed entities */
+static apr_off_t inum;     /* estimated number of inodes in the cache */
 
 /* short program name as called */
 static const char *shortname = "htcacheclean";
@@ -401,6 +420,170 @@ static void delete_entry(char *path, char *basename, apr_off_t *nodes,
 
 }
 
+/*
+ * length of the on-disk info struct of the split formats, zero for others
+ */
+static apr_size_t split_info_len(apr_uint32_t format)
+{
+    switch (format) {
+    case DISK_FORMAT_VERSION_SPLIT:
+        return DISK_INFO_SPLIT_LEN;
+    case DISK_FORMAT_VERSION_SPLIT_NOSTALE:
+        return DISK_INFO_SPLIT_NOSTALE_LEN;
+    }
+    return 0;
+}
+
+/*
+ * rewrite an entity stored in one of the split formats, with its body in
+ * a separate data file, into the single file format
+ */
+static apr_status_t migrate_entry(const char *path, const char *basename,
+        disk_cache_info_t *disk_info, apr_off_t *size, apr_pool_t *pool)
+{
+    apr_pool_t *p;
+    apr_file_t *fd, *dfd = NULL, *tfd = NULL;
+    apr_finfo_t finfo;
+    apr_off_t offset;
+    apr_size_t len;
+    apr_status_t status;
+    struct iovec iov[2];
+    char *hname, *tname, *block, *s, *end, *eol;
+    char buf[APR_BUCKET_BUFF_SIZE];
+    apr_size_t info_len = split_info_len(disk_info->format);
+    int empty = 0;
+
+    /* temp pool, otherwise lots of memory could be allocated */
+    apr_pool_create(&p, pool);
+
+    hname = apr_pstrcat(p, path, "/", basename, CACHE_HEADER_SUFFIX, NULL);
+    tname = apr_pstrcat(p, path, AP_TEMPFILE, NULL);
+
+    /* the header block follows the old, shorter info struct */
+    status = apr_file_open(&fd, hname, APR_FOPEN_READ | APR_FOPEN_BINARY,
+                           APR_OS_DEFAULT, p);
+    if (status == APR_SUCCESS) {
+        status = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd);
+    }
+    if (status == APR_SUCCESS
+        && finfo.size < (apr_off_t)(info_len + disk_info->name_len)) {
+        status = APR_EGENERAL;
+    }
+    if (status == APR_SUCCESS) {
+        len = (apr_size_t)(finfo.size - info_len);
+        block = apr_palloc(p, len + 4);
+        offset = info_len;
+        status = apr_file_seek(fd, APR_SET, &offset);
+        if (status == APR_SUCCESS) {
+            status = apr_file_read_full(fd, block, len, &len);
+        }
+    }
+    if (status != APR_SUCCESS) {
+        apr_pool_destroy(p);
+        return status;
+    }
+
+    /* both header tables must end with an empty line, but an entity
+     * which was invalidated may have been stored without them
+     */
+    end = block + len;
+    for (s = block + disk_info->name_len;
+         (eol = memchr(s, '\n', end - s)) != NULL; s = eol + 1) {
+        if (eol == s || (eol == s + 1 && *s == '\r')) {
+            empty++;
+        }
+    }
+    for (; empty < 2; empty++) {
+        memcpy(block + len, "\r\n", 2);
+        len += 2;
+    }
+
+    if (disk_info->has_body) {
+        status = apr_file_open(&dfd, apr_pstrcat(p, path, "/", basename,
+                CACHE_DATA_SUFFIX, NULL), APR_FOPEN_READ | APR_FOPEN_BINARY,
+                APR_OS_DEFAULT, p);
+        if (status == APR_SUCCESS) {
+            status = apr_file_info_get(&finfo,
+                    APR_FINFO_SIZE | APR_FINFO_IDENT, dfd);
+        }
+        /* does the body file belong to the header file? */
+        if (status == APR_SUCCESS && (finfo.inode != disk_info->inode
+                                      || finfo.device != disk_info->device)) {
+            status = APR_EGENERAL;
+        }
+        if (status != APR_SUCCESS) {
+            apr_pool_destroy(p);
+            return status;
+        }
+    }
+
+    /* what used to be padding after the flags of the cache control */
+    if (disk_info->format == DISK_FORMAT_VERSION_SPLIT_NOSTALE) {
+        disk_info->control.stale_while_revalidate = 0;
+        disk_info->control.stale_if_error = 0;
+        disk_info->control.stale_while_revalidate_value = -1;
+        disk_info->control.stale_if_error_value = -1;
+    }
+
+    disk_info->format = DISK_FORMAT_VERSION;
+    disk_info->inode = 0;
+    disk_info->device = 0;
+    disk_info->hdrs_len = len;
+    disk_info->body_offset = APR_ALIGN(sizeof(disk_cache_info_t) + len,
+                                       CACHE_DISK_BODY_ALIGN);
+    disk_info->body_len = dfd ? finfo.size : 0;
+
+    status = apr_file_mktemp(&tfd, tname, APR_FOPEN_CREATE | APR_FOPEN_WRITE
+            | APR_FOPEN_BINARY | APR_FOPEN_BUFFERED | APR_FOPEN_EXCL, p);
+    if (status == APR_SUCCESS) {
+        iov[0].iov_base = (void *)disk_info;
+        iov[0].iov_len = sizeof(disk_cache_info_t);
+        iov[1].iov_base = block;
+        iov[1].iov_len = len;
+        status = apr_file_writev_full(tfd, iov, 2, NULL);
+    }
+
+    if (status == APR_SUCCESS && dfd) {
+        offset = disk_info->body_offset;
+        status = apr_file_seek(tfd, APR_SET, &offset);
+        while (status == APR_SUCCESS) {
+            len = sizeof(buf);
+            status = apr_file_read(dfd, buf, &len);
+            if (status == APR_SUCCESS) {
+                status = apr_file_write_full(tfd, buf, len, NULL);
+            }
+        }
+        if (APR_STATUS_IS_EOF(status)) {
+            status = APR_SUCCESS;
+        }
+    }
+
+    if (tfd) {
+        apr_status_t rv = apr_file_close(tfd);
+        if (status == APR_SUCCESS) {
+            status = rv;
+        }
+    }
+
+    /* replacing the headers file is atomic, the now unreferenced data
+     * file is left to the caller
+     */
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(tname, hname, p);
+    }
+    if (status == APR_SUCCESS) {
+        *size = dfd ? disk_info->body_offset + disk_info->body_len
+                    : (apr_off_t)(sizeof(disk_cache_info_t) + disk_info->hdrs_len);
+    }
+    else if (tfd) {
+        apr_file_remove(tname, p);
+    }
+
+    apr_pool_destroy(p);
+
+    return status;
+}
+
 /*
  * list the cache directory tree
  */
@@ -464,39 +647,22 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                         == APR_SUCCESS) {
 
                                     if (listextended) {
-                                        apr_finfo_t hinfo, dinfo;
+                                        apr_finfo_t hinfo;
 
-                                        /* stat the header file */
+                                        /* stat the entity file */
                                         if (APR_SUCCESS != apr_file_info_get(
                                                 &hinfo, APR_FINFO_SIZE, fd)) {
                                             /* ignore the file */
                                         }
-                                        else if (disk_info.has_body && APR_SUCCESS
-                                                != apr_stat(
-                                                        &dinfo,
-                                                        apr_pstrcat(
-                                                                p,
-                                                                path,
-                                                                "/",
-                                                                apr_pstrndup(
-                                                                        p,
-                                                                        info.name,
-                                                                        ext
-                                                                                - info.name),
-                                                                CACHE_DATA_SUFFIX,
-                                                                NULL),
-                                                        APR_FINFO_SIZE
-                                                                | APR_FINFO_IDENT,
-                                                        p)) {
-                                            /* ignore the file */
-                                        }
-                                        else if (disk_info.has_body && (dinfo.device
-                                                != disk_info.device
-                                                || dinfo.inode
-                                                        != disk_info.inode)) {
-                                            /* ignore the file */
+                                        else if (disk_info.has_body
+                                                && hinfo.size
+                                                        < disk_info.body_offset
+                                                        + disk_info.body_len) {
+                                            /* ignore the truncated file */
                                         }
                                         else {
+                                            apr_off_t dsize = disk_info.has_body
+                                                    ? disk_info.body_len : 0;
 
                                             apr_file_printf(
                                                     outfile,
@@ -509,10 +675,8 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                                     " %" APR_TIME_T_FMT
                                                     " %d %d\n",
                                                     url,
-                                                    round_up((apr_size_t)hinfo.size, round),
-                                                    round_up(
-                                                            disk_info.has_body ? (apr_size_t)dinfo.size
-                                                                    : 0, round),
+                                                    round_up((apr_size_t)(hinfo.size - dsize), round),
+                                                    round_up((apr_size_t)dsize, round),
                                                     disk_info.status,
                                                     disk_info.entity_version,
                                                     disk_info.date,
@@ -524,38 +688,7 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
                                         }
                                     }
                                     else {
-                                        apr_finfo_t dinfo;
-
-                                        /* stat the data file */
-                                        if (disk_info.has_body && APR_SUCCESS
-                                                != apr_stat(
-                                                        &dinfo,
-                                                        apr_pstrcat(
-                                                                p,
-                                                                path,
-                                                                "/",
-                                                                apr_pstrndup(
-                                                                        p,
-                                                                        info.name,
-                                                                        ext
-                                                                                - info.name),
-                                                                CACHE_DATA_SUFFIX,
-                                                                NULL),
-                                                        APR_FINFO_SIZE
-                                                                | APR_FINFO_IDENT,
-                                                        p)) {
-                                            /* ignore the file */
-                                        }
-                                        else if (disk_info.has_body && (dinfo.device
-                                                != disk_info.device
-                                                || dinfo.inode
-                                                        != disk_info.inode)) {
-                                            /* ignore the file */
-                                        }
-                                        else {
-                                            apr_file_printf(outfile, "%s\n",
-                                                    url);
-                                        }
+                                        apr_file_printf(outfile, "%s\n", url);
                                     }
                                 }
 
@@ -773,16 +906,42 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                 len = sizeof(format);
                 if (apr_file_read_full(fd, &format, len,
                                        &len) == APR_SUCCESS) {
-                    if (format == DISK_FORMAT_VERSION) {
+                    if (format == DISK_FORMAT_VERSION
+                        || split_info_len(format)) {
                         apr_off_t offset = 0;
 
                         apr_file_seek(fd, APR_SET, &offset);
 
-                        len = sizeof(disk_cache_info_t);
+                        memset(&disk_info, 0, sizeof(disk_cache_info_t));
+                        len = (format == DISK_FORMAT_VERSION)
+                              ? sizeof(disk_cache_info_t)
+                              : split_info_len(format);
 
                         if (apr_file_read_full(fd, &disk_info, len,
                                                &len) == APR_SUCCESS) {
                             apr_file_close(fd);
+
+                            /* Entities of the split format are moved into
+                             * a single file, which leaves the data file
+                             * behind, just like entities that apache has
+                             * already stored in the single file format.
+                             */
+                            if (format != DISK_FORMAT_VERSION
+                                && !dryrun) {
+                                if (migrate_entry(path, d->basename,
+                                        &disk_info, &d->hsize, p)
+                                        != APR_SUCCESS) {
+                                    delete_entry(path, d->basename, nodes, p);
+                                    break;
+                                }
+                                format = DISK_FORMAT_VERSION;
+                            }
+                            if (format == DISK_FORMAT_VERSION) {
+                                delete_file(path, apr_pstrcat(p, d->basename,
+                                        CACHE_DATA_SUFFIX, NULL), nodes, p);
+                                d->dsize = 0;
+                            }
+
                             e = apr_palloc(pool, sizeof(ENTRY));
                             APR_RING_INSERT_TAIL(&root.link, e, _entry, link);
                             e->expire = disk_info.expire;
@@ -792,11 +951,6 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             e->hsize = d->hsize;
                             e->dsize = d->dsize;
                             e->basename = apr_pstrdup(pool, d->basename);
-                            if (!disk_info.has_body) {
-                                delete_file(path, apr_pstrcat(p, path, "/",
-                                        d->basename, CACHE_DATA_SUFFIX, NULL),
-                                        nodes, p);
-                            }
                             break;
                         }
                         else {
@@ -889,16 +1043,34 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             break;
                         }
                     }
-                    else if (format == DISK_FORMAT_VERSION) {
+                    else if (format == DISK_FORMAT_VERSION
+                             || split_info_len(format)) {
                         apr_off_t offset = 0;
 
                         apr_file_seek(fd, APR_SET, &offset);
 
-                        len = sizeof(disk_cache_info_t);
+                        memset(&disk_info, 0, sizeof(disk_cache_info_t));
+                        len = (format == DISK_FORMAT_VERSION)
+                              ? sizeof(disk_cache_info_t)
+                              : split_info_len(format);
 
                         if (apr_file_read_full(fd, &disk_info, len,
                                                &len) == APR_SUCCESS) {
                             apr_file_close(fd);
+
+                            /* a split entity without its data file can
+                             * only be moved over if it never had a body
+                             */
+                            if (format != DISK_FORMAT_VERSION
+                                && !dryrun
+                                && (disk_info.has_body
+                                    || migrate_entry(path, d->basename,
+                                            &disk_info, &d->hsize, p)
+                                            != APR_SUCCESS)) {
+                                delete_entry(path, d->basename, nodes, p);
+                                break;
+                            }
+
                             e = apr_palloc(pool, sizeof(ENTRY));
                             APR_RING_INSERT_TAIL(&root.link, e, _entry, link);
                             e->expire = disk_info.expire;
@@ -1086,6 +1258,435 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
     }
 }
 
+/*
+ * add an entity to the index or mark it as most recently used, a store
+ * also updates its size
+ */
+static void index_touch(const char *basename, apr_time_t atime,
+        apr_off_t size, int store, apr_off_t round)
+{
+    IENTRY *e;
+
+    e = apr_hash_get(ihash, basename, APR_HASH_KEY_STRING);
+    if (!e) {
+        apr_size_t len;
+
+        /* served, but stored before we knew about it */
+        if (!store) {
+            return;
+        }
+
+        len = strlen(basename);
+        e = malloc(sizeof(IENTRY) + len);
+        if (!e) {
+            exit(1);
+        }
+        memcpy(e->basename, basename, len + 1);
+        e->size = 0;
+        apr_hash_set(ihash, e->basename, APR_HASH_KEY_STRING, e);
+        ientries++;
+        inum++;
+    }
+    else {
+        APR_RING_REMOVE(e, link);
+    }
+
+    if (store) {
+        isum -= round_up((apr_size_t)e->size, round);
+        e->size = size;
+        isum += round_up((apr_size_t)e->size, round);
+    }
+    e->atime = atime;
+    APR_RING_INSERT_TAIL(&iroot.link, e, _ientry, link);
+}
+
+/*
+ * drop an entity from the index
+ */
+static void index_remove(IENTRY *e, apr_off_t round)
+{
+    APR_RING_REMOVE(e, link);
+    apr_hash_set(ihash, e->basename, APR_HASH_KEY_STRING, NULL);
+    isum -= round_up((apr_size_t)e->size, round);
+    ientries--;
+    free(e);
+}
+
+/*
+ * drop the whole index
+ */
+static void index_clear(apr_off_t round)
+{
+    while (!APR_RING_EMPTY(&iroot.link, _ientry, link)) {
+        index_remove(APR_RING_FIRST(&iroot.link), round);
+    }
+    isum = 0;
+    ientries = 0;
+    inum = 0;
+}
+
+/*
+ * split a journal or index line "<op> <time> <size> <entity>"
+ */
+static int parse_record(char *line, char *op, apr_time_t *atime,
+        apr_off_t *size, char **basename)
+{
+    char *end;
+
+    if (!line[0] || line[1] != ' ') {
+        return 0;
+    }
+    *op = line[0];
+
+    *atime = (apr_time_t)apr_strtoi64(line + 2, &end, 10);
+    if (end == line + 2 || *end != ' ') {
+        return 0;
+    }
+    if (apr_strtoff(size, end + 1, &end, 10) != APR_SUCCESS || *end != ' ') {
+        return 0;
+    }
+
+    /* an incomplete line is the one still being written */
+    *basename = end + 1;
+    end = strchr(*basename, '\n');
+    if (!end || end == *basename) {
+        return 0;
+    }
+    *end = '\0';
+
+    /* never leave the cache root */
+    if (**basename == '/' || strstr(*basename, "..")) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * apply the records of a journal to the index
+ */
+static apr_status_t journal_read(const char *name, apr_pool_t *pool,
+        apr_off_t round)
+{
+    apr_file_t *fd;
+    apr_status_t status;
+    apr_time_t atime;
+    apr_off_t size;
+    char line[LINE_LEN], *basename, op;
+    IENTRY *e;
+
+    status = apr_file_open(&fd, name, APR_FOPEN_READ | APR_FOPEN_BINARY
+            | APR_FOPEN_BUFFERED, APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    while (!interrupted
+           && apr_file_gets(line, sizeof(line), fd) == APR_SUCCESS) {
+        if (!parse_record(line, &op, &atime, &size, &basename)) {
+            continue;
+        }
+        switch (op) {
+        case CACHE_JOURNAL_STORE:
+            index_touch(basename, atime, size, 1, round);
+            break;
+
+        case CACHE_JOURNAL_ACCESS:
+            index_touch(basename, atime, 0, 0, round);
+            break;
+
+        case CACHE_JOURNAL_REMOVE:
+            e = apr_hash_get(ihash, basename, APR_HASH_KEY_STRING);
+            if (e) {
+                index_remove(e, round);
+                inum--;
+            }
+            break;
+        }
+    }
+
+    apr_file_close(fd);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * take over what httpd journaled since the last call, the journal is
+ * linked aside and then replaced by an empty one in a single rename, so
+ * that no record gets lost in between
+ */
+static int journal_rotate(char *path, apr_pool_t *pool, apr_off_t round,
+        int discard)
+{
+    apr_pool_t *p;
+    apr_file_t *fd;
+    apr_status_t status;
+    char *journal, *work, *fresh;
+
+    apr_pool_create(&p, pool);
+    journal = apr_pstrcat(p, path, "/", CACHE_JOURNAL_FILE, NULL);
+    work = apr_pstrcat(p, path, "/", JOURNAL_WORK, NULL);
+    fresh = apr_pstrcat(p, path, "/", JOURNAL_NEW, NULL);
+
+    /* the records of an interrupted run come first */
+    if (!discard) {
+        journal_read(work, p, round);
+    }
+    apr_file_remove(work, p);
+
+    /* httpd appends to the journal as another user, possibly */
+    status = apr_file_open(&fd, fresh, APR_FOPEN_WRITE | APR_FOPEN_CREATE
+            | APR_FOPEN_TRUNCATE, CACHE_JOURNAL_PERMS, p);
+    if (status == APR_SUCCESS) {
+        apr_file_close(fd);
+        status = apr_file_link(journal, work);
+        if (APR_STATUS_IS_ENOENT(status)) {
+            /* nothing journaled yet */
+            status = APR_SUCCESS;
+        }
+        else if (status != APR_SUCCESS) {
+            /* no hard links here, records written in between get lost */
+            status = apr_file_rename(journal, work, p);
+        }
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(fresh, journal, p);
+    }
+    if (status != APR_SUCCESS) {
+        apr_file_remove(fresh, p);
+        apr_pool_destroy(p);
+        return 1;
+    }
+
+    /* the children of httpd append to what is now the work file until
+     * they notice the new journal
+     */
+    if (!discard) {
+        apr_sleep(CACHE_JOURNAL_RECHECK);
+        journal_read(work, p, round);
+    }
+    apr_file_remove(work, p);
+
+    apr_pool_destroy(p);
+
+    return interrupted != 0;
+}
+
+/*
+ * load the index saved by an earlier run
+ */
+static int index_load(char *path, apr_pool_t *pool, apr_off_t round)
+{
+    apr_pool_t *p;
+    apr_file_t *fd;
+    apr_time_t atime;
+    apr_off_t size, nodes;
+    char line[LINE_LEN], *name, *basename, *end, op;
+    int ok = 0;
+
+    apr_pool_create(&p, pool);
+    name = apr_pstrcat(p, path, "/", CACHE_INDEX_FILE, NULL);
+
+    if (apr_file_open(&fd, name, APR_FOPEN_READ | APR_FOPEN_BINARY
+            | APR_FOPEN_BUFFERED, APR_OS_DEFAULT, p) != APR_SUCCESS) {
+        apr_pool_destroy(p);
+        return 1;
+    }
+
+    if (apr_file_gets(line, sizeof(line), fd) == APR_SUCCESS
+        && !strncmp(line, INDEX_MAGIC " ", sizeof(INDEX_MAGIC))
+        && apr_strtoff(&nodes, line + sizeof(INDEX_MAGIC), &end, 10)
+                == APR_SUCCESS
+        && *end == '\n') {
+        ok = 1;
+        while (apr_file_gets(line, sizeof(line), fd) == APR_SUCCESS) {
+            if (!parse_record(line, &op, &atime, &size, &basename)
+                || op != CACHE_JOURNAL_STORE) {
+                ok = 0;
+                break;
+            }
+            index_touch(basename, atime, size, 1, round);
+        }
+    }
+
+    apr_file_close(fd);
+
+    /* the index is only good until the next journal is applied, make
+     * sure a crash leaves none behind that is out of date
+     */
+    apr_file_remove(name, p);
+    apr_pool_destroy(p);
+
+    if (!ok || interrupted) {
+        index_clear(round);
+        return 1;
+    }
+
+    inum = nodes;
+
+    return 0;
+}
+
+/*
+ * save the index for the next run
+ */
+static int index_save(char *path, apr_pool_t *pool)
+{
+    apr_pool_t *p;
+    apr_file_t *fd;
+    apr_status_t status;
+    IENTRY *e;
+    char *name, *fresh;
+
+    apr_pool_create(&p, pool);
+    name = apr_pstrcat(p, path, "/", CACHE_INDEX_FILE, NULL);
+    fresh = apr_pstrcat(p, path, "/", INDEX_NEW, NULL);
+
+    status = apr_file_open(&fd, fresh, APR_FOPEN_WRITE | APR_FOPEN_CREATE
+            | APR_FOPEN_TRUNCATE | APR_FOPEN_BINARY | APR_FOPEN_BUFFERED,
+            APR_OS_DEFAULT, p);
+    if (status == APR_SUCCESS) {
+        if (apr_file_printf(fd, INDEX_MAGIC " %" APR_OFF_T_FMT "\n",
+                            inum) < 0) {
+            status = APR_EGENERAL;
+        }
+        for (e = APR_RING_FIRST(&iroot.link);
+             status == APR_SUCCESS
+             && e != APR_RING_SENTINEL(&iroot.link, _ientry, link);
+             e = APR_RING_NEXT(e, link)) {
+            if (apr_file_printf(fd, "%c %" APR_TIME_T_FMT " %" APR_OFF_T_FMT
+                                " %s\n", CACHE_JOURNAL_STORE, e->atime,
+                                e->size, e->basename) < 0) {
+                status = APR_EGENERAL;
+            }
+        }
+        if (apr_file_close(fd) != APR_SUCCESS) {
+            status = APR_EGENERAL;
+        }
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(fresh, name, p);
+    }
+    if (status != APR_SUCCESS) {
+        apr_file_remove(fresh, p);
+    }
+
+    apr_pool_destroy(p);
+
+    return status != APR_SUCCESS;
+}
+
+/*
+ * sort entities found by process_dir() oldest first
+ */
+static apr_time_t entry_time(const ENTRY *e)
+{
+    return e->htime > e->dtime ? e->htime : e->dtime;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    apr_time_t ta = entry_time(*(const ENTRY * const *)a);
+    apr_time_t tb = entry_time(*(const ENTRY * const *)b);
+
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+/*
+ * build the index from a walk of the cache directory tree
+ */
+static int index_build(char *path, apr_pool_t *pool, apr_off_t round)
+{
+    ENTRY *e, **list;
+    apr_off_t nodes = 0;
+    int count = 0, i;
+
+    /* what httpd journaled until now is covered by the walk */
+    if (journal_rotate(path, pool, round, 1)) {
+        return 1;
+    }
+
+    APR_RING_INIT(&root.link, _entry, link);
+    if (process_dir(path, pool, &nodes) || interrupted) {
+        return 1;
+    }
+
+    for (e = APR_RING_FIRST(&root.link);
+         e != APR_RING_SENTINEL(&root.link, _entry, link);
+         e = APR_RING_NEXT(e, link)) {
+        count++;
+    }
+
+    list = apr_palloc(pool, (count + 1) * sizeof(ENTRY *));
+    for (i = 0, e = APR_RING_FIRST(&root.link);
+         e != APR_RING_SENTINEL(&root.link, _entry, link);
+         e = APR_RING_NEXT(e, link)) {
+        list[i++] = e;
+    }
+    qsort(list, count, sizeof(ENTRY *), entry_cmp);
+
+    for (i = 0; i < count; i++) {
+        index_touch(list[i]->basename, entry_time(list[i]),
+                    list[i]->hsize + list[i]->dsize, 1, round);
+    }
+    inum = nodes;
+
+    return 0;
+}
+
+/*
+ * bring the index up to date, at the cost of a walk of the cache
+ * directory tree only when there is no index to start from
+ */
+static int index_update(char *path, apr_pool_t *pool, apr_off_t round)
+{
+    if (indexed == 1) {
+        if (index_load(path, pool, round)
+            && index_build(path, pool, round)) {
+            index_clear(round);
+            return 1;
+        }
+        indexed = 2;
+    }
+
+    return journal_rotate(path, pool, round, 0);
+}
+
+/*
+ * purge indexed cache entries least recently used first
+ */
+static void index_purge(char *path, apr_pool_t *pool, apr_off_t max,
+        apr_off_t inodes, apr_off_t round)
+{
+    IENTRY *e;
+    struct stats s;
+
+    s.total = isum;
+    s.etotal = ientries;
+    s.ntotal = inum;
+    s.max = max;
+    s.inodes = inodes;
+    s.dfuture = 0;
+    s.dexpired = 0;
+    s.dfresh = 0;
+
+    while (((max && isum > max) || (inodes && inum > inodes))
+           && !interrupted && !APR_RING_EMPTY(&iroot.link, _ientry, link)) {
+        e = APR_RING_FIRST(&iroot.link);
+        delete_entry(path, e->basename, &inum, pool);
+        index_remove(e, round);
+        s.dfresh++;
+    }
+
+    s.sum = isum;
+    s.entries = ientries;
+    s.nodes = inum;
+
+    if (!interrupted) {
+        printstats(path, &s);
+    }
+}
+
 static apr_status_t remove_directory(apr_pool_t *pool, const char *dir)
 {
     apr_status_t rv;
@@ -1287,6 +1888,7 @@ static void usage(const char *error)
     "Usage: %s [-Dvtrn] -pPATH [-lLIMIT] [-LLIMIT] [-PPIDFILE]"              NL
     "       %s [-nti] -dINTERVAL -pPATH [-lLIMIT] [-LLIMIT] [-PPIDFILE]"     NL
     "       %s [-Dvt] -pPATH URL ..."                                        NL
+    "       %s -j [-nvt] [-dINTERVAL] -pPATH [-lLIMIT] [-LLIMIT] [-PPIDFILE]" NL
                                                                              NL
     "Options:"                                                               NL
     "  -d   Daemonize and repeat cache cleaning every INTERVAL minutes."     NL
@@ -1330,6 +1932,12 @@ static void usage(const char *error)
     "       the disk cache. This option is only possible together with the"  NL
     "       -d option."                                                      NL
                                                                              NL
+    "  -j   Keep an index of the cache, which is built by walking the"      NL
+    "       cache once and then kept up to date from the journal written"   NL
+    "       by mod_cache_disk with CacheJournal on. Entities are deleted"    NL
+    "       least recently used first. This option is mutually exclusive"    NL
+    "       with the -i, -r, -D, -a and -A options."                         NL
+                                                                             NL
     "  -a   List the URLs currently stored in the cache. Variants of the"    NL
     "       same URL will be listed once for each variant."                  NL
                                                                              NL
@@ -1347,6 +1955,7 @@ static void usage(const char *error)
     shortname,
     shortname,
     shortname,
+    shortname,
     shortname
     );
 
@@ -1438,7 +2047,7 @@ int main(int argc, const char * const argv[])
     apr_getopt_init(&o, pool, argc, argv);
 
     while (1) {
-        status = apr_getopt(o, "iDnvrtd:l:L:p:P:R:aA", &opt, &arg);
+        status = apr_getopt(o, "iDnvrtjd:l:L:p:P:R:aA", &opt, &arg);
         if (status == APR_EOF) {
             break;
         }
@@ -1492,6 +2101,13 @@ int main(int argc, const char * const argv[])
                 deldirs = 1;
                 break;
 
+            case 'j':
+                if (indexed) {
+                    usage_repeated_arg(pool, opt);
+                }
+                indexed = 1;
+                break;
+
             case 'd':
                 if (isdaemon) {
                     usage_repeated_arg(pool, opt);
@@ -1640,6 +2256,9 @@ int main(int argc, const char * const argv[])
         if (limit_found) {
             usage("Option -l and -L cannot be used with URL arguments, aborting");
         }
+        if (indexed) {
+            usage("Option -j cannot be used with URL arguments, aborting");
+        }
         while (o->ind < argc) {
             status = delete_url(pool, proxypath, argv[o->ind]);
             if (APR_SUCCESS == status) {
@@ -1679,6 +2298,10 @@ int main(int argc, const char * const argv[])
          usage("Option -i cannot be used without -d");
     }
 
+    if (indexed && (intelligent || realclean || dryrun || listurls)) {
+         usage("Option -j cannot be used with -i, -r, -D, -a or -A");
+    }
+
     if (!listurls && max <= 0 && inodes <= 0) {
          usage("At least one of option -l or -L must be greater than zero");
     }
@@ -1699,6 +2322,11 @@ int main(int argc, const char * const argv[])
         return (interrupted != 0);
     }
 
+    if (indexed) {
+        APR_RING_INIT(&iroot.link, _ientry, link);
+        ihash = apr_hash_make(pool);
+    }
+
 #ifndef DEBUG
     if (isdaemon) {
         apr_file_close(errfile);
@@ -1770,7 +2398,17 @@ int main(int argc, const char * const argv[])
 
         if (dowork && !interrupted) {
             apr_off_t nodes = 0;
-            if (!process_dir(path, instance, &nodes) && !interrupted) {
+            if (indexed) {
+                if (!index_update(path, instance, round) && !interrupted) {
+                    index_purge(path, instance, max, inodes, round);
+                }
+                else if (!isdaemon && !interrupted) {
+                    apr_file_printf(errfile, "An error occurred, cache "
+                                    "cleaning aborted." APR_EOL_STR);
+                    return 1;
+                }
+            }
+            else if (!process_dir(path, instance, &nodes) && !interrupted) {
                 purge(path, instance, max, inodes, nodes, round);
             }
             else if (!isdaemon && !interrupted) {
@@ -1832,6 +2470,11 @@ int main(int argc, const char * const argv[])
         }
     } while (isdaemon && !interrupted);
 
+    /* the index survives a restart, provided we are not killed */
+    if (indexed == 2) {
+        index_save(path, pool);
+    }
+
     if (!isdaemon && interrupted) {
         apr_file_printf(errfile, "Cache cleaning aborted due to user "
                                  "request." APR_EOL_STR);
@@ -0,0 +1,30 @@
+#!/usr/bin/env python3
+import os, sys
+
+# The query string selects the Cache-Control of the response. The status
+# is taken from the file 'stale-<query>.status', if there is one, and each
+# call is counted in 'stale-<query>.count', next to this script.
+controls = {
+    "swr": "max-age=3, stale-while-revalidate=30",
+    "sie": "max-age=1, stale-if-error=30",
+    "sie-short": "max-age=1, stale-if-error=1",
+}
+query = os.environ.get("QUERY_STRING", "")
+here = os.path.dirname(os.path.abspath(__file__))
+
+status = "200"
+try:
+    with open(os.path.join(here, f"stale-{query}.status")) as fd:
+        status = fd.read().strip()
+except FileNotFoundError:
+    pass
+with open(os.path.join(here, f"stale-{query}.count"), "a") as fd:
+    fd.write("x")
+with open(os.path.join(here, f"stale-{query}.count")) as fd:
+    count = len(fd.read())
+
+content = f"{query} response {count}\n"
+print(f"Status: {status}")
+print(f"Cache-Control: {controls.get(query, 'no-store')}")
+print("Content-Type: text/plain\n")
+sys.stdout.write(content)
@@ -0,0 +1,10 @@
+#!/usr/bin/env python3
+import os, sys
+
+# A cacheable response which varies on the Accept-Language of the request
+lang = os.environ.get("HTTP_ACCEPT_LANGUAGE", "none")
+print("Status: 200")
+print("Cache-Control: max-age=3600")
+print("Vary: Accept-Language")
+print("Content-Type: text/plain\n")
+sys.stdout.write(f"language {lang}\n")
@@ -0,0 +1,248 @@
+import logging
+import os
+import re
+import shutil
+import struct
+import time
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+log = logging.getLogger(__name__)
+
+
+class TestCacheDisk:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        cache_root = os.path.join(env.gen_dir, 'cache-disk')
+        if os.path.exists(cache_root):
+            shutil.rmtree(cache_root)
+        os.makedirs(cache_root)
+        conf = HttpdConf(env, extras={
+            'base': f"""
+        CacheRoot {cache_root}
+        CacheDirLevels 2
+        CacheDirLength 1
+        CacheHeader on
+        CacheIgnoreNoLastMod on
+        CacheDefaultExpire 3600
+        """,
+            f"test1.{env.http_tld}": [
+                "CacheEnable disk /",
+            ],
+        })
+        conf.add_vhost_test1()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    def cache_files(self, env):
+        root = os.path.join(env.gen_dir, 'cache-disk')
+        found = []
+        for dirpath, dirnames, filenames in os.walk(root):
+            found.extend(filenames)
+        return found
+
+    def get_twice(self, env, path):
+        url = env.mkurl("https", "test1", path)
+        r1 = env.curl_get(url)
+        assert r1.response["status"] == 200
+        r2 = env.curl_get(url)
+        assert r2.response["status"] == 200
+        return r1, r2
+
+    # a cached entity is a single file, served from there on the next hit
+    def test_core_003_01(self, env):
+        r1, r2 = self.get_twice(env, "/006.html")
+        assert r1.response["header"]["x-cache"].startswith("MISS")
+        assert r2.response["header"]["x-cache"].startswith("HIT")
+        with open(os.path.join(env.server_docs_dir, "test1", "006.html"), 'rb') as fd:
+            assert r2.response["body"] == fd.read()
+        files = self.cache_files(env)
+        assert len([f for f in files if f.endswith(".header")]) > 0
+        assert len([f for f in files if f.endswith(".data")]) == 0
+
+    # a larger binary body survives the round trip unchanged
+    def test_core_003_02(self, env):
+        r1, r2 = self.get_twice(env, "/002.jpg")
+        assert r2.response["header"]["x-cache"].startswith("HIT")
+        assert r2.response["body"] == r1.response["body"]
+        with open(os.path.join(env.server_docs_dir, "test1", "002.jpg"), 'rb') as fd:
+            assert r2.response["body"] == fd.read()
+
+    # htcacheclean lists the entities with their body size
+    def test_core_003_03(self, env):
+        self.get_twice(env, "/006.html")
+        htcacheclean = os.path.join(env.bin_dir, "htcacheclean")
+        if not os.path.exists(htcacheclean):
+            pytest.skip("htcacheclean not installed")
+        r = env.run([htcacheclean, "-A", f"-p{os.path.join(env.gen_dir, 'cache-disk')}"])
+        assert r.exit_code == 0
+        size = os.path.getsize(os.path.join(env.server_docs_dir, "test1", "006.html"))
+        lines = [l for l in r.stdout.splitlines() if "/006.html" in l]
+        assert len(lines) == 1, f"{r.stdout}"
+        assert int(lines[0].split()[2]) == size
+
+    # hit latency, for comparing on-disk formats
+    @pytest.mark.skipif(condition=not shutil.which("h2load"), reason="no h2load")
+    def test_core_003_04(self, env):
+        self.get_twice(env, "/006.html")
+        n = 2000
+        r = env.run([env.h2load, "-n", f"{n}", "-c", "4", "-m", "1",
+                     f"--connect-to=localhost:{env.https_port}",
+                     env.mkurl("https", "test1", "/006.html")])
+        assert r.exit_code == 0
+        r = env.h2load_status(r)
+        assert n == r.results["h2load"]["requests"]["succeeded"], f'{r.results}'
+        m = re.search(r'time for request:\s+(\S+)\s+(\S+)\s+(\S+)', r.stdout)
+        if m:
+            log.info(f"cache hit latency min/max/mean: "
+                     f"{m.group(1)}/{m.group(2)}/{m.group(3)}")
+
+    # an entity of the split format 6, as stored before the stale-* fields
+    # of the cache control, is moved into a single file by htcacheclean
+    # rather than deleted (struct layout as on LP64)
+    def test_core_003_05(self, env):
+        htcacheclean = os.path.join(env.bin_dir, "htcacheclean")
+        if not os.path.exists(htcacheclean):
+            pytest.skip("htcacheclean not installed")
+        root = os.path.join(env.gen_dir, 'cache-disk-v6')
+        shutil.rmtree(root, ignore_errors=True)
+        edir = os.path.join(root, "A", "b")
+        os.makedirs(edir)
+        name = f"http://test1.{env.http_tld}:{env.http_port}/old.html?"
+        body = b"old entity\n" * 1000
+        with open(os.path.join(edir, "entity.data"), 'wb') as fd:
+            fd.write(body)
+        st = os.stat(os.path.join(edir, "entity.data"))
+        now = int(time.time() * 1000000)
+        # has_body, and the bits of stale_while_revalidate/stale_if_error
+        # set in what used to be padding
+        control_bits = (1 << 18) | (1 << 19)
+        info = struct.pack("<IiQQqqqqQQI4xI4xqqqq", 6, 200, len(name), 1,
+                           now, now + 3600 * 1000000, now, now,
+                           st.st_ino, st.st_dev, 1,
+                           control_bits, -1, -1, -1, -1)
+        assert len(info) == 120
+        block = (name + "Content-Type: text/plain\r\n\r\n\r\n").encode()
+        with open(os.path.join(edir, "entity.header"), 'wb') as fd:
+            fd.write(info + block)
+        r = env.run([htcacheclean, f"-p{root}", "-l100M"])
+        assert r.exit_code == 0, r.stderr
+        assert not os.path.exists(os.path.join(edir, "entity.data"))
+        with open(os.path.join(edir, "entity.header"), 'rb') as fd:
+            data = fd.read()
+        fmt, status, name_len = struct.unpack_from("<IiQ", data, 0)
+        assert (fmt, status, name_len) == (8, 200, len(name))
+        (bits,) = struct.unpack_from("<I", data, 80)
+        assert bits & control_bits == 0
+        hdrs_len, body_offset, body_len = struct.unpack_from("<Qqq", data, 136)
+        assert data[160:160 + hdrs_len] == block
+        assert body_len == len(body)
+        assert data[body_offset:body_offset + body_len] == body
+        r = env.run([htcacheclean, "-A", f"-p{root}"])
+        assert r.exit_code == 0
+        lines = [l for l in r.stdout.splitlines() if l.startswith(name)]
+        assert len(lines) == 1, f"{r.stdout}"
+        assert int(lines[0].split()[2]) == len(body)
+
+
+class TestCacheDiskWriteBehind:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        cache_root = os.path.join(env.gen_dir, 'cache-disk-wb')
+        if os.path.exists(cache_root):
+            shutil.rmtree(cache_root)
+        os.makedirs(cache_root)
+        conf = HttpdConf(env, extras={
+            'base': f"""
+        CacheRoot {cache_root}
+        CacheDirLevels 2
+        CacheDirLength 1
+        CacheHeader on
+        CacheIgnoreNoLastMod on
+        CacheDefaultExpire 3600
+        CacheWriteBehindThreads 2
+        """,
+            f"test1.{env.http_tld}": [
+                "CacheEnable disk /",
+                "CacheWriteBehind on",
+            ],
+        })
+        conf.add_vhost_test1()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # the body written in the background is served from the cache, once
+    # the writer got to it
+    def test_core_003_10(self, env):
+        url = env.mkurl("https", "test1", "/002.jpg")
+        r = env.curl_get(url)
+        assert r.response["status"] == 200
+        assert r.response["header"]["x-cache"].startswith("MISS")
+        with open(os.path.join(env.server_docs_dir, "test1", "002.jpg"), 'rb') as fd:
+            body = fd.read()
+        assert r.response["body"] == body
+        for i in range(50):
+            r = env.curl_get(url)
+            assert r.response["status"] == 200
+            if r.response["header"]["x-cache"].startswith("HIT"):
+                break
+            time.sleep(0.1)
+        assert r.response["header"]["x-cache"].startswith("HIT")
+        assert r.response["body"] == body
+
+
+class TestCacheDiskJournal:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        cache_root = os.path.join(env.gen_dir, 'cache-disk-journal')
+        if os.path.exists(cache_root):
+            shutil.rmtree(cache_root)
+        os.makedirs(cache_root)
+        conf = HttpdConf(env, extras={
+            'base': f"""
+        CacheRoot {cache_root}
+        CacheDirLevels 2
+        CacheDirLength 1
+        CacheHeader on
+        CacheIgnoreNoLastMod on
+        CacheDefaultExpire 3600
+        CacheJournal on
+        """,
+            f"test1.{env.http_tld}": [
+                "CacheEnable disk /",
+            ],
+        })
+        conf.add_vhost_test1()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # htcacheclean picks up what was stored from the journal and evicts
+    # it from its index, without walking the cache again
+    def test_core_003_20(self, env):
+        htcacheclean = os.path.join(env.bin_dir, "htcacheclean")
+        if not os.path.exists(htcacheclean):
+            pytest.skip("htcacheclean not installed")
+        cache_root = os.path.join(env.gen_dir, 'cache-disk-journal')
+        r = env.run([htcacheclean, "-j", f"-p{cache_root}", "-l100M"])
+        assert r.exit_code == 0
+        assert os.path.exists(os.path.join(cache_root, "cache.index"))
+        assert os.path.exists(os.path.join(cache_root, "cache.journal"))
+        url = env.mkurl("https", "test1", "/006.html")
+        r = env.curl_get(url)
+        assert r.response["header"]["x-cache"].startswith("MISS")
+        r = env.curl_get(url)
+        assert r.response["header"]["x-cache"].startswith("HIT")
+        with open(os.path.join(cache_root, "cache.journal")) as fd:
+            ops = [l[0] for l in fd.read().splitlines()]
+        assert "+" in ops and "*" in ops, f"{ops}"
+        r = env.run([htcacheclean, "-j", f"-p{cache_root}", "-l1"])
+        assert r.exit_code == 0
+        headers = []
+        for dirpath, dirnames, filenames in os.walk(cache_root):
+            headers.extend([f for f in filenames if f.endswith(".header")])
+        assert headers == []
@@ -0,0 +1,91 @@
+import os
+import shutil
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+
+class TestCacheMemory:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        cache_root = os.path.join(env.gen_dir, 'cache-memory')
+        if os.path.exists(cache_root):
+            shutil.rmtree(cache_root)
+        os.makedirs(cache_root)
+        conf = HttpdConf(env, extras={
+            'base': f"""
+        CacheRoot {cache_root}
+        CacheDirLevels 2
+        CacheDirLength 1
+        CacheHeader on
+        CacheDetailHeader on
+        CacheIgnoreNoLastMod on
+        CacheDefaultExpire 3600
+        CacheMemorySize 1048576
+        CacheMemoryMaxEntitySize 16384
+        """,
+            f"test1.{env.http_tld}": [
+                "CacheEnable disk /",
+            ],
+            f"cgi.{env.http_tld}": [
+                "CacheEnable disk /",
+            ],
+        })
+        conf.add_vhost_test1()
+        conf.add_vhost_cgi()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    def get_until_memory(self, env, path, tries=20, vhost="test1",
+                         scheme="https", options=None):
+        url = env.mkurl(scheme, vhost, path)
+        for i in range(tries):
+            r = env.curl_get(url, options=options)
+            assert r.response["status"] == 200
+            if "from memory" in r.response["header"].get("x-cache-detail", ""):
+                return r
+        return r
+
+    # entities served from disk are taken into memory and served from there
+    def test_core_004_01(self, env):
+        r = self.get_until_memory(env, "/006.html")
+        assert "from memory" in r.response["header"]["x-cache-detail"]
+        assert r.response["header"]["x-cache"].startswith("HIT")
+        with open(os.path.join(env.server_docs_dir, "test1", "006.html"), 'rb') as fd:
+            assert r.response["body"] == fd.read()
+
+    # bodies over CacheMemoryMaxEntitySize stay on disk
+    def test_core_004_02(self, env):
+        size = os.path.getsize(os.path.join(env.server_docs_dir, "test1", "002.jpg"))
+        assert size > 16384
+        r = self.get_until_memory(env, "/002.jpg", tries=6)
+        assert r.response["header"]["x-cache"].startswith("HIT")
+        assert "from memory" not in r.response["header"]["x-cache-detail"]
+
+    # the variants of a Vary'd entity are held apart and each is served
+    # from memory to the requests it was selected for
+    def test_core_004_03(self, env):
+        for lang in ["de", "en", "de", "en"]:
+            r = self.get_until_memory(env, "/vary.py", vhost="cgi",
+                                      scheme="http",
+                                      options=["-H", f"Accept-Language: {lang}"])
+            assert "from memory" in r.response["header"]["x-cache-detail"], \
+                f"{lang}: {r.response['header']}"
+            assert r.response["body"] == f"language {lang}\n".encode()
+
+    # an entity cached on a HEAD is not taken into memory, the GETs
+    # after it get the full body
+    def test_core_004_04(self, env):
+        url = env.mkurl("https", "test1", "/007.html")
+        for i in range(3):
+            r = env.curl_get(url, options=["-I"])
+            assert r.response["status"] == 200
+        with open(os.path.join(env.server_docs_dir, "test1", "007.html"), 'rb') as fd:
+            body = fd.read()
+        assert len(body) > 0
+        for i in range(3):
+            r = env.curl_get(url)
+            assert r.response["status"] == 200
+            assert r.response["body"] == body
@@ -0,0 +1,127 @@
+import http.client
+import os
+import re
+import shutil
+import time
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+
+class TestCacheStale:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        cache_root = os.path.join(env.gen_dir, 'cache-stale')
+        if os.path.exists(cache_root):
+            shutil.rmtree(cache_root)
+        os.makedirs(cache_root)
+        conf = HttpdConf(env, extras={
+            'base': f"""
+        CacheRoot {cache_root}
+        CacheDirLevels 2
+        CacheDirLength 1
+        CacheHeader on
+        CacheIgnoreNoLastMod on
+        CacheStaleWhileRevalidate on
+        <Location /server-status>
+            SetHandler server-status
+        </Location>
+        """,
+            f"cgi.{env.http_tld}": [
+                "CacheEnable disk /",
+                "CacheDisable /server-status",
+            ],
+        })
+        conf.add_vhost_cgi()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    @pytest.fixture(autouse=True)
+    def conn(self, env):
+        # a single connection, so that all requests and the status
+        # counters of mod_cache are those of one child
+        self.c = http.client.HTTPConnection("localhost", env.http_port,
+                                            timeout=10)
+        yield
+        self.c.close()
+
+    def get(self, env, path):
+        self.c.request("GET", path,
+                       headers={"Host": f"cgi.{env.http_tld}"})
+        r = self.c.getresponse()
+        return r.status, r.headers, r.read().decode()
+
+    def stats(self, env):
+        status, headers, body = self.get(env, "/server-status?auto")
+        assert status == 200
+        stats = {}
+        for line in body.splitlines():
+            m = re.match(r'(Cache\S+): (\d+)', line)
+            if m:
+                stats[m.group(1)] = int(m.group(2))
+        return stats
+
+    def set_status(self, env, query, status):
+        path = os.path.join(env.server_docs_dir, "cgi", f"stale-{query}.status")
+        with open(path, 'w') as fd:
+            fd.write(f"{status}\n")
+
+    def calls(self, env, query):
+        path = os.path.join(env.server_docs_dir, "cgi", f"stale-{query}.count")
+        with open(path) as fd:
+            return len(fd.read())
+
+    # a stale entity within stale-while-revalidate is served right away
+    # and refreshed in the background
+    def test_core_005_01(self, env):
+        before = self.stats(env)
+        status, headers, body = self.get(env, "/stale.py?swr")
+        assert (status, body) == (200, "swr response 1\n")
+        time.sleep(4)
+        status, headers, body = self.get(env, "/stale.py?swr")
+        assert (status, body) == (200, "swr response 1\n")
+        assert "110" in headers.get("Warning", "")
+        # the background refresh went to the origin and stored its answer
+        for i in range(20):
+            if self.calls(env, "swr") == 2:
+                break
+            time.sleep(0.2)
+        assert self.calls(env, "swr") == 2
+        time.sleep(1)
+        status, headers, body = self.get(env, "/stale.py?swr")
+        assert (status, body) == (200, "swr response 2\n")
+        assert "110" not in headers.get("Warning", "")
+        after = self.stats(env)
+        assert after["CacheStaleWhileRevalidate"] - before["CacheStaleWhileRevalidate"] == 1
+        assert after["CacheRefreshStarted"] - before["CacheRefreshStarted"] == 1
+        assert after["CacheRefreshFailed"] == before["CacheRefreshFailed"]
+        assert after["CacheRefreshActive"] == 0
+
+    # a stale entity within stale-if-error replaces an error of the origin
+    def test_core_005_02(self, env):
+        before = self.stats(env)
+        status, headers, body = self.get(env, "/stale.py?sie")
+        assert (status, body) == (200, "sie response 1\n")
+        self.set_status(env, "sie", 503)
+        time.sleep(2)
+        status, headers, body = self.get(env, "/stale.py?sie")
+        assert (status, body) == (200, "sie response 1\n")
+        assert "111" in headers.get("Warning", "")
+        assert self.calls(env, "sie") == 2
+        after = self.stats(env)
+        assert after["CacheStaleIfError"] - before["CacheStaleIfError"] == 1
+        assert after["CacheStaleWhileRevalidate"] == before["CacheStaleWhileRevalidate"]
+
+    # beyond stale-if-error, the error of the origin is passed on
+    def test_core_005_03(self, env):
+        before = self.stats(env)
+        status, headers, body = self.get(env, "/stale.py?sie-short")
+        assert (status, body) == (200, "sie-short response 1\n")
+        self.set_status(env, "sie-short", 503)
+        time.sleep(3)
+        status, headers, body = self.get(env, "/stale.py?sie-short")
+        assert status == 503
+        after = self.stats(env)
+        assert after["CacheStaleIfError"] == before["CacheStaleIfError"]
@@ -0,0 +1,99 @@
+import os
+import shutil
+import socket
+import ssl
+import struct
+import time
+
+import pytest
+
+from .env import H1Conf
+
+
+class TestTlsRecords:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        if env.ssl_module != 'mod_ssl':
+            pytest.skip("TLS record sizing is a mod_ssl feature")
+        for vhost in ["test1", "test2", "cgi"]:
+            shutil.copyfile(os.path.join(env.gen_dir, "data-100k"),
+                            os.path.join(env.server_docs_dir, vhost, "data-100k.txt"))
+        H1Conf(env, extras={
+            f"test2.{env.http_tld}": "SSLRecordWarmUpSize 16384",
+            f"cgi.{env.http_tld}": "SSLRecordWarmUpSize 0",
+        }).add_vhost_test1().add_vhost_test2().add_vhost_cgi().install()
+        assert env.apache_restart() == 0
+
+    def get_records(self, env, host, path):
+        """GET the path over TLSv1.2, where all records after the handshake
+        carry application data, and return the lengths of the records
+        received together with the time and number of bytes it took
+        until the first of them could be decrypted."""
+        domain = f"{host}.{env.http_tld}"
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        ctx.check_hostname = False
+        ctx.verify_mode = ssl.CERT_NONE
+        ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+        incoming = ssl.MemoryBIO()
+        outgoing = ssl.MemoryBIO()
+        tls = ctx.wrap_bio(incoming, outgoing, server_hostname=domain)
+        sock = socket.create_connection(('localhost', env.https_port), timeout=5)
+        try:
+            while True:
+                try:
+                    tls.do_handshake()
+                    break
+                except ssl.SSLWantReadError:
+                    sock.sendall(outgoing.read())
+                    data = sock.recv(16384)
+                    assert data, "connection closed during handshake"
+                    incoming.write(data)
+            tls.write(f"GET {path} HTTP/1.1\r\nHost: {domain}\r\n"
+                      "Connection: close\r\n\r\n".encode())
+            start = time.monotonic()
+            sock.sendall(outgoing.read())
+            raw = b''
+            ttfb = None
+            while True:
+                data = sock.recv(65536)
+                if not data:
+                    break
+                raw += data
+                if ttfb is None and len(raw) >= 5 \
+                        and len(raw) >= 5 + struct.unpack('!H', raw[3:5])[0]:
+                    ttfb = time.monotonic() - start
+        finally:
+            sock.close()
+        records = []
+        offset = 0
+        while offset + 5 <= len(raw):
+            rtype, rlen = raw[offset], struct.unpack('!H', raw[offset+3:offset+5])[0]
+            if rtype == 23:
+                records.append(rlen)
+            offset += 5 + rlen
+        assert len(records) > 0
+        return records, ttfb, 5 + records[0]
+
+    # a new connection gets records that fit into a TCP segment each,
+    # the first bytes can be decrypted as soon as the first packet arrives
+    def test_h1_008_01(self, env):
+        records, ttfb, first_bytes = self.get_records(env, "test1", "/data-100k.txt")
+        assert sum(records) > 100000
+        assert max(records) <= 1400, f"{records}"
+        assert first_bytes <= 1405
+        print(f"time to first decryptable byte: {ttfb:.6f}s, {first_bytes} bytes")
+
+    # without warm up, the body goes out in large records
+    def test_h1_008_02(self, env):
+        records, ttfb, first_bytes = self.get_records(env, "cgi", "/data-100k.txt")
+        assert sum(records) > 100000
+        assert max(records) > 1400, f"{records}"
+        print(f"time to first decryptable byte: {ttfb:.6f}s, {first_bytes} bytes")
+
+    # small records until the warm up size is reached, large ones after
+    def test_h1_008_03(self, env):
+        records, ttfb, first_bytes = self.get_records(env, "test2", "/data-100k.txt")
+        large = [i for i, rlen in enumerate(records) if rlen > 1400]
+        assert len(large) > 0, f"{records}"
+        assert sum(records[:large[0]]) >= 16384 - 1400, f"{records}"
@@ -1,3 +1,6 @@
+import os
+from concurrent.futures import ThreadPoolExecutor
+
 import pytest
 
 from .env import H2Conf, H2TestEnv
@@ -136,6 +139,57 @@ class TestH2Proxy:
             else env.http_port2
         assert int(r.json[1]["port"]) == exp_port
 
+    # concurrent requests on shared backend sessions
+    def test_h2_600_06(self, env):
+        conf = H2Conf(env, extras={
+            f'cgi.{env.http_tld}': [
+                "LogLevel proxy_http2:debug",
+                f"ProxyPass /h2c/ h2c://127.0.0.1:{env.http_port}/",
+                "ProxyHTTP2Multiplex on",
+            ]
+        })
+        conf.add_vhost_cgi()
+        conf.install()
+        assert env.apache_restart() == 0
+        error_log = os.path.join(env.server_logs_dir, "error_log")
+        with open(error_log) as fd:
+            before = fd.read().count("AH10498")
+        # slow enough for all requests to overlap
+        url = env.mkurl("https", "cgi", "/h2c/necho.py?count=1&text=shared&wait1=1")
+        n = 16
+        with ThreadPoolExecutor(max_workers=n) as executor:
+            results = list(executor.map(
+                lambda i: env.curl_get(url, 5, options=["--http1.1"]),
+                range(n)))
+        for r in results:
+            assert r.response["status"] == 200
+            assert r.response["body"] == b"shared\n"
+        with open(error_log) as fd:
+            sessions = fd.read().count("AH10498") - before
+        # fewer backend connections than requests
+        assert 0 < sessions < n, f"{sessions} sessions for {n} requests"
+
+    # request bodies on shared backend sessions
+    def test_h2_600_07(self, env):
+        conf = H2Conf(env, extras={
+            f'cgi.{env.http_tld}': [
+                f"ProxyPass /h2c/ h2c://127.0.0.1:{env.http_port}/",
+                "ProxyHTTP2Multiplex on",
+            ]
+        })
+        conf.add_vhost_cgi()
+        conf.install()
+        assert env.apache_restart() == 0
+        url = env.mkurl("https", "cgi", "/h2c/echo.py")
+        n = 8
+        with ThreadPoolExecutor(max_workers=n) as executor:
+            results = list(executor.map(
+                lambda i: env.curl_post_data(url, f"{i}" * (1000 * (i + 1)), 5),
+                range(n)))
+        for i, r in enumerate(results):
+            assert r.response["status"] == 200
+            assert r.response["body"] == f"{i}".encode() * (1000 * (i + 1))
+
     # lets do some error tests
     def test_h2_600_30(self, env):
         conf = H2Conf(env)
@@ -17,7 +17,9 @@ class ProxyTestSetup(HttpdTestSetup):
     def __init__(self, env: 'HttpdTestEnv'):
         super().__init__(env=env)
         self.add_source_dir(os.path.dirname(inspect.getfile(ProxyTestSetup)))
-        self.add_modules(["proxy", "proxy_http", "proxy_balancer", "lbmethod_byrequests"])
+        self.add_modules(["proxy", "proxy_http", "proxy_balancer", "lbmethod_byrequests",
+                          "lbmethod_bylatency", "lbmethod_byhash", "proxy_fcgi",
+                          "proxy_hcheck", "cgid"])
 
 
 class ProxyTestEnv(HttpdTestEnv):
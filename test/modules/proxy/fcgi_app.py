@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+#
+# The FastCGI application of test_05_fcgi.py, spawned by fcgistarter which
+# passes the listening socket as fd 0 (FCGI_LISTENSOCK_FILENO).
+#
+import argparse
+import hashlib
+import json
+import os
+import socket
+import struct
+import time
+from threading import Lock, Thread
+from urllib.parse import parse_qs
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_ABORT_REQUEST = 2
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_KEEP_CONN = 1
+
+
+def fcgi_record(rtype, rid, content=b''):
+    padding = (8 - len(content) % 8) % 8
+    return struct.pack('!BBHHBx', 1, rtype, rid, len(content), padding) \
+        + content + b'\0' * padding
+
+
+def fcgi_pairs(data):
+    pairs = {}
+    pos = 0
+    while pos < len(data):
+        lens = []
+        for _ in range(2):
+            n = data[pos]
+            if n & 0x80:
+                n = struct.unpack('!I', data[pos:pos + 4])[0] & 0x7fffffff
+                pos += 4
+            else:
+                pos += 1
+            lens.append(n)
+        name = data[pos:pos + lens[0]].decode()
+        pos += lens[0]
+        pairs[name] = data[pos:pos + lens[1]].decode()
+        pos += lens[1]
+    return pairs
+
+
+def fcgi_pair(name, value):
+    return bytes([len(name), len(value)]) + name.encode() + value.encode()
+
+
+def fcgi_body(size):
+    # the (checkable) body of the responses asked with ?size=
+    return bytes(i % 251 for i in range(size))
+
+
+class FcgiApp:
+    """A FastCGI responder multiplexing the requests it gets on a
+    connection, each answered from its own thread. The response is
+    a JSON description of the request and where it was served, or
+    fcgi_body() with ?size=. With values=False, FCGI_GET_VALUES is
+    never answered."""
+
+    def __init__(self, listener, mpxs=True, values=True):
+        self._socket = listener
+        self._mpxs = mpxs
+        self._values = values
+        self._conn_id = 0
+
+    def run(self):
+        while True:
+            c, _addr = self._socket.accept()
+            self._conn_id += 1
+            Thread(target=self._serve, daemon=True,
+                   args=[c, self._conn_id]).start()
+
+    @staticmethod
+    def _recv_exactly(c, n):
+        data = b''
+        while len(data) < n:
+            chunk = c.recv(n - len(data))
+            if not chunk:
+                raise EOFError()
+            data += chunk
+        return data
+
+    def _serve(self, c, conn_id):
+        wlock = Lock()
+        requests = {}
+        state = {'keep': True, 'active': 0}
+
+        def send(data):
+            with wlock:
+                c.sendall(data)
+
+        def respond(rid, req):
+            params = fcgi_pairs(req['params'])
+            query = parse_qs(params.get('QUERY_STRING', ''))
+            if 'delay' in query:
+                time.sleep(float(query['delay'][0]))
+            if 'size' in query:
+                out = b'Content-Type: application/octet-stream\r\n\r\n' \
+                    + fcgi_body(int(query['size'][0]))
+            else:
+                body = json.dumps({
+                    'conn': conn_id, 'rid': rid,
+                    'method': params.get('REQUEST_METHOD'),
+                    'length': len(req['stdin']),
+                    'sha256': hashlib.sha256(req['stdin']).hexdigest(),
+                }).encode()
+                out = b'Content-Type: application/json\r\n\r\n' + body
+            for pos in range(0, len(out), 65535):
+                send(fcgi_record(FCGI_STDOUT, rid, out[pos:pos + 65535]))
+            send(fcgi_record(FCGI_STDOUT, rid)
+                 + fcgi_record(FCGI_END_REQUEST, rid, b'\0' * 8))
+            with wlock:
+                state['active'] -= 1
+                if not state['keep'] and state['active'] == 0:
+                    c.shutdown(socket.SHUT_RDWR)
+
+        try:
+            while True:
+                header = self._recv_exactly(c, 8)
+                _v, rtype, rid, clen, plen = struct.unpack('!BBHHBx', header)
+                content = self._recv_exactly(c, clen + plen)[:clen]
+                if rtype == FCGI_GET_VALUES and not self._values:
+                    pass
+                elif rtype == FCGI_GET_VALUES:
+                    asked = fcgi_pairs(content)
+                    values = b''
+                    if 'FCGI_MPXS_CONNS' in asked:
+                        values += fcgi_pair('FCGI_MPXS_CONNS',
+                                            '1' if self._mpxs else '0')
+                    if 'FCGI_MAX_REQS' in asked:
+                        values += fcgi_pair('FCGI_MAX_REQS', '8')
+                    send(fcgi_record(FCGI_GET_VALUES_RESULT, 0, values))
+                elif rtype == FCGI_BEGIN_REQUEST:
+                    with wlock:
+                        state['keep'] = bool(content[2] & FCGI_KEEP_CONN)
+                        state['active'] += 1
+                    requests[rid] = {'params': b'', 'stdin': b''}
+                elif rtype == FCGI_PARAMS and rid in requests:
+                    requests[rid]['params'] += content
+                elif rtype == FCGI_STDIN and rid in requests:
+                    if clen:
+                        requests[rid]['stdin'] += content
+                    else:
+                        Thread(target=respond, daemon=True,
+                               args=[rid, requests.pop(rid)]).start()
+                elif rtype == FCGI_ABORT_REQUEST and rid in requests:
+                    requests.pop(rid)
+                    with wlock:
+                        state['active'] -= 1
+        except (EOFError, OSError):
+            pass
+        finally:
+            c.close()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--pidfile', required=True)
+    parser.add_argument('--no-mpxs', action='store_true')
+    parser.add_argument('--no-values', action='store_true')
+    args = parser.parse_args()
+    with open(args.pidfile, 'w') as fd:
+        fd.write(f"{os.getpid()}\n")
+    listener = socket.socket(fileno=0)
+    FcgiApp(listener, mpxs=not args.no_mpxs, values=not args.no_values).run()
+
+
+if __name__ == '__main__':
+    main()
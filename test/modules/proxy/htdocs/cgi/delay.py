@@ -0,0 +1,14 @@
+#!/usr/bin/env python3
+import os, sys, time
+
+# Answers after the number of seconds given in the query string, or
+# 0.3 seconds when called under a path containing 'slow'.
+query = os.environ.get("QUERY_STRING", "")
+uri = os.environ.get("REQUEST_URI", "")
+delay = float(query) if query else (0.3 if "slow" in uri else 0)
+
+content = f"{'slow' if 'slow' in uri else 'fast'} response\n"
+time.sleep(delay)
+print("Status: 200")
+print("Content-Type: text/plain\n")
+sys.stdout.write(content)
@@ -1,5 +1,8 @@
 import os
+import socket
+import threading
 import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
 
 import pytest
 
@@ -94,3 +97,195 @@ class TestProxyHttp:
         r = env.curl_get(f"https://{domain}:{env.https_port}/proxy/alive.json", 5)
         assert r.response["status"] == 200
         assert r.json['host'] == "test1"
+
+    # with ProxyAsyncDelay, responses still make it through when the
+    # request is suspended while waiting for the backend
+    def test_proxy_01_004(self, env):
+        domain = f"test1.{env.http_tld}"
+        conf = HttpdConf(env)
+        conf.add("ProxyPreserveHost on")
+        conf.start_vhost(domains=[domain], port=env.https_port, doc_root="htdocs/test1")
+        conf.add([
+            "ProxyAsyncDelay 0",
+            f"ProxyPass /proxy/ http://127.0.0.1:{env.http_port}/",
+        ])
+        conf.end_vhost()
+        conf.add_vhost(domains=[domain], port=env.http_port, doc_root='htdocs/test1')
+        conf.install()
+        assert env.apache_restart() == 0
+        for path in ["/alive.json", "/002.jpg"]:
+            r = env.curl_get(f"https://{domain}:{env.https_port}/proxy{path}", 5)
+            assert r.response["status"] == 200
+            with open(os.path.join(env.server_docs_dir, "test1", path[1:]), 'rb') as fd:
+                assert r.response["body"] == fd.read()
+
+    # a backend slower than ProxyAsyncDelay gets the request suspended,
+    # and the response completed from the MPM
+    def test_proxy_01_005(self, env):
+        if env.mpm_module != 'mpm_event':
+            pytest.skip("suspending requests needs mpm_event")
+        domain = f"test1.{env.http_tld}"
+        conf = HttpdConf(env)
+        conf.add(["ProxyPreserveHost on", "LogLevel proxy_http:trace1"])
+        conf.start_vhost(domains=[domain], port=env.https_port, doc_root="htdocs/test1")
+        conf.add([
+            "ProxyAsyncDelay 0",
+            f"ProxyPass /proxy/ http://127.0.0.1:{env.http_port}/",
+        ])
+        conf.end_vhost()
+        conf.add_vhost(domains=[domain], port=env.http_port, doc_root='htdocs')
+        conf.install()
+        assert env.apache_restart() == 0
+        error_log = os.path.join(env.server_logs_dir, "error_log")
+        with open(error_log) as fd:
+            before = fd.read().count("suspended, going async")
+        r = env.curl_get(f"https://{domain}:{env.https_port}/proxy/cgi/delay.py?1", 5)
+        assert r.response["status"] == 200
+        assert r.response["body"] == b"fast response\n"
+        with open(error_log) as fd:
+            assert fd.read().count("suspended, going async") > before
+
+    # an upgraded connection between plain sockets is forwarded with
+    # splice(), with the default modules (mod_reqtimeout) loaded
+    def test_proxy_01_006(self, env):
+        if not os.path.exists("/proc/sys/fs/pipe-max-size"):
+            pytest.skip("splice() is linux only")
+        backend = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        backend.bind(("127.0.0.1", 0))
+        backend.listen(1)
+        port = backend.getsockname()[1]
+
+        def echo():
+            # answer the upgrade, then echo everything
+            conn, _ = backend.accept()
+            with conn:
+                head = b""
+                while b"\r\n\r\n" not in head:
+                    head += conn.recv(4096)
+                conn.sendall(b"HTTP/1.1 101 Switching Protocols\r\n"
+                             b"Connection: Upgrade\r\nUpgrade: echo\r\n\r\n")
+                while True:
+                    data = conn.recv(65536)
+                    if not data:
+                        break
+                    conn.sendall(data)
+
+        domain = f"test1.{env.http_tld}"
+        conf = HttpdConf(env)
+        conf.add("LogLevel proxy:trace2")
+        conf.start_vhost(domains=[domain], port=env.http_port, doc_root="htdocs/test1")
+        conf.add(f"ProxyPass /echo/ http://127.0.0.1:{port}/ upgrade=echo")
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+        error_log = os.path.join(env.server_logs_dir, "error_log")
+        with open(error_log) as fd:
+            before = fd.read().count("spliced")
+        t = threading.Thread(target=echo)
+        t.start()
+        payload = os.urandom(1024 * 1024)
+        received = b""
+        with socket.create_connection(("127.0.0.1", env.http_port), timeout=10) as c:
+            c.sendall(f"GET /echo/ HTTP/1.1\r\nHost: {domain}\r\n"
+                      "Connection: Upgrade\r\nUpgrade: echo\r\n\r\n".encode())
+            head = b""
+            while b"\r\n\r\n" not in head:
+                head += c.recv(1)
+            assert head.startswith(b"HTTP/1.1 101"), head
+            sender = threading.Thread(target=c.sendall, args=(payload,))
+            sender.start()
+            while len(received) < len(payload):
+                data = c.recv(65536)
+                if not data:
+                    break
+                received += data
+            sender.join()
+        t.join(timeout=10)
+        backend.close()
+        assert received == payload
+        with open(error_log) as fd:
+            assert fd.read().count("spliced") > before
+
+    # with a backend name resolving to both families, an address not
+    # answering costs the connect delay only, not the connect timeout
+    @pytest.mark.parametrize(["delay", "fast"], [
+        ["250ms", True],
+        ["off", False],
+    ])
+    def test_proxy_01_007(self, env, delay, fast):
+        probe = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        probe.bind(("127.0.0.1", 0))
+        port = probe.getsockname()[1]
+        probe.close()
+        addrs = socket.getaddrinfo("localhost", port, type=socket.SOCK_STREAM)
+        families = []
+        for a in addrs:
+            if a[0] not in families:
+                families.append(a[0])
+        if len(families) < 2:
+            pytest.skip("localhost does not resolve to IPv4 and IPv6")
+        first = [a for a in addrs if a[0] == families[0]][0][4]
+        second = [a for a in addrs if a[0] == families[1]][0][4]
+
+        # the first address resolved does not complete any connect: its
+        # backlog is full and further SYNs are dropped
+        blackhole = socket.socket(families[0], socket.SOCK_STREAM)
+        try:
+            blackhole.bind(first)
+        except OSError:
+            pytest.skip(f"port {port} not available for both families")
+        blackhole.listen(0)
+        fillers = []
+        for i in range(8):
+            f = socket.socket(families[0], socket.SOCK_STREAM)
+            f.settimeout(0.5)
+            try:
+                f.connect(first)
+            except OSError:
+                f.close()
+                break
+            fillers.append(f)
+
+        class Handler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                body = b"happy\n"
+                self.send_response(200)
+                self.send_header("Content-Length", str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+
+            def log_message(self, *args):
+                pass
+
+        class Server(ThreadingHTTPServer):
+            address_family = families[1]
+
+        server = Server(second[:2], Handler)
+        t = threading.Thread(target=server.serve_forever)
+        t.start()
+        try:
+            domain = f"test1.{env.http_tld}"
+            conf = HttpdConf(env)
+            conf.start_vhost(domains=[domain], port=env.http_port, doc_root="htdocs/test1")
+            conf.add(f"ProxyPass /he/ http://localhost:{port}/ "
+                     f"connectiontimeout=5 connectdelay={delay}")
+            conf.end_vhost()
+            conf.install()
+            assert env.apache_restart() == 0
+            start = time.time()
+            r = env.curl_get(f"http://{domain}:{env.http_port}/he/", 10)
+            elapsed = time.time() - start
+            assert r.response["status"] == 200
+            assert r.response["body"] == b"happy\n"
+            if fast:
+                assert elapsed < 2, f"{elapsed}"
+            else:
+                assert elapsed >= 4, f"{elapsed}"
+        finally:
+            server.shutdown()
+            server.server_close()
+            t.join()
+            for f in fillers:
+                f.close()
+            blackhole.close()
+            env.httpd_error_log.ignore_recent()
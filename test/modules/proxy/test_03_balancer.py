@@ -0,0 +1,193 @@
+import xml.etree.ElementTree as ET
+from concurrent.futures import ThreadPoolExecutor
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+
+def balancer_workers(env, url):
+    # the workers of the balancer-manager's XML page, by name
+    r = env.curl_get(f"{url}?xml=1", 5)
+    assert r.response["status"] == 200
+    ns = {'httpd': 'http://httpd.apache.org'}
+    workers = {}
+    for w in ET.fromstring(r.response["body"]).iterfind('.//httpd:worker', ns):
+        workers[w.find('httpd:name', ns).text] = {
+            c.tag.split('}')[1]: c.text for c in w
+        }
+    return workers
+
+
+class TestProxyBalancer:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = HttpdConf(env)
+        conf.add([
+            "<Proxy balancer://latency>",
+            f"  BalancerMember http://127.0.0.1:{env.http_port}",
+            f"  BalancerMember http://localhost:{env.http_port}",
+            "  ProxySet lbmethod=bylatency",
+            "</Proxy>",
+        ])
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            "ProxyPreserveHost on",
+            "ProxyPass / balancer://latency/",
+        ])
+        conf.end_vhost()
+        conf.add_vhost(domains=[env.d_reverse], port=env.http_port, doc_root='htdocs/test1')
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # requests are spread over the members by latency and served
+    def test_proxy_03_001(self, env):
+        for i in range(20):
+            r = env.curl_get(f"https://{env.d_reverse}:{env.https_port}/alive.json", 5)
+            assert r.response["status"] == 200
+            assert r.json['host'] == "test1"
+
+
+class TestProxyBalancerLatency:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = HttpdConf(env)
+        conf.add([
+            "<Proxy balancer://latency>",
+            f"  BalancerMember http://127.0.0.1:{env.http_port}/fast",
+            f"  BalancerMember http://localhost:{env.http_port}/slow",
+            "  ProxySet lbmethod=bylatency",
+            "</Proxy>",
+        ])
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            "ProxyPreserveHost on",
+            "ProxyPass / balancer://latency/",
+        ])
+        conf.end_vhost()
+        conf.start_vhost(domains=[env.d_reverse], port=env.http_port, doc_root='htdocs/cgi')
+        conf.add(f"AliasMatch ^/(fast|slow)/(.*)$ {env.server_docs_dir}/cgi/$2")
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # once both members answered, the slow one is left alone
+    def test_proxy_03_002(self, env):
+        seen = {"fast": 0, "slow": 0}
+        for i in range(30):
+            r = env.curl_get(f"https://{env.d_reverse}:{env.https_port}/delay.py", 5)
+            assert r.response["status"] == 200
+            seen[r.response["body"].decode().split()[0]] += 1
+        assert seen["fast"] >= 25, f"{seen}"
+
+
+class TestProxyBalancerHash:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = HttpdConf(env)
+        conf.add([
+            "<Proxy balancer://hash>",
+            f"  BalancerMember http://127.0.0.1:{env.http_port}",
+            f"  BalancerMember http://localhost:{env.http_port}",
+            "  ProxySet lbmethod=byhash",
+            "  BalancerHashKey header X-Key",
+            "</Proxy>",
+        ])
+        conf.start_vhost(domains=[env.d_mixed], port=env.https_port)
+        conf.add([
+            "ProxyPreserveHost on",
+            "ProxyPass / balancer://hash/",
+            "Header always set X-Worker \"%{BALANCER_WORKER_NAME}e\"",
+        ])
+        conf.end_vhost()
+        conf.add_vhost(domains=[env.d_mixed], port=env.http_port, doc_root='htdocs/test1')
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # the same key always goes to the same worker
+    def test_proxy_03_010(self, env):
+        url = f"https://{env.d_mixed}:{env.https_port}/alive.json"
+        for key in ["a", "b", "c", "d"]:
+            seen = set()
+            for i in range(5):
+                r = env.curl_get(url, 5, options=["-H", f"X-Key: {key}"])
+                assert r.response["status"] == 200
+                seen.add(r.response["header"]["x-worker"])
+            assert len(seen) == 1, f"{key}: {seen}"
+
+
+class TestProxyBalancerConcurrent:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = HttpdConf(env)
+        conf.add([
+            "<Proxy balancer://rr>",
+            f"  BalancerMember http://127.0.0.1:{env.http_port}",
+            f"  BalancerMember http://localhost:{env.http_port}",
+            "  ProxySet lbmethod=byrequests",
+            "</Proxy>",
+        ])
+        conf.start_vhost(domains=[env.d_forward], port=env.https_port)
+        conf.add([
+            "ProxyPreserveHost on",
+            "ProxyPass /balancer-manager !",
+            "ProxyPass / balancer://rr/",
+            "<Location /balancer-manager>",
+            "  SetHandler balancer-manager",
+            "</Location>",
+        ])
+        conf.end_vhost()
+        conf.add_vhost(domains=[env.d_forward], port=env.http_port, doc_root='htdocs/test1')
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # workers are elected without the balancer lock: under concurrent
+    # requests, no election and no busy count gets lost, and byrequests
+    # still spreads the requests evenly
+    def test_proxy_03_020(self, env):
+        base = f"https://{env.d_forward}:{env.https_port}"
+        before = balancer_workers(env, f"{base}/balancer-manager")
+        count = 100
+
+        def get(i):
+            r = env.curl_get(f"{base}/alive.json", 5)
+            return r.response["status"] if r.response else 0
+
+        with ThreadPoolExecutor(max_workers=10) as pool:
+            statuses = list(pool.map(get, range(count)))
+        assert statuses == [200] * count
+        after = balancer_workers(env, f"{base}/balancer-manager")
+        assert len(after) == 2
+        elected = [int(after[n]['elected']) - int(before[n]['elected'])
+                   for n in after]
+        assert sum(elected) == count, f"{after}"
+        for e in elected:
+            assert count / 4 <= e <= 3 * count / 4, f"{elected}"
+        for n in after:
+            assert int(after[n]['busy']) == 0, f"{after}"
+        # each request either reused a pooled connection or established one
+        pooled = [int(after[n]['poolhits']) + int(after[n]['poolmisses'])
+                  - int(before[n]['poolhits']) - int(before[n]['poolmisses'])
+                  for n in after]
+        assert sum(pooled) == count, f"{after}"
+
+    # the first request of a child establishes the connection to the
+    # member, the next ones reuse it
+    def test_proxy_03_021(self, env):
+        base = f"https://{env.d_forward}:{env.https_port}"
+        before = balancer_workers(env, f"{base}/balancer-manager")
+        count = 20
+        for i in range(count):
+            r = env.curl_get(f"{base}/alive.json", 5)
+            assert r.response["status"] == 200
+        after = balancer_workers(env, f"{base}/balancer-manager")
+        hits = sum(int(after[n]['poolhits']) - int(before[n]['poolhits'])
+                   for n in after)
+        misses = sum(int(after[n]['poolmisses']) - int(before[n]['poolmisses'])
+                     for n in after)
+        assert hits + misses == count, f"{after}"
+        assert hits > 0, f"{after}"
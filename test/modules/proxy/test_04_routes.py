@@ -0,0 +1,93 @@
+import logging
+import re
+import shutil
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+log = logging.getLogger(__name__)
+
+
+class TestProxyRoutes:
+
+    ROUTES = 2000
+
+    @staticmethod
+    def routes(env, n):
+        backend = f"http://127.0.0.1:{env.http_port}"
+        lines = [
+            # exclusion and overlapping prefixes, first match wins
+            "ProxyPass /svc7/alive.json !",
+            f"ProxyPass /svc8/sub/ {backend}/nothere/",
+            f"ProxyPassMatch ^/re(\\d+)/skip/ {backend}/nothere/",
+            # neither indexed, always checked in order
+            f"ProxyPassMatch /unanchored/(.*)$ {backend}/$1",
+        ]
+        for i in range(n):
+            lines.append(f"ProxyPass /svc{i}/ {backend}/")
+            lines.append(f"ProxyPass /svc{i} {backend}/")
+        lines.append(f"ProxyPassMatch ^/re(\\d+)/(.*)$ {backend}/$2")
+        return lines
+
+    @staticmethod
+    def configure(env, n):
+        conf = HttpdConf(env)
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add(TestProxyRoutes.routes(env, n))
+        conf.end_vhost()
+        conf.add_vhost(domains=[env.d_reverse], port=env.http_port, doc_root='htdocs/test1')
+        conf.install()
+        assert env.apache_restart() == 0
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        self.configure(env, self.ROUTES)
+
+    def url(self, env, path):
+        return f"https://{env.d_reverse}:{env.https_port}{path}"
+
+    # routes are found whatever their position
+    @pytest.mark.parametrize("path", [
+        "/svc0/alive.json", "/svc1999/alive.json", "/svc1000//alive.json",
+        "//svc42/alive.json", "/re5/alive.json", "/unanchored/alive.json",
+    ])
+    def test_proxy_04_001(self, env, path):
+        r = env.curl_get(self.url(env, path), 5)
+        assert r.response["status"] == 200
+        assert r.json['host'] == "test1"
+
+    # the first matching rule wins, as configured
+    def test_proxy_04_002(self, env):
+        # excluded, served locally
+        r = env.curl_get(self.url(env, "/svc7/alive.json"), 5)
+        assert r.response["status"] == 404
+        # /svc8/sub/ comes first
+        r = env.curl_get(self.url(env, "/svc8/sub/alive.json"), 5)
+        assert r.response["status"] == 404
+        r = env.curl_get(self.url(env, "/svc8/alive.json"), 5)
+        assert r.response["status"] == 200
+        r = env.curl_get(self.url(env, "/re3/skip/alive.json"), 5)
+        assert r.response["status"] == 404
+
+    # segment boundaries are respected
+    def test_proxy_04_003(self, env):
+        r = env.curl_get(self.url(env, "/svc1x/alive.json"), 5)
+        assert r.response["status"] == 404
+
+    # lookup latency vs number of routes, for the last configured ones
+    @pytest.mark.skipif(condition=not shutil.which("h2load"), reason="no h2load")
+    @pytest.mark.parametrize("n", [10, 1000, 8000])
+    def test_proxy_04_010(self, env, n):
+        self.configure(env, n)
+        total = 2000
+        r = env.run([env.h2load, "-n", f"{total}", "-c", "4", "-m", "1",
+                     f"--connect-to=localhost:{env.https_port}",
+                     self.url(env, f"/svc{n - 1}/alive.json")])
+        assert r.exit_code == 0
+        r = env.h2load_status(r)
+        assert total == r.results["h2load"]["requests"]["succeeded"], f'{r.results}'
+        m = re.search(r'time for request:\s+(\S+)\s+(\S+)\s+(\S+)', r.stdout)
+        if m:
+            log.info(f"{n} routes, latency min/max/mean: "
+                     f"{m.group(1)}/{m.group(2)}/{m.group(3)}")
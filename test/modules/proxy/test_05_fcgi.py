@@ -0,0 +1,198 @@
+import hashlib
+import inspect
+import os
+import signal
+import socket
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+from .fcgi_app import fcgi_body
+
+class FcgiStarter:
+    """Runs fcgi_app.py as a FastCGI application on a port, spawned by
+    support/fcgistarter like a real deployment would."""
+
+    def __init__(self, env, port, *app_args):
+        self._env = env
+        self._port = port
+        self._app_args = app_args
+        self._pidfile = os.path.join(env.gen_dir, f"fcgi-app-{port}.pid")
+
+    def start(self):
+        starter = os.path.join(self._env.sbin_dir, "fcgistarter")
+        if not os.access(starter, os.X_OK):
+            pytest.skip("fcgistarter is not installed")
+        # fcgistarter execs the command without arguments
+        app = os.path.join(os.path.dirname(inspect.getfile(FcgiStarter)),
+                           "fcgi_app.py")
+        cmd = os.path.join(self._env.gen_dir, f"fcgi-app-{self._port}.sh")
+        with open(cmd, 'w') as fd:
+            fd.write("#!/bin/sh\n"
+                     f"exec '{sys.executable}' '{app}' --pidfile "
+                     f"'{self._pidfile}' {' '.join(self._app_args)}\n")
+        os.chmod(cmd, 0o755)
+        if os.path.exists(self._pidfile):
+            os.remove(self._pidfile)
+        p = subprocess.run([starter, "-c", cmd, "-p", str(self._port),
+                            "-i", "127.0.0.1", "-N", "1"])
+        assert p.returncode == 0
+        end = time.time() + 10
+        while not os.path.exists(self._pidfile) \
+                or not os.path.getsize(self._pidfile):
+            assert time.time() < end, "fcgi_app.py did not start"
+            time.sleep(0.1)
+
+    def stop(self):
+        with open(self._pidfile) as fd:
+            pid = int(fd.read())
+        os.kill(pid, signal.SIGTERM)
+        os.remove(self._pidfile)
+
+
+class TestProxyFcgi:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        app = FcgiStarter(env, env.proxy_port)
+        app.start()
+        conf = HttpdConf(env)
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            f"ProxyPass /mux/ fcgi://127.0.0.1:{env.proxy_port}/",
+            "ProxyFCGIMultiplex on",
+        ])
+        conf.end_vhost()
+        conf.start_vhost(domains=[env.d_forward], port=env.https_port)
+        conf.add([
+            f"ProxyPass /plain/ fcgi://127.0.0.1:{env.proxy_port}/",
+        ])
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+        yield
+        app.stop()
+
+    def url(self, env, path, domain=None):
+        domain = domain or env.d_reverse
+        return f"https://{domain}:{env.https_port}{path}"
+
+    # a multiplexed request
+    def test_proxy_05_001(self, env):
+        r = env.curl_get(self.url(env, "/mux/hello"), 5)
+        assert r.response["status"] == 200
+        assert r.json['method'] == "GET"
+        assert r.json['rid'] >= 1
+
+    # a request body goes through the stream
+    def test_proxy_05_002(self, env):
+        data = "x" * 100000
+        r = env.curl_post_data(self.url(env, "/mux/echo"), data, 5)
+        assert r.response["status"] == 200
+        assert r.json['method'] == "POST"
+        assert r.json['length'] == len(data)
+
+    # concurrent requests share connections, with distinct request ids
+    def test_proxy_05_003(self, env):
+        if env.mpm_module == "mpm_prefork":
+            pytest.skip("prefork handles a single request per process")
+        n = 8
+        with ThreadPoolExecutor(max_workers=n) as executor:
+            results = list(executor.map(
+                lambda i: env.curl_get(self.url(env, f"/mux/{i}?delay=0.5"), 5),
+                range(n)))
+        seen = set()
+        for r in results:
+            assert r.response["status"] == 200
+            key = (r.json['conn'], r.json['rid'])
+            assert key not in seen
+            seen.add(key)
+        assert len(set([conn for conn, _rid in seen])) < n
+
+    # without multiplexing, each request has a connection of its own
+    def test_proxy_05_004(self, env):
+        conns = set()
+        for i in range(3):
+            r = env.curl_get(self.url(env, "/plain/hello", env.d_forward), 5)
+            assert r.response["status"] == 200
+            assert r.json['rid'] == 1
+            conns.add(r.json['conn'])
+        assert len(conns) == 3
+
+    # request and response bodies spanning many records arrive intact,
+    # with and without multiplexing
+    @pytest.mark.parametrize(["path", "domain"], [
+        ["/mux/", "reverse"],
+        ["/plain/", "forward"],
+    ])
+    def test_proxy_05_006(self, env, path, domain):
+        domain = env.d_reverse if domain == "reverse" else env.d_forward
+        data = os.urandom(300 * 1024)
+        fpath = os.path.join(env.gen_dir, "fcgi-upload.bin")
+        with open(fpath, 'wb') as fd:
+            fd.write(data)
+        r = env.curl_raw([self.url(env, f"{path}upload", domain)], options=[
+            "--data-binary", f"@{fpath}", "-H", "Content-Type: application/octet-stream"
+        ])
+        assert r.response["status"] == 200
+        assert r.json['length'] == len(data)
+        assert r.json['sha256'] == hashlib.sha256(data).hexdigest()
+        size = 300 * 1024 + 17
+        r = env.curl_get(self.url(env, f"{path}download?size={size}", domain), 5)
+        assert r.response["status"] == 200
+        assert r.response["body"] == fcgi_body(size)
+
+    # a response larger than what's buffered for a stream reaches a slow
+    # client intact, while the other streams of the connection complete
+    def test_proxy_05_005(self, env):
+        if env.mpm_module == "mpm_prefork":
+            pytest.skip("prefork handles a single request per process")
+        size = 1024 * 1024
+        with ThreadPoolExecutor(max_workers=4) as executor:
+            slow = executor.submit(env.curl_get, self.url(env, f"/mux/big?size={size}"),
+                                   5, options=["--limit-rate", "256k"])
+            time.sleep(0.5)
+            others = list(executor.map(
+                lambda i: env.curl_get(self.url(env, f"/mux/{i}"), 5),
+                range(3)))
+            r = slow.result()
+        assert r.response["status"] == 200
+        assert r.response["body"] == fcgi_body(size)
+        for o in others:
+            assert o.response["status"] == 200
+
+
+class TestProxyFcgiNoValues:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+            s.bind(("127.0.0.1", 0))
+            port = s.getsockname()[1]
+        app = FcgiStarter(env, port, "--no-values")
+        app.start()
+        conf = HttpdConf(env)
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            f"ProxyPass /mux/ fcgi://127.0.0.1:{port}/ timeout=30",
+            "ProxyFCGIMultiplex on",
+        ])
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+        yield
+        app.stop()
+
+    # an application ignoring FCGI_GET_VALUES costs a short wait only, and
+    # is used without multiplexing
+    def test_proxy_05_010(self, env):
+        start = time.time()
+        r = env.curl_get(f"https://{env.d_reverse}:{env.https_port}/mux/hello", 5)
+        assert r.response["status"] == 200
+        assert r.json['rid'] == 1
+        assert time.time() - start < 5
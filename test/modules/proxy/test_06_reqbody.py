@@ -0,0 +1,180 @@
+import json
+import socket
+from threading import Thread
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+from .test_03_balancer import balancer_workers
+
+
+class BodyFaker:
+    """An HTTP/1.1 backend answering with how it received the request
+    body. Chunked bodies are refused (411) for the "localhost" host."""
+
+    def __init__(self, port):
+        self._port = port
+        self._done = False
+        self.requests = []
+
+    def start(self):
+        self._socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self._socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self._socket.bind(('127.0.0.1', self._port))
+        self._socket.listen(16)
+        self._thread = Thread(target=self._accept, daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        self._done = True
+        self._socket.close()
+
+    def _accept(self):
+        while self._done is False:
+            try:
+                c, _addr = self._socket.accept()
+            except OSError:
+                self._done = True
+                break
+            Thread(target=self._serve, daemon=True, args=[c]).start()
+
+    @staticmethod
+    def _readline(f):
+        return f.readline().decode().rstrip('\r\n')
+
+    def _serve(self, c):
+        try:
+            f = c.makefile('rb')
+            line = self._readline(f)
+            if not line:
+                return
+            method, target, _proto = line.split(' ', 2)
+            headers = {}
+            while True:
+                line = self._readline(f)
+                if not line:
+                    break
+                name, value = line.split(':', 1)
+                headers[name.strip().lower()] = value.strip()
+            chunked = 'chunked' in headers.get('transfer-encoding', '')
+            length = 0
+            if chunked:
+                while True:
+                    size = int(self._readline(f).split(';')[0], 16)
+                    if size:
+                        length += len(f.read(size))
+                    self._readline(f)
+                    if not size:
+                        break
+            elif 'content-length' in headers:
+                length = len(f.read(int(headers['content-length'])))
+            self.requests.append((method, target, chunked,
+                                  headers.get('host', '')))
+            if chunked and headers.get('host', '').startswith('localhost'):
+                status = "411 Length Required"
+            else:
+                status = "200 OK"
+            body = json.dumps({
+                'method': method, 'chunked': chunked, 'length': length,
+            }).encode()
+            c.sendall(f"HTTP/1.1 {status}\r\n"
+                      "Content-Type: application/json\r\n"
+                      f"Content-Length: {len(body)}\r\n"
+                      "Connection: close\r\n\r\n".encode() + body)
+        except (OSError, ValueError):
+            pass
+        finally:
+            c.close()
+
+
+class TestProxyReqBody:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        faker = BodyFaker(port=env.proxy_port)
+        faker.start()
+        TestProxyReqBody.faker = faker
+        backend = f"127.0.0.1:{env.proxy_port}"
+        TestProxyReqBody.probed = f"http://{backend}"
+        TestProxyReqBody.refused = f"http://localhost:{env.proxy_port}"
+        conf = HttpdConf(env)
+        conf.add([
+            "<Proxy balancer://probe>",
+            f"  BalancerMember {self.probed} sendchunked=probe",
+            "</Proxy>",
+            "<Proxy balancer://refused>",
+            f"  BalancerMember {self.refused} sendchunked=probe",
+            "</Proxy>",
+        ])
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            "SetEnvIf Request_URI ^/sendcl/ proxy-sendcl",
+            "ProxyPass /balancer-manager !",
+            f"ProxyPass /default/ http://{backend}/default/",
+            f"ProxyPass /sendcl/ http://{backend}/sendcl/ sendchunked=on",
+            f"ProxyPass /spool/ http://{backend}/spool/ sendchunked=off",
+            "ProxyPass /probe/ balancer://probe/probe/",
+            "ProxyPass /refused/ balancer://refused/refused/",
+            "<Location /balancer-manager>",
+            "  SetHandler balancer-manager",
+            "</Location>",
+        ])
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+        yield
+        faker.stop()
+
+    def post_chunked(self, env, path, data):
+        url = f"https://{env.d_reverse}:{env.https_port}{path}"
+        return env.curl_post_data(url, data, 5, options=[
+            "--http1.1", "-H", "Transfer-Encoding: chunked"
+        ])
+
+    @pytest.mark.parametrize(["path", "chunked"], [
+        ["/default/", True],
+        # sendchunked=on wins over proxy-sendcl
+        ["/sendcl/", True],
+        ["/spool/", False],
+    ])
+    def test_proxy_06_001(self, env, path, chunked):
+        data = "x" * 100000
+        r = self.post_chunked(env, path, data)
+        assert r.response["status"] == 200
+        assert r.json['chunked'] == chunked
+        assert r.json['length'] == len(data)
+
+    def probes(self, host):
+        return [req for req in self.faker.requests
+                if req[0] == "OPTIONS" and req[3].startswith(host)]
+
+    def worker(self, env, name):
+        url = f"https://{env.d_reverse}:{env.https_port}/balancer-manager"
+        return balancer_workers(env, url)[name]
+
+    # the backend is asked once, and the bodies streamed since it accepts them
+    def test_proxy_06_002(self, env):
+        for i in range(3):
+            r = self.post_chunked(env, "/probe/", "y" * 1000)
+            assert r.response["status"] == 200
+            assert r.json['chunked'] is True
+            assert r.json['length'] == 1000
+        probes = self.probes("127.0.0.1")
+        assert len(probes) == 1, f"{probes}"
+        assert probes[0][1] == "*" and probes[0][2] is True
+        worker = self.worker(env, self.probed)
+        assert worker['spooled'] == "0", f"{worker}"
+        assert worker['spooledrequests'] == "0", f"{worker}"
+
+    # the backend refuses them, the bodies are spooled
+    def test_proxy_06_003(self, env):
+        for i in range(2):
+            r = self.post_chunked(env, "/refused/", "z" * 1000)
+            assert r.response["status"] == 200
+            assert r.json['chunked'] is False
+            assert r.json['length'] == 1000
+        assert len(self.probes("localhost")) == 1
+        worker = self.worker(env, self.refused)
+        assert worker['spooledrequests'] == "2", f"{worker}"
+        assert worker['spooled'] == "2000", f"{worker}"
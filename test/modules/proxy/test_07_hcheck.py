@@ -0,0 +1,147 @@
+import os
+import socket
+import time
+
+import pytest
+
+from pyhttpd.conf import HttpdConf
+
+from .test_03_balancer import balancer_workers
+
+
+def unused_port():
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_status(env, names, flag, timeout=10):
+    # wait for the given workers to show (or not) the flag in their status
+    url = f"https://{env.d_reverse}:{env.https_port}/balancer-manager"
+    end = time.time() + timeout
+    while True:
+        workers = balancer_workers(env, url)
+        if all(flag in workers[n]['status'] for n in names) \
+                or time.time() > end:
+            return workers
+        time.sleep(0.5)
+
+
+class TestProxyHCheckAsync:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        TestProxyHCheckAsync.live = f"http://127.0.0.1:{env.http_port}"
+        TestProxyHCheckAsync.dead = f"http://127.0.0.1:{unused_port()}"
+        conf = HttpdConf(env)
+        conf.add([
+            "ProxyHCAsync On",
+            "LogLevel proxy_hcheck:debug",
+            "<Proxy balancer://hc>",
+            f"  BalancerMember {self.live} hcmethod=TCP hcinterval=1",
+            f"  BalancerMember {self.dead} hcmethod=TCP hcinterval=1",
+            "</Proxy>",
+        ])
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            "ProxyPass /balancer-manager !",
+            "ProxyPass / balancer://hc/",
+            "<Location /balancer-manager>",
+            "  SetHandler balancer-manager",
+            "</Location>",
+        ])
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # the checks run on the pollset of the watchdog, and tell the dead
+    # member from the live one
+    def test_proxy_07_001(self, env):
+        workers = wait_status(env, [self.dead], "HcFl")
+        assert "HcFl" in workers[self.dead]['status'], f"{workers}"
+        assert "HcFl" not in workers[self.live]['status'], f"{workers}"
+        with open(os.path.join(env.server_logs_dir, "error_log")) as fd:
+            assert "AH10474" in fd.read()
+        env.httpd_error_log.ignore_recent()
+
+
+class TestProxyHCheckAsyncFull:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        TestProxyHCheckAsyncFull.slow = f"http://127.0.0.1:{env.http_port}"
+        TestProxyHCheckAsyncFull.dead = f"https://127.0.0.1:{unused_port()}"
+        conf = HttpdConf(env)
+        conf.add([
+            "ProxyHCAsync 1",
+            "SSLProxyEngine on",
+            "<Proxy balancer://hc>",
+            f"  BalancerMember {self.slow} hcmethod=GET hcuri=/cgi/delay.py?3 hcinterval=1",
+            f"  BalancerMember {self.dead} hcmethod=TCP hcinterval=1",
+            "</Proxy>",
+        ])
+        conf.add_vhost(domains=[env.d_mixed], port=env.http_port, doc_root='htdocs')
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            "ProxyPass /balancer-manager !",
+            "ProxyPass / balancer://hc/",
+            "<Location /balancer-manager>",
+            "  SetHandler balancer-manager",
+            "</Location>",
+        ])
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # while the slow asynchronous check takes up the only slot, the check
+    # over TLS still runs on the threadpool
+    def test_proxy_07_002(self, env):
+        workers = wait_status(env, [self.dead], "HcFl", timeout=5)
+        assert "HcFl" in workers[self.dead]['status'], f"{workers}"
+        assert "HcFl" not in workers[self.slow]['status'], f"{workers}"
+        env.httpd_error_log.ignore_recent()
+
+
+class TestProxyHCheckAddress:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        TestProxyHCheckAddress.member = f"http://localhost:{env.http_port}"
+        conf = HttpdConf(env)
+        conf.add([
+            "LogLevel proxy:trace2",
+            "<Proxy balancer://ttl>",
+            f"  BalancerMember {self.member} addressttl=1 hcmethod=GET hcuri=/alive.json hcinterval=1",
+            "</Proxy>",
+        ])
+        conf.add_vhost(domains=[env.d_mixed], port=env.http_port, doc_root='htdocs/test1')
+        conf.start_vhost(domains=[env.d_reverse], port=env.https_port)
+        conf.add([
+            "ProxyPass /balancer-manager !",
+            "ProxyPass / balancer://ttl/",
+            "<Location /balancer-manager>",
+            "  SetHandler balancer-manager",
+            "</Location>",
+        ])
+        conf.end_vhost()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # the address of the member is resolved again every second, by the
+    # requests and the health checks, and keeps being used meanwhile
+    def test_proxy_07_003(self, env):
+        error_log = os.path.join(env.server_logs_dir, "error_log")
+        with open(error_log) as fd:
+            before = fd.read().count(f"of worker {self.member} unchanged")
+        url = f"https://{env.d_reverse}:{env.https_port}/alive.json"
+        end = time.time() + 4
+        while time.time() < end:
+            r = env.curl_get(url, 5)
+            assert r.response["status"] == 200
+            assert r.json['host'] == "test1"
+            time.sleep(0.2)
+        workers = balancer_workers(env, f"https://{env.d_reverse}:{env.https_port}/balancer-manager")
+        assert "HcFl" not in workers[self.member]['status'], f"{workers}"
+        assert "Err" not in workers[self.member]['status'], f"{workers}"
+        with open(error_log) as fd:
+            assert fd.read().count(f"of worker {self.member} unchanged") > before
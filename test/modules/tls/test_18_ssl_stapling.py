@@ -0,0 +1,173 @@
+import re
+import time
+from datetime import datetime, timedelta
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from threading import Thread
+
+import pytest
+from cryptography.hazmat.primitives import hashes, serialization
+from cryptography.x509 import ocsp
+
+from .conf import TlsTestConf
+
+
+class OcspResponder:
+    """An OCSP responder saying GOOD for the certificate of one domain,
+    answering after 'delay' seconds."""
+
+    def __init__(self, port, creds):
+        self._port = port
+        self._creds = creds
+        self.delay = 0
+        self.next_update = timedelta(days=1)
+        self.queries = 0
+
+    def start(self):
+        responder = self
+
+        class Handler(BaseHTTPRequestHandler):
+            def do_POST(self):
+                body = self.rfile.read(int(self.headers['Content-Length']))
+                ocsp.load_der_ocsp_request(body)
+                responder.queries += 1
+                time.sleep(responder.delay)
+                der = responder.response()
+                self.send_response(200)
+                self.send_header('Content-Type', 'application/ocsp-response')
+                self.send_header('Content-Length', str(len(der)))
+                self.end_headers()
+                self.wfile.write(der)
+
+            def log_message(self, *args):
+                pass
+
+        self._httpd = ThreadingHTTPServer(('127.0.0.1', self._port), Handler)
+        self._thread = Thread(target=self._httpd.serve_forever, daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        self._httpd.shutdown()
+        self._httpd.server_close()
+
+    def response(self) -> bytes:
+        now = datetime.utcnow()
+        issuer = self._creds.issuer
+        return ocsp.OCSPResponseBuilder().add_response(
+            cert=self._creds.certificate, issuer=issuer.certificate,
+            algorithm=hashes.SHA1(), cert_status=ocsp.OCSPCertStatus.GOOD,
+            this_update=now - timedelta(minutes=1),
+            next_update=now + self.next_update,
+            revocation_time=None, revocation_reason=None,
+        ).responder_id(
+            ocsp.OCSPResponderEncoding.HASH, issuer.certificate
+        ).sign(issuer.private_key, hashes.SHA256()).public_bytes(
+            serialization.Encoding.DER)
+
+
+class TestSSLStapling:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        if env.ssl_module != 'mod_ssl':
+            pytest.skip("OCSP stapling refresh is a mod_ssl feature")
+        creds = env.get_credentials_for_name(env.domain_a)[0]
+        responder = OcspResponder(port=env.proxy_port, creds=creds)
+        responder.start()
+        TestSSLStapling.responder = responder
+        conf = TlsTestConf(env=env, extras={
+            'base': [
+                "LogLevel ssl:debug watchdog:debug",
+                "SSLStaplingCache shmcb:stapling_cache(128000)",
+                "<Location /server-status>",
+                "    SetHandler server-status",
+                "</Location>",
+            ],
+            env.domain_a: [
+                "SSLUseStapling on",
+                f"SSLStaplingForceURL http://127.0.0.1:{env.proxy_port}/",
+                f"SSLCACertificateFile {env.ca.cert_file}",
+            ],
+        })
+        conf.add_tls_vhosts(domains=[env.domain_a], ssl_module='mod_ssl')
+        conf.install()
+        yield
+        responder.stop()
+
+    def ocsp_status(self, env):
+        r = env.openssl_client(env.domain_a, extra_args=["-status"])
+        m = re.search(r'OCSP Response Status:\s*(\S+)', r.stdout)
+        if m:
+            return m.group(1), r.duration
+        m = re.search(r'OCSP response: +([^=\n]+)\n', r.stdout)
+        return (m.group(1) if m else None), r.duration
+
+    def stapling_stats(self, env):
+        r = env.tls_get(env.domain_a, "/server-status?auto")
+        assert r.exit_code == 0
+        stats = {}
+        for line in r.stdout.splitlines():
+            m = re.match(r'(TLSStapling\S+): (\d+)', line)
+            if m:
+                stats[m.group(1)] = int(m.group(2))
+        return stats
+
+    def await_stapled(self, env, timeout=10):
+        end = time.time() + timeout
+        while time.time() < end:
+            status, _ = self.ocsp_status(env)
+            if status == "successful":
+                return True
+            time.sleep(.5)
+        return False
+
+    # the response is fetched right after start, and not by handshakes
+    def test_tls_18_01(self, env):
+        self.responder.delay = 0
+        self.responder.next_update = timedelta(days=1)
+        self.responder.queries = 0
+        assert env.apache_restart() == 0
+        assert self.await_stapled(env)
+        queries = self.responder.queries
+        assert queries >= 1
+        for i in range(5):
+            status, _ = self.ocsp_status(env)
+            assert status == "successful"
+        assert self.responder.queries == queries
+        stats = self.stapling_stats(env)
+        assert stats['TLSStaplingRefreshes'] >= 1
+        assert stats['TLSStaplingRefreshFailures'] == 0
+
+    # the response is refreshed before its nextUpdate, long before it would
+    # leave the cache, and a slow responder meanwhile does not hold up the
+    # handshakes
+    def test_tls_18_02(self, env):
+        self.responder.delay = 0
+        self.responder.next_update = timedelta(seconds=8)
+        self.responder.queries = 0
+        assert env.apache_restart() == 0
+        assert self.await_stapled(env)
+        queries = self.responder.queries
+        self.responder.delay = 2
+        end = time.time() + 10
+        while time.time() < end:
+            status, duration = self.ocsp_status(env)
+            assert status == "successful"
+            assert duration < timedelta(seconds=1)
+            time.sleep(.5)
+        assert self.responder.queries > queries
+        stats = self.stapling_stats(env)
+        assert stats['TLSStaplingRefreshes'] > 1
+        assert stats['TLSStaplingRefreshMaxMs'] >= 1500
+
+    # without a cached response yet, the handshake does not wait for the
+    # responder but goes without, the watchdog fetches it meanwhile
+    def test_tls_18_03(self, env):
+        self.responder.delay = 2
+        self.responder.next_update = timedelta(days=1)
+        self.responder.queries = 0
+        assert env.apache_restart() == 0
+        status, duration = self.ocsp_status(env)
+        assert status != "successful"
+        assert duration < timedelta(seconds=1)
+        assert self.await_stapled(env)
+        assert self.responder.queries == 1
@@ -0,0 +1,82 @@
+import os
+import re
+
+import pytest
+
+from .conf import TlsTestConf
+
+
+class TestSSLContextOnDemand:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        if env.ssl_module != 'mod_ssl':
+            pytest.skip("SSL contexts on demand are a mod_ssl feature")
+
+    def configure(self, env, extras):
+        conf = TlsTestConf(env=env, extras={
+            'base': [
+                "LogLevel ssl:debug",
+                "SSLContextOnDemand on",
+                "SSLContextCacheSize 1",
+            ],
+            **extras
+        })
+        conf.add_tls_vhosts(domains=[env.domain_a, env.domain_b],
+                            ssl_module='mod_ssl')
+        conf.install()
+        path = env.httpd_error_log.path
+        self.log_start = os.path.getsize(path) if os.path.isfile(path) else 0
+        assert env.apache_restart() == 0
+
+    def log_lines(self, env, logno):
+        with open(env.httpd_error_log.path) as fd:
+            fd.seek(self.log_start)
+            return [line for line in fd if re.match(rf'.*{logno}: ', line)]
+
+    def pid_of(self, line):
+        m = re.match(r'.*\[pid (\d+)', line)
+        return m.group(1) if m else None
+
+    # both contexts are created on demand, only one fits into the cache
+    def test_tls_19_01(self, env):
+        self.configure(env, {})
+        deferred = self.log_lines(env, "AH10508")
+        for domain in [env.domain_a, env.domain_b]:
+            assert any(domain in line for line in deferred)
+        for i in range(5):
+            for domain in [env.domain_a, env.domain_b]:
+                data = env.tls_get_json(domain, "/index.json")
+                assert data == {'domain': domain}
+        created = self.log_lines(env, "AH10512")
+        for domain in [env.domain_a, env.domain_b]:
+            assert any(domain in line for line in created)
+        # a child serving both evicted one of them and created it again
+        lines = self.log_lines(env, "AH1051[24]")
+        evicted = [line for line in lines if 'AH10514' in line]
+        assert len(evicted) > 0, f"{lines}"
+        rebuilt = False
+        for i, line in enumerate(lines):
+            if 'AH10514' not in line:
+                continue
+            pid = self.pid_of(line)
+            host = re.match(r'.*context of (\S+) from', line).group(1)
+            rebuilt = rebuilt or any(
+                'AH10512' in later and self.pid_of(later) == pid
+                and f"of {host} created" in later for later in lines[i+1:])
+        assert rebuilt, f"{lines}"
+
+    # a preloaded host next to one created on demand
+    def test_tls_19_02(self, env):
+        self.configure(env, {
+            env.domain_a: "SSLContextOnDemand off",
+        })
+        deferred = self.log_lines(env, "AH10508")
+        assert any(env.domain_b in line for line in deferred)
+        assert not any(env.domain_a in line for line in deferred)
+        for i in range(3):
+            for domain in [env.domain_a, env.domain_b]:
+                data = env.tls_get_json(domain, "/index.json")
+                assert data == {'domain': domain}
+        # domain_b is the only one in the cache
+        assert len(self.log_lines(env, "AH10514")) == 0
@@ -0,0 +1,76 @@
+import os
+import re
+
+import pytest
+
+from .conf import TlsTestConf
+
+
+class TestSSLAsyncKeyOps:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        if env.ssl_module != 'mod_ssl':
+            pytest.skip("SSLAsyncKeyOps is a mod_ssl feature")
+        conf = TlsTestConf(env=env, extras={
+            'base': [
+                "LogLevel ssl:trace1",
+                "SSLAsyncKeyOpsThreads 2",
+                "<Location /server-status>",
+                "    SetHandler server-status",
+                "</Location>",
+            ],
+            env.domain_a: "SSLAsyncKeyOps on",
+        })
+        conf.add_tls_vhosts(domains=[env.domain_a, env.domain_b],
+                            ssl_module='mod_ssl')
+        conf.install()
+        path = env.httpd_error_log.path
+        TestSSLAsyncKeyOps.log_start = os.path.getsize(path) \
+            if os.path.isfile(path) else 0
+        assert env.apache_restart() == 0
+
+    def log_text(self, env):
+        with open(env.httpd_error_log.path) as fd:
+            fd.seek(self.log_start)
+            return fd.read()
+
+    def keyops_stats(self, env, domain):
+        r = env.tls_get(domain, "/server-status?auto")
+        assert r.exit_code == 0
+        stats = {}
+        for line in r.stdout.splitlines():
+            m = re.match(r'(TLSKeyOps\S*): (\d+)', line)
+            if m:
+                stats[m.group(1)] = int(m.group(2))
+        return stats
+
+    # handshakes with offloaded key operations complete, the status
+    # request's own handshake is counted by the child answering it
+    def test_tls_20_01(self, env):
+        for i in range(5):
+            for domain in [env.domain_a, env.domain_b]:
+                data = env.tls_get_json(domain, "/index.json")
+                assert data == {'domain': domain}
+        stats = self.keyops_stats(env, env.domain_a)
+        assert stats['TLSKeyOps'] >= 1
+        assert stats['TLSKeyOpsQueued'] == 0
+        assert 'TLSKeyOpsQueueMaxUs' in stats
+
+    # with mpm_event, the worker parks the connection and goes on rather
+    # than waiting for the key operation, which resumes it just once
+    def test_tls_20_02(self, env):
+        if env.mpm_module != 'mpm_event':
+            pytest.skip("connections are parked by mpm_event only")
+        for i in range(5):
+            data = env.tls_get_json(env.domain_a, "/index.json")
+            assert data == {'domain': env.domain_a}
+        text = self.log_text(env)
+        parked = text.count("SSL handshake: parking the connection")
+        resumed = text.count("SSL handshake: resuming after the private")
+        assert parked >= 5
+        assert resumed >= parked
+        # neither waited for in the worker nor resumed too early
+        assert "AH10515" not in text
+        assert "AH02615" not in text
+        assert "AH02616" not in text
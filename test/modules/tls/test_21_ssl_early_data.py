@@ -0,0 +1,91 @@
+import os
+
+import pytest
+
+from .conf import TlsTestConf
+from .env import TlsTestEnv
+
+
+@pytest.mark.skipif(condition=not TlsTestEnv.openssl_supports_tls_1_3(),
+                    reason="no TLS 1.3 support in openssl")
+class TestSSLEarlyData:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        if env.ssl_module != 'mod_ssl':
+            pytest.skip("early data is a mod_ssl feature")
+        conf = TlsTestConf(env=env, extras={
+            'base': ["LogLevel ssl:debug"],
+            env.domain_a: "SSLEarlyData on",
+        })
+        conf.add_tls_vhosts(domains=[env.domain_a, env.domain_b],
+                            ssl_module='mod_ssl')
+        conf.install()
+        assert env.apache_restart() == 0
+
+    def s_client(self, env, domain, extra_args, intext=None):
+        args = ["openssl", "s_client", "-CAfile", env.ca.cert_file,
+                "-servername", domain, "-tls1_3",
+                "-connect", f"localhost:{env.https_port}"]
+        return env.run(args + extra_args, intext=intext)
+
+    def request(self, domain, method="GET"):
+        return f"{method} /index.json HTTP/1.1\r\n" \
+               f"Host: {domain}\r\nConnection: close\r\n\r\n"
+
+    def early_data(self, env, domain, method="GET"):
+        sess = os.path.join(env.gen_dir, f"early-{domain}.sess")
+        req = os.path.join(env.gen_dir, f"early-{domain}.req")
+        with open(req, 'w') as fd:
+            fd.write(self.request(domain, method))
+        r = self.s_client(env, domain, ["-sess_out", sess, "-ign_eof"],
+                          intext=self.request(domain))
+        assert r.exit_code == 0, r.stderr
+        return sess, req
+
+    # a GET in early data is served, replaying its ticket is not
+    def test_tls_21_01(self, env):
+        domain = env.domain_a
+        sess, req = self.early_data(env, domain)
+        r = self.s_client(env, domain, ["-sess_in", sess,
+                                        "-early_data", req, "-ign_eof"])
+        out = r.stdout.decode()
+        assert "Early data was accepted" in out, out
+        assert '"domain"' in out, out
+        r = self.s_client(env, domain, ["-sess_in", sess,
+                                        "-early_data", req])
+        out = r.stdout.decode()
+        assert "Early data was rejected" in out, out
+
+    # a POST in early data is refused as too early
+    def test_tls_21_02(self, env):
+        domain = env.domain_a
+        sess, req = self.early_data(env, domain, method="POST")
+        r = self.s_client(env, domain, ["-sess_in", sess,
+                                        "-early_data", req, "-ign_eof"])
+        out = r.stdout.decode()
+        assert "Early data was accepted" in out, out
+        assert "HTTP/1.1 425" in out, out
+
+    # a host without SSLEarlyData does not accept any
+    def test_tls_21_03(self, env):
+        domain = env.domain_b
+        sess, req = self.early_data(env, domain)
+        r = self.s_client(env, domain, ["-sess_in", sess,
+                                        "-early_data", req])
+        out = r.stdout.decode()
+        assert "Early data was accepted" not in out, out
+
+    # a POST whose head is only partly sent in early data is refused as
+    # well, though the handshake completed before it was read in full
+    def test_tls_21_04(self, env):
+        domain = env.domain_a
+        sess, req = self.early_data(env, domain)
+        with open(req, 'w') as fd:
+            fd.write(f"POST /index.json HTTP/1.1\r\nHost: {domain}\r\n")
+        r = self.s_client(env, domain, ["-sess_in", sess,
+                                        "-early_data", req, "-ign_eof"],
+                          intext="Connection: close\r\n\r\n")
+        out = r.stdout.decode()
+        assert "Early data was accepted" in out, out
+        assert "HTTP/1.1 425" in out, out
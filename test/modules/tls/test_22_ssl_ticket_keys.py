@@ -0,0 +1,145 @@
+import os
+import shutil
+import time
+
+import pytest
+
+from .conf import TlsTestConf
+from .env import TlsTestEnv
+
+
+class TestSSLTicketKeys:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        if env.ssl_module != 'mod_ssl':
+            pytest.skip("ticket key rotation is a mod_ssl feature")
+        TestSSLTicketKeys.key_dir = os.path.join(env.gen_dir, "ticket-keys")
+        shutil.rmtree(self.key_dir, ignore_errors=True)
+        os.makedirs(self.key_dir)
+        self.add_key("20250101.key")
+        conf = TlsTestConf(env=env, extras={
+            'base': ["LogLevel ssl:debug",
+                     "SSLSessionTicketKeyRefresh 1"],
+            env.domain_a: f"SSLSessionTicketKeyDir {self.key_dir}",
+        })
+        conf.add_tls_vhosts(domains=[env.domain_a, env.domain_b],
+                            ssl_module='mod_ssl')
+        conf.install()
+        assert env.apache_restart() == 0
+
+    def add_key(self, name):
+        with open(os.path.join(self.key_dir, name), 'wb') as fd:
+            fd.write(os.urandom(48))
+
+    def remove_key(self, name):
+        os.remove(os.path.join(self.key_dir, name))
+
+    def touch_key(self, name, ahead):
+        # a modification time in the future keeps a key from becoming
+        # current, as if it just arrived
+        mtime = time.time() + ahead
+        os.utime(os.path.join(self.key_dir, name), (mtime, mtime))
+
+    def wait_refresh(self):
+        # every child rescans the directory once per second
+        time.sleep(3)
+
+    def connect(self, env, domain, sess_in=None, sess_out=None,
+                proto="-tls1_2"):
+        args = ["openssl", "s_client", "-CAfile", env.ca.cert_file,
+                "-servername", domain, proto,
+                "-connect", f"localhost:{env.https_port}"]
+        if sess_in:
+            args.extend(["-sess_in", sess_in])
+        if sess_out:
+            args.extend(["-sess_out", sess_out])
+        intext = ""
+        if proto == "-tls1_3":
+            # TLS 1.3 tickets come after the handshake, wait for them
+            args.append("-ign_eof")
+            intext = f"GET / HTTP/1.1\r\nHost: {domain}\r\n" \
+                     f"Connection: close\r\n\r\n"
+        r = env.run(args, intext=intext)
+        assert r.exit_code == 0, r.stderr
+        out = r.stdout.decode()
+        if "Reused, " in out:
+            return "reused"
+        assert "New, " in out, out
+        return "new"
+
+    # tickets of the previous key are accepted and renewed, removed keys
+    # no longer decrypt their tickets
+    def test_tls_22_01(self, env):
+        domain = env.domain_a
+        sess_old = os.path.join(env.gen_dir, "ticket-old.sess")
+        sess_new = os.path.join(env.gen_dir, "ticket-new.sess")
+        assert self.connect(env, domain, sess_out=sess_old) == "new"
+        assert self.connect(env, domain, sess_in=sess_old) == "reused"
+        # rotate, the first key becomes a previous one
+        self.add_key("20250102.key")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess_old,
+                            sess_out=sess_new) == "reused"
+        # retire the first key
+        self.remove_key("20250101.key")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess_old) == "new"
+        assert self.connect(env, domain, sess_in=sess_new) == "reused"
+
+    # keys whose files are hidden or not named *.key are ignored
+    def test_tls_22_02(self, env):
+        domain = env.domain_a
+        sess = os.path.join(env.gen_dir, "ticket-hidden.sess")
+        assert self.connect(env, domain, sess_out=sess) == "new"
+        self.add_key(".20991231.key")
+        self.add_key("20991231.key.tmp")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess) == "reused"
+
+    # a key just added only decrypts tickets, until it was there for a
+    # refresh interval
+    def test_tls_22_03(self, env):
+        domain = env.domain_a
+        sess_cur = os.path.join(env.gen_dir, "ticket-cur.sess")
+        sess_next = os.path.join(env.gen_dir, "ticket-next.sess")
+        self.add_key("20250103.key")
+        self.touch_key("20250103.key", 3600)
+        self.wait_refresh()
+        # the ticket is not encrypted with the new key
+        assert self.connect(env, domain, sess_out=sess_cur) == "new"
+        self.remove_key("20250103.key")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess_cur) == "reused"
+        # the key made current by another node already decrypts here
+        self.add_key("20250104.key")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_out=sess_next) == "new"
+        self.touch_key("20250104.key", 3600)
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess_next) == "reused"
+        self.remove_key("20250104.key")
+        self.wait_refresh()
+
+    # rotation works the same for the tickets of TLS 1.3
+    @pytest.mark.skipif(condition=not TlsTestEnv.openssl_supports_tls_1_3(),
+                        reason="no TLS 1.3 support in openssl")
+    def test_tls_22_04(self, env):
+        domain = env.domain_a
+        sess_old = os.path.join(env.gen_dir, "ticket13-old.sess")
+        sess_new = os.path.join(env.gen_dir, "ticket13-new.sess")
+        tls13 = "-tls1_3"
+        assert self.connect(env, domain, sess_out=sess_old,
+                            proto=tls13) == "new"
+        assert self.connect(env, domain, sess_in=sess_old,
+                            proto=tls13) == "reused"
+        self.add_key("20250105.key")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess_old, sess_out=sess_new,
+                            proto=tls13) == "reused"
+        self.remove_key("20250102.key")
+        self.wait_refresh()
+        assert self.connect(env, domain, sess_in=sess_old,
+                            proto=tls13) == "new"
+        assert self.connect(env, domain, sess_in=sess_new,
+                            proto=tls13) == "reused"
@@ -231,6 +231,7 @@ class HttpdTestEnv:
         self.config.read(os.path.join(self._our_dir, 'config.ini'))
 
         self._bin_dir = self.config.get('global', 'bindir')
+        self._sbin_dir = self.config.get('global', 'sbindir')
         self._apxs = self.config.get('global', 'apxs')
         self._prefix = self.config.get('global', 'prefix')
         self._apachectl = self.config.get('global', 'apachectl')
@@ -378,6 +379,10 @@ class HttpdTestEnv:
     def bin_dir(self) -> str:
         return self._bin_dir
 
+    @property
+    def sbin_dir(self) -> str:
+        return self._sbin_dir
+
     @property
     def gen_dir(self) -> str:
         return self._gen_dir